@@ -0,0 +1,353 @@
+#include "doc-rasterizer.h"
+
+#include <graphics/image-file.h>
+#include <util/platform.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <ctype.h>
+#include <stdlib.h>
+
+/*
+ * Rasterizer backend for image based documents, decoded with the libobs
+ * image loader:
+ *
+ *   - a directory of images (e.g. exported slides), one page per file
+ *   - an animated GIF, one page per frame
+ *   - any other single image as a one page document
+ */
+
+static const char *image_exts[] = {
+    ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".webp", ".psd",
+};
+
+struct image_doc {
+    char *path;
+    bool is_dir;
+    DARRAY(char *) files;
+
+    /* single images and GIFs stay decoded while the document is open */
+    gs_image_file_t image;
+    bool image_loaded;
+    int32_t gif_frame;
+    int32_t page_count;
+};
+
+/* A page owns its pixels, so tiles render without the document lock. */
+struct image_page {
+    uint8_t *pixels;
+    uint32_t cx;
+    uint32_t cy;
+    bool rgba;
+    bool opaque;
+};
+
+static bool has_image_ext(const char *path)
+{
+    const char *ext = os_get_path_extension(path);
+    if (!ext)
+        return false;
+
+    for (size_t i = 0; i < sizeof(image_exts) / sizeof(image_exts[0]); i++) {
+        if (astrcmpi(ext, image_exts[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool is_directory(const char *path)
+{
+    os_dir_t *dir = os_opendir(path);
+    if (!dir)
+        return false;
+    os_closedir(dir);
+    return true;
+}
+
+/* "page2.png" sorts before "page10.png" */
+static int natural_cmp(const void *a, const void *b)
+{
+    const char *s1 = *(const char *const *)a;
+    const char *s2 = *(const char *const *)b;
+
+    while (*s1 && *s2) {
+        if (isdigit((unsigned char)*s1) && isdigit((unsigned char)*s2)) {
+            const unsigned long long n1 = strtoull(s1, (char **)&s1, 10);
+            const unsigned long long n2 = strtoull(s2, (char **)&s2, 10);
+            if (n1 != n2)
+                return n1 < n2 ? -1 : 1;
+            continue;
+        }
+
+        const int c1 = tolower((unsigned char)*s1++);
+        const int c2 = tolower((unsigned char)*s2++);
+        if (c1 != c2)
+            return c1 - c2;
+    }
+    return (unsigned char)*s1 - (unsigned char)*s2;
+}
+
+static bool image_probe(const char *path)
+{
+    if (is_directory(path))
+        return true;
+    return has_image_ext(path) && os_file_exists(path);
+}
+
+static void image_free_doc_image(struct image_doc *doc)
+{
+    if (doc->image_loaded)
+        gs_image_file_free(&doc->image);
+    memset(&doc->image, 0, sizeof(doc->image));
+    doc->image_loaded = false;
+    doc->gif_frame = -1;
+}
+
+static void *image_open(const char *path)
+{
+    struct image_doc *doc = bzalloc(sizeof(struct image_doc));
+    doc->path = bstrdup(path);
+    doc->gif_frame = -1;
+    doc->is_dir = is_directory(path);
+
+    if (doc->is_dir) {
+        os_dir_t *dir = os_opendir(path);
+        struct os_dirent *ent;
+        struct dstr file = { 0 };
+
+        while ((ent = os_readdir(dir)) != NULL) {
+            if (ent->directory || !has_image_ext(ent->d_name))
+                continue;
+
+            dstr_printf(&file, "%s/%s", path, ent->d_name);
+            char *name = bstrdup(file.array);
+            da_push_back(doc->files, &name);
+        }
+
+        os_closedir(dir);
+        dstr_free(&file);
+
+        qsort(doc->files.array, doc->files.num, sizeof(char *), natural_cmp);
+        doc->page_count = (int32_t)doc->files.num;
+    } else {
+        gs_image_file_init(&doc->image, path);
+        if (!doc->image.loaded) {
+            gs_image_file_free(&doc->image);
+            bfree(doc->path);
+            bfree(doc);
+            return NULL;
+        }
+
+        doc->image_loaded = true;
+        doc->page_count = doc->image.is_animated_gif ? (int32_t)doc->image.gif.frame_count : 1;
+    }
+
+    if (!doc->page_count) {
+        image_free_doc_image(doc);
+        bfree(doc->path);
+        da_free(doc->files);
+        bfree(doc);
+        return NULL;
+    }
+
+    return doc;
+}
+
+static void image_close(void *data)
+{
+    struct image_doc *doc = data;
+
+    image_free_doc_image(doc);
+    for (size_t i = 0; i < doc->files.num; i++)
+        bfree(doc->files.array[i]);
+    da_free(doc->files);
+    bfree(doc->path);
+    bfree(doc);
+}
+
+static int32_t image_get_page_count(void *data)
+{
+    struct image_doc *doc = data;
+    return doc->page_count;
+}
+
+static uint8_t *copy_pixels(const uint8_t *src, uint32_t cx, uint32_t cy)
+{
+    const size_t size = (size_t)cx * cy * 4;
+    uint8_t *pixels = bmalloc(size);
+    memcpy(pixels, src, size);
+    return pixels;
+}
+
+/* Copies one frame of a decoded image into the page. */
+static bool load_from_image(struct image_doc *doc, gs_image_file_t *image,
+                            int32_t frame, struct image_page *page)
+{
+    page->cx = image->cx;
+    page->cy = image->cy;
+
+    if (image->is_animated_gif) {
+        /* GIF frames build on the previous ones, going back restarts */
+        if (frame < doc->gif_frame)
+            doc->gif_frame = -1;
+
+        for (int32_t i = doc->gif_frame + 1; i <= frame; i++) {
+            if (gif_decode_frame(&image->gif, (unsigned int)i) != GIF_OK)
+                return false;
+            doc->gif_frame = i;
+        }
+
+        page->pixels = copy_pixels(image->gif.frame_image, page->cx, page->cy);
+        page->rgba = true;
+        return true;
+    }
+
+    switch (image->format) {
+    case GS_RGBA:
+        page->rgba = true;
+        break;
+    case GS_BGRA:
+        page->rgba = false;
+        break;
+    case GS_BGRX:
+        page->rgba = false;
+        page->opaque = true;
+        break;
+    default:
+        return false;
+    }
+
+    page->pixels = copy_pixels(image->texture_data, page->cx, page->cy);
+    return true;
+}
+
+static void *image_load_page(void *data, int32_t page_index, uint32_t *cx, uint32_t *cy)
+{
+    struct image_doc *doc = data;
+    struct image_page *page = bzalloc(sizeof(struct image_page));
+    bool success = false;
+
+    if (page_index < 0 || page_index >= doc->page_count)
+        goto fail;
+
+    if (doc->is_dir) {
+        gs_image_file_t image;
+        gs_image_file_init(&image, doc->files.array[page_index]);
+        if (image.loaded) {
+            doc->gif_frame = -1;
+            success = load_from_image(doc, &image, 0, page);
+        }
+        gs_image_file_free(&image);
+    } else {
+        success = load_from_image(doc, &doc->image, page_index, page);
+    }
+
+    if (!success)
+        goto fail;
+
+    *cx = page->cx;
+    *cy = page->cy;
+    return page;
+
+fail:
+    bfree(page->pixels);
+    bfree(page);
+    return NULL;
+}
+
+static void image_release_page(void *data)
+{
+    struct image_page *page = data;
+    bfree(page->pixels);
+    bfree(page);
+}
+
+/*
+ * Box filter when shrinking, so dense text keeps its weight instead of
+ * dropping lines, and bilinear when enlarging.
+ */
+static bool image_render_region(void *data, uint8_t *dst, uint32_t linesize,
+                                uint32_t cx, uint32_t cy, uint32_t x_start,
+                                uint32_t y_start, uint32_t w, uint32_t h)
+{
+    const struct image_page *page = data;
+    const uint8_t *src = page->pixels;
+    const uint32_t src_cx = page->cx;
+    const uint32_t src_cy = page->cy;
+    const uint32_t src_linesize = src_cx * 4;
+    const int r = page->rgba ? 0 : 2;
+    const int b = page->rgba ? 2 : 0;
+    const float sx = (float)src_cx / (float)cx;
+    const float sy = (float)src_cy / (float)cy;
+
+    for (uint32_t y = y_start; y < y_start + h; y++) {
+        uint8_t *out = dst + (size_t)(y - y_start) * linesize;
+
+        for (uint32_t x = x_start; x < x_start + w; x++, out += 4) {
+            uint32_t acc[4] = { 0 };
+            uint32_t count = 0;
+
+            if (sx >= 1.0f && sy >= 1.0f) {
+                const uint32_t x0 = (uint32_t)(x * sx);
+                const uint32_t y0 = (uint32_t)(y * sy);
+                uint32_t x1 = (uint32_t)((x + 1) * sx);
+                uint32_t y1 = (uint32_t)((y + 1) * sy);
+                if (x1 <= x0) x1 = x0 + 1;
+                if (y1 <= y0) y1 = y0 + 1;
+                if (x1 > src_cx) x1 = src_cx;
+                if (y1 > src_cy) y1 = src_cy;
+
+                for (uint32_t yy = y0; yy < y1; yy++) {
+                    const uint8_t *in = src + (size_t)yy * src_linesize + x0 * 4;
+                    for (uint32_t xx = x0; xx < x1; xx++, in += 4) {
+                        acc[0] += in[0];
+                        acc[1] += in[1];
+                        acc[2] += in[2];
+                        acc[3] += in[3];
+                    }
+                }
+                count = (x1 - x0) * (y1 - y0);
+            } else {
+                float fx = (x + 0.5f) * sx - 0.5f;
+                float fy = (y + 0.5f) * sy - 0.5f;
+                if (fx < 0.0f) fx = 0.0f;
+                if (fy < 0.0f) fy = 0.0f;
+                const uint32_t x0 = (uint32_t)fx < src_cx ? (uint32_t)fx : src_cx - 1;
+                const uint32_t y0 = (uint32_t)fy < src_cy ? (uint32_t)fy : src_cy - 1;
+                const uint32_t x1 = x0 + 1 < src_cx ? x0 + 1 : x0;
+                const uint32_t y1 = y0 + 1 < src_cy ? y0 + 1 : y0;
+                const uint32_t wx = (uint32_t)((fx - x0) * 256.0f);
+                const uint32_t wy = (uint32_t)((fy - y0) * 256.0f);
+
+                const uint8_t *p00 = src + (size_t)y0 * src_linesize + x0 * 4;
+                const uint8_t *p01 = src + (size_t)y0 * src_linesize + x1 * 4;
+                const uint8_t *p10 = src + (size_t)y1 * src_linesize + x0 * 4;
+                const uint8_t *p11 = src + (size_t)y1 * src_linesize + x1 * 4;
+
+                for (int c = 0; c < 4; c++) {
+                    const uint32_t top = p00[c] * (256 - wx) + p01[c] * wx;
+                    const uint32_t bottom = p10[c] * (256 - wx) + p11[c] * wx;
+                    acc[c] = top * (256 - wy) + bottom * wy;
+                }
+                count = 65536;
+            }
+
+            out[0] = (uint8_t)(acc[b] / count);
+            out[1] = (uint8_t)(acc[1] / count);
+            out[2] = (uint8_t)(acc[r] / count);
+            out[3] = page->opaque ? 0xFF : (uint8_t)(acc[3] / count);
+        }
+    }
+
+    return true;
+}
+
+const struct doc_rasterizer_backend doc_image_backend = {
+    .id = "image",
+    .probe = image_probe,
+    .open = image_open,
+    .close = image_close,
+    .get_page_count = image_get_page_count,
+    .load_page = image_load_page,
+    .release_page = image_release_page,
+    .render_region = image_render_region,
+};
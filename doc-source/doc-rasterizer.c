@@ -0,0 +1,422 @@
+#include "doc-rasterizer.h"
+
+#include <util/darray.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <pthread.h>
+
+static const struct doc_rasterizer_backend *backends[] = {
+    &doc_synthetic_backend,
+    &doc_image_backend,
+};
+
+struct doc_rasterizer {
+    struct doc_page_cache *cache;
+    struct doc_worker_pool *pool;
+
+    /* guards the backend handle, held while a page is decoded */
+    pthread_mutex_t doc_mutex;
+    const struct doc_rasterizer_backend *open_backend;
+    void *doc;
+
+    /* guards everything below, never held for long */
+    pthread_mutex_t state_mutex;
+    const struct doc_rasterizer_backend *backend;
+    char *path;
+    char *cache_id;
+    uint32_t out_cx;
+    uint32_t out_cy;
+    int lod;
+    bool reopen;
+    long generation;
+    DARRAY(int32_t) in_flight;
+
+    volatile long page_count;
+
+    pthread_mutex_t stats_mutex;
+    struct doc_raster_stats stats;
+};
+
+struct raster_job {
+    struct doc_rasterizer *r;
+    long generation;
+    int32_t page_index;
+    bool urgent;
+};
+
+struct tile_batch {
+    struct doc_rasterizer *r;
+    const struct doc_rasterizer_backend *backend;
+    void *page;
+    struct doc_page *cache_page;
+    long generation;
+
+    uint32_t cx;
+    uint32_t cy;
+    uint32_t cols;
+
+    uint64_t start_ns;
+    volatile long first_tile_done;
+    uint64_t first_tile_ns;
+    volatile bool failed;
+};
+
+const struct doc_rasterizer_backend *doc_rasterizer_find_backend(const char *path)
+{
+    if (!path || !*path)
+        return NULL;
+
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (backends[i]->probe(path))
+            return backends[i];
+    }
+    return NULL;
+}
+
+void doc_rasterizer_fit(uint32_t page_cx, uint32_t page_cy, uint32_t out_cx,
+                        uint32_t out_cy, uint32_t *cx, uint32_t *cy)
+{
+    if (!page_cx || !page_cy || !out_cx || !out_cy) {
+        *cx = page_cx;
+        *cy = page_cy;
+        return;
+    }
+
+    /* compare page_cx / page_cy against out_cx / out_cy without rounding */
+    if ((uint64_t)page_cx * out_cy > (uint64_t)page_cy * out_cx) {
+        *cx = out_cx;
+        *cy = (uint32_t)(((uint64_t)page_cy * out_cx + page_cx / 2) / page_cx);
+    } else {
+        *cy = out_cy;
+        *cx = (uint32_t)(((uint64_t)page_cx * out_cy + page_cy / 2) / page_cy);
+    }
+
+    if (!*cx)
+        *cx = 1;
+    if (!*cy)
+        *cy = 1;
+}
+
+/* A job from before the last generation change has no entry: the list was
+ * cleared then, and the entry for its page is a newer job's. */
+static void remove_in_flight(struct doc_rasterizer *r, const struct raster_job *job)
+{
+    pthread_mutex_lock(&r->state_mutex);
+    if (job->generation != r->generation) {
+        pthread_mutex_unlock(&r->state_mutex);
+        return;
+    }
+
+    for (size_t i = 0; i < r->in_flight.num; i++) {
+        if (r->in_flight.array[i] == job->page_index) {
+            da_erase(r->in_flight, i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&r->state_mutex);
+}
+
+/* doc_mutex must be held */
+static void reopen_if_needed(struct doc_rasterizer *r)
+{
+    const struct doc_rasterizer_backend *backend;
+    char *path = NULL;
+
+    pthread_mutex_lock(&r->state_mutex);
+    const bool reopen = r->reopen;
+    r->reopen = false;
+    backend = r->backend;
+    if (reopen && r->path)
+        path = bstrdup(r->path);
+    pthread_mutex_unlock(&r->state_mutex);
+
+    if (!reopen)
+        return;
+
+    if (r->doc)
+        r->open_backend->close(r->doc);
+
+    r->doc = NULL;
+    r->open_backend = backend;
+    os_atomic_set_long(&r->page_count, -1);
+
+    if (backend && path) {
+        r->doc = backend->open(path);
+        if (r->doc)
+            os_atomic_set_long(&r->page_count, backend->get_page_count(r->doc));
+        else
+            blog(LOG_WARNING, "[doc_source] %s backend could not open '%s'",
+                 backend->id, path);
+    }
+
+    bfree(path);
+}
+
+static bool is_current(struct doc_rasterizer *r, long generation)
+{
+    pthread_mutex_lock(&r->state_mutex);
+    const bool current = generation == r->generation;
+    pthread_mutex_unlock(&r->state_mutex);
+    return current;
+}
+
+static void render_tile(void *param, size_t index)
+{
+    struct tile_batch *batch = param;
+
+    /* the document changed, don't bother with the rest of the page */
+    if (os_atomic_load_bool(&batch->failed))
+        return;
+    if (!is_current(batch->r, batch->generation)) {
+        os_atomic_set_bool(&batch->failed, true);
+        return;
+    }
+
+    const uint32_t x = (uint32_t)(index % batch->cols) * DOC_RASTER_TILE_SIZE;
+    const uint32_t y = (uint32_t)(index / batch->cols) * DOC_RASTER_TILE_SIZE;
+    const uint32_t w = batch->cx - x < DOC_RASTER_TILE_SIZE ? batch->cx - x : DOC_RASTER_TILE_SIZE;
+    const uint32_t h = batch->cy - y < DOC_RASTER_TILE_SIZE ? batch->cy - y : DOC_RASTER_TILE_SIZE;
+
+    struct obs_source_frame *frame = batch->cache_page->frame;
+    uint8_t *dst = frame->data[0] + (size_t)y * frame->linesize[0] + (size_t)x * 4;
+
+    if (!batch->backend->render_region(batch->page, dst, frame->linesize[0],
+                                       batch->cx, batch->cy, x, y, w, h)) {
+        os_atomic_set_bool(&batch->failed, true);
+        return;
+    }
+
+    page_cache_tile_done(batch->r->cache, batch->cache_page, x, y, w, h);
+
+    if (os_atomic_compare_swap_long(&batch->first_tile_done, 0, 1))
+        batch->first_tile_ns = os_gettime_ns() - batch->start_ns;
+}
+
+static void raster_job_run(void *param)
+{
+    struct raster_job *job = param;
+    struct doc_rasterizer *r = job->r;
+    const struct doc_rasterizer_backend *backend = NULL;
+    void *page = NULL;
+    uint32_t out_cx, out_cy;
+    uint32_t page_cx = 0, page_cy = 0;
+    uint32_t display_cx, display_cy;
+    int lod;
+    struct tile_batch batch = { 0 };
+    char *cache_id;
+
+    pthread_mutex_lock(&r->state_mutex);
+    const bool stale = job->generation != r->generation;
+    out_cx = r->out_cx;
+    out_cy = r->out_cy;
+    lod = r->lod;
+    cache_id = bstrdup(r->cache_id);
+    pthread_mutex_unlock(&r->state_mutex);
+
+    if (stale)
+        goto done;
+
+    pthread_mutex_lock(&r->doc_mutex);
+    reopen_if_needed(r);
+
+    if (r->doc && job->page_index < os_atomic_load_long(&r->page_count)) {
+        backend = r->open_backend;
+        page = backend->load_page(r->doc, job->page_index, &page_cx, &page_cy);
+    }
+    pthread_mutex_unlock(&r->doc_mutex);
+
+    if (!page)
+        goto done;
+
+    batch.r = r;
+    batch.backend = backend;
+    batch.page = page;
+    batch.generation = job->generation;
+    batch.start_ns = os_gettime_ns();
+    doc_rasterizer_fit(page_cx, page_cy, out_cx, out_cy, &display_cx, &display_cy);
+    batch.cx = (display_cx + (1 << lod) / 2) >> lod;
+    batch.cy = (display_cy + (1 << lod) / 2) >> lod;
+    if (!batch.cx)
+        batch.cx = 1;
+    if (!batch.cy)
+        batch.cy = 1;
+
+    batch.cache_page = page_cache_begin(r->cache, cache_id, job->page_index, batch.cx,
+                                        batch.cy, lod, display_cx, display_cy);
+    if (batch.cache_page) {
+        batch.cols = (batch.cx + DOC_RASTER_TILE_SIZE - 1) / DOC_RASTER_TILE_SIZE;
+        const uint32_t rows = (batch.cy + DOC_RASTER_TILE_SIZE - 1) / DOC_RASTER_TILE_SIZE;
+        const size_t tiles = (size_t)batch.cols * rows;
+
+        /* prefetched pages stay on one worker, the page on screen gets them all */
+        doc_worker_pool_parallel_for(job->urgent ? r->pool : NULL, tiles, render_tile, &batch);
+
+        const bool success = !batch.failed && is_current(r, job->generation);
+        page_cache_end(r->cache, batch.cache_page, success);
+
+        if (success) {
+            const uint64_t elapsed = os_gettime_ns() - batch.start_ns;
+
+            pthread_mutex_lock(&r->stats_mutex);
+            r->stats.pages++;
+            r->stats.tiles += tiles;
+            r->stats.total_ns += elapsed;
+            r->stats.first_tile_ns += batch.first_tile_ns;
+            pthread_mutex_unlock(&r->stats_mutex);
+
+            blog(LOG_DEBUG, "[doc_source] %s page %d: %ux%u, %zu tiles in %.2f ms "
+                 "(first tile after %.2f ms)", backend->id, job->page_index,
+                 batch.cx, batch.cy, tiles, (double)elapsed / 1000000.0,
+                 (double)batch.first_tile_ns / 1000000.0);
+        }
+    }
+
+    backend->release_page(page);
+
+done:
+    remove_in_flight(r, job);
+    bfree(cache_id);
+}
+
+struct doc_rasterizer *doc_rasterizer_create(struct doc_page_cache *cache,
+                                             struct doc_worker_pool *pool)
+{
+    struct doc_rasterizer *r = bzalloc(sizeof(struct doc_rasterizer));
+    r->cache = cache;
+    r->pool = pool;
+    r->page_count = -1;
+    pthread_mutex_init(&r->doc_mutex, NULL);
+    pthread_mutex_init(&r->state_mutex, NULL);
+    pthread_mutex_init(&r->stats_mutex, NULL);
+    return r;
+}
+
+/* The worker pool must already be destroyed so no job still uses r. */
+void doc_rasterizer_destroy(struct doc_rasterizer *r)
+{
+    if (!r)
+        return;
+
+    if (r->doc)
+        r->open_backend->close(r->doc);
+
+    da_free(r->in_flight);
+    bfree(r->path);
+    bfree(r->cache_id);
+    pthread_mutex_destroy(&r->doc_mutex);
+    pthread_mutex_destroy(&r->state_mutex);
+    pthread_mutex_destroy(&r->stats_mutex);
+    bfree(r);
+}
+
+bool doc_rasterizer_set_file(struct doc_rasterizer *r, const char *path,
+                             const char *cache_id, uint32_t cx, uint32_t cy)
+{
+    const struct doc_rasterizer_backend *backend = doc_rasterizer_find_backend(path);
+    bool changed;
+
+    if (!backend)
+        path = NULL;
+
+    pthread_mutex_lock(&r->state_mutex);
+
+    const bool path_changed = !r->path != !path ||
+                              (path && r->path && strcmp(r->path, path) != 0);
+    const bool size_changed = r->out_cx != cx || r->out_cy != cy;
+    changed = path_changed || size_changed || r->backend != backend ||
+              !r->cache_id || strcmp(r->cache_id, cache_id) != 0;
+
+    if (changed) {
+        bfree(r->path);
+        bfree(r->cache_id);
+        r->path = bstrdup(path);
+        r->cache_id = bstrdup(cache_id);
+        r->out_cx = cx;
+        r->out_cy = cy;
+        r->reopen = r->reopen || path_changed || r->backend != backend;
+        if (r->reopen)
+            os_atomic_set_long(&r->page_count, -1);
+        r->backend = backend;
+        r->generation++;
+        r->in_flight.num = 0;
+    }
+
+    pthread_mutex_unlock(&r->state_mutex);
+
+    /* pages rendered for the old size or file must not be shown */
+    if (changed && backend)
+        page_cache_clear(r->cache, cache_id);
+
+    return backend != NULL;
+}
+
+void doc_rasterizer_set_lod(struct doc_rasterizer *r, int lod)
+{
+    if (lod < 0)
+        lod = 0;
+    if (lod > DOC_RASTER_MAX_LOD)
+        lod = DOC_RASTER_MAX_LOD;
+
+    pthread_mutex_lock(&r->state_mutex);
+    if (r->lod != lod) {
+        r->lod = lod;
+        r->generation++;
+        r->in_flight.num = 0;
+    }
+    pthread_mutex_unlock(&r->state_mutex);
+}
+
+bool doc_rasterizer_active(struct doc_rasterizer *r)
+{
+    pthread_mutex_lock(&r->state_mutex);
+    const bool active = r->backend != NULL;
+    pthread_mutex_unlock(&r->state_mutex);
+    return active;
+}
+
+void doc_rasterizer_request(struct doc_rasterizer *r, int32_t page_index, bool urgent)
+{
+    if (page_index < 0)
+        return;
+
+    const long page_count = os_atomic_load_long(&r->page_count);
+    if (page_count >= 0 && page_index >= page_count)
+        return;
+
+    pthread_mutex_lock(&r->state_mutex);
+
+    if (!r->backend || page_cache_contains_lod(r->cache, r->cache_id, page_index, r->lod)) {
+        pthread_mutex_unlock(&r->state_mutex);
+        return;
+    }
+
+    for (size_t i = 0; i < r->in_flight.num; i++) {
+        if (r->in_flight.array[i] == page_index) {
+            pthread_mutex_unlock(&r->state_mutex);
+            return;
+        }
+    }
+    da_push_back(r->in_flight, &page_index);
+
+    struct raster_job *job = bmalloc(sizeof(struct raster_job));
+    job->r = r;
+    job->generation = r->generation;
+    job->page_index = page_index;
+    job->urgent = urgent;
+
+    pthread_mutex_unlock(&r->state_mutex);
+
+    doc_worker_pool_push(r->pool, raster_job_run, job, urgent);
+}
+
+int32_t doc_rasterizer_get_page_count(struct doc_rasterizer *r)
+{
+    return (int32_t)os_atomic_load_long(&r->page_count);
+}
+
+void doc_rasterizer_get_stats(struct doc_rasterizer *r, struct doc_raster_stats *stats)
+{
+    pthread_mutex_lock(&r->stats_mutex);
+    *stats = r->stats;
+    pthread_mutex_unlock(&r->stats_mutex);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <obs.h>
+#include "page-cache.h"
+#include "doc-worker.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-process document rasterizers.  A backend turns one page of a local
+ * file into BGRA pixels at a requested size; the doc_rasterizer drives it
+ * from the worker pool and stores the result in the page cache, so the
+ * external producer is only needed for documents no backend understands.
+ *
+ * Pages are rendered in DOC_RASTER_TILE_SIZE tiles spread over the pool,
+ * and every finished tile is uploaded on its own, so the top of a page
+ * shows up long before the whole page is done.
+ */
+
+#define DOC_RASTER_TILE_SIZE 256
+
+/* pages can be rendered at up to 1/8 of their displayed size */
+#define DOC_RASTER_MAX_LOD 3
+
+struct doc_rasterizer_backend {
+    const char *id;
+
+    bool (*probe)(const char *path);
+    void *(*open)(const char *path);
+    void (*close)(void *doc);
+
+    int32_t (*get_page_count)(void *doc);
+
+    /* Decodes a page, called with the document locked. */
+    void *(*load_page)(void *doc, int32_t page_index, uint32_t *cx, uint32_t *cy);
+    void (*release_page)(void *page);
+
+    /*
+     * Renders the (x, y, w, h) part of the page scaled to cx x cy as BGRA.
+     * dst points at the first pixel of that part.  Called concurrently for
+     * disjoint parts of the same page, without the document lock.
+     */
+    bool (*render_region)(void *page, uint8_t *dst, uint32_t linesize,
+                          uint32_t cx, uint32_t cy, uint32_t x, uint32_t y,
+                          uint32_t w, uint32_t h);
+};
+
+struct doc_raster_stats {
+    uint64_t pages;
+    uint64_t tiles;
+    uint64_t total_ns;
+    uint64_t first_tile_ns;
+};
+
+extern const struct doc_rasterizer_backend doc_image_backend;
+extern const struct doc_rasterizer_backend doc_synthetic_backend;
+
+const struct doc_rasterizer_backend *doc_rasterizer_find_backend(const char *path);
+
+struct doc_rasterizer;
+
+struct doc_rasterizer *doc_rasterizer_create(struct doc_page_cache *cache,
+                                             struct doc_worker_pool *pool);
+void doc_rasterizer_destroy(struct doc_rasterizer *r);
+
+/*
+ * Switches to a new file and output size.  Returns false when no backend
+ * can handle the file; pages are then expected from the producer.
+ */
+bool doc_rasterizer_set_file(struct doc_rasterizer *r, const char *path,
+                             const char *cache_id, uint32_t cx, uint32_t cy);
+
+/*
+ * Renders pages at 1 / 2^lod of the output size from now on.  Cached pages
+ * of another lod stay in use until they are rendered again.
+ */
+void doc_rasterizer_set_lod(struct doc_rasterizer *r, int lod);
+
+bool doc_rasterizer_active(struct doc_rasterizer *r);
+
+/* Queues the page unless it is cached at the current lod or in flight. */
+void doc_rasterizer_request(struct doc_rasterizer *r, int32_t page_index, bool urgent);
+
+/* -1 until the document has been opened on a worker */
+int32_t doc_rasterizer_get_page_count(struct doc_rasterizer *r);
+
+void doc_rasterizer_get_stats(struct doc_rasterizer *r, struct doc_raster_stats *stats);
+
+/* Fits a page of page_cx x page_cy into the output box, keeping aspect. */
+void doc_rasterizer_fit(uint32_t page_cx, uint32_t page_cy, uint32_t out_cx,
+                        uint32_t out_cy, uint32_t *cx, uint32_t *cy);
+
+#ifdef __cplusplus
+}
+#endif
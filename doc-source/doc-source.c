@@ -3,11 +3,16 @@
 #include <util/platform.h>
 #include <util/dstr.h>
 #include <sys/stat.h>
+#include <math.h>
 #include <obs.h>
 
 #include <util/threading.h>
 #include <pthread.h>
 #include "implement.h"
+#include "page-cache.h"
+#include "doc-rasterizer.h"
+#include "doc-worker.h"
+#include "frame-format.h"
 
 #define blog(log_level, format, ...)                    \
 	blog(log_level, "[doc_source: '%s'] " format, \
@@ -17,6 +22,12 @@
 #define info(format, ...) blog(LOG_INFO, format, ##__VA_ARGS__)
 #define warn(format, ...) blog(LOG_WARNING, format, ##__VA_ARGS__)
 
+#define DEFAULT_CACHE_SIZE_MB 256
+#define MAX_RASTER_THREADS 4
+
+/* seconds a smaller placement must last before pages are rendered smaller */
+#define LOD_DOWNGRADE_DELAY 1.0f
+
 typedef struct gs_document_file {
     gs_texture_t *texture;
     enum gs_color_format format;
@@ -41,9 +52,22 @@ typedef struct document_source_t {
     struct vec4 color_srgb;
 
     struct gs_document_file document_tex;
-    struct obs_source_frame *frame_cache;
+    struct doc_page_cache page_cache;
+    struct doc_worker_pool *workers;
+    struct doc_rasterizer *rasterizer;
+
+    /* page currently on screen, kept until the requested page arrives */
+    int32_t shown_page_index;
+    bool page_changed;
+
+    /* largest on-screen scale seen since the last tick, and the lod it maps to */
+    bool match_display_size;
+    float display_scale;
+    int display_lod;
+    float lod_timer;
 
-    enum gs_color_format color_format;
+    /* draws YUV pages and masks, see frame-format.h */
+    gs_effect_t *format_effect;
 
     struct pthread_mutex_t_ *mutex;
 
@@ -64,6 +88,45 @@ static const char *doc_source_get_name(void *unused)
     return obs_module_text("DocumentInput");
 }
 
+static void doc_source_prefetch(struct document_source_t *context, int32_t page_index)
+{
+    /* update may replace the document while we ask for its pages */
+    pthread_mutex_lock(&context->mutex);
+    const int32_t total_page_num = context->total_page_num;
+    char *doc_id = bstrdup(context->doc_id);
+    pthread_mutex_unlock(&context->mutex);
+
+    if (page_index < 0 || (total_page_num > 0 && page_index >= total_page_num))
+        goto done;
+
+    if (page_cache_contains(&context->page_cache, doc_id, page_index))
+        goto done;
+
+    calldata_t cd;
+    calldata_init(&cd);
+    calldata_set_ptr(&cd, "source", context->source);
+    calldata_set_string(&cd, "doc_id", doc_id);
+    calldata_set_int(&cd, "page_index", page_index);
+    signal_handler_signal(obs_source_get_signal_handler(context->source), "prefetch_page", &cd);
+    calldata_free(&cd);
+
+done:
+    bfree(doc_id);
+}
+
+static void doc_source_request_pages(struct document_source_t *context, int32_t page_index)
+{
+    if (doc_rasterizer_active(context->rasterizer)) {
+        doc_rasterizer_request(context->rasterizer, page_index, true);
+        doc_rasterizer_request(context->rasterizer, page_index + 1, false);
+        doc_rasterizer_request(context->rasterizer, page_index - 1, false);
+        return;
+    }
+
+    doc_source_prefetch(context, page_index + 1);
+    doc_source_prefetch(context, page_index - 1);
+}
+
 static void doc_source_update(void *data, obs_data_t *settings)
 {
     struct document_source_t *context = data;
@@ -72,21 +135,77 @@ static void doc_source_update(void *data, obs_data_t *settings)
     const char *doc_id = obs_data_get_string(settings, "doc_id");
     const int32_t doc_width = obs_data_get_int(settings, "doc_width");
     const int32_t doc_height = obs_data_get_int(settings, "doc_height");
+    const int32_t page_index = (int32_t)obs_data_get_int(settings, "page_index");
+    const int32_t page_count = (int32_t)obs_data_get_int(settings, "page_count");
+    const size_t cache_mb = (size_t)obs_data_get_int(settings, "cache_size_mb");
+    const bool mipmaps = obs_data_get_bool(settings, "mipmaps");
+    const bool match_display_size = obs_data_get_bool(settings, "match_display_size");
+    const uint32_t mask_color = (uint32_t)obs_data_get_int(settings, "mask_color");
+
+    pthread_mutex_lock(&context->mutex);
 
-    if (strlen(file_name))
-        context->file = file_name;
+    bfree(context->file);
+    context->file = bstrdup(file_name);
 
-    if (strlen(doc_id))
-        context->doc_id = doc_id;
+    /* documents opened from a file are cached under their path */
+    if (!*doc_id)
+        doc_id = file_name;
 
-    context->file = file_name;
-    context->doc_id = doc_id;
+    const bool doc_changed = !context->doc_id || strcmp(context->doc_id, doc_id) != 0;
+    bfree(context->doc_id);
+    context->doc_id = bstrdup(doc_id);
+
+    if (doc_changed || page_index != context->cur_page_index) {
+        context->cur_page_index = page_index;
+        context->page_changed = true;
+    }
+    context->total_page_num = page_count;
+
+    vec4_from_rgba(&context->color, mask_color);
+    vec4_from_rgba_srgb(&context->color_srgb, mask_color);
+
+    context->match_display_size = match_display_size;
+    if (!match_display_size)
+        context->display_lod = 0;
+    const int lod = context->display_lod;
+
+    pthread_mutex_unlock(&context->mutex);
+
+    page_cache_set_max_bytes(&context->page_cache, cache_mb * 1024 * 1024);
+    page_cache_set_mipmaps(&context->page_cache, mipmaps);
+    doc_rasterizer_set_lod(context->rasterizer, lod);
+
+    /* pages are rendered at exactly the size they are shown at */
+    uint32_t out_cx = doc_width > 0 ? (uint32_t)doc_width : 0;
+    uint32_t out_cy = doc_height > 0 ? (uint32_t)doc_height : 0;
+    struct obs_video_info ovi;
+    if ((!out_cx || !out_cy) && obs_get_video_info(&ovi)) {
+        out_cx = ovi.base_width;
+        out_cy = ovi.base_height;
+    }
+
+    if (doc_rasterizer_set_file(context->rasterizer, file_name, doc_id, out_cx, out_cy)) {
+        const int32_t backend_pages = doc_rasterizer_get_page_count(context->rasterizer);
+        if (backend_pages >= 0) {
+            pthread_mutex_lock(&context->mutex);
+            context->total_page_num = backend_pages;
+            pthread_mutex_unlock(&context->mutex);
+        }
+    }
+
+    doc_source_request_pages(context, page_index);
 }
 
 static void doc_source_defaults(obs_data_t *settings)
 {
     obs_data_set_default_bool(settings, "unload", false);
     obs_data_set_default_bool(settings, "linear_alpha", false);
+    obs_data_set_default_int(settings, "page_index", 0);
+    obs_data_set_default_int(settings, "page_count", 0);
+    obs_data_set_default_int(settings, "cache_size_mb", DEFAULT_CACHE_SIZE_MB);
+    obs_data_set_default_bool(settings, "mipmaps", false);
+    obs_data_set_default_bool(settings, "match_display_size", false);
+    obs_data_set_default_int(settings, "mask_color", 0xFF000000);
 }
 
 static void doc_source_show(void *data)
@@ -99,6 +218,51 @@ static void doc_source_hide(void *data)
     struct document_source_t *context = data;
 }
 
+static void doc_source_set_page_frame_proc(void *data, calldata_t *cd)
+{
+    struct document_source_t *context = data;
+    struct obs_source_frame *frame = calldata_ptr(cd, "frame");
+    const int32_t page_index = (int32_t)calldata_int(cd, "page_index");
+
+    if (!frame || page_index < 0)
+        return;
+
+    pthread_mutex_lock(&context->mutex);
+    page_cache_put(&context->page_cache, context->doc_id, page_index, frame);
+    pthread_mutex_unlock(&context->mutex);
+}
+
+static void doc_source_get_cache_stats_proc(void *data, calldata_t *cd)
+{
+    struct document_source_t *context = data;
+    struct doc_page_cache_stats stats;
+
+    page_cache_get_stats(&context->page_cache, &stats);
+    calldata_set_int(cd, "hits", (long long)stats.hits);
+    calldata_set_int(cd, "misses", (long long)stats.misses);
+    calldata_set_int(cd, "evictions", (long long)stats.evictions);
+    calldata_set_int(cd, "bytes", (long long)stats.bytes);
+    calldata_set_int(cd, "pages", (long long)stats.pages);
+}
+
+static void doc_source_get_raster_stats_proc(void *data, calldata_t *cd)
+{
+    struct document_source_t *context = data;
+    struct doc_raster_stats stats;
+
+    doc_rasterizer_get_stats(context->rasterizer, &stats);
+    calldata_set_int(cd, "pages", (long long)stats.pages);
+    calldata_set_int(cd, "tiles", (long long)stats.tiles);
+    calldata_set_int(cd, "total_ns", (long long)stats.total_ns);
+    calldata_set_int(cd, "first_tile_ns", (long long)stats.first_tile_ns);
+}
+
+static void doc_source_get_frame_formats_proc(void *data, calldata_t *cd)
+{
+    UNUSED_PARAMETER(data);
+    calldata_set_string(cd, "formats", DOC_FRAME_FORMATS);
+}
+
 static void *doc_source_create(obs_data_t *settings, obs_source_t *source)
 {
     struct document_source_t *context = bzalloc(sizeof(struct document_source_t));
@@ -106,6 +270,39 @@ static void *doc_source_create(obs_data_t *settings, obs_source_t *source)
     if (pthread_mutex_init(&context->mutex, NULL) != 0) {
         warn("init thread mutex error");
     }
+    page_cache_init(&context->page_cache, (size_t)DEFAULT_CACHE_SIZE_MB * 1024 * 1024);
+
+    int threads = os_get_logical_cores() / 2;
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_RASTER_THREADS)
+        threads = MAX_RASTER_THREADS;
+    context->workers = doc_worker_pool_create((size_t)threads, "doc-source: raster");
+    context->rasterizer = doc_rasterizer_create(&context->page_cache, context->workers);
+
+    signal_handler_t *sh = obs_source_get_signal_handler(source);
+    signal_handler_add(sh, "void prefetch_page(ptr source, string doc_id, int page_index)");
+
+    proc_handler_t *ph = obs_source_get_proc_handler(source);
+    proc_handler_add(ph, "void set_page_frame(in ptr frame, in int page_index)",
+        doc_source_set_page_frame_proc, context);
+    proc_handler_add(ph, "void get_cache_stats(out int hits, out int misses, "
+        "out int evictions, out int bytes, out int pages)",
+        doc_source_get_cache_stats_proc, context);
+    proc_handler_add(ph, "void get_raster_stats(out int pages, out int tiles, "
+        "out int total_ns, out int first_tile_ns)",
+        doc_source_get_raster_stats_proc, context);
+    proc_handler_add(ph, "void get_frame_formats(out string formats)",
+        doc_source_get_frame_formats_proc, context);
+
+    char *effect_path = obs_module_file("doc-format.effect");
+    obs_enter_graphics();
+    context->format_effect = gs_effect_create_from_file(effect_path, NULL);
+    obs_leave_graphics();
+    bfree(effect_path);
+    if (!context->format_effect)
+        warn("could not load doc-format.effect, YUV pages will not show");
+
     doc_source_update(context, settings);
     return context;
 }
@@ -114,16 +311,27 @@ static void doc_source_destroy(void *data)
 {
     struct document_source_t *context = data;
     if (context) {
+        struct doc_page_cache_stats stats;
+        page_cache_get_stats(&context->page_cache, &stats);
+        info("page cache: %llu hits, %llu misses, %llu evictions",
+            (unsigned long long)stats.hits,
+            (unsigned long long)stats.misses,
+            (unsigned long long)stats.evictions);
+
+        /* workers first, queued jobs still reference the rasterizer */
+        doc_worker_pool_destroy(context->workers);
+        doc_rasterizer_destroy(context->rasterizer);
 
         if (pthread_mutex_destroy(&context->mutex) != 0)
             warn("destroy thread mutex error");
 
-        if (context->frame_cache)
-            obs_source_frame_destroy(context->frame_cache);
-
-        if (context->document_tex.texture)
-            gs_texture_destroy(context->document_tex.texture);
+        obs_enter_graphics();
+        page_cache_free(&context->page_cache);
+        gs_effect_destroy(context->format_effect);
+        obs_leave_graphics();
 
+        bfree(context->file);
+        bfree(context->doc_id);
     }
 
     bfree(context);
@@ -141,54 +349,106 @@ static uint32_t doc_source_getheight(void *data)
     return context ? context->document_tex.height : 0;
 }
 
-static void doc_source_render(void *data, gs_effect_t *effect)
+static void set_color_row(gs_effect_t *effect, const char *name, const float *row)
 {
-    struct document_source_t *context = data;
-    bool need_create_tex = false, reset_tex = false;
+    struct vec4 vec;
+    vec4_set(&vec, row[0], row[1], row[2], row[3]);
+    gs_effect_set_vec4(gs_effect_get_param_by_name(effect, name), &vec);
+}
 
-    if (!context)
-        return;
+static void set_vec3_param(gs_effect_t *effect, const char *name, const float *v)
+{
+    struct vec3 vec;
+    vec3_set(&vec, v[0], v[1], v[2]);
+    gs_effect_set_vec3(gs_effect_get_param_by_name(effect, name), &vec);
+}
 
-    pthread_mutex_lock(&context->mutex);
-    reset_tex = !context->document_tex.texture || (context->document_tex.width != context->frame_cache->width
-        || context->document_tex.height != context->frame_cache->height);
+/* YUV pages and masks are converted by doc-format.effect while drawing */
+static void doc_source_draw_planes(struct document_source_t *context,
+                                   const struct doc_page_view *view)
+{
+    gs_effect_t *effect = context->format_effect;
+    const char *tech;
 
-    if (reset_tex && context->frame_cache) {
-        if (context->document_tex.texture) {
-            gs_texture_destroy(context->document_tex.texture);
-        }
+    if (!effect)
+        return;
 
-        context->document_tex.texture = gs_texture_create(context->frame_cache->width
-            , context->frame_cache->height
-            , GS_BGRA
-            , 1
-            , NULL
-            , 0);
+    switch (view->format) {
+    case VIDEO_FORMAT_NV12:
+        tech = "DrawNV12";
+        break;
+    case VIDEO_FORMAT_I420:
+        tech = "DrawI420";
+        break;
+    default:
+        tech = "DrawMask";
+        break;
     }
-    pthread_mutex_unlock(&context->mutex);
-    if (!context->document_tex.texture)
+
+    gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), view->texture);
+    gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image_u"), view->chroma[0]);
+    gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image_v"), view->chroma[1]);
+    set_color_row(effect, "color_vec0", view->color_matrix);
+    set_color_row(effect, "color_vec1", view->color_matrix + 4);
+    set_color_row(effect, "color_vec2", view->color_matrix + 8);
+    set_vec3_param(effect, "color_range_min", view->color_range_min);
+    set_vec3_param(effect, "color_range_max", view->color_range_max);
+
+    struct vec4 mask_color = context->color_srgb;
+    vec4_set(&mask_color, mask_color.x * mask_color.w, mask_color.y * mask_color.w,
+             mask_color.z * mask_color.w, mask_color.w);
+    gs_effect_set_vec4(gs_effect_get_param_by_name(effect, "mask_color"), &mask_color);
+
+    while (gs_effect_loop(effect, tech))
+        gs_draw_sprite(view->texture, 0, view->cx, view->cy);
+}
+
+static void doc_source_render(void *data, gs_effect_t *effect)
+{
+    struct document_source_t *context = data;
+    struct doc_page_view view;
+    UNUSED_PARAMETER(effect);
+
+    if (!context)
         return;
 
-    context->document_tex.width = context->frame_cache->width;
-    context->document_tex.height = context->frame_cache->height;
-    context->document_tex.format = GS_BGRA;
+    page_cache_collect(&context->page_cache);
 
     pthread_mutex_lock(&context->mutex);
+    const bool page_changed = context->page_changed;
+    bool found = page_cache_acquire(&context->page_cache, context->doc_id,
+        context->cur_page_index, page_changed, &view);
+
+    if (found) {
+        context->shown_page_index = context->cur_page_index;
+        context->page_changed = false;
+    } else {
+        /* keep showing the previous page until the requested one arrives */
+        found = page_cache_acquire(&context->page_cache, context->doc_id,
+            context->shown_page_index, false, &view);
+    }
 
-    gs_texture_t *tmp_texture = gs_texture_create(context->frame_cache->width
-        , context->frame_cache->height
-        , GS_BGRA
-        , 1
-        , &context->frame_cache->data[0]
-        , 0);
+    /* the scene item transform is on the matrix stack while we render */
+    if (context->match_display_size) {
+        struct matrix4 world;
+        gs_matrix_get(&world);
 
-    gs_copy_texture_region(context->document_tex.texture, 0, 0
-        , tmp_texture, 0, 0, context->document_tex.width,
-        context->document_tex.height);
+        const float sx = sqrtf(world.x.x * world.x.x + world.x.y * world.x.y);
+        const float sy = sqrtf(world.y.x * world.y.x + world.y.y * world.y.y);
+        const float scale = sx > sy ? sx : sy;
+        if (scale > context->display_scale)
+            context->display_scale = scale;
+    }
+    pthread_mutex_unlock(&context->mutex);
 
-    gs_texture_destroy(tmp_texture);
+    context->document_tex.texture = found ? view.texture : NULL;
+    if (!found)
+        return;
 
-    pthread_mutex_unlock(&context->mutex);
+    /* pages of a higher lod are smaller than their size on screen */
+    context->document_tex.width = view.cx;
+    context->document_tex.height = view.cy;
+    context->document_tex.format = gs_texture_get_color_format(view.texture);
 
     const bool previous = gs_framebuffer_srgb_enabled();
     gs_enable_framebuffer_srgb(true);
@@ -196,12 +456,16 @@ static void doc_source_render(void *data, gs_effect_t *effect)
     gs_blend_state_push();
     gs_blend_function(GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
 
-    gs_eparam_t *const param = gs_effect_get_param_by_name(effect, "image");
-    gs_effect_set_texture_srgb(param, context->document_tex.texture);
+    if (doc_format_packed_rgb(view.format)) {
+        gs_effect_t *const default_effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+        gs_eparam_t *const param = gs_effect_get_param_by_name(default_effect, "image");
+        gs_effect_set_texture_srgb(param, view.texture);
 
-    gs_draw_sprite(context->document_tex.texture, 0,
-        context->document_tex.width,
-        context->document_tex.height);
+        while (gs_effect_loop(default_effect, "Draw"))
+            gs_draw_sprite(view.texture, 0, view.cx, view.cy);
+    } else {
+        doc_source_draw_planes(context, &view);
+    }
 
     gs_blend_state_pop();
 
@@ -210,9 +474,52 @@ static void doc_source_render(void *data, gs_effect_t *effect)
 
 static void doc_source_tick(void *data, float seconds)
 {
-    return;
     struct document_source_t *context = data;
-    uint64_t frame_time = obs_get_video_frame_time();
+
+    /* the page count is only known once a worker opened the document */
+    const int32_t backend_pages = doc_rasterizer_get_page_count(context->rasterizer);
+
+    pthread_mutex_lock(&context->mutex);
+
+    if (backend_pages >= 0)
+        context->total_page_num = backend_pages;
+
+    const float scale = context->display_scale;
+    context->display_scale = 0.0f;
+
+    /* not rendered since the last tick, keep what we have */
+    if (!context->match_display_size || scale <= 0.0f) {
+        pthread_mutex_unlock(&context->mutex);
+        return;
+    }
+
+    int lod = 0;
+    while (lod < DOC_RASTER_MAX_LOD && scale * (float)(2 << lod) <= 1.0f)
+        lod++;
+
+    /* sharper pages right away, smaller ones only once the placement settled */
+    bool apply = false;
+    if (lod < context->display_lod) {
+        apply = true;
+    } else if (lod > context->display_lod) {
+        context->lod_timer += seconds;
+        apply = context->lod_timer >= LOD_DOWNGRADE_DELAY;
+    } else {
+        context->lod_timer = 0.0f;
+    }
+
+    if (apply) {
+        context->display_lod = lod;
+        context->lod_timer = 0.0f;
+    }
+    const int32_t page_index = context->cur_page_index;
+
+    pthread_mutex_unlock(&context->mutex);
+
+    if (apply && doc_rasterizer_active(context->rasterizer)) {
+        doc_rasterizer_set_lod(context->rasterizer, lod);
+        doc_source_request_pages(context, page_index);
+    }
 }
 
 static obs_properties_t *doc_source_properties(void *data)
@@ -222,6 +529,25 @@ static obs_properties_t *doc_source_properties(void *data)
 
     obs_properties_t *props = obs_properties_create();
 
+    obs_properties_add_int(props, "cache_size_mb",
+        obs_module_text("PageCache.Size"), 16, 4096, 16);
+    obs_properties_add_bool(props, "mipmaps", obs_module_text("Mipmaps"));
+    obs_properties_add_bool(props, "match_display_size",
+        obs_module_text("MatchDisplaySize"));
+    obs_properties_add_color(props, "mask_color", obs_module_text("MaskColor"));
+
+    if (s) {
+        struct doc_page_cache_stats stats;
+        page_cache_get_stats(&s->page_cache, &stats);
+        dstr_printf(&path, "%s: %llu / %llu, %zu MB",
+            obs_module_text("PageCache.HitsMisses"),
+            (unsigned long long)stats.hits,
+            (unsigned long long)stats.misses,
+            stats.bytes / (1024 * 1024));
+        obs_properties_add_text(props, "cache_stats", path.array, OBS_TEXT_INFO);
+        dstr_free(&path);
+    }
+
     return props;
 }
 
@@ -243,7 +569,7 @@ static obs_missing_files_t *doc_source_missingfiles(void *data)
     struct document_source_t *s = data;
     obs_missing_files_t *files = obs_missing_files_create();
 
-    if (strcmp(s->file, "") != 0) {
+    if (strcmp(s->file, "") != 0 && !doc_synthetic_backend.probe(s->file)) {
         if (!os_file_exists(s->file)) {
             obs_missing_file_t *file = obs_missing_file_create(
                 s->file, missing_file_callback,
@@ -263,29 +589,14 @@ static void doc_source_set_video_frame(void *data, int x, int y, struct obs_sour
         return;
 
     pthread_mutex_lock(&context->mutex);
-    if (context->frame_cache && (context->frame_cache->width != frame->width
-        || context->frame_cache->height != frame->height)) {
-        info("change frame, width:%u, height:%u."
-            , frame->width
-            , frame->height);
-        obs_source_frame_destroy(context->frame_cache);
-        context->frame_cache = NULL;
-    }
-
-    if (!context->frame_cache) {
-        info("change frame, alloc memory size, width:%u, height:%u.", frame->width, frame->height);
-        context->frame_cache = obs_source_frame_create(frame->format, frame->width, frame->height);
-    }
-
-    memmove(context->frame_cache->data[0], frame->data[0], frame->width * frame->height * 4);
-    context->color_format = GS_BGRA;
+    page_cache_put(&context->page_cache, context->doc_id, context->cur_page_index, frame);
     pthread_mutex_unlock(&context->mutex);
 }
 
 static struct obs_source_info doc_source_info = {
     .id = "document_source",
     .type = OBS_SOURCE_TYPE_INPUT,
-    .output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_SRGB,
+    .output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW | OBS_SOURCE_SRGB,
     .get_name = doc_source_get_name,
     .create = doc_source_create,
     .destroy = doc_source_destroy,
@@ -0,0 +1,191 @@
+#include "doc-rasterizer.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/*
+ * Procedural documents for benchmarking the rasterizer without real files.
+ *
+ *   synthetic:<pages>[:<width>x<height>]
+ *
+ * Each page imitates a dense vector page: lines of "words", a hatched
+ * figure and a few rings, evaluated per pixel with 4x4 supersampling so a
+ * page costs roughly what a busy PDF page would.  The default page size is
+ * A4 at 300 dpi.  Per page timings are logged at debug level and exposed
+ * through the get_raster_stats proc of the source.
+ */
+
+#define SYNTHETIC_PREFIX "synthetic:"
+#define SYNTHETIC_SAMPLES 4
+
+struct synthetic_doc {
+    int32_t page_count;
+    uint32_t cx;
+    uint32_t cy;
+};
+
+struct synthetic_page {
+    int32_t page_index;
+    uint32_t cx;
+    uint32_t cy;
+};
+
+static inline uint32_t hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static bool synthetic_probe(const char *path)
+{
+    return path && strncmp(path, SYNTHETIC_PREFIX, sizeof(SYNTHETIC_PREFIX) - 1) == 0;
+}
+
+static void *synthetic_open(const char *path)
+{
+    struct synthetic_doc *doc = bzalloc(sizeof(struct synthetic_doc));
+    const char *args = path + sizeof(SYNTHETIC_PREFIX) - 1;
+    char *end;
+
+    doc->page_count = (int32_t)strtol(args, &end, 10);
+    doc->cx = 2480;
+    doc->cy = 3508;
+
+    if (*end == ':') {
+        const unsigned long cx = strtoul(end + 1, &end, 10);
+        const unsigned long cy = *end == 'x' ? strtoul(end + 1, &end, 10) : 0;
+        if (cx && cy) {
+            doc->cx = (uint32_t)cx;
+            doc->cy = (uint32_t)cy;
+        }
+    }
+
+    if (doc->page_count <= 0)
+        doc->page_count = 1;
+
+    return doc;
+}
+
+static void synthetic_close(void *data)
+{
+    bfree(data);
+}
+
+static int32_t synthetic_get_page_count(void *data)
+{
+    struct synthetic_doc *doc = data;
+    return doc->page_count;
+}
+
+static void *synthetic_load_page(void *data, int32_t page_index, uint32_t *cx, uint32_t *cy)
+{
+    struct synthetic_doc *doc = data;
+    struct synthetic_page *page = bzalloc(sizeof(struct synthetic_page));
+
+    page->page_index = page_index;
+    page->cx = doc->cx;
+    page->cy = doc->cy;
+
+    *cx = doc->cx;
+    *cy = doc->cy;
+    return page;
+}
+
+static void synthetic_release_page(void *page)
+{
+    bfree(page);
+}
+
+/* ink coverage (0 or 1) at a point of the page, in page pixels */
+static bool synthetic_ink(const struct synthetic_page *page, float x, float y)
+{
+    const float margin = page->cx * 0.08f;
+    const float line_h = page->cy / 60.0f;
+    const uint32_t seed = hash32((uint32_t)page->page_index + 1);
+
+    if (x < margin || x > page->cx - margin || y < margin || y > page->cy - margin)
+        return false;
+
+    /* a hatched figure with rings in the middle third of the page */
+    const float fig_top = page->cy * 0.40f;
+    const float fig_bottom = page->cy * 0.62f;
+    if (y >= fig_top && y < fig_bottom) {
+        const float cx = page->cx * 0.5f;
+        const float cy = (fig_top + fig_bottom) * 0.5f;
+        const float dx = x - cx;
+        const float dy = y - cy;
+        const float d = sqrtf(dx * dx + dy * dy);
+        const float ring = fmodf(d + (float)(seed & 31), line_h * 1.5f);
+
+        if (ring < 1.5f)
+            return true;
+        return fmodf(x + y + (float)(seed & 63), line_h * 0.5f) < 1.0f;
+    }
+
+    /* text lines made of words of pseudo random length */
+    const uint32_t line = (uint32_t)((y - margin) / line_h);
+    const float in_line = fmodf(y - margin, line_h);
+    if (in_line < line_h * 0.25f || in_line > line_h * 0.75f)
+        return false;
+
+    float word_x = margin;
+    for (uint32_t word = 0; word < 64; word++) {
+        const uint32_t h = hash32(seed ^ (line * 131 + word * 7919));
+        const float len = line_h * (0.8f + (float)(h & 7) * 0.6f);
+        if (x < word_x)
+            return false;
+        if (x < word_x + len)
+            return ((uint32_t)(x * 0.7f) + (h >> 8)) % 5 != 0;
+        word_x += len + line_h * 0.45f;
+    }
+    return false;
+}
+
+static bool synthetic_render_region(void *data, uint8_t *dst, uint32_t linesize,
+                                    uint32_t cx, uint32_t cy, uint32_t x_start,
+                                    uint32_t y_start, uint32_t w, uint32_t h)
+{
+    const struct synthetic_page *page = data;
+    const float sx = (float)page->cx / (float)cx;
+    const float sy = (float)page->cy / (float)cy;
+    const float step = 1.0f / SYNTHETIC_SAMPLES;
+
+    for (uint32_t y = y_start; y < y_start + h; y++) {
+        uint8_t *out = dst + (size_t)(y - y_start) * linesize;
+
+        for (uint32_t x = x_start; x < x_start + w; x++, out += 4) {
+            uint32_t ink = 0;
+
+            for (int j = 0; j < SYNTHETIC_SAMPLES; j++) {
+                for (int i = 0; i < SYNTHETIC_SAMPLES; i++) {
+                    const float px = ((float)x + (i + 0.5f) * step) * sx;
+                    const float py = ((float)y + (j + 0.5f) * step) * sy;
+                    ink += synthetic_ink(page, px, py);
+                }
+            }
+
+            const uint8_t v = (uint8_t)(255 - ink * 255 / (SYNTHETIC_SAMPLES * SYNTHETIC_SAMPLES));
+            out[0] = v;
+            out[1] = v;
+            out[2] = v;
+            out[3] = 0xFF;
+        }
+    }
+
+    return true;
+}
+
+const struct doc_rasterizer_backend doc_synthetic_backend = {
+    .id = "synthetic",
+    .probe = synthetic_probe,
+    .open = synthetic_open,
+    .close = synthetic_close,
+    .get_page_count = synthetic_get_page_count,
+    .load_page = synthetic_load_page,
+    .release_page = synthetic_release_page,
+    .render_region = synthetic_render_region,
+};
@@ -0,0 +1,286 @@
+#include "doc-worker.h"
+
+#include <util/circlebuf.h>
+#include <util/threading.h>
+#include <pthread.h>
+
+/*
+ * Every worker owns a deque.  Jobs pushed from a worker go to its own deque
+ * and are popped from the back (most recent first), idle workers steal
+ * from the front of other deques.  Jobs pushed from outside the pool go to
+ * a shared injection queue.  One semaphore counts all queued jobs, so a
+ * worker that wakes up is guaranteed to find one somewhere.
+ */
+
+struct doc_job {
+    doc_job_func_t func;
+    /* run instead of func when the pool is destroyed with the job queued */
+    doc_job_func_t cancel;
+    void *param;
+};
+
+struct doc_worker {
+    struct doc_worker_pool *pool;
+    pthread_t thread;
+    bool started;
+
+    pthread_mutex_t mutex;
+    struct circlebuf deque;
+};
+
+struct doc_worker_pool {
+    pthread_mutex_t mutex;
+    struct circlebuf jobs;
+    os_sem_t *jobs_sem;
+    volatile bool stopping;
+
+    pthread_key_t worker_key;
+
+    char *name;
+    size_t num_threads;
+    struct doc_worker *workers;
+};
+
+struct doc_parallel_batch {
+    volatile long refs;
+    volatile long next;
+    volatile long done;
+    long count;
+
+    doc_parallel_func_t func;
+    void *param;
+    os_event_t *finished;
+};
+
+struct doc_parallel_job {
+    struct doc_parallel_batch *batch;
+};
+
+static bool pop_job(struct circlebuf *queue, pthread_mutex_t *mutex,
+                    struct doc_job *job, bool back)
+{
+    bool found = false;
+
+    pthread_mutex_lock(mutex);
+    if (queue->size) {
+        if (back)
+            circlebuf_pop_back(queue, job, sizeof(*job));
+        else
+            circlebuf_pop_front(queue, job, sizeof(*job));
+        found = true;
+    }
+    pthread_mutex_unlock(mutex);
+
+    return found;
+}
+
+static bool find_job(struct doc_worker *self, struct doc_job *job)
+{
+    struct doc_worker_pool *pool = self->pool;
+
+    if (pop_job(&self->deque, &self->mutex, job, true))
+        return true;
+    if (pop_job(&pool->jobs, &pool->mutex, job, false))
+        return true;
+
+    const size_t self_idx = (size_t)(self - pool->workers);
+    for (size_t i = 1; i < pool->num_threads; i++) {
+        struct doc_worker *victim = &pool->workers[(self_idx + i) % pool->num_threads];
+        if (pop_job(&victim->deque, &victim->mutex, job, false))
+            return true;
+    }
+
+    return false;
+}
+
+static void *doc_worker_thread(void *data)
+{
+    struct doc_worker *self = data;
+    struct doc_worker_pool *pool = self->pool;
+
+    os_set_thread_name(pool->name);
+    pthread_setspecific(pool->worker_key, self);
+
+    while (os_sem_wait(pool->jobs_sem) == 0) {
+        if (os_atomic_load_bool(&pool->stopping))
+            break;
+
+        struct doc_job job;
+        if (find_job(self, &job)) {
+            job.func(job.param);
+            bfree(job.param);
+        }
+    }
+
+    return NULL;
+}
+
+struct doc_worker_pool *doc_worker_pool_create(size_t num_threads, const char *name)
+{
+    struct doc_worker_pool *pool = bzalloc(sizeof(struct doc_worker_pool));
+
+    if (!num_threads)
+        num_threads = 1;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_key_create(&pool->worker_key, NULL);
+    os_sem_init(&pool->jobs_sem, 0);
+    circlebuf_init(&pool->jobs);
+    pool->name = bstrdup(name);
+    pool->workers = bzalloc(sizeof(struct doc_worker) * num_threads);
+
+    /* all deques must exist before any worker starts stealing */
+    for (size_t i = 0; i < num_threads; i++) {
+        pool->workers[i].pool = pool;
+        pthread_mutex_init(&pool->workers[i].mutex, NULL);
+        circlebuf_init(&pool->workers[i].deque);
+    }
+    pool->num_threads = num_threads;
+
+    for (size_t i = 0; i < num_threads; i++) {
+        struct doc_worker *worker = &pool->workers[i];
+        worker->started = pthread_create(&worker->thread, NULL, doc_worker_thread,
+                                         worker) == 0;
+    }
+
+    return pool;
+}
+
+static void free_queue(struct circlebuf *queue)
+{
+    while (queue->size) {
+        struct doc_job job;
+        circlebuf_pop_front(queue, &job, sizeof(job));
+        if (job.cancel)
+            job.cancel(job.param);
+        bfree(job.param);
+    }
+    circlebuf_free(queue);
+}
+
+void doc_worker_pool_destroy(struct doc_worker_pool *pool)
+{
+    if (!pool)
+        return;
+
+    os_atomic_set_bool(&pool->stopping, true);
+    for (size_t i = 0; i < pool->num_threads; i++)
+        os_sem_post(pool->jobs_sem);
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        if (pool->workers[i].started)
+            pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        free_queue(&pool->workers[i].deque);
+        pthread_mutex_destroy(&pool->workers[i].mutex);
+    }
+    free_queue(&pool->jobs);
+
+    os_sem_destroy(pool->jobs_sem);
+    pthread_key_delete(pool->worker_key);
+    pthread_mutex_destroy(&pool->mutex);
+    bfree(pool->workers);
+    bfree(pool->name);
+    bfree(pool);
+}
+
+static void push_job(struct doc_worker_pool *pool, doc_job_func_t func,
+                     doc_job_func_t cancel, void *param, bool urgent)
+{
+    struct doc_job job = { func, cancel, param };
+    struct doc_worker *self = pthread_getspecific(pool->worker_key);
+
+    if (self && !urgent) {
+        pthread_mutex_lock(&self->mutex);
+        circlebuf_push_back(&self->deque, &job, sizeof(job));
+        pthread_mutex_unlock(&self->mutex);
+    } else {
+        pthread_mutex_lock(&pool->mutex);
+        if (urgent)
+            circlebuf_push_front(&pool->jobs, &job, sizeof(job));
+        else
+            circlebuf_push_back(&pool->jobs, &job, sizeof(job));
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    os_sem_post(pool->jobs_sem);
+}
+
+void doc_worker_pool_push(struct doc_worker_pool *pool, doc_job_func_t func,
+                          void *param, bool urgent)
+{
+    push_job(pool, func, NULL, param, urgent);
+}
+
+size_t doc_worker_pool_num_threads(const struct doc_worker_pool *pool)
+{
+    return pool ? pool->num_threads : 0;
+}
+
+static void release_batch(struct doc_parallel_batch *batch)
+{
+    if (os_atomic_dec_long(&batch->refs) == 0) {
+        os_event_destroy(batch->finished);
+        bfree(batch);
+    }
+}
+
+/* Claims indices until none are left, so late helpers simply return. */
+static void run_batch(struct doc_parallel_batch *batch)
+{
+    for (;;) {
+        const long index = os_atomic_inc_long(&batch->next) - 1;
+        if (index >= batch->count)
+            break;
+
+        batch->func(batch->param, (size_t)index);
+
+        if (os_atomic_inc_long(&batch->done) == batch->count)
+            os_event_signal(batch->finished);
+    }
+}
+
+static void parallel_job_run(void *param)
+{
+    struct doc_parallel_job *job = param;
+    run_batch(job->batch);
+    release_batch(job->batch);
+}
+
+/* The caller ran every index itself, only the helper's ref is left to drop. */
+static void parallel_job_cancel(void *param)
+{
+    struct doc_parallel_job *job = param;
+    release_batch(job->batch);
+}
+
+void doc_worker_pool_parallel_for(struct doc_worker_pool *pool, size_t count,
+                                  doc_parallel_func_t func, void *param)
+{
+    if (!count)
+        return;
+
+    struct doc_parallel_batch *batch = bzalloc(sizeof(struct doc_parallel_batch));
+    batch->count = (long)count;
+    batch->func = func;
+    batch->param = param;
+    batch->refs = 1;
+    os_event_init(&batch->finished, OS_EVENT_TYPE_MANUAL);
+
+    size_t helpers = pool ? pool->num_threads : 0;
+    if (helpers > count - 1)
+        helpers = count - 1;
+
+    for (size_t i = 0; i < helpers; i++) {
+        struct doc_parallel_job *job = bmalloc(sizeof(struct doc_parallel_job));
+        job->batch = batch;
+        os_atomic_inc_long(&batch->refs);
+        push_job(pool, parallel_job_run, parallel_job_cancel, job, false);
+    }
+
+    /* the caller works too, so this never waits on an idle queue */
+    run_batch(batch);
+    os_event_wait(batch->finished);
+    release_batch(batch);
+}
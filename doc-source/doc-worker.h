@@ -0,0 +1,40 @@
+#pragma once
+
+#include <obs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Small fixed-size work-stealing thread pool used to keep document
+ * rasterization off the graphics thread.  Job parameters must be allocated
+ * with bmalloc; the pool frees them after the job ran, or when the pool is
+ * destroyed with the job still queued.
+ */
+
+typedef void (*doc_job_func_t)(void *param);
+typedef void (*doc_parallel_func_t)(void *param, size_t index);
+
+struct doc_worker_pool;
+
+struct doc_worker_pool *doc_worker_pool_create(size_t num_threads, const char *name);
+void doc_worker_pool_destroy(struct doc_worker_pool *pool);
+
+/* urgent jobs go to the front of the queue (the page on screen) */
+void doc_worker_pool_push(struct doc_worker_pool *pool, doc_job_func_t func,
+                          void *param, bool urgent);
+
+/*
+ * Runs func for every index in [0, count) on the calling thread and any
+ * idle workers, and returns once all of them finished.  Safe to call from
+ * a job, and with pool NULL (everything then runs on the caller).
+ */
+void doc_worker_pool_parallel_for(struct doc_worker_pool *pool, size_t count,
+                                  doc_parallel_func_t func, void *param);
+
+size_t doc_worker_pool_num_threads(const struct doc_worker_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
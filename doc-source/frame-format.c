@@ -0,0 +1,327 @@
+#include "frame-format.h"
+
+#include <media-io/video-io.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DOC_FORMAT_SSE2
+#endif
+
+bool doc_format_native(enum video_format format)
+{
+    switch (format) {
+    case VIDEO_FORMAT_BGRA:
+    case VIDEO_FORMAT_BGRX:
+    case VIDEO_FORMAT_RGBA:
+    case VIDEO_FORMAT_NV12:
+    case VIDEO_FORMAT_I420:
+    case VIDEO_FORMAT_Y800:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool doc_format_packed_rgb(enum video_format format)
+{
+    return format == VIDEO_FORMAT_BGRA || format == VIDEO_FORMAT_BGRX ||
+           format == VIDEO_FORMAT_RGBA;
+}
+
+static inline void set_plane(struct doc_plane *plane, enum gs_color_format format,
+                             uint32_t cx, uint32_t cy, uint32_t bpp)
+{
+    plane->format = format;
+    plane->cx = cx ? cx : 1;
+    plane->cy = cy ? cy : 1;
+    plane->bpp = bpp;
+}
+
+size_t doc_format_get_planes(enum video_format format, uint32_t cx, uint32_t cy,
+                             struct doc_plane planes[DOC_MAX_PLANES])
+{
+    switch (format) {
+    case VIDEO_FORMAT_BGRA:
+        set_plane(&planes[0], GS_BGRA, cx, cy, 4);
+        return 1;
+    case VIDEO_FORMAT_BGRX:
+        set_plane(&planes[0], GS_BGRX, cx, cy, 4);
+        return 1;
+    case VIDEO_FORMAT_RGBA:
+        set_plane(&planes[0], GS_RGBA, cx, cy, 4);
+        return 1;
+    case VIDEO_FORMAT_Y800:
+        set_plane(&planes[0], GS_R8, cx, cy, 1);
+        return 1;
+    case VIDEO_FORMAT_NV12:
+        set_plane(&planes[0], GS_R8, cx, cy, 1);
+        set_plane(&planes[1], GS_R8G8, (cx + 1) / 2, (cy + 1) / 2, 2);
+        return 2;
+    case VIDEO_FORMAT_I420:
+        set_plane(&planes[0], GS_R8, cx, cy, 1);
+        set_plane(&planes[1], GS_R8, (cx + 1) / 2, (cy + 1) / 2, 1);
+        set_plane(&planes[2], GS_R8, (cx + 1) / 2, (cy + 1) / 2, 1);
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+void doc_format_get_color_matrix(const struct obs_source_frame *frame, float matrix[16],
+                                 float range_min[3], float range_max[3])
+{
+    bool empty = true;
+    for (int i = 0; i < 16 && empty; i++)
+        empty = frame->color_matrix[i] == 0.0f;
+
+    if (empty) {
+        video_format_get_parameters(VIDEO_CS_709,
+                                    frame->full_range ? VIDEO_RANGE_FULL : VIDEO_RANGE_PARTIAL,
+                                    matrix, range_min, range_max);
+        return;
+    }
+
+    memcpy(matrix, frame->color_matrix, sizeof(float) * 16);
+    memcpy(range_min, frame->color_range_min, sizeof(float) * 3);
+    memcpy(range_max, frame->color_range_max, sizeof(float) * 3);
+
+    /* producers that only set the matrix mean the full range */
+    if (range_max[0] == 0.0f && range_max[1] == 0.0f && range_max[2] == 0.0f) {
+        range_min[0] = range_min[1] = range_min[2] = 0.0f;
+        range_max[0] = range_max[1] = range_max[2] = 1.0f;
+    }
+}
+
+/*
+ * The conversion works on 8 bit values, so the offsets are scaled to 255
+ * while the multipliers stay as they are.
+ */
+struct yuv_coeffs {
+    float m[12];
+    float min[3];
+    float max[3];
+};
+
+static void yuv_coeffs_init(struct yuv_coeffs *c, const struct obs_source_frame *frame)
+{
+    float matrix[16];
+    float range_min[3];
+    float range_max[3];
+
+    doc_format_get_color_matrix(frame, matrix, range_min, range_max);
+
+    for (int row = 0; row < 3; row++) {
+        c->m[row * 4 + 0] = matrix[row * 4 + 0];
+        c->m[row * 4 + 1] = matrix[row * 4 + 1];
+        c->m[row * 4 + 2] = matrix[row * 4 + 2];
+        c->m[row * 4 + 3] = matrix[row * 4 + 3] * 255.0f;
+        c->min[row] = range_min[row] * 255.0f;
+        c->max[row] = range_max[row] * 255.0f;
+    }
+}
+
+static inline uint8_t clamp_u8(float v)
+{
+    return v <= 0.0f ? 0 : v >= 255.0f ? 255 : (uint8_t)lrintf(v);
+}
+
+static inline float clampf(float v, float lo, float hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void yuv_row_to_bgra_c(const uint8_t *y_row, const uint8_t *u_row,
+                              const uint8_t *v_row, uint8_t *dst, uint32_t start,
+                              uint32_t width, const struct yuv_coeffs *c)
+{
+    for (uint32_t x = start; x < width; x++) {
+        const float y = clampf(y_row[x], c->min[0], c->max[0]);
+        const float u = clampf(u_row[x], c->min[1], c->max[1]);
+        const float v = clampf(v_row[x], c->min[2], c->max[2]);
+        uint8_t *out = dst + x * 4;
+
+        out[2] = clamp_u8(c->m[0] * y + c->m[1] * u + c->m[2] * v + c->m[3]);
+        out[1] = clamp_u8(c->m[4] * y + c->m[5] * u + c->m[6] * v + c->m[7]);
+        out[0] = clamp_u8(c->m[8] * y + c->m[9] * u + c->m[10] * v + c->m[11]);
+        out[3] = 0xFF;
+    }
+}
+
+#ifdef DOC_FORMAT_SSE2
+static inline __m128 load4_u8(const uint8_t *src)
+{
+    int32_t bytes;
+    memcpy(&bytes, src, sizeof(bytes));
+
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_cvtsi32_si128(bytes);
+    v = _mm_unpacklo_epi8(v, zero);
+    v = _mm_unpacklo_epi16(v, zero);
+    return _mm_cvtepi32_ps(v);
+}
+
+static inline __m128i dot4(__m128 y, __m128 u, __m128 v, const float *m)
+{
+    __m128 r = _mm_mul_ps(y, _mm_set1_ps(m[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(u, _mm_set1_ps(m[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(v, _mm_set1_ps(m[2])));
+    r = _mm_add_ps(r, _mm_set1_ps(m[3]));
+    return _mm_cvtps_epi32(r);
+}
+
+/* four pixels per step, with one shuffle to interleave the channels */
+static void yuv_row_to_bgra(const uint8_t *y_row, const uint8_t *u_row,
+                            const uint8_t *v_row, uint8_t *dst, uint32_t width,
+                            const struct yuv_coeffs *c)
+{
+    const __m128 y_min = _mm_set1_ps(c->min[0]), y_max = _mm_set1_ps(c->max[0]);
+    const __m128 u_min = _mm_set1_ps(c->min[1]), u_max = _mm_set1_ps(c->max[1]);
+    const __m128 v_min = _mm_set1_ps(c->min[2]), v_max = _mm_set1_ps(c->max[2]);
+    const __m128i alpha = _mm_set1_epi32(255);
+    uint32_t x = 0;
+
+    for (; x + 4 <= width; x += 4) {
+        const __m128 y = _mm_min_ps(_mm_max_ps(load4_u8(y_row + x), y_min), y_max);
+        const __m128 u = _mm_min_ps(_mm_max_ps(load4_u8(u_row + x), u_min), u_max);
+        const __m128 v = _mm_min_ps(_mm_max_ps(load4_u8(v_row + x), v_min), v_max);
+
+        const __m128i r = dot4(y, u, v, c->m);
+        const __m128i g = dot4(y, u, v, c->m + 4);
+        const __m128i b = dot4(y, u, v, c->m + 8);
+
+        /* b0..b3 g0..g3 r0..r3 a0..a3, saturated to bytes */
+        const __m128i planar = _mm_packus_epi16(_mm_packs_epi32(b, g),
+                                                _mm_packs_epi32(r, alpha));
+        const __m128i bg = _mm_unpacklo_epi8(planar, _mm_srli_si128(planar, 4));
+        const __m128i ra = _mm_unpacklo_epi8(_mm_srli_si128(planar, 8),
+                                             _mm_srli_si128(planar, 12));
+        _mm_storeu_si128((__m128i *)(dst + x * 4), _mm_unpacklo_epi16(bg, ra));
+    }
+
+    yuv_row_to_bgra_c(y_row, u_row, v_row, dst, x, width, c);
+}
+#else
+static void yuv_row_to_bgra(const uint8_t *y_row, const uint8_t *u_row,
+                            const uint8_t *v_row, uint8_t *dst, uint32_t width,
+                            const struct yuv_coeffs *c)
+{
+    yuv_row_to_bgra_c(y_row, u_row, v_row, dst, 0, width, c);
+}
+#endif
+
+/* byte offsets of y0, u, y1 and v in a packed 4:2:2 macropixel */
+static bool packed_422_layout(enum video_format format, int offsets[4])
+{
+    switch (format) {
+    case VIDEO_FORMAT_YUY2:
+        offsets[0] = 0, offsets[1] = 1, offsets[2] = 2, offsets[3] = 3;
+        return true;
+    case VIDEO_FORMAT_UYVY:
+        offsets[0] = 1, offsets[1] = 0, offsets[2] = 3, offsets[3] = 2;
+        return true;
+    case VIDEO_FORMAT_YVYU:
+        offsets[0] = 0, offsets[1] = 3, offsets[2] = 2, offsets[3] = 1;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Any YUV layout is split into full width y, u and v rows first, so one
+ * row kernel serves all of them.
+ */
+static struct obs_source_frame *convert_to_bgra(const struct obs_source_frame *src)
+{
+    int layout[4];
+    const bool packed = packed_422_layout(src->format, layout);
+
+    if (!packed && src->format != VIDEO_FORMAT_I444)
+        return NULL;
+
+    struct obs_source_frame *dst =
+        obs_source_frame_create(VIDEO_FORMAT_BGRA, src->width, src->height);
+    if (!dst)
+        return NULL;
+
+    struct yuv_coeffs coeffs;
+    yuv_coeffs_init(&coeffs, src);
+
+    const uint32_t width = src->width;
+    uint8_t *rows = packed ? bmalloc((size_t)width * 3) : NULL;
+
+    for (uint32_t y = 0; y < src->height; y++) {
+        const uint8_t *y_row, *u_row, *v_row;
+
+        if (packed) {
+            const uint8_t *in = src->data[0] + (size_t)y * src->linesize[0];
+            uint8_t *y_out = rows;
+            uint8_t *u_out = rows + width;
+            uint8_t *v_out = rows + width * 2;
+
+            for (uint32_t x = 0; x < width; x += 2, in += 4) {
+                y_out[x] = in[layout[0]];
+                u_out[x] = in[layout[1]];
+                v_out[x] = in[layout[3]];
+                if (x + 1 < width) {
+                    y_out[x + 1] = in[layout[2]];
+                    u_out[x + 1] = in[layout[1]];
+                    v_out[x + 1] = in[layout[3]];
+                }
+            }
+
+            y_row = y_out;
+            u_row = u_out;
+            v_row = v_out;
+        } else {
+            y_row = src->data[0] + (size_t)y * src->linesize[0];
+            u_row = src->data[1] + (size_t)y * src->linesize[1];
+            v_row = src->data[2] + (size_t)y * src->linesize[2];
+        }
+
+        yuv_row_to_bgra(y_row, u_row, v_row, dst->data[0] + (size_t)y * dst->linesize[0],
+                        width, &coeffs);
+    }
+
+    bfree(rows);
+    return dst;
+}
+
+struct obs_source_frame *doc_format_copy_frame(const struct obs_source_frame *src)
+{
+    struct doc_plane planes[DOC_MAX_PLANES];
+    const size_t count = doc_format_get_planes(src->format, src->width, src->height, planes);
+
+    if (!count) {
+        struct obs_source_frame *converted = convert_to_bgra(src);
+        if (!converted)
+            blog(LOG_WARNING, "[doc_source] unsupported page format %s",
+                 get_video_format_name(src->format));
+        return converted;
+    }
+
+    struct obs_source_frame *dst =
+        obs_source_frame_create(src->format, src->width, src->height);
+    if (!dst)
+        return NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t row_bytes = planes[i].cx * planes[i].bpp;
+        const uint32_t src_linesize = src->linesize[i] ? src->linesize[i] : row_bytes;
+
+        if (src_linesize == dst->linesize[i]) {
+            memcpy(dst->data[i], src->data[i], (size_t)src_linesize * planes[i].cy);
+        } else {
+            for (uint32_t y = 0; y < planes[i].cy; y++)
+                memcpy(dst->data[i] + (size_t)y * dst->linesize[i],
+                       src->data[i] + (size_t)y * src_linesize, row_bytes);
+        }
+    }
+
+    dst->full_range = src->full_range;
+    memcpy(dst->color_matrix, src->color_matrix, sizeof(dst->color_matrix));
+    memcpy(dst->color_range_min, src->color_range_min, sizeof(dst->color_range_min));
+    memcpy(dst->color_range_max, src->color_range_max, sizeof(dst->color_range_max));
+    return dst;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <obs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pixel formats document pages are accepted in.
+ *
+ * BGRA, BGRX and RGBA pages are uploaded as they are.  NV12 and I420 pages
+ * are uploaded plane by plane (R8 / R8G8 textures) and converted while
+ * drawing by doc-format.effect, so video backed producers need not convert
+ * and the cache holds 12 instead of 32 bits per pixel.  Y800 pages are ink
+ * coverage masks (A8) tinted with the mask color of the source.
+ *
+ * Other YUV formats are converted to BGRA when the frame is handed in.
+ */
+
+#define DOC_MAX_PLANES 3
+
+/* formats producers should prefer, most compact first */
+#define DOC_FRAME_FORMATS "NV12,I420,BGRA,RGBA,BGRX,Y800"
+
+struct doc_plane {
+    enum gs_color_format format;
+    uint32_t cx;
+    uint32_t cy;
+    uint32_t bpp;
+};
+
+/* Formats that are uploaded without conversion. */
+bool doc_format_native(enum video_format format);
+
+/* Formats with 4 bytes per pixel in a single plane, e.g. for mipmaps. */
+bool doc_format_packed_rgb(enum video_format format);
+
+/* Describes the textures of a native format, returns the plane count. */
+size_t doc_format_get_planes(enum video_format format, uint32_t cx, uint32_t cy,
+                             struct doc_plane planes[DOC_MAX_PLANES]);
+
+/*
+ * YUV to RGB coefficients of a frame, as rows (y, u, v, offset) for R, G
+ * and B with values in 0..1, falling back to BT.709 when the producer
+ * left the matrix empty.
+ */
+void doc_format_get_color_matrix(const struct obs_source_frame *frame, float matrix[16],
+                                 float range_min[3], float range_max[3]);
+
+/* Copies a native frame, or converts any other YUV frame to BGRA. */
+struct obs_source_frame *doc_format_copy_frame(const struct obs_source_frame *frame);
+
+#ifdef __cplusplus
+}
+#endif
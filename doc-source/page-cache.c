@@ -0,0 +1,590 @@
+#include "page-cache.h"
+
+#include <obs-module.h>
+#include <util/threading.h>
+
+/*
+ * A document rarely has more than a few dozen pages resident, so the
+ * cache is a plain LRU list and lookups scan it linearly.
+ */
+
+static inline bool page_matches(const struct doc_page *page, const char *doc_id,
+                                int32_t page_index)
+{
+    return !page->discarded && !page->staged && page->page_index == page_index &&
+           strcmp(page->doc_id, doc_id ? doc_id : "") == 0;
+}
+
+static struct doc_page *find_page(struct doc_page_cache *cache,
+                                  const char *doc_id, int32_t page_index)
+{
+    for (struct doc_page *page = cache->head; page; page = page->next) {
+        if (page_matches(page, doc_id, page_index))
+            return page;
+    }
+    return NULL;
+}
+
+static void unlink_page(struct doc_page_cache *cache, struct doc_page *page)
+{
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        cache->head = page->next;
+
+    if (page->next)
+        page->next->prev = page->prev;
+    else
+        cache->tail = page->prev;
+
+    page->prev = NULL;
+    page->next = NULL;
+}
+
+static void push_front(struct doc_page_cache *cache, struct doc_page *page)
+{
+    page->prev = NULL;
+    page->next = cache->head;
+    if (cache->head)
+        cache->head->prev = page;
+    cache->head = page;
+    if (!cache->tail)
+        cache->tail = page;
+}
+
+/* Pages that arrive queue behind the one on screen, it stays most recent. */
+static void insert_page(struct doc_page_cache *cache, struct doc_page *page)
+{
+    struct doc_page *displayed = cache->displayed;
+
+    if (!displayed || displayed == page) {
+        push_front(cache, page);
+        return;
+    }
+
+    page->prev = displayed;
+    page->next = displayed->next;
+    if (displayed->next)
+        displayed->next->prev = page;
+    else
+        cache->tail = page;
+    displayed->next = page;
+}
+
+static void bury_textures(struct doc_page_cache *cache, struct doc_page *page)
+{
+    if (page->texture)
+        da_push_back(cache->graveyard, &page->texture);
+    for (size_t i = 0; i < DOC_MAX_PLANES - 1; i++) {
+        if (page->chroma[i])
+            da_push_back(cache->graveyard, &page->chroma[i]);
+        page->chroma[i] = NULL;
+    }
+    page->texture = NULL;
+}
+
+static size_t frame_bytes(enum video_format format, uint32_t cx, uint32_t cy)
+{
+    struct doc_plane planes[DOC_MAX_PLANES];
+    const size_t count = doc_format_get_planes(format, cx, cy, planes);
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < count; i++)
+        bytes += (size_t)planes[i].cx * planes[i].cy * planes[i].bpp;
+    return bytes;
+}
+
+static void drop_page(struct doc_page_cache *cache, struct doc_page *page)
+{
+    /* tiles are still being written, page_cache_end() frees it */
+    if (page->pinned) {
+        page->discarded = true;
+        return;
+    }
+
+    unlink_page(cache, page);
+    if (cache->displayed == page)
+        cache->displayed = NULL;
+
+    cache->bytes -= page->bytes;
+    cache->pages--;
+
+    bury_textures(cache, page);
+    if (page->frame)
+        obs_source_frame_destroy(page->frame);
+
+    da_free(page->dirty_tiles);
+    bfree(page->mip_data);
+    bfree(page->doc_id);
+    bfree(page);
+}
+
+/* Never evicts the displayed page, nor keep, the page just added. */
+static void evict_to_budget(struct doc_page_cache *cache, struct doc_page *keep)
+{
+    struct doc_page *page = cache->tail;
+
+    while (cache->bytes > cache->max_bytes && page) {
+        struct doc_page *prev = page->prev;
+        if (!page->pinned && page != cache->displayed && page != keep) {
+            drop_page(cache, page);
+            cache->evictions++;
+        }
+        page = prev;
+    }
+}
+
+static struct doc_page *new_page(struct doc_page_cache *cache, const char *doc_id,
+                                 int32_t page_index)
+{
+    struct doc_page *page = bzalloc(sizeof(struct doc_page));
+    page->doc_id = bstrdup(doc_id ? doc_id : "");
+    page->page_index = page_index;
+    cache->pages++;
+    return page;
+}
+
+static inline uint32_t half_size(uint32_t size)
+{
+    return size > 1 ? size / 2 : 1;
+}
+
+/*
+ * Box filters levels 1..n of a BGRA frame into one buffer, with the level
+ * sizes the graphics APIs expect (halved and rounded down).
+ */
+static uint8_t *build_mips(const struct obs_source_frame *frame, uint32_t *levels,
+                           size_t *bytes)
+{
+    uint32_t cx = frame->width;
+    uint32_t cy = frame->height;
+    size_t size = 0;
+
+    *levels = 1;
+    while (cx > 1 || cy > 1) {
+        cx = half_size(cx);
+        cy = half_size(cy);
+        size += (size_t)cx * cy * 4;
+        (*levels)++;
+    }
+
+    *bytes = size;
+    if (!size)
+        return NULL;
+
+    uint8_t *mips = bmalloc(size);
+    const uint8_t *src = frame->data[0];
+    uint32_t src_linesize = frame->linesize[0];
+    uint32_t src_cx = frame->width;
+    uint32_t src_cy = frame->height;
+    uint8_t *dst = mips;
+
+    for (uint32_t level = 1; level < *levels; level++) {
+        const uint32_t dst_cx = half_size(src_cx);
+        const uint32_t dst_cy = half_size(src_cy);
+
+        for (uint32_t y = 0; y < dst_cy; y++) {
+            const uint32_t y0 = y * 2 < src_cy ? y * 2 : src_cy - 1;
+            const uint32_t y1 = y * 2 + 1 < src_cy ? y * 2 + 1 : src_cy - 1;
+            const uint8_t *row0 = src + (size_t)y0 * src_linesize;
+            const uint8_t *row1 = src + (size_t)y1 * src_linesize;
+            uint8_t *out = dst + (size_t)y * dst_cx * 4;
+
+            for (uint32_t x = 0; x < dst_cx; x++, out += 4) {
+                const uint32_t x0 = (x * 2 < src_cx ? x * 2 : src_cx - 1) * 4;
+                const uint32_t x1 = (x * 2 + 1 < src_cx ? x * 2 + 1 : src_cx - 1) * 4;
+
+                for (int c = 0; c < 4; c++)
+                    out[c] = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] +
+                                        row1[x1 + c] + 2) >> 2);
+            }
+        }
+
+        src = dst;
+        src_linesize = dst_cx * 4;
+        src_cx = dst_cx;
+        src_cy = dst_cy;
+        dst += (size_t)dst_cx * dst_cy * 4;
+    }
+
+    return mips;
+}
+
+void page_cache_init(struct doc_page_cache *cache, size_t max_bytes)
+{
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->mutex, NULL);
+    cache->max_bytes = max_bytes;
+}
+
+void page_cache_free(struct doc_page_cache *cache)
+{
+    page_cache_clear(cache, NULL);
+    page_cache_collect(cache);
+    for (size_t i = 0; i < cache->staging.num; i++)
+        gs_texture_destroy(cache->staging.array[i]);
+    da_free(cache->staging);
+    da_free(cache->graveyard);
+    pthread_mutex_destroy(&cache->mutex);
+}
+
+void page_cache_set_max_bytes(struct doc_page_cache *cache, size_t max_bytes)
+{
+    pthread_mutex_lock(&cache->mutex);
+    cache->max_bytes = max_bytes;
+    evict_to_budget(cache, NULL);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void page_cache_set_mipmaps(struct doc_page_cache *cache, bool mipmaps)
+{
+    os_atomic_set_bool(&cache->mipmaps, mipmaps);
+}
+
+void page_cache_take(struct doc_page_cache *cache, const char *doc_id,
+                     int32_t page_index, struct obs_source_frame *frame)
+{
+    uint8_t *mips = NULL;
+    uint32_t levels = 1;
+    size_t mip_bytes = 0;
+
+    if (!frame)
+        return;
+    if (!frame->width || !frame->height) {
+        obs_source_frame_destroy(frame);
+        return;
+    }
+
+    if (!doc_format_native(frame->format)) {
+        struct obs_source_frame *converted = doc_format_copy_frame(frame);
+        obs_source_frame_destroy(frame);
+        if (!converted)
+            return;
+        frame = converted;
+    }
+
+    if (os_atomic_load_bool(&cache->mipmaps) && doc_format_packed_rgb(frame->format))
+        mips = build_mips(frame, &levels, &mip_bytes);
+
+    pthread_mutex_lock(&cache->mutex);
+
+    struct doc_page *page = find_page(cache, doc_id, page_index);
+    if (page && page->pinned) {
+        /* the rasterizer is still writing into it, replace the whole page */
+        page->discarded = true;
+        page = NULL;
+    }
+
+    if (page) {
+        unlink_page(cache, page);
+        cache->bytes -= page->bytes;
+
+        /* the old texture stays on screen until the new frame is uploaded */
+        if (page->frame)
+            obs_source_frame_destroy(page->frame);
+        bfree(page->mip_data);
+    } else {
+        page = new_page(cache, doc_id, page_index);
+    }
+
+    page->frame = frame;
+    page->format = frame->format;
+    page->width = frame->width;
+    page->height = frame->height;
+    doc_format_get_color_matrix(frame, page->color_matrix, page->color_range_min,
+                                page->color_range_max);
+    page->display_width = frame->width;
+    page->display_height = frame->height;
+    page->lod = 0;
+    page->mip_data = mips;
+    page->levels = levels;
+    page->bytes = frame_bytes(frame->format, frame->width, frame->height) + mip_bytes;
+    page->dirty_tiles.num = 0;
+    page->full_upload = true;
+    page->complete = true;
+
+    cache->bytes += page->bytes;
+    insert_page(cache, page);
+    evict_to_budget(cache, page);
+
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void page_cache_put(struct doc_page_cache *cache, const char *doc_id,
+                    int32_t page_index, const struct obs_source_frame *frame)
+{
+    if (!frame || !frame->width || !frame->height)
+        return;
+
+    page_cache_take(cache, doc_id, page_index, doc_format_copy_frame(frame));
+}
+
+bool page_cache_contains(struct doc_page_cache *cache, const char *doc_id,
+                         int32_t page_index)
+{
+    pthread_mutex_lock(&cache->mutex);
+    const bool found = find_page(cache, doc_id, page_index) != NULL;
+    pthread_mutex_unlock(&cache->mutex);
+    return found;
+}
+
+bool page_cache_contains_lod(struct doc_page_cache *cache, const char *doc_id,
+                             int32_t page_index, int lod)
+{
+    pthread_mutex_lock(&cache->mutex);
+    const struct doc_page *page = find_page(cache, doc_id, page_index);
+    const bool found = page && page->lod == lod;
+    pthread_mutex_unlock(&cache->mutex);
+    return found;
+}
+
+struct doc_page *page_cache_begin(struct doc_page_cache *cache, const char *doc_id,
+                                  int32_t page_index, uint32_t cx, uint32_t cy,
+                                  int lod, uint32_t display_cx, uint32_t display_cy)
+{
+    struct obs_source_frame *frame = obs_source_frame_create(VIDEO_FORMAT_BGRA, cx, cy);
+    if (!frame)
+        return NULL;
+
+    memset(frame->data[0], 0, (size_t)frame->linesize[0] * cy);
+
+    pthread_mutex_lock(&cache->mutex);
+
+    /* a finished page stays visible while it is rendered at another lod */
+    struct doc_page *old = find_page(cache, doc_id, page_index);
+    const bool staged = old && old->complete && !old->pinned;
+    if (old && !staged)
+        drop_page(cache, old);
+
+    struct doc_page *page = new_page(cache, doc_id, page_index);
+    page->frame = frame;
+    page->format = VIDEO_FORMAT_BGRA;
+    page->width = cx;
+    page->height = cy;
+    page->display_width = display_cx;
+    page->display_height = display_cy;
+    page->lod = lod;
+    page->levels = 1;
+    page->bytes = (size_t)cx * cy * 4;
+    page->pinned = true;
+    page->staged = staged;
+
+    cache->bytes += page->bytes;
+    insert_page(cache, page);
+    evict_to_budget(cache, page);
+
+    pthread_mutex_unlock(&cache->mutex);
+    return page;
+}
+
+void page_cache_tile_done(struct doc_page_cache *cache, struct doc_page *page,
+                          uint32_t x, uint32_t y, uint32_t cx, uint32_t cy)
+{
+    struct doc_tile_rect rect = { x, y, cx, cy };
+
+    pthread_mutex_lock(&cache->mutex);
+    if (!page->discarded && !page->staged)
+        da_push_back(page->dirty_tiles, &rect);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void page_cache_end(struct doc_page_cache *cache, struct doc_page *page, bool success)
+{
+    uint8_t *mips = NULL;
+    uint32_t levels = 1;
+    size_t mip_bytes = 0;
+
+    /* still pinned, so the frame can be read without the lock */
+    if (success && os_atomic_load_bool(&cache->mipmaps))
+        mips = build_mips(page->frame, &levels, &mip_bytes);
+
+    pthread_mutex_lock(&cache->mutex);
+
+    page->pinned = false;
+    page->complete = success;
+
+    if (page->discarded || !success) {
+        page->discarded = false;
+        bfree(mips);
+        drop_page(cache, page);
+    } else {
+        /* the staged page takes over from the one shown until now */
+        if (page->staged) {
+            struct doc_page *old = cache->head;
+            while (old) {
+                struct doc_page *next = old->next;
+                if (page_matches(old, page->doc_id, page->page_index))
+                    drop_page(cache, old);
+                old = next;
+            }
+            page->staged = false;
+        }
+
+        /* the texture is created again, this time with all levels */
+        if (mips) {
+            page->mip_data = mips;
+            page->levels = levels;
+            page->bytes += mip_bytes;
+            cache->bytes += mip_bytes;
+            page->full_upload = true;
+            page->dirty_tiles.num = 0;
+        }
+
+        evict_to_budget(cache, page);
+    }
+
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+static gs_texture_t *get_staging(struct doc_page_cache *cache, uint32_t cx, uint32_t cy)
+{
+    for (size_t i = 0; i < cache->staging.num; i++) {
+        gs_texture_t *tex = cache->staging.array[i];
+        if (gs_texture_get_width(tex) == cx && gs_texture_get_height(tex) == cy)
+            return tex;
+    }
+
+    gs_texture_t *tex = gs_texture_create(cx, cy, GS_BGRA, 1, NULL, GS_DYNAMIC);
+    if (tex)
+        da_push_back(cache->staging, &tex);
+    return tex;
+}
+
+/* graphics thread, cache mutex held */
+static void upload_page(struct doc_page_cache *cache, struct doc_page *page)
+{
+    const uint8_t *data = page->frame->data[0];
+    const uint32_t linesize = page->frame->linesize[0];
+
+    if (!page->texture || page->full_upload) {
+        struct doc_plane planes[DOC_MAX_PLANES];
+        const size_t count = doc_format_get_planes(page->format, page->width,
+                                                   page->height, planes);
+
+        bury_textures(cache, page);
+
+        const uint8_t *levels[32] = { data };
+        const uint8_t *mip = page->mip_data;
+        uint32_t cx = page->width;
+        uint32_t cy = page->height;
+        for (uint32_t i = 1; i < page->levels && i < 32; i++) {
+            cx = half_size(cx);
+            cy = half_size(cy);
+            levels[i] = mip;
+            mip += (size_t)cx * cy * 4;
+        }
+
+        page->texture = gs_texture_create(planes[0].cx, planes[0].cy, planes[0].format,
+                                          page->levels, levels, 0);
+
+        for (size_t i = 1; i < count; i++) {
+            const uint8_t *plane = page->frame->data[i];
+            page->chroma[i - 1] = gs_texture_create(planes[i].cx, planes[i].cy,
+                                                    planes[i].format, 1, &plane, 0);
+        }
+
+        page->full_upload = false;
+        page->dirty_tiles.num = 0;
+    }
+
+    for (size_t i = 0; i < page->dirty_tiles.num && page->texture; i++) {
+        const struct doc_tile_rect *rect = &page->dirty_tiles.array[i];
+        gs_texture_t *staging = get_staging(cache, rect->cx, rect->cy);
+        if (!staging)
+            continue;
+
+        gs_texture_set_image(staging, data + (size_t)rect->y * linesize + rect->x * 4,
+                             linesize, false);
+        gs_copy_texture_region(page->texture, rect->x, rect->y, staging, 0, 0,
+                               rect->cx, rect->cy);
+    }
+    page->dirty_tiles.num = 0;
+
+    /* the texture now holds the pixels, the CPU copy is not needed */
+    if (page->complete && !page->pinned) {
+        obs_source_frame_destroy(page->frame);
+        page->frame = NULL;
+        bfree(page->mip_data);
+        page->mip_data = NULL;
+    }
+}
+
+bool page_cache_acquire(struct doc_page_cache *cache, const char *doc_id,
+                        int32_t page_index, bool count_stats,
+                        struct doc_page_view *view)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&cache->mutex);
+
+    struct doc_page *page = find_page(cache, doc_id, page_index);
+    if (!page) {
+        if (count_stats)
+            cache->misses++;
+        goto unlock;
+    }
+
+    if (count_stats)
+        cache->hits++;
+
+    if (page != cache->head) {
+        unlink_page(cache, page);
+        push_front(cache, page);
+    }
+    cache->displayed = page;
+
+    if (page->frame)
+        upload_page(cache, page);
+
+    view->format = page->format;
+    view->texture = page->texture;
+    for (size_t i = 0; i < DOC_MAX_PLANES - 1; i++)
+        view->chroma[i] = page->chroma[i];
+    memcpy(view->color_matrix, page->color_matrix, sizeof(view->color_matrix));
+    memcpy(view->color_range_min, page->color_range_min, sizeof(view->color_range_min));
+    memcpy(view->color_range_max, page->color_range_max, sizeof(view->color_range_max));
+    view->cx = page->display_width;
+    view->cy = page->display_height;
+    found = page->texture != NULL;
+
+unlock:
+    pthread_mutex_unlock(&cache->mutex);
+    return found;
+}
+
+void page_cache_clear(struct doc_page_cache *cache, const char *doc_id)
+{
+    pthread_mutex_lock(&cache->mutex);
+
+    struct doc_page *page = cache->head;
+    while (page) {
+        struct doc_page *next = page->next;
+        if (!doc_id || strcmp(page->doc_id, doc_id) == 0)
+            drop_page(cache, page);
+        page = next;
+    }
+
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void page_cache_collect(struct doc_page_cache *cache)
+{
+    pthread_mutex_lock(&cache->mutex);
+    for (size_t i = 0; i < cache->graveyard.num; i++)
+        gs_texture_destroy(cache->graveyard.array[i]);
+    cache->graveyard.num = 0;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void page_cache_get_stats(struct doc_page_cache *cache,
+                          struct doc_page_cache_stats *stats)
+{
+    pthread_mutex_lock(&cache->mutex);
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->bytes = cache->bytes;
+    stats->max_bytes = cache->max_bytes;
+    stats->pages = cache->pages;
+    pthread_mutex_unlock(&cache->mutex);
+}
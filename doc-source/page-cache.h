@@ -0,0 +1,190 @@
+#pragma once
+
+#include <obs.h>
+#include <util/darray.h>
+#include <pthread.h>
+#include "frame-format.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded cache of rasterized document pages, keyed by doc_id and page
+ * index and evicted least-recently-used first once the byte budget is hit.
+ * The page last acquired for display is never evicted, and pages that
+ * arrive (prefetched neighbours, the requested page) are queued behind it
+ * until they are acquired themselves.
+ *
+ * Pages arrive as CPU frames from any thread and are turned into textures
+ * lazily on the graphics thread, so a page turn to a cached page is just a
+ * texture swap.  Textures of evicted pages are parked until the next
+ * page_cache_collect() call, which must run inside the graphics context.
+ *
+ * The in-process rasterizer fills pages progressively instead: it pins a
+ * page with page_cache_begin(), writes tiles straight into its frame and
+ * reports each finished tile, and the graphics thread uploads only those
+ * tiles.  Pinned pages are never evicted or freed until page_cache_end().
+ *
+ * A page may be rendered smaller than it is displayed (see the lod of the
+ * rasterizer).  When a complete page is rendered again at another lod, the
+ * new one is staged: hidden until it is done, so the old one stays on
+ * screen instead of a half empty page.
+ */
+
+struct doc_tile_rect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t cx;
+    uint32_t cy;
+};
+
+struct doc_page {
+    char *doc_id;
+    int32_t page_index;
+
+    struct obs_source_frame *frame;
+    enum video_format format;
+    gs_texture_t *texture;
+    uint32_t width;
+    uint32_t height;
+    size_t bytes;
+
+    /* size the page is drawn at, the texture may be smaller */
+    uint32_t display_width;
+    uint32_t display_height;
+    int lod;
+
+    /* U/V planes of YUV pages, drawn with the color matrix of the frame */
+    gs_texture_t *chroma[DOC_MAX_PLANES - 1];
+    float color_matrix[16];
+    float color_range_min[3];
+    float color_range_max[3];
+
+    /* box filtered levels 1..n, tightly packed, when mipmaps are enabled */
+    uint8_t *mip_data;
+    uint32_t levels;
+
+    /* tiles written since the last upload, for progressive pages */
+    DARRAY(struct doc_tile_rect) dirty_tiles;
+    bool full_upload;
+    bool pinned;
+    bool complete;
+    bool discarded;
+    bool staged;
+
+    struct doc_page *prev;
+    struct doc_page *next;
+};
+
+/* What the graphics thread needs to draw a page. */
+struct doc_page_view {
+    enum video_format format;
+    gs_texture_t *texture;
+    gs_texture_t *chroma[DOC_MAX_PLANES - 1];
+    float color_matrix[16];
+    float color_range_min[3];
+    float color_range_max[3];
+
+    /* size the page is displayed at */
+    uint32_t cx;
+    uint32_t cy;
+};
+
+struct doc_page_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t bytes;
+    size_t max_bytes;
+    size_t pages;
+};
+
+struct doc_page_cache {
+    pthread_mutex_t mutex;
+
+    /* head is the most recently used page */
+    struct doc_page *head;
+    struct doc_page *tail;
+
+    /* page last acquired for display, never evicted */
+    struct doc_page *displayed;
+
+    size_t bytes;
+    size_t max_bytes;
+    size_t pages;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
+    volatile bool mipmaps;
+
+    DARRAY(gs_texture_t *) graveyard;
+
+    /* dynamic textures tiles are staged through, one per tile size */
+    DARRAY(gs_texture_t *) staging;
+};
+
+void page_cache_init(struct doc_page_cache *cache, size_t max_bytes);
+void page_cache_free(struct doc_page_cache *cache);
+
+void page_cache_set_max_bytes(struct doc_page_cache *cache, size_t max_bytes);
+
+/* Builds full mip chains for pages completed from now on. */
+void page_cache_set_mipmaps(struct doc_page_cache *cache, bool mipmaps);
+
+/*
+ * Copies frame into the cache, replacing any page with the same key.
+ * Frames in formats that can't be drawn directly are converted to BGRA.
+ */
+void page_cache_put(struct doc_page_cache *cache, const char *doc_id,
+                    int32_t page_index, const struct obs_source_frame *frame);
+
+/* Like page_cache_put, but adopts frame instead of copying it. */
+void page_cache_take(struct doc_page_cache *cache, const char *doc_id,
+                     int32_t page_index, struct obs_source_frame *frame);
+
+/*
+ * Creates a pinned, cleared cx x cy BGRA page displayed at display_cx x
+ * display_cy and returns it.  Tiles are written into page->frame by the
+ * caller, then announced with page_cache_tile_done().  page_cache_end()
+ * unpins the page; it is dropped if rendering failed or the page was
+ * cleared meanwhile.
+ */
+struct doc_page *page_cache_begin(struct doc_page_cache *cache, const char *doc_id,
+                                  int32_t page_index, uint32_t cx, uint32_t cy,
+                                  int lod, uint32_t display_cx, uint32_t display_cy);
+void page_cache_tile_done(struct doc_page_cache *cache, struct doc_page *page,
+                          uint32_t x, uint32_t y, uint32_t cx, uint32_t cy);
+void page_cache_end(struct doc_page_cache *cache, struct doc_page *page, bool success);
+
+bool page_cache_contains(struct doc_page_cache *cache, const char *doc_id,
+                         int32_t page_index);
+
+/* Same, but only counts a page rendered at the given lod. */
+bool page_cache_contains_lod(struct doc_page_cache *cache, const char *doc_id,
+                             int32_t page_index, int lod);
+
+/*
+ * Graphics thread only.  Fills view with the page textures, uploading the
+ * pending frame if needed, and marks the page as most recently used.
+ * Counts a hit or a miss when count_stats is set.  The view is valid until
+ * the next page_cache_collect().
+ */
+bool page_cache_acquire(struct doc_page_cache *cache, const char *doc_id,
+                        int32_t page_index, bool count_stats,
+                        struct doc_page_view *view);
+
+/* Drops every page of doc_id, or every page when doc_id is NULL. */
+void page_cache_clear(struct doc_page_cache *cache, const char *doc_id);
+
+/* Graphics thread only.  Destroys textures of evicted pages. */
+void page_cache_collect(struct doc_page_cache *cache);
+
+void page_cache_get_stats(struct doc_page_cache *cache,
+                          struct doc_page_cache_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <util/platform.h>
+
+#include "doc-rasterizer.h"
+
+/*
+ * Turns through every page of a document the way the source does when the
+ * page on screen changes: one urgent page at a time, its tiles spread over
+ * the worker pool, into the page cache.  Runs without OBS, on a synthetic
+ * document unless told otherwise:
+ *
+ *   raster-bench [document] [threads] [lod]
+ *
+ * Prints the time per page and to the first tile, and fails when a page
+ * never makes it into the cache.
+ */
+
+#define BENCH_DOCUMENT "synthetic:16"
+#define BENCH_DOC_ID "raster-bench"
+#define BENCH_CX 1920
+#define BENCH_CY 1080
+#define BENCH_CACHE_MB 1024
+#define BENCH_TIMEOUT_NS (120 * 1000000000ULL)
+
+static uint64_t pages_done(struct doc_rasterizer *r)
+{
+    struct doc_raster_stats stats;
+    doc_rasterizer_get_stats(r, &stats);
+    return stats.pages;
+}
+
+static bool wait_for(struct doc_rasterizer *r, uint64_t pages, uint64_t deadline)
+{
+    while (pages_done(r) < pages) {
+        if (os_gettime_ns() > deadline)
+            return false;
+        os_sleep_ms(1);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *document = argc > 1 ? argv[1] : BENCH_DOCUMENT;
+    int threads = argc > 2 ? atoi(argv[2]) : os_get_logical_cores();
+    const int lod = argc > 3 ? atoi(argv[3]) : 0;
+    bool ok = true;
+
+    if (threads < 1)
+        threads = 1;
+
+    struct doc_page_cache cache;
+    page_cache_init(&cache, (size_t)BENCH_CACHE_MB * 1024 * 1024);
+    struct doc_worker_pool *pool = doc_worker_pool_create((size_t)threads, "raster-bench");
+    struct doc_rasterizer *r = doc_rasterizer_create(&cache, pool);
+
+    if (!doc_rasterizer_set_file(r, document, BENCH_DOC_ID, BENCH_CX, BENCH_CY)) {
+        fprintf(stderr, "no backend for '%s'\n", document);
+        ok = false;
+        goto done;
+    }
+    doc_rasterizer_set_lod(r, lod);
+
+    const uint64_t start_ns = os_gettime_ns();
+    const uint64_t deadline = start_ns + BENCH_TIMEOUT_NS;
+
+    /* the first job opens the document */
+    doc_rasterizer_request(r, 0, true);
+    if (!wait_for(r, 1, deadline)) {
+        fprintf(stderr, "page 0 of '%s' was not rendered\n", document);
+        ok = false;
+        goto done;
+    }
+
+    const int32_t page_count = doc_rasterizer_get_page_count(r);
+    for (int32_t i = 1; i < page_count; i++) {
+        doc_rasterizer_request(r, i, true);
+        if (!wait_for(r, (uint64_t)i + 1, deadline)) {
+            fprintf(stderr, "page %d of '%s' was not rendered\n", i, document);
+            ok = false;
+            goto done;
+        }
+    }
+
+    for (int32_t i = 0; i < page_count; i++) {
+        if (!page_cache_contains_lod(&cache, BENCH_DOC_ID, i, lod)) {
+            fprintf(stderr, "page %d is not in the cache\n", i);
+            ok = false;
+        }
+    }
+
+    const uint64_t elapsed_ns = os_gettime_ns() - start_ns;
+    struct doc_raster_stats stats;
+    doc_rasterizer_get_stats(r, &stats);
+    printf("%s: %d pages at lod %d on %d threads in %.1f ms\n", document, page_count, lod,
+           threads, (double)elapsed_ns / 1000000.0);
+    if (stats.pages) {
+        printf("%.2f ms per page, first tile after %.2f ms, %.1f tiles per page\n",
+               (double)stats.total_ns / 1000000.0 / (double)stats.pages,
+               (double)stats.first_tile_ns / 1000000.0 / (double)stats.pages,
+               (double)stats.tiles / (double)stats.pages);
+    }
+
+done:
+    /* jobs still queued use the rasterizer */
+    doc_worker_pool_destroy(pool);
+    doc_rasterizer_destroy(r);
+    page_cache_free(&cache);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,474 @@
+#include "cpu-raster.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include "drawing-source.h"
+#include "glyph-atlas.h"
+
+// the color a page is cleared to, white with no alpha
+#define RASTER_CLEAR_COLOR 0x00FFFFFFu
+
+enum primitive_kind {
+    PRIMITIVE_CLEAR,
+    PRIMITIVE_POLYLINE,
+    PRIMITIVE_RECT,
+    PRIMITIVE_ELLIPSE,
+    PRIMITIVE_GLYPHS,
+    PRIMITIVE_IMAGE,
+};
+
+struct primitive {
+    primitive_kind kind;
+    uint32_t color;
+    // pixels touched, clipped to the image, x1 and y1 exclusive
+    int32_t x0, y0, x1, y1;
+
+    float half;
+    std::vector<z_point> points;
+    // rect: outer and inner box; ellipse: center and radii; image: where
+    // it is stretched to
+    float shape[4];
+    float inner[4];
+    std::vector<glyph_bitmap> glyphs;
+    // image: the command holding the pixels
+    const draw_command *image;
+};
+
+static inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint8_t to_coverage(float c)
+{
+    return c >= 1.0f ? 255 : static_cast<uint8_t>(c * 255.0f + 0.5f);
+}
+
+static inline float clamp01(float v)
+{
+    return std::min(std::max(v, 0.0f), 1.0f);
+}
+
+static inline uint32_t blend_pixel(uint32_t dst, uint32_t color, uint32_t a)
+{
+    const uint32_t ia = 255 - a;
+    const uint32_t r = div255((color & 0xFF) * a + (dst & 0xFF) * ia);
+    const uint32_t g = div255(((color >> 8) & 0xFF) * a + ((dst >> 8) & 0xFF) * ia);
+    const uint32_t b = div255(((color >> 16) & 0xFF) * a + ((dst >> 16) & 0xFF) * ia);
+    const uint32_t alpha = div255(255 * a + (dst >> 24) * ia);
+    return r | g << 8 | b << 16 | alpha << 24;
+}
+
+/* Blends color into a row of pixels by their coverage, four at a time with SSE2. */
+static void blend_span(uint32_t *dst, const uint8_t *coverage, int32_t count, uint32_t color)
+{
+    const uint32_t color_alpha = color >> 24;
+    if (!color_alpha)
+        return;
+
+    int32_t i = 0;
+
+#ifdef DRAW_SOURCE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i bias = _mm_set1_epi16(128);
+    // the alpha lane blends to a + dst * (1 - a)
+    const __m128i source = _mm_set_epi16(255
+        , static_cast<short>((color >> 16) & 0xFF), static_cast<short>((color >> 8) & 0xFF)
+        , static_cast<short>(color & 0xFF), 255
+        , static_cast<short>((color >> 16) & 0xFF), static_cast<short>((color >> 8) & 0xFF)
+        , static_cast<short>(color & 0xFF));
+
+    for (; i + 4 <= count; i += 4) {
+        uint32_t covered;
+        memcpy(&covered, coverage + i, sizeof(covered));
+        if (!covered)
+            continue;
+
+        const short a0 = static_cast<short>(div255(color_alpha * coverage[i]));
+        const short a1 = static_cast<short>(div255(color_alpha * coverage[i + 1]));
+        const short a2 = static_cast<short>(div255(color_alpha * coverage[i + 2]));
+        const short a3 = static_cast<short>(div255(color_alpha * coverage[i + 3]));
+        const __m128i alpha_lo = _mm_set_epi16(a1, a1, a1, a1, a0, a0, a0, a0);
+        const __m128i alpha_hi = _mm_set_epi16(a3, a3, a3, a3, a2, a2, a2, a2);
+
+        const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        __m128i lo = _mm_unpacklo_epi8(px, zero);
+        __m128i hi = _mm_unpackhi_epi8(px, zero);
+
+        lo = _mm_add_epi16(_mm_mullo_epi16(source, alpha_lo), _mm_mullo_epi16(lo, _mm_sub_epi16(full, alpha_lo)));
+        hi = _mm_add_epi16(_mm_mullo_epi16(source, alpha_hi), _mm_mullo_epi16(hi, _mm_sub_epi16(full, alpha_hi)));
+        lo = _mm_add_epi16(lo, bias);
+        hi = _mm_add_epi16(hi, bias);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < count; i++) {
+        if (coverage[i])
+            dst[i] = blend_pixel(dst[i], color, div255(color_alpha * coverage[i]));
+    }
+}
+
+static void cover_segment(uint8_t *coverage, int32_t tile_x, int32_t tile_y,
+    int32_t x0, int32_t y0, int32_t x1, int32_t y1, z_point a, z_point b, float half)
+{
+    x0 = std::max(x0, static_cast<int32_t>(std::floor(std::min(a.x, b.x) - half - 1.0f)));
+    y0 = std::max(y0, static_cast<int32_t>(std::floor(std::min(a.y, b.y) - half - 1.0f)));
+    x1 = std::min(x1, static_cast<int32_t>(std::ceil(std::max(a.x, b.x) + half + 1.0f)));
+    y1 = std::min(y1, static_cast<int32_t>(std::ceil(std::max(a.y, b.y) + half + 1.0f)));
+
+    const float dx = b.x - a.x;
+    const float dy = b.y - a.y;
+    const float length2 = dx * dx + dy * dy;
+
+    for (int32_t y = y0; y < y1; y++) {
+        uint8_t *row = coverage + static_cast<size_t>(y - tile_y) * RASTER_TILE - tile_x;
+        const float py = static_cast<float>(y) + 0.5f - a.y;
+        for (int32_t x = x0; x < x1; x++) {
+            const float px = static_cast<float>(x) + 0.5f - a.x;
+            const float t = length2 > 0.0f ? clamp01((px * dx + py * dy) / length2) : 0.0f;
+            const float ex = px - t * dx;
+            const float ey = py - t * dy;
+            const float c = half + 0.5f - std::sqrt(ex * ex + ey * ey);
+            if (c > 0.0f)
+                row[x] = std::max(row[x], to_coverage(c));
+        }
+    }
+}
+
+static float box_coverage(float px, float py, const float box[4])
+{
+    if (box[2] <= box[0] || box[3] <= box[1])
+        return 0.0f;
+    return clamp01(std::min(px - box[0], box[2] - px) + 0.5f) * clamp01(std::min(py - box[1], box[3] - py) + 0.5f);
+}
+
+/* Blends an image command stretched over its box, sampling the nearest pixel. */
+static void draw_image(raster_image &image, const primitive &prim, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    const uint32_t width = prim.image->image_width;
+    const auto height = static_cast<uint32_t>(prim.image->pixels.size() / width);
+    const float scale_x = static_cast<float>(width) / (prim.shape[2] - prim.shape[0]);
+    const float scale_y = static_cast<float>(height) / (prim.shape[3] - prim.shape[1]);
+
+    for (int32_t y = y0; y < y1; y++) {
+        const auto row = std::min(static_cast<uint32_t>(std::max((static_cast<float>(y) + 0.5f - prim.shape[1])
+            * scale_y, 0.0f)), height - 1);
+        const uint32_t *in = &prim.image->pixels[static_cast<size_t>(row) * width];
+        uint32_t *out = &image.pixels[static_cast<size_t>(y) * image.width];
+        for (int32_t x = x0; x < x1; x++) {
+            const auto col = std::min(static_cast<uint32_t>(std::max((static_cast<float>(x) + 0.5f - prim.shape[0])
+                * scale_x, 0.0f)), width - 1);
+            const uint32_t a = in[col] >> 24;
+            if (a == 255)
+                out[x] = in[col];
+            else if (a)
+                out[x] = blend_pixel(out[x], in[col], a);
+        }
+    }
+}
+
+/* Coverage of the primitive within the tile region, then blended in. */
+static void draw_primitive(raster_image &image, uint8_t *coverage, const primitive &prim,
+    int32_t tile_x, int32_t tile_y, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    if (prim.kind == PRIMITIVE_CLEAR) {
+        for (int32_t y = y0; y < y1; y++)
+            std::fill_n(&image.pixels[static_cast<size_t>(y) * image.width + x0], x1 - x0, RASTER_CLEAR_COLOR);
+        return;
+    }
+
+    if (prim.kind == PRIMITIVE_IMAGE) {
+        draw_image(image, prim, x0, y0, x1, y1);
+        return;
+    }
+
+    for (int32_t y = y0; y < y1; y++)
+        memset(coverage + static_cast<size_t>(y - tile_y) * RASTER_TILE + (x0 - tile_x), 0, x1 - x0);
+
+    switch (prim.kind) {
+    case PRIMITIVE_POLYLINE:
+        for (size_t i = 1; i < prim.points.size(); i++)
+            cover_segment(coverage, tile_x, tile_y, x0, y0, x1, y1, prim.points[i - 1], prim.points[i], prim.half);
+        break;
+
+    case PRIMITIVE_RECT:
+        for (int32_t y = y0; y < y1; y++) {
+            uint8_t *row = coverage + static_cast<size_t>(y - tile_y) * RASTER_TILE - tile_x;
+            const float py = static_cast<float>(y) + 0.5f;
+            for (int32_t x = x0; x < x1; x++) {
+                const float px = static_cast<float>(x) + 0.5f;
+                const float c = box_coverage(px, py, prim.shape) - box_coverage(px, py, prim.inner);
+                if (c > 0.0f)
+                    row[x] = to_coverage(c);
+            }
+        }
+        break;
+
+    case PRIMITIVE_ELLIPSE: {
+        const float cx = prim.shape[0];
+        const float cy = prim.shape[1];
+        const float rx = prim.shape[2];
+        const float ry = prim.shape[3];
+        for (int32_t y = y0; y < y1; y++) {
+            uint8_t *row = coverage + static_cast<size_t>(y - tile_y) * RASTER_TILE - tile_x;
+            const float ny = (static_cast<float>(y) + 0.5f - cy) / ry;
+            for (int32_t x = x0; x < x1; x++) {
+                const float nx = (static_cast<float>(x) + 0.5f - cx) / rx;
+                // distance to the outline from the gradient of the implicit form
+                const float g = std::sqrt(nx * nx + ny * ny);
+                const float gx = nx / rx;
+                const float gy = ny / ry;
+                const float gradient = g > 0.0f ? std::sqrt(gx * gx + gy * gy) / g : 0.0f;
+                const float distance = gradient > 0.0f ? std::fabs(g - 1.0f) / gradient : std::min(rx, ry);
+                const float c = prim.half + 0.5f - distance;
+                if (c > 0.0f)
+                    row[x] = to_coverage(c);
+            }
+        }
+        break;
+    }
+
+    case PRIMITIVE_GLYPHS:
+        for (const auto &glyph : prim.glyphs) {
+            const int32_t gx0 = std::max(x0, glyph.x);
+            const int32_t gy0 = std::max(y0, glyph.y);
+            const int32_t gx1 = std::min(x1, glyph.x + static_cast<int32_t>(glyph.width));
+            const int32_t gy1 = std::min(y1, glyph.y + static_cast<int32_t>(glyph.height));
+            for (int32_t y = gy0; y < gy1; y++) {
+                uint8_t *row = coverage + static_cast<size_t>(y - tile_y) * RASTER_TILE - tile_x;
+                const uint8_t *in = &glyph.coverage[static_cast<size_t>(y - glyph.y) * glyph.width - glyph.x];
+                for (int32_t x = gx0; x < gx1; x++)
+                    row[x] = std::max(row[x], in[x]);
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    for (int32_t y = y0; y < y1; y++)
+        blend_span(&image.pixels[static_cast<size_t>(y) * image.width + x0]
+            , coverage + static_cast<size_t>(y - tile_y) * RASTER_TILE + (x0 - tile_x), x1 - x0, prim.color);
+}
+
+static void set_bounds(primitive &prim, float x0, float y0, float x1, float y1, const raster_image &image)
+{
+    prim.x0 = std::max(static_cast<int32_t>(std::floor(x0)), 0);
+    prim.y0 = std::max(static_cast<int32_t>(std::floor(y0)), 0);
+    prim.x1 = std::min(static_cast<int32_t>(std::ceil(x1)), static_cast<int32_t>(image.width));
+    prim.y1 = std::min(static_cast<int32_t>(std::ceil(y1)), static_cast<int32_t>(image.height));
+}
+
+/* Scales a command to pixels; false when it draws nothing. */
+static bool build_primitive(const raster_image &image, const draw_command &command, GlyphAtlas *atlas,
+    primitive &prim)
+{
+    const auto width = static_cast<float>(image.width);
+    const auto height = static_cast<float>(image.height);
+    prim.color = command.color;
+
+    if (command.type == DRAW_CLEAR) {
+        prim.kind = PRIMITIVE_CLEAR;
+        set_bounds(prim, 0.0f, 0.0f, width, height, image);
+        return true;
+    }
+
+    if (command.type == DRAW_TEXT) {
+        if (!atlas || command.points.empty() || command.text.empty())
+            return false;
+
+        prim.kind = PRIMITIVE_GLYPHS;
+        atlas->BuildBitmaps(command.text, command.points[0].x * width, command.points[0].y * height
+            , static_cast<uint32_t>(std::lround(command.size * height)), prim.glyphs);
+        if (prim.glyphs.empty())
+            return false;
+
+        int32_t x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+        for (const auto &glyph : prim.glyphs) {
+            x0 = std::min(x0, glyph.x);
+            y0 = std::min(y0, glyph.y);
+            x1 = std::max(x1, glyph.x + static_cast<int32_t>(glyph.width));
+            y1 = std::max(y1, glyph.y + static_cast<int32_t>(glyph.height));
+        }
+        set_bounds(prim, static_cast<float>(x0), static_cast<float>(y0)
+            , static_cast<float>(x1), static_cast<float>(y1), image);
+        return true;
+    }
+
+    if (command.points.size() < 2)
+        return false;
+
+    if (command.type == DRAW_IMAGE) {
+        if (!command.image_width || command.pixels.empty())
+            return false;
+
+        // whole pixels, as the sprite is drawn on the GPU
+        prim.kind = PRIMITIVE_IMAGE;
+        prim.image = &command;
+        prim.shape[0] = std::round(command.points[0].x * width);
+        prim.shape[1] = std::round(command.points[0].y * height);
+        prim.shape[2] = std::round(command.points[1].x * width);
+        prim.shape[3] = std::round(command.points[1].y * height);
+        if (prim.shape[2] <= prim.shape[0] || prim.shape[3] <= prim.shape[1])
+            return false;
+        set_bounds(prim, prim.shape[0], prim.shape[1], prim.shape[2], prim.shape[3], image);
+        return true;
+    }
+
+    prim.half = std::max(command.size * height, 1.0f) * 0.5f;
+    for (const auto &point : command.points)
+        prim.points.push_back({ point.x * width, point.y * height });
+
+    float x0 = prim.points[0].x, y0 = prim.points[0].y;
+    float x1 = x0, y1 = y0;
+    for (const auto &point : prim.points) {
+        x0 = std::min(x0, point.x);
+        y0 = std::min(y0, point.y);
+        x1 = std::max(x1, point.x);
+        y1 = std::max(y1, point.y);
+    }
+    const float pad = prim.half + 1.0f;
+    set_bounds(prim, x0 - pad, y0 - pad, x1 + pad, y1 + pad, image);
+
+    if (command.type == DRAW_RECT) {
+        // the outline is centered on the box edges, as in ShapeBuffer::AddRect
+        const float cx = (x0 + x1) * 0.5f;
+        const float cy = (y0 + y1) * 0.5f;
+        prim.kind = PRIMITIVE_RECT;
+        prim.shape[0] = x0 - prim.half;
+        prim.shape[1] = y0 - prim.half;
+        prim.shape[2] = x1 + prim.half;
+        prim.shape[3] = y1 + prim.half;
+        prim.inner[0] = std::min(x0 + prim.half, cx);
+        prim.inner[1] = std::min(y0 + prim.half, cy);
+        prim.inner[2] = std::max(x1 - prim.half, cx);
+        prim.inner[3] = std::max(y1 - prim.half, cy);
+    }
+    else if (command.type == DRAW_CIRCLE) {
+        const float rx = (x1 - x0) * 0.5f;
+        const float ry = (y1 - y0) * 0.5f;
+        const float cx = (x0 + x1) * 0.5f;
+        const float cy = (y0 + y1) * 0.5f;
+
+        // a flat ellipse is a line through its center
+        if (rx < 0.5f || ry < 0.5f) {
+            prim.kind = PRIMITIVE_POLYLINE;
+            prim.points = { { cx - rx, cy - ry }, { cx + rx, cy + ry } };
+            if (rx >= 0.5f)
+                prim.points = { { x0, cy }, { x1, cy } };
+            else if (ry >= 0.5f)
+                prim.points = { { cx, y0 }, { cx, y1 } };
+            return true;
+        }
+
+        prim.kind = PRIMITIVE_ELLIPSE;
+        prim.shape[0] = cx;
+        prim.shape[1] = cy;
+        prim.shape[2] = rx;
+        prim.shape[3] = ry;
+    }
+    else {
+        prim.kind = PRIMITIVE_POLYLINE;
+    }
+    return true;
+}
+
+void raster_clear(raster_image &image, uint32_t width, uint32_t height)
+{
+    image.width = width;
+    image.height = height;
+    image.pixels.assign(static_cast<size_t>(width) * height, RASTER_CLEAR_COLOR);
+}
+
+void raster_commands(raster_image &image, const draw_command *commands, size_t count, GlyphAtlas *atlas)
+{
+    if (!image.width || !image.height)
+        return;
+
+    // commands taken out by a later erase are not drawn
+    std::vector<bool> erased(count, false);
+    for (size_t i = 0; i < count; i++) {
+        for (uint32_t target : commands[i].targets) {
+            if (target && target <= i)
+                erased[i - target] = true;
+        }
+    }
+
+    std::vector<primitive> prims;
+    prims.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        if (erased[i] || commands[i].type == DRAW_ERASE)
+            continue;
+
+        primitive prim;
+        if (build_primitive(image, commands[i], atlas, prim) && prim.x0 < prim.x1 && prim.y0 < prim.y1)
+            prims.push_back(std::move(prim));
+    }
+    if (prims.empty())
+        return;
+
+    const uint32_t tiles_x = (image.width + RASTER_TILE - 1) / RASTER_TILE;
+    const uint32_t tiles_y = (image.height + RASTER_TILE - 1) / RASTER_TILE;
+    const size_t tiles = static_cast<size_t>(tiles_x) * tiles_y;
+    std::atomic<size_t> next_tile { 0 };
+
+    const auto worker = [&]() {
+        std::vector<uint8_t> coverage(RASTER_TILE * RASTER_TILE);
+        for (size_t tile = next_tile++; tile < tiles; tile = next_tile++) {
+            const auto tile_x = static_cast<int32_t>(tile % tiles_x * RASTER_TILE);
+            const auto tile_y = static_cast<int32_t>(tile / tiles_x * RASTER_TILE);
+            const int32_t tile_x1 = std::min(tile_x + RASTER_TILE, static_cast<int32_t>(image.width));
+            const int32_t tile_y1 = std::min(tile_y + RASTER_TILE, static_cast<int32_t>(image.height));
+
+            for (const auto &prim : prims) {
+                const int32_t x0 = std::max(prim.x0, tile_x);
+                const int32_t y0 = std::max(prim.y0, tile_y);
+                const int32_t x1 = std::min(prim.x1, tile_x1);
+                const int32_t y1 = std::min(prim.y1, tile_y1);
+                if (x0 < x1 && y0 < y1)
+                    draw_primitive(image, coverage.data(), prim, tile_x, tile_y, x0, y0, x1, y1);
+            }
+        }
+    };
+
+    const size_t thread_count = std::min<size_t>({ std::max(std::thread::hardware_concurrency(), 1u)
+        , RASTER_MAX_THREADS, tiles });
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < thread_count; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void raster_blit(raster_image &image, int32_t x, int32_t y, const uint32_t *pixels,
+    uint32_t width, uint32_t height, uint32_t stride)
+{
+    const int32_t x0 = std::max(x, 0);
+    const int32_t y0 = std::max(y, 0);
+    const int32_t x1 = std::min(x + static_cast<int32_t>(width), static_cast<int32_t>(image.width));
+    const int32_t y1 = std::min(y + static_cast<int32_t>(height), static_cast<int32_t>(image.height));
+
+    for (int32_t row = y0; row < y1; row++) {
+        const uint32_t *in = pixels + static_cast<size_t>(row - y) * stride - x;
+        uint32_t *out = &image.pixels[static_cast<size_t>(row) * image.width];
+        for (int32_t col = x0; col < x1; col++) {
+            const uint32_t a = in[col] >> 24;
+            if (a == 255)
+                out[col] = in[col];
+            else if (a)
+                out[col] = blend_pixel(out[col], in[col], a);
+        }
+    }
+}
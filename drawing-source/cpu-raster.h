@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "display-list.h"
+
+class GlyphAtlas;
+
+// Draws display lists into RGBA images on the CPU, for pages without a
+// render target: thumbnails of saved pages, export and checks without a
+// GPU.  Blending matches the render targets, straight alpha with
+// SRCALPHA/INVSRCALPHA for color and ONE/INVSRCALPHA for alpha, and
+// edges are anti-aliased by pixel coverage.
+//
+// The image is drawn in RASTER_TILE tiles on up to RASTER_MAX_THREADS
+// threads; each tile applies the commands touching it in order.
+#define RASTER_TILE 128
+#define RASTER_MAX_THREADS 8
+
+struct raster_image {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // RGBA
+    std::vector<uint32_t> pixels;
+};
+
+// Sizes the image and clears it like a new page.
+void raster_clear(raster_image &image, uint32_t width, uint32_t height);
+
+// Draws commands scaled to the image, as replay does on the GPU.  Text
+// needs the atlas of the page's font.
+void raster_commands(raster_image &image, const draw_command *commands, size_t count, GlyphAtlas *atlas);
+
+// Blends an RGBA image with its top left corner at (x, y).
+void raster_blit(raster_image &image, int32_t x, int32_t y, const uint32_t *pixels,
+    uint32_t width, uint32_t height, uint32_t stride);
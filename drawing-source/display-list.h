@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "obs-module.h"
+#include "drawing-source.h"
+#include "zmath.h"
+
+// One committed item of a page.  Coordinates are fractions of the canvas
+// width/height and sizes fractions of the canvas height, so a page can be
+// replayed into a canvas of any size.
+struct draw_command {
+    draw_type type { DRAW_NONE };
+    uint32_t color { 0 };
+    float size { 0.0f };
+
+    // DRAW_TEXT: the top left corner of the first line
+    std::vector<z_point> points;
+    std::string text;
+    // DRAW_ERASE: the commands it removes, as distances back from it
+    std::vector<uint32_t> targets;
+    // DRAW_IMAGE: RGBA rows of image_width pixels, stretched from the first
+    // point to the second
+    std::vector<uint32_t> pixels;
+    uint32_t image_width { 0 };
+};
+
+typedef std::vector<draw_command> display_list;
@@ -2,11 +2,18 @@
 #include "obs-source.h"
 #include "source-manager.h"
 #include "drawing-source.h"
+#include "glyph-atlas.h"
+#include "stroke-effect.h"
+#include "cpu-raster.h"
 #include <string>
 #include "pthread.h"
 #include "zmath.h"
 #include "graphics/matrix4.h"
 #include "obs.h"
+#include "util/platform.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 
 #define blog(log_level, format, ...)                    \
 	blog(log_level, "[draw_source: '%s'] " format, \
@@ -16,15 +23,11 @@
 #define info(format, ...) blog(LOG_INFO, format, ##__VA_ARGS__)
 #define warn(format, ...) blog(LOG_WARNING, format, ##__VA_ARGS__)
 
-enum draw_type {
-    DRAW_NONE = 0,
-    DRAW_PEN = 1,
-    DRAW_CIRCLE = 2,
-    DRAW_RECT = 3,
-    DRAW_LINE = 4,
-    DRAW_TEXT = 9,
-    DRAW_CLEAR = 10,
-};
+#ifdef _WIN32
+#define DEFAULT_TEXT_FONT "C:/Windows/Fonts/arial.ttf"
+#else
+#define DEFAULT_TEXT_FONT "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
+#endif
 
 static bool draw_info_changed(void *data, obs_properties_t *props)
 {
@@ -233,10 +236,18 @@ static void mis_get_last_line_end_point(draw_line_t *line, z_point *r_1_3, z_poi
     }
 }
 
-static void mis_setup_line(draw_line_t *line)
+/* Triangle strip vertices of a line segment; returns how many, up to 6. */
+static int mis_line_vertices(draw_line_t *line, z_point *out)
 {
     if (line->base.width <= 0)
-        return;
+        return 0;
+
+    int count = 0;
+    const auto vertex = [&](float x, float y) {
+        out[count].x = x;
+        out[count].y = y;
+        count++;
+    };
 
     line->base.buf = NULL;
     bool is_x_equal = line->start_x == line->end_x;
@@ -291,16 +302,16 @@ static void mis_setup_line(draw_line_t *line)
         float x3 = (float)(y3 - b2_2) / k2;
         float x4 = (float)(y4 - b2_2) / k2;
 
-        gs_vertex2f(x2, y2);
-        gs_vertex2f(x1, y1);
-        gs_vertex2f(x3, y3);
-        gs_vertex2f(x2, y2);
-        gs_vertex2f(x3, y3);
-        gs_vertex2f(x4, y4);
+        vertex(x2, y2);
+        vertex(x1, y1);
+        vertex(x3, y3);
+        vertex(x2, y2);
+        vertex(x3, y3);
+        vertex(x4, y4);
 
     }
     else if (is_x_equal && is_y_equal) {
-        gs_vertex2f(line->start_x, line->end_x);
+        vertex(line->start_x, line->end_x);
     }
     else if (is_x_equal) {
         float x_start = (float)line->start_x - (float)line->base.width / 2;
@@ -310,10 +321,10 @@ static void mis_setup_line(draw_line_t *line)
         if (y_start > y_end)
             mis_swapf(&y_start, &y_end);
 
-        gs_vertex2f(x_start, y_end);
-        gs_vertex2f(x_start, y_start);
-        gs_vertex2f(x_end, y_end);
-        gs_vertex2f(x_end, y_start);
+        vertex(x_start, y_end);
+        vertex(x_start, y_start);
+        vertex(x_end, y_end);
+        vertex(x_end, y_start);
     }
     else if (is_y_equal) {
         float x_start = line->start_x;
@@ -323,351 +334,2374 @@ static void mis_setup_line(draw_line_t *line)
         if (x_start > x_end)
             mis_swapf(&x_start, &x_end);
 
-        gs_vertex2f(x_start, y_end);
-        gs_vertex2f(x_start, y_start);
-        gs_vertex2f(x_end, y_end);
-        gs_vertex2f(x_end, y_start);
+        vertex(x_start, y_end);
+        vertex(x_start, y_start);
+        vertex(x_end, y_end);
+        vertex(x_end, y_start);
 
     }
+    return count;
 }
 
-static void mis_setup_rectangle(draw_rect_t *rect)
+static void mis_setup_line(draw_line_t *line)
 {
-    int width_ex = rect->base.width / 2;
-    draw_line_t line;
-
-    line.base.rgba = rect->base.rgba;
-    line.base.width = rect->base.width;
-    line.start_x = rect->x - width_ex;
-    line.start_y = rect->y;
-    line.end_x = rect->x + rect->width + width_ex;
-    line.end_y = rect->y;
-    z_point leftTopPoint;
-    z_point rightTopPoint;
-    z_point leftBottomPoint;
-    z_point rightBottomPoint;
+    z_point vertices[6];
+    const int count = mis_line_vertices(line, vertices);
+    for (int i = 0; i < count; i++)
+        gs_vertex2f(vertices[i].x, vertices[i].y);
+}
 
-    leftTopPoint.x = line.start_x;
-    leftTopPoint.y = line.start_y;
-    rightTopPoint.x = line.start_x + rect->width;
-    rightTopPoint.y = line.start_y;
-    leftBottomPoint.x = line.start_x;
-    leftBottomPoint.y = line.start_y + rect->height;
-    rightBottomPoint.x = line.start_x + rect->width;
-    rightBottomPoint.y = line.start_y + rect->height;
+static void mis_draw_rectangle(gs_drawing_texture *texture)
+{
+    const draw_rect_t *rect = &texture->rect;
+
+    texture->shapes.Reset();
+    texture->shapes.AddRect(static_cast<float>(rect->x)
+        , static_cast<float>(rect->y)
+        , static_cast<float>(rect->x + rect->width)
+        , static_cast<float>(rect->y + rect->height)
+        , 0.0f, static_cast<float>(std::max(rect->base.width, 1)), false);
+    texture->shapes.Draw();
+}
 
-    z_point p1_1, p1_2, p1_3, p1_4;
-    p1_1.x = leftTopPoint.x - width_ex;
-    p1_1.y = leftTopPoint.y - width_ex;
-    p1_2.x = leftTopPoint.x + width_ex;
-    p1_2.y = leftTopPoint.y - width_ex;
-    p1_3.x = leftTopPoint.x + width_ex;
-    p1_3.y = leftTopPoint.y + width_ex;
-    p1_4.x = leftTopPoint.x - width_ex;
-    p1_4.y = leftTopPoint.y + width_ex;
+/* Outline of the ellipse inscribed in the dragged box. */
+static void mis_draw_ellipse(gs_drawing_texture *texture)
+{
+    const draw_point_t *point = &texture->point;
+
+    texture->shapes.Reset();
+    texture->shapes.AddEllipse(static_cast<float>(point->x)
+        , static_cast<float>(point->y)
+        , static_cast<float>(point->x + point->width)
+        , static_cast<float>(point->y + point->height)
+        , static_cast<float>(std::max(point->line_width, 1)), false);
+    texture->shapes.Draw();
+}
 
-    z_point p2_1, p2_2, p2_3, p2_4;
-    p2_1.x = rightTopPoint.x - width_ex;
-    p2_1.y = rightTopPoint.y - width_ex;
-    p2_2.x = rightTopPoint.x + width_ex;
-    p2_2.y = rightTopPoint.y - width_ex;
-    p2_3.x = rightTopPoint.x + width_ex;
-    p2_3.y = rightTopPoint.y + width_ex;
-    p2_4.x = rightTopPoint.x - width_ex;
-    p2_4.y = rightTopPoint.y + width_ex;
+static void mis_rgba_to_vec4(uint32_t rgba, vec4 *out)
+{
+    vec4_set(out, (float)mis_get_rgba_r(rgba) / 0xff,
+        (float)mis_get_rgba_g(rgba) / 0xff,
+        (float)mis_get_rgba_b(rgba) / 0xff,
+        (float)mis_get_rgba_a(rgba) / 0xff);
+}
 
-    z_point p3_1, p3_2, p3_3, p3_4;
-    p3_1.x = rightBottomPoint.x - width_ex;
-    p3_1.y = rightBottomPoint.y - width_ex;
-    p3_2.x = rightBottomPoint.x + width_ex;
-    p3_2.y = rightBottomPoint.y - width_ex;
-    p3_3.x = rightBottomPoint.x + width_ex;
-    p3_3.y = rightBottomPoint.y + width_ex;
-    p3_4.x = rightBottomPoint.x - width_ex;
-    p3_4.y = rightBottomPoint.y + width_ex;
+static z_point canvas_fraction(float x, float y, uint32_t width, uint32_t height)
+{
+    z_point p;
+    p.x = x / static_cast<float>(width);
+    p.y = y / static_cast<float>(height);
+    return p;
+}
 
-    z_point p4_1, p4_2, p4_3, p4_4;
-    p4_1.x = leftBottomPoint.x - width_ex;
-    p4_1.y = leftBottomPoint.y - width_ex;
-    p4_2.x = leftBottomPoint.x + width_ex;
-    p4_2.y = leftBottomPoint.y - width_ex;
-    p4_3.x = leftBottomPoint.x + width_ex;
-    p4_3.y = leftBottomPoint.y + width_ex;
-    p4_4.x = leftBottomPoint.x - width_ex;
-    p4_4.y = leftBottomPoint.y + width_ex;
-    z_point points[16];
-    points[0] = p1_1; points[1] = p1_2; points[2] = p1_3; points[3] = p1_4;
-    points[4] = p2_1; points[5] = p2_2; points[6] = p2_3; points[7] = p2_4;
-    points[8] = p3_1; points[9] = p3_2; points[10] = p3_3; points[11] = p3_4;
-    points[12] = p4_1; points[13] = p4_2; points[14] = p4_3; points[15] = p4_4;
+/* Top left of the view in zoomed page pixels, on whole pixels so tiles stay sharp. */
+static void view_origin(const gs_drawing_texture *texture, float &x, float &y)
+{
+    x = std::round(texture->view.x * texture->view.zoom);
+    y = std::round(texture->view.y * texture->view.zoom);
+}
 
-    gs_vertex2f(p1_1.x, p1_1.y); gs_vertex2f(p1_2.x, p1_2.y); gs_vertex2f(p1_4.x, p1_4.y);
+/* The page point under a point of the view, in page pixels. */
+static z_point page_point(const gs_drawing_texture *texture, float x, float y)
+{
+    float origin_x, origin_y;
+    view_origin(texture, origin_x, origin_y);
+    z_point p;
+    p.x = (x + origin_x) / texture->view.zoom;
+    p.y = (y + origin_y) / texture->view.zoom;
+    return p;
+}
 
-    gs_vertex2f(p1_2.x, p1_2.y); gs_vertex2f(p1_4.x, p1_4.y); gs_vertex2f(p1_3.x, p1_3.y);
+/* A point of the view as a fraction of the canvas, on the page under it. */
+static z_point page_fraction(const gs_drawing_texture *texture, float x, float y,
+    uint32_t width, uint32_t height)
+{
+    const z_point p = page_point(texture, x, y);
+    return canvas_fraction(p.x, p.y, width, height);
+}
 
-    gs_vertex2f(p1_2.x, p1_2.y);	gs_vertex2f(p1_3.x, p1_3.y); gs_vertex2f(p2_1.x, p2_1.y);
+/* Maps page pixels into the view, to draw page content into the page target. */
+static void push_view(const gs_drawing_texture *texture)
+{
+    float origin_x, origin_y;
+    view_origin(texture, origin_x, origin_y);
+    gs_matrix_push();
+    gs_matrix_scale3f(texture->view.zoom, texture->view.zoom, 1.0f);
+    gs_matrix_translate3f(-origin_x / texture->view.zoom, -origin_y / texture->view.zoom, 0.0f);
+}
 
-    gs_vertex2f(p2_1.x, p2_1.y); gs_vertex2f(p1_3.x, p1_3.y); gs_vertex2f(p2_4.x, p2_4.y);
+/* Adds the pen segment about to be drawn to the stroke being recorded. */
+static void record_pen_segment(SourceManager *context, gs_drawing_texture *texture)
+{
+    const auto [width, height] = context->GetCanvasSize();
+    if (!width || !height)
+        return;
 
-    gs_vertex2f(p2_1.x, p2_1.y);	gs_vertex2f(p2_4.x, p2_4.y); gs_vertex2f(p2_2.x, p2_2.y);
+    const z_point start = page_fraction(texture, static_cast<float>(texture->line.start_x)
+        , static_cast<float>(texture->line.start_y), width, height);
+    const z_point end = page_fraction(texture, static_cast<float>(texture->line.end_x)
+        , static_cast<float>(texture->line.end_y), width, height);
 
-    gs_vertex2f(p2_2.x, p2_2.y);	gs_vertex2f(p2_4.x, p2_4.y); gs_vertex2f(p2_3.x, p2_3.y);
+    auto &points = texture->stroke.points;
+    if (points.empty() || points.back().x != start.x || points.back().y != start.y)
+        points.push_back(start);
+    points.push_back(end);
+}
 
-    gs_vertex2f(p2_3.x, p2_3.y);	gs_vertex2f(p2_4.x, p2_4.y); gs_vertex2f(p2_1.x, p2_1.y);
+static uint32_t tile_count(uint32_t size)
+{
+    return (size + PAGE_TILE_SIZE - 1) / PAGE_TILE_SIZE;
+}
 
-    gs_vertex2f(p2_3.x, p2_3.y);	gs_vertex2f(p2_4.x, p2_4.y); gs_vertex2f(p3_1.x, p3_1.y);
+/* Marks the tiles under a rectangle of the page, in pixels, as inked. */
+static void mark_ink(gs_drawing_texture *texture, float x0, float y0, float x1, float y1)
+{
+    const uint32_t columns = tile_count(texture->width);
+    const uint32_t rows = tile_count(texture->height);
+    texture->ink.resize(static_cast<size_t>(columns) * rows);
+    if (texture->ink.empty() || x1 <= 0.0f || y1 <= 0.0f || x0 >= static_cast<float>(texture->width)
+        || y0 >= static_cast<float>(texture->height))
+        return;
 
-    gs_vertex2f(p2_3.x, p2_3.y);	gs_vertex2f(p3_1.x, p3_1.y); gs_vertex2f(p3_2.x, p3_2.y);
+    const uint32_t tx0 = static_cast<uint32_t>(std::max(x0, 0.0f)) / PAGE_TILE_SIZE;
+    const uint32_t ty0 = static_cast<uint32_t>(std::max(y0, 0.0f)) / PAGE_TILE_SIZE;
+    const uint32_t tx1 = std::min(static_cast<uint32_t>(x1) / PAGE_TILE_SIZE, columns - 1);
+    const uint32_t ty1 = std::min(static_cast<uint32_t>(y1) / PAGE_TILE_SIZE, rows - 1);
+    for (uint32_t ty = ty0; ty <= ty1; ty++) {
+        for (uint32_t tx = tx0; tx <= tx1; tx++)
+            texture->ink[static_cast<size_t>(ty) * columns + tx] = true;
+    }
+}
 
-    gs_vertex2f(p3_2.x, p3_2.y); gs_vertex2f(p3_1.x, p3_1.y); gs_vertex2f(p3_3.x, p3_3.y);
+/*
+ * Bounds of what a command draws on a canvas of width x height, in page
+ * pixels as x0, y0, x1, y1.  False when it draws nothing, and for a clear.
+ */
+static bool command_bounds(SourceManager *context, const draw_command &command,
+    uint32_t canvas_width, uint32_t canvas_height, float bounds[4])
+{
+    const auto width = static_cast<float>(canvas_width);
+    const auto height = static_cast<float>(canvas_height);
+    if (command.type == DRAW_CLEAR || command.points.empty())
+        return false;
 
-    gs_vertex2f(p3_1.x, p3_1.y); gs_vertex2f(p3_4.x, p3_4.y); gs_vertex2f(p3_3.x, p3_3.y);
+    if (command.type == DRAW_TEXT) {
+        GlyphAtlas *atlas = context->GetGlyphAtlas().get();
+        if (!atlas)
+            return false;
+
+        std::vector<glyph_quad> quads;
+        atlas->BuildQuads(command.text, command.points[0].x * width, command.points[0].y * height
+            , static_cast<uint32_t>(std::lround(command.size * height)), quads);
+        if (quads.empty())
+            return false;
+
+        bounds[0] = quads[0].x0;
+        bounds[1] = quads[0].y0;
+        bounds[2] = quads[0].x1;
+        bounds[3] = quads[0].y1;
+        for (const auto &quad : quads) {
+            bounds[0] = std::min(bounds[0], quad.x0);
+            bounds[1] = std::min(bounds[1], quad.y0);
+            bounds[2] = std::max(bounds[2], quad.x1);
+            bounds[3] = std::max(bounds[3], quad.y1);
+        }
+        return true;
+    }
 
-    gs_vertex2f(p3_1.x, p3_1.y); gs_vertex2f(p4_2.x, p4_2.y); gs_vertex2f(p3_4.x, p3_4.y);
+    // the stroke and its anti-aliased edge
+    const float pad = std::max(command.size * height, 1.0f) * 0.5f + 2.0f;
+    float x0 = command.points[0].x, y0 = command.points[0].y;
+    float x1 = x0, y1 = y0;
+    for (const auto &point : command.points) {
+        x0 = std::min(x0, point.x);
+        y0 = std::min(y0, point.y);
+        x1 = std::max(x1, point.x);
+        y1 = std::max(y1, point.y);
+    }
+    bounds[0] = x0 * width - pad;
+    bounds[1] = y0 * height - pad;
+    bounds[2] = x1 * width + pad;
+    bounds[3] = y1 * height + pad;
+    return true;
+}
 
-    gs_vertex2f(p3_4.x, p3_4.y); gs_vertex2f(p4_2.x, p4_2.y); gs_vertex2f(p4_3.x, p4_3.y);
+/* Marks the tiles a committed command can have drawn on. */
+static void mark_command_ink(SourceManager *context, gs_drawing_texture *texture, const draw_command &command)
+{
+    if (command.type == DRAW_CLEAR) {
+        std::fill(texture->ink.begin(), texture->ink.end(), false);
+        return;
+    }
 
-    gs_vertex2f(p4_2.x, p4_2.y); gs_vertex2f(p4_4.x, p4_4.y); gs_vertex2f(p4_3.x, p4_3.y);
+    float bounds[4];
+    if (command_bounds(context, command, texture->width, texture->height, bounds))
+        mark_ink(texture, bounds[0], bounds[1], bounds[2], bounds[3]);
+}
 
-    gs_vertex2f(p4_1.x, p4_1.y); gs_vertex2f(p4_4.x, p4_4.y); gs_vertex2f(p4_2.x, p4_2.y);
+static index_rect empty_rect()
+{
+    return { 0.0f, 0.0f, -1.0f, -1.0f };
+}
 
-    gs_vertex2f(p4_1.x, p4_1.y);  gs_vertex2f(p4_2.x, p4_2.y); gs_vertex2f(p1_3.x, p1_3.y);
+static void grow_rect(index_rect &rect, const index_rect &other)
+{
+    if (other.x1 < other.x0)
+        return;
+    if (rect.x1 < rect.x0) {
+        rect = other;
+        return;
+    }
+    rect.x0 = std::min(rect.x0, other.x0);
+    rect.y0 = std::min(rect.y0, other.y0);
+    rect.x1 = std::max(rect.x1, other.x1);
+    rect.y1 = std::max(rect.y1, other.y1);
+}
 
-    gs_vertex2f(p1_4.x, p1_4.y);  gs_vertex2f(p4_1.x, p4_1.y); gs_vertex2f(p1_3.x, p1_3.y);
+/* Brings the stroke index of a page up to its history. */
+static void sync_index(SourceManager *context, gs_drawing_texture *texture)
+{
+    StrokeIndex &index = texture->index;
+    const PageHistory &history = texture->history;
+    if (!index.Matches(texture->width, texture->height, history.Generation()))
+        index.Reset(texture->width, texture->height, history.Generation());
+
+    const auto &commands = history.Commands();
+    index.Truncate(commands.size());
+    for (size_t i = index.Size(); i < commands.size(); i++) {
+        float bounds[4];
+        if (command_bounds(context, commands[i], texture->width, texture->height, bounds)) {
+            const index_rect rect = { bounds[0], bounds[1], bounds[2], bounds[3] };
+            index.Add(&rect);
+        }
+        else {
+            index.Add(nullptr);
+        }
 
+        for (uint32_t target : commands[i].targets) {
+            if (target && target <= i)
+                index.Erase(i - target, i);
+        }
+    }
+}
 
+/* First of the applied commands that can show, the one after the last clear. */
+static size_t first_shown(const gs_drawing_texture *texture, size_t applied)
+{
+    const auto &commands = texture->history.Commands();
+    for (size_t i = applied; i-- > 0;) {
+        if (commands[i].type == DRAW_CLEAR)
+            return i + 1;
+    }
+    return 0;
 }
 
-static void mis_setup_circle_point(draw_point_t *point)
+/*
+ * Whether a command shows once the first `applied` commands are drawn,
+ * leaving out the ones the eraser is going over.  Index synced.
+ */
+static bool shown(const gs_drawing_texture *texture, size_t index, size_t applied)
 {
-    gs_load_vertexbuffer(point->base.buf);
-    struct matrix4 box;
-    matrix4_identity(&box);
+    return texture->index.Visible(index, applied)
+        && !std::binary_search(texture->erasing.begin(), texture->erasing.end(), static_cast<uint32_t>(index));
+}
 
-    vec4_set(&box.x, 1280, 0, 0, 0);
-    vec4_set(&box.y, 0, 720, 0, 0);
-    vec4_set(&box.z, 0, 0, 0, 0);
-    vec4_set(&box.t, 0, 0, 0, 0);
+static uint64_t world_key(int32_t x, int32_t y)
+{
+    return static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32 | static_cast<uint32_t>(y);
+}
 
+static void release_world_tiles(SourceManager *context, gs_drawing_texture *texture)
+{
+    for (const auto &tile : texture->world.tiles) {
+        if (!tile.second.empty)
+            context->GetTiles().Free(tile.second.slot);
+    }
+    texture->world.tiles.clear();
+}
 
-    struct vec3 pos;
-    vec3_set(&pos, (float)point->x / (float)1280, (float)point->y / (float)720, 0.0f);
-    vec3_transform(&pos, &pos, &box);
-    vec3_mulf(&pos, &pos, 1); //位置
+/*
+ * Drops the tiles of an infinite page over a rectangle of it, in page
+ * pixels, to be drawn again from the commands when next shown.
+ */
+static void invalidate_world_rect(SourceManager *context, gs_drawing_texture *texture, const index_rect &rect)
+{
+    const float scale = texture->world.zoom / static_cast<float>(PAGE_TILE_SIZE);
+    const auto tx0 = static_cast<int32_t>(std::floor(rect.x0 * scale));
+    const auto ty0 = static_cast<int32_t>(std::floor(rect.y0 * scale));
+    const auto tx1 = static_cast<int32_t>(std::floor(rect.x1 * scale));
+    const auto ty1 = static_cast<int32_t>(std::floor(rect.y1 * scale));
+
+    auto &tiles = texture->world.tiles;
+    if (static_cast<int64_t>(tx1 - tx0 + 1) * (ty1 - ty0 + 1) > static_cast<int64_t>(tiles.size())) {
+        for (auto it = tiles.begin(); it != tiles.end();) {
+            const auto x = static_cast<int32_t>(it->first >> 32);
+            const auto y = static_cast<int32_t>(it->first & 0xFFFFFFFF);
+            if (x < tx0 || x > tx1 || y < ty0 || y > ty1) {
+                ++it;
+                continue;
+            }
+            if (!it->second.empty)
+                context->GetTiles().Free(it->second.slot);
+            it = tiles.erase(it);
+        }
+        return;
+    }
 
-    //for (int i = 0; i < circle->line_width; i++)
-    //{
-    //	gs_matrix_push();
-    //	gs_matrix_translate(&pos);
-    //	gs_matrix_scale3f(circle->width / 2 + i, circle->width / 2 + i, 1.0f);
-    //	gs_draw(GS_LINESTRIP, 0, 0);
-    //	gs_matrix_pop();
-    //}
+    for (int32_t y = ty0; y <= ty1; y++) {
+        for (int32_t x = tx0; x <= tx1; x++) {
+            const auto find_item = tiles.find(world_key(x, y));
+            if (find_item == tiles.end())
+                continue;
+            if (!find_item->second.empty)
+                context->GetTiles().Free(find_item->second.slot);
+            tiles.erase(find_item);
+        }
+    }
+}
 
+/*
+ * Drops the tiles of an infinite page the command at a place of its history
+ * drew on, or an erase took commands off.  The page target already has it.
+ */
+static void invalidate_world(SourceManager *context, gs_drawing_texture *texture, const draw_command &command,
+    size_t position)
+{
+    if (command.type == DRAW_ERASE) {
+        sync_index(context, texture);
+        index_rect region = empty_rect();
+        for (uint32_t target : command.targets) {
+            if (target && target <= position)
+                grow_rect(region, texture->index.Bounds(position - target));
+        }
+        if (region.x0 <= region.x1)
+            invalidate_world_rect(context, texture, region);
+        return;
+    }
 
-    for (int i = 0; i < point->line_width * 2; i++) {
-        gs_matrix_push();
-        gs_matrix_translate(&pos);
-        gs_matrix_scale3f(point->width / 2 + i * 0.5, point->width / 2 + i * 0.5, 1.0f);
-        gs_draw(GS_LINESTRIP, 0, 0);
-        gs_matrix_pop();
+    float bounds[4];
+    if (!command_bounds(context, command, texture->width, texture->height, bounds)) {
+        if (command.type == DRAW_CLEAR)
+            release_world_tiles(context, texture);
+        return;
     }
+    invalidate_world_rect(context, texture, { bounds[0], bounds[1], bounds[2], bounds[3] });
+}
+
+/* Replaces the lasso selection of a page, telling the host when it changed. */
+static void set_selection(SourceManager *context, gs_drawing_texture *texture, std::vector<uint32_t> &&selection)
+{
+    if (selection.empty() && texture->selection.empty())
+        return;
 
+    texture->selection = std::move(selection);
+    texture->selection_generation = texture->history.Generation();
 
+    calldata_t cd;
+    calldata_init(&cd);
+    calldata_set_ptr(&cd, "source", context->source);
+    calldata_set_int(&cd, "count", static_cast<long long>(texture->selection.size()));
+    signal_handler_signal(obs_source_get_signal_handler(context->source), "selection_changed", &cd);
+    calldata_free(&cd);
 }
 
-
-static const char *draw_source_get_name(void *unused)
+/* Adds a command drawn into the page to its history and the journal. */
+static void commit_command(SourceManager *context, gs_drawing_texture *texture, draw_command &&command)
 {
-    UNUSED_PARAMETER(unused);
-    return obs_module_text("DrawingInput");
+    if (texture->infinite)
+        invalidate_world(context, texture, command, texture->history.Applied());
+    else
+        mark_command_ink(context, texture, command);
+    context->LogOperation(JOURNAL_PUSH, &command);
+
+    // the commands that could have been redone go from the index as well
+    texture->index.Truncate(texture->history.Applied());
+    texture->strokes.Truncate(texture->history.Applied());
+    texture->history.Push(std::move(command));
+    texture->revision++;
+    set_selection(context, texture, {});
 }
 
-static void *draw_source_create(obs_data_t *settings, obs_source_t *source)
+/* Records the line, rectangle or ellipse left by the last preview. */
+static void record_shape(SourceManager *context, gs_drawing_texture *texture, draw_type type)
 {
-    UNUSED_PARAMETER(settings);
-    const auto context = new SourceManager(source);
-    return context;
+    const auto [width, height] = context->GetCanvasSize();
+    if (!width || !height)
+        return;
+
+    int32_t x0, y0, x1, y1, stroke;
+    if (type == DRAW_LINE) {
+        x0 = texture->line.start_x;
+        y0 = texture->line.start_y;
+        x1 = texture->line.end_x;
+        y1 = texture->line.end_y;
+        stroke = texture->line.base.width;
+    }
+    else if (type == DRAW_RECT) {
+        x0 = texture->rect.x;
+        y0 = texture->rect.y;
+        x1 = x0 + texture->rect.width;
+        y1 = y0 + texture->rect.height;
+        stroke = texture->rect.base.width;
+    }
+    else {
+        x0 = texture->point.x;
+        y0 = texture->point.y;
+        x1 = x0 + texture->point.width;
+        y1 = y0 + texture->point.height;
+        stroke = texture->point.line_width;
+    }
+
+    // nothing was drawn without a drag
+    if (x0 == x1 && y0 == y1)
+        return;
+
+    draw_command command;
+    command.type = type;
+    command.color = texture->line.base.rgba;
+    command.size = static_cast<float>(stroke) / static_cast<float>(height) / texture->view.zoom;
+    command.points.push_back(page_fraction(texture, static_cast<float>(x0), static_cast<float>(y0), width, height));
+    command.points.push_back(page_fraction(texture, static_cast<float>(x1), static_cast<float>(y1), width, height));
+    commit_command(context, texture, std::move(command));
 }
 
-static void draw_source_update(void *data, obs_data_t *settings)
+static draw_line_t polyline_line(const draw_command &command, uint32_t height)
 {
-    auto *context = (SourceManager *)data;
+    draw_line_t line = {};
+    line.base.rgba = command.color;
+    line.base.width = std::max(static_cast<int32_t>(std::lround(command.size * static_cast<float>(height))), 1);
+    return line;
+}
 
-    if (!context)
-        return;
+static void polyline_segment(const draw_command &command, size_t i, uint32_t width, uint32_t height,
+    draw_line_t &line)
+{
+    line.start_x = static_cast<int32_t>(std::lround(command.points[i - 1].x * static_cast<float>(width)));
+    line.start_y = static_cast<int32_t>(std::lround(command.points[i - 1].y * static_cast<float>(height)));
+    line.end_x = static_cast<int32_t>(std::lround(command.points[i].x * static_cast<float>(width)));
+    line.end_y = static_cast<int32_t>(std::lround(command.points[i].y * static_cast<float>(height)));
+}
 
-    struct obs_video_info ovi;
-    if (obs_get_video_info(&ovi))
-        context->UpdateCanvasSize(ovi.base_width, ovi.base_height);
+/* The segment of the line as capsule triangles for the stroke effect. */
+static size_t line_segment(const draw_line_t *line, stroke_vertex *out)
+{
+    return stroke_segment(static_cast<float>(line->start_x), static_cast<float>(line->start_y)
+        , static_cast<float>(line->end_x), static_cast<float>(line->end_y)
+        , static_cast<float>(line->base.width), out);
+}
 
-    std::string key = obs_data_get_string(settings, "key");
-    if (!context->HasKey(key)) {
-        if (!context->AddKey(key))
-            return;
+/*
+ * Draws a segment of the line through immediate mode, for GS_TRISTRIP, or
+ * adds its capsule to vertices for the stroke effect.
+ */
+static void emit_segment(draw_line_t *line, std::vector<stroke_vertex> *vertices)
+{
+    if (!vertices) {
+        mis_setup_line(line);
+        return;
     }
-    context->SetCurrentKey(key);
 
-    draw_info_changed(data, context->props);
+    stroke_vertex segment[STROKE_SEGMENT_VERTICES];
+    vertices->insert(vertices->end(), segment, segment + line_segment(line, segment));
 }
 
-static void draw_source_show(void *data)
+/* The capsules of every segment of a pen or line. */
+static void polyline_vertices(const draw_command &command, uint32_t width, uint32_t height,
+    std::vector<stroke_vertex> &vertices)
 {
-    UNUSED_PARAMETER(data);
+    vertices.reserve(vertices.size() + (command.points.size() - 1) * STROKE_SEGMENT_VERTICES);
+    draw_line_t line = polyline_line(command, height);
+    for (size_t i = 1; i < command.points.size(); i++) {
+        polyline_segment(command, i, width, height, line);
+        emit_segment(&line, &vertices);
+    }
 }
 
-static void draw_source_hide(void *data)
+static void replay_polyline(const draw_command &command, uint32_t width, uint32_t height, bool smooth)
 {
-    UNUSED_PARAMETER(data);
+    if (smooth) {
+        std::vector<stroke_vertex> vertices;
+        polyline_vertices(command, width, height, vertices);
+        stroke_draw(vertices.data(), vertices.size());
+        return;
+    }
+
+    // immediate mode holds 512 vertices, six per segment
+    const size_t segments_per_batch = 80;
+
+    draw_line_t line = polyline_line(command, height);
+
+    gs_render_start(true);
+    for (size_t i = 1; i < command.points.size(); i++) {
+        if (i % segments_per_batch == 0) {
+            gs_render_stop(GS_TRISTRIP);
+            gs_render_start(true);
+        }
+
+        polyline_segment(command, i, width, height, line);
+        emit_segment(&line, nullptr);
+    }
+    gs_render_stop(GS_TRISTRIP);
 }
 
-static uint32_t draw_source_get_width(void *data)
+/*
+ * Draws the pen or line at a place of the page history from its cached
+ * vertex buffer, building it from all the segments the first time.
+ * Inside a pass of the stroke effect.
+ */
+static bool replay_cached_polyline(gs_drawing_texture *texture, const draw_command &command, size_t position)
 {
-    UNUSED_PARAMETER(data);
-    obs_video_info ovi;
-    if (obs_get_video_info(&ovi))
-        return ovi.base_width;
+    StrokeCache &strokes = texture->strokes;
+    const PageHistory &history = texture->history;
+    if (!strokes.Matches(texture->width, texture->height, history.Generation()))
+        strokes.Reset(texture->width, texture->height, history.Generation());
+    strokes.Truncate(history.Commands().size());
+
+    if (strokes.Draw(position))
+        return true;
+
+    std::vector<stroke_vertex> vertices;
+    polyline_vertices(command, texture->width, texture->height, vertices);
+    return strokes.Store(position, vertices);
+}
+
+// replayed commands that are not in the page history
+#define NOT_IN_HISTORY SIZE_MAX
 
-    return -1;
+/* Bounds of the capsules of a pen or line, in target pixels. */
+static void polyline_bounds(const draw_command &command, uint32_t width, uint32_t height, float bounds[4])
+{
+    const draw_line_t line = polyline_line(command, height);
+    const float reach = stroke_reach(static_cast<float>(line.base.width));
+
+    bounds[0] = bounds[1] = FLT_MAX;
+    bounds[2] = bounds[3] = -FLT_MAX;
+    for (const auto &point : command.points) {
+        const float x = static_cast<float>(std::lround(point.x * static_cast<float>(width)));
+        const float y = static_cast<float>(std::lround(point.y * static_cast<float>(height)));
+        bounds[0] = std::min(bounds[0], x - reach);
+        bounds[1] = std::min(bounds[1], y - reach);
+        bounds[2] = std::max(bounds[2], x + reach);
+        bounds[3] = std::max(bounds[3], y + reach);
+    }
 }
 
-static uint32_t draw_source_get_height(void *data)
+/*
+ * Draws a pen or line with smooth edges, from the stroke cache when it is
+ * at a place of the history drawn at the page size.  Translucent ones go
+ * through the scratch coverage, so their joints are not inked twice.
+ * Drawn solid when the stroke effect is missing.
+ */
+static void replay_stroke(gs_drawing_texture *texture, const draw_command &command, size_t position,
+    const vec4 *color, uint32_t width, uint32_t height)
 {
-    UNUSED_PARAMETER(data);
-    obs_video_info ovi;
-    if (obs_get_video_info(&ovi))
-        return ovi.base_height;
+    gs_effect_t *effect = stroke_effect();
+    if (!effect) {
+        gs_effect_t *solid = obs_get_base_effect(OBS_EFFECT_SOLID);
+        gs_effect_set_vec4(gs_effect_get_param_by_name(solid, "color"), color);
+        while (gs_effect_loop(solid, "Solid"))
+            replay_polyline(command, width, height, false);
+        return;
+    }
+
+    gs_effect_set_vec4(gs_effect_get_param_by_name(effect, "color"), color);
+
+    gs_blend_state_push();
+    gs_enable_blending(true);
+    gs_blend_function_separate(GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA
+        , GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
+    const bool cached = position != NOT_IN_HISTORY && width == texture->width && height == texture->height;
+    StrokeCoverage &coverage = stroke_scratch();
+    const bool layered = color->w < 1.0f && coverage.Begin(true);
+
+    while (gs_effect_loop(effect, layered ? "Coverage" : "Draw")) {
+        if (!cached || !replay_cached_polyline(texture, command, position))
+            replay_polyline(command, width, height, true);
+    }
+
+    if (layered) {
+        coverage.End();
+
+        float bounds[4];
+        polyline_bounds(command, width, height, bounds);
+        coverage.Composite(color, bounds);
+    }
 
-    return -1;
+    gs_blend_state_pop();
 }
 
-static obs_properties_t *draw_source_properties(void *data)
+/*
+ * Draws a committed blit stretched over its box, blended as when it was
+ * committed.  Blits are few, so the texture is only made for the replay.
+ */
+static void replay_image(const draw_command &command, uint32_t width, uint32_t height)
 {
-    const auto context = reinterpret_cast<SourceManager *>(data);
-
-    if (!context)
-        return nullptr;
+    if (command.points.size() < 2 || !command.image_width || command.pixels.empty())
+        return;
 
-    obs_properties_t *props = obs_properties_create();
-    context->props = props;
+    const float x0 = std::round(command.points[0].x * static_cast<float>(width));
+    const float y0 = std::round(command.points[0].y * static_cast<float>(height));
+    const float x1 = std::round(command.points[1].x * static_cast<float>(width));
+    const float y1 = std::round(command.points[1].y * static_cast<float>(height));
+    if (x1 <= x0 || y1 <= y0)
+        return;
 
-    draw_info_changed(data, props);
+    const auto image_height = static_cast<uint32_t>(command.pixels.size() / command.image_width);
+    const auto *data = reinterpret_cast<const uint8_t *>(command.pixels.data());
+    gs_texture_t *tex = gs_texture_create(command.image_width, image_height, GS_RGBA, 1, &data, 0);
+    if (!tex)
+        return;
 
-    return props;
+    gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+    gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), tex);
+
+    gs_blend_state_push();
+    gs_enable_blending(true);
+    gs_blend_function_separate(GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA
+        , GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+    gs_matrix_push();
+    gs_matrix_translate3f(x0, y0, 0.0f);
+    while (gs_effect_loop(effect, "Draw"))
+        gs_draw_sprite(tex, 0, static_cast<uint32_t>(x1 - x0), static_cast<uint32_t>(y1 - y0));
+    gs_matrix_pop();
+    gs_blend_state_pop();
+
+    gs_texture_destroy(tex);
 }
 
-static void draw_source_render(void *data, gs_effect_t *effect, bool is_display)
+/*
+ * Draws a committed command into the current target.  Strokes at a place
+ * of the history drawn at the page size come from the stroke cache.
+ */
+static void replay_command(SourceManager *context, gs_drawing_texture *texture,
+    const draw_command &command, size_t position, uint32_t width, uint32_t height)
 {
-    const auto context = reinterpret_cast<SourceManager *>(data);
-    if (!context)
+    if (command.type == DRAW_CLEAR) {
+        vec4 clear_color;
+        vec4_set(&clear_color, 1.0, 1.0, 1.0, 0.0);
+        gs_clear(GS_CLEAR_COLOR, &clear_color, 1.0f, 0);
         return;
+    }
 
-    const auto texture = context->GetCurrentPageTexture();
-    if (!texture)
+    if (command.type == DRAW_TEXT) {
+        text_draw(context->GetGlyphAtlas().get(), command, width, height);
         return;
+    }
 
-    gs_texrender_reset(texture->texrender);
-    gs_technique_t *tech = gs_effect_get_technique(effect, "Draw");
-    gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
-    size_t      passes;
-    gs_texture_t *tex = !texture->render_text ? gs_texrender_get_texture(texture->texrender) : texture->image_texture;
-    gs_effect_set_texture(image, tex);
-    passes = gs_technique_begin(tech);
-    for (size_t i = 0; i < passes; i++) {
-        if (gs_technique_begin_pass(tech, i)) {
-            gs_draw_sprite(tex
-                , 0
-                , std::get<0>(context->GetCanvasSize())
-                , std::get<1>(context->GetCanvasSize()));
-            gs_technique_end_pass(tech);
-        }
+    if (command.type == DRAW_IMAGE) {
+        replay_image(command, width, height);
+        return;
     }
-    gs_technique_end(tech);
+
+    if (command.points.size() < 2)
+        return;
+
+    vec4 color;
+    mis_rgba_to_vec4(command.color, &color);
+    if (command.type == DRAW_PEN || command.type == DRAW_LINE) {
+        replay_stroke(texture, command, position, &color, width, height);
+        return;
+    }
+
+    gs_effect_t *solid = obs_get_base_effect(OBS_EFFECT_SOLID);
+    gs_effect_set_vec4(gs_effect_get_param_by_name(solid, "color"), &color);
+
+    const float x0 = command.points[0].x * static_cast<float>(width);
+    const float y0 = command.points[0].y * static_cast<float>(height);
+    const float x1 = command.points[1].x * static_cast<float>(width);
+    const float y1 = command.points[1].y * static_cast<float>(height);
+    const float stroke = std::max(command.size * static_cast<float>(height), 1.0f);
+
+    texture->shapes.Reset();
+    if (command.type == DRAW_RECT)
+        texture->shapes.AddRect(x0, y0, x1, y1, 0.0f, stroke, false);
+    else if (command.type == DRAW_CIRCLE)
+        texture->shapes.AddEllipse(x0, y0, x1, y1, stroke, false);
+
+    while (gs_effect_loop(solid, "Solid"))
+        texture->shapes.Draw();
 }
 
-static void draw_source_tick(void *data, float seconds)
+/*
+ * Draws the nearest checkpoint, or the base of the page, into the current
+ * target.  Returns the number of commands it already contains.
+ */
+static size_t restore_page(gs_drawing_texture *texture, uint32_t width, uint32_t height)
 {
-    return;
+    vec4 clear_color;
+    vec4_set(&clear_color, 1.0, 1.0, 1.0, 0.0);
+    gs_clear(GS_CLEAR_COLOR, &clear_color, 1.0f, 0);
+
+    const page_checkpoint *checkpoint = texture->history.Nearest();
+    gs_texture_t *tex = checkpoint ? checkpoint->texture : texture->history.Base();
+    if (tex) {
+        gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+        gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), tex);
+
+        gs_blend_state_push();
+        gs_enable_blending(false);
+        while (gs_effect_loop(effect, "Draw"))
+            gs_draw_sprite(tex, 0, width, height);
+        gs_blend_state_pop();
+    }
+
+    return checkpoint ? checkpoint->index : 0;
 }
 
-static void draw_source_destroy(void *data)
+/* Copies the page into a checkpoint of its first index commands. */
+static void capture_checkpoint(gs_drawing_texture *texture, size_t index)
 {
-    const auto context = (SourceManager *)data;
+    gs_texture_t *target = gs_texrender_get_texture(texture->texrender);
+    if (!target)
+        return;
 
-    delete context;
+    gs_texture_t *copy = gs_texture_create(gs_texture_get_width(target)
+        , gs_texture_get_height(target), GS_RGBA, 1, nullptr, 0);
+    if (!copy)
+        return;
+
+    gs_copy_texture(copy, target);
+    texture->history.AddCheckpoint(copy, index);
 }
 
-OBS_DECLARE_MODULE()
-OBS_MODULE_USE_DEFAULT_LOCALE("drawing-source", "en-US")
-MODULE_EXPORT const char *obs_module_description(void)
+/* Gives the tiles of a page back to the atlas. */
+static void release_tiles(SourceManager *context, gs_drawing_texture *texture)
 {
-    return "drawing source";
+    for (const auto &tile : texture->tiles)
+        context->GetTiles().Free(tile.second);
+    texture->tiles.clear();
+    texture->parked = false;
 }
 
-static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool pressed, bool moving, bool released, uint32_t color, int shapeType, int size)
+/* The tiles of a page as (atlas, tile index), grouped by atlas. */
+static std::vector<std::pair<uint32_t, uint32_t>> tiles_by_atlas(const gs_drawing_texture *texture)
 {
-    if (!data)
-        return;
-
-    const auto context = reinterpret_cast<SourceManager *>(data);
+    std::vector<std::pair<uint32_t, uint32_t>> order;
+    order.reserve(texture->tiles.size());
+    for (const auto &tile : texture->tiles)
+        order.emplace_back(tile.second.atlas, tile.first);
+    std::sort(order.begin(), order.end());
+    return order;
+}
 
-    gs_effect_t *solid = obs_get_base_effect(OBS_EFFECT_SOLID);
+struct tile_quad {
+    tile_slot slot;
+    float x;
+    float y;
+    uint32_t width;
+    uint32_t height;
+};
 
-    gs_eparam_t *effectcolor = gs_effect_get_param_by_name(solid, "color");
-    gs_technique_t *tech = gs_effect_get_technique(solid, "Solid");
+/*
+ * Draws tiles at their places, inside a pass of an effect with the given
+ * image parameter, in one batch per atlas.
+ */
+static void draw_tile_quads(SourceManager *context, std::vector<tile_quad> &quads, gs_eparam_t *image)
+{
+    // immediate mode holds 512 vertices, six per tile
+    const size_t tiles_per_batch = 80;
+    const float scale = 1.0f / static_cast<float>(TILE_ATLAS_SIZE);
+
+    std::sort(quads.begin(), quads.end(), [](const tile_quad &a, const tile_quad &b) {
+        return a.slot.atlas < b.slot.atlas;
+    });
+
+    for (size_t i = 0; i < quads.size();) {
+        size_t end = i;
+        while (end < quads.size() && quads[end].slot.atlas == quads[i].slot.atlas)
+            end++;
+
+        gs_texture_t *tex = context->GetTiles().GetTexture(quads[i].slot.atlas);
+        if (tex) {
+            gs_effect_set_texture(image, tex);
+            for (size_t batch = i; batch < end; batch += tiles_per_batch) {
+                gs_render_start(true);
+                for (size_t j = batch; j < std::min(end, batch + tiles_per_batch); j++) {
+                    const tile_quad &quad = quads[j];
+                    const float x0 = quad.x;
+                    const float y0 = quad.y;
+                    const float x1 = quad.x + static_cast<float>(quad.width);
+                    const float y1 = quad.y + static_cast<float>(quad.height);
+                    const float u0 = static_cast<float>(quad.slot.x) * scale;
+                    const float v0 = static_cast<float>(quad.slot.y) * scale;
+                    const float u1 = static_cast<float>(quad.slot.x + quad.width) * scale;
+                    const float v1 = static_cast<float>(quad.slot.y + quad.height) * scale;
+
+                    gs_texcoord(u0, v0, 0); gs_vertex2f(x0, y0);
+                    gs_texcoord(u1, v0, 0); gs_vertex2f(x1, y0);
+                    gs_texcoord(u0, v1, 0); gs_vertex2f(x0, y1);
+                    gs_texcoord(u1, v0, 0); gs_vertex2f(x1, y0);
+                    gs_texcoord(u1, v1, 0); gs_vertex2f(x1, y1);
+                    gs_texcoord(u0, v1, 0); gs_vertex2f(x0, y1);
+                }
+                gs_render_stop(GS_TRIS);
+            }
+        }
+        i = end;
+    }
+}
 
-    unsigned int rgba = color;
-    vec4 colorVal;
-    vec4_set(&colorVal, (float)mis_get_rgba_r(rgba) / 0xff,
-        (float)mis_get_rgba_g(rgba) / 0xff,
-        (float)mis_get_rgba_b(rgba) / 0xff,
-        (float)mis_get_rgba_a(rgba) / 0xff);
+/* Draws the tiles of a parked page at their place on the page. */
+static void draw_page_tiles(SourceManager *context, gs_drawing_texture *texture, gs_eparam_t *image)
+{
+    const uint32_t columns = tile_count(texture->width);
+    std::vector<tile_quad> quads;
+    quads.reserve(texture->tiles.size());
+    for (const auto &tile : texture->tiles) {
+        const uint32_t x = tile.first % columns * PAGE_TILE_SIZE;
+        const uint32_t y = tile.first / columns * PAGE_TILE_SIZE;
+        quads.push_back({ tile.second, static_cast<float>(x), static_cast<float>(y)
+            , std::min<uint32_t>(PAGE_TILE_SIZE, texture->width - x)
+            , std::min<uint32_t>(PAGE_TILE_SIZE, texture->height - y) });
+    }
+    draw_tile_quads(context, quads, image);
+}
 
-    gs_drawing_texture *draw_texture = context->GetCurrentPageTexture();
-    if (!draw_texture)
+/*
+ * Moves a page nobody is drawing on out of its render target into tiles,
+ * keeping only the tiles with ink.  Its checkpoints go too; undo makes
+ * them again.  Graphics context entered.
+ */
+static void park_page(SourceManager *context, gs_drawing_texture *texture)
+{
+    // an infinite page keeps no more than its view, composed again when shown
+    if (texture->infinite && !texture->tmp_render && !texture->point_array) {
+        texture->strokes.Clear();
+        release_world_tiles(context, texture);
+        gs_texrender_destroy(texture->texrender);
+        texture->texrender = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+        texture->world.dirty = true;
         return;
+    }
 
-    if (size > 0)
-        context->SetLineWidth(size);
+    if (texture->infinite || texture->parked || !texture->width || !texture->height || texture->tmp_render || texture->point_array)
+        return;
 
-    obs_enter_graphics();
+    gs_texture_t *tex = gs_texrender_get_texture(texture->texrender);
+    if (!tex)
+        return;
 
-    obs_video_info ovi;
-    obs_get_video_info(&ovi);
-    const auto t_width = ovi.base_width;
-    const auto t_height = ovi.base_height;
+    TileAtlas &atlas = context->GetTiles();
+    const uint32_t columns = tile_count(texture->width);
+    for (uint32_t i = 0; i < texture->ink.size(); i++) {
+        tile_slot slot;
+        if (!texture->ink[i])
+            continue;
+        if (!atlas.Allocate(slot)) {
+            release_tiles(context, texture);
+            return;
+        }
+        texture->tiles[i] = slot;
+    }
 
-    gs_ortho(0.0f, static_cast<float>(t_width), 0.0f, static_cast<float>(t_height),
-        -100.0f, 100.0f);
+    gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+    gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
 
-    gs_texrender_reset(draw_texture->texrender);
-    gs_effect_set_vec4(effectcolor, &colorVal);
+    gs_blend_state_push();
+    gs_enable_blending(false);
 
-    gs_texrender_begin(draw_texture->texrender
-        , std::get<0>(context->GetCanvasSize())
-        , std::get<1>(context->GetCanvasSize()));
+    const auto order = tiles_by_atlas(texture);
+    bool copied = true;
+    for (size_t i = 0; i < order.size() && copied;) {
+        const uint32_t atlas_index = order[i].first;
+        if (!(copied = atlas.Begin(atlas_index)))
+            break;
 
-    if (draw_texture->point.is_frist_draw) {
-        draw_texture->point.is_frist_draw = false;
-        vec4 cleanColor;
-        vec4_set(&cleanColor, 1.0, 1.0, 1.0, 0.0);
-        gs_clear(GS_CLEAR_COLOR, &cleanColor, 1.0f, 0);
-        obs_enter_graphics();
-        gs_render_start(true);
-        for (int i = 0; i <= 360; i += 1) {
-            float pos = i * 0.0174532925199432957692369076848f;
-            gs_vertex2f(cosf(pos), sinf(pos));
+        gs_effect_set_texture(image, tex);
+        size_t end = i;
+        while (end < order.size() && order[end].first == atlas_index)
+            end++;
+
+        while (gs_effect_loop(effect, "Draw")) {
+            for (size_t j = i; j < end; j++) {
+                // with the border from the neighbouring tiles
+                const tile_slot &slot = texture->tiles[order[j].second];
+                const uint32_t x = order[j].second % columns * PAGE_TILE_SIZE;
+                const uint32_t y = order[j].second / columns * PAGE_TILE_SIZE;
+                const uint32_t x0 = x ? x - 1 : 0;
+                const uint32_t y0 = y ? y - 1 : 0;
+                const uint32_t x1 = std::min(x + PAGE_TILE_SIZE + 1, texture->width);
+                const uint32_t y1 = std::min(y + PAGE_TILE_SIZE + 1, texture->height);
+
+                gs_matrix_push();
+                gs_matrix_translate3f(static_cast<float>(slot.x - (x - x0))
+                    , static_cast<float>(slot.y - (y - y0)), 0.0f);
+                gs_draw_sprite_subregion(tex, 0, x0, y0, x1 - x0, y1 - y0);
+                gs_matrix_pop();
+            }
         }
-        draw_texture->point.base.buf = gs_render_save();
-        obs_leave_graphics();
+        atlas.End(atlas_index);
+        i = end;
     }
 
-    gs_technique_begin(tech);
-    gs_technique_begin_pass(tech, 0);
-    gs_render_start(false);
+    gs_blend_state_pop();
 
-    z_point p;
-    p.x = static_cast<float>(mouse_x);
+    if (!copied) {
+        release_tiles(context, texture);
+        return;
+    }
+
+    // an empty texrender holds no texture until it is next drawn into
+    gs_texrender_destroy(texture->texrender);
+    texture->texrender = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+    texture->history.DropCheckpoints();
+    texture->strokes.Clear();
+    texture->parked = true;
+}
+
+/* Draws a parked page back into a render target, to draw on it. */
+static bool unpark_page(SourceManager *context, gs_drawing_texture *texture)
+{
+    if (!texture->parked)
+        return true;
+
+    gs_texrender_reset(texture->texrender);
+    if (!gs_texrender_begin(texture->texrender, texture->width, texture->height))
+        return false;
+
+    gs_ortho(0.0f, static_cast<float>(texture->width), 0.0f, static_cast<float>(texture->height),
+        -100.0f, 100.0f);
+
+    vec4 clear_color;
+    vec4_set(&clear_color, 1.0, 1.0, 1.0, 0.0);
+    gs_clear(GS_CLEAR_COLOR, &clear_color, 1.0f, 0);
+
+    gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+    gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
+
+    gs_blend_state_push();
+    gs_enable_blending(false);
+    while (gs_effect_loop(effect, "Draw"))
+        draw_page_tiles(context, texture, image);
+    gs_blend_state_pop();
+
+    gs_texrender_end(texture->texrender);
+    release_tiles(context, texture);
+    return true;
+}
+
+/* Fills a rectangle of the current target with the color of a new page. */
+static void fill_clear(float x0, float y0, float x1, float y1)
+{
+    gs_effect_t *solid = obs_get_base_effect(OBS_EFFECT_SOLID);
+    vec4 clear_color;
+    vec4_set(&clear_color, 1.0, 1.0, 1.0, 0.0);
+    gs_effect_set_vec4(gs_effect_get_param_by_name(solid, "color"), &clear_color);
+
+    gs_blend_state_push();
+    gs_enable_blending(false);
+    while (gs_effect_loop(solid, "Solid")) {
+        gs_render_start(true);
+        gs_vertex2f(x0, y0);
+        gs_vertex2f(x1, y0);
+        gs_vertex2f(x0, y1);
+        gs_vertex2f(x1, y1);
+        gs_render_stop(GS_TRISTRIP);
+    }
+    gs_blend_state_pop();
+}
+
+/*
+ * Draws a region of the page, in page pixels, again from its base and the
+ * commands over it, as the page stands once the first `applied` commands
+ * are drawn.  Only the region is touched, so taking a stroke out costs the
+ * strokes around it.  Page target bound.
+ */
+static void redraw_region(SourceManager *context, gs_drawing_texture *texture, const index_rect &region,
+    size_t applied)
+{
+    const uint32_t width = texture->width;
+    const uint32_t height = texture->height;
+    const auto x0 = static_cast<int32_t>(std::max(std::floor(region.x0), 0.0f));
+    const auto y0 = static_cast<int32_t>(std::max(std::floor(region.y0), 0.0f));
+    const auto x1 = static_cast<int32_t>(std::min(std::ceil(region.x1), static_cast<float>(width)));
+    const auto y1 = static_cast<int32_t>(std::min(std::ceil(region.y1), static_cast<float>(height)));
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    const auto &commands = texture->history.Commands();
+    const size_t first = first_shown(texture, applied);
+    gs_texture_t *base = first ? nullptr : texture->history.Base();
+
+    sync_index(context, texture);
+    std::vector<uint32_t> over;
+    texture->index.Query({ static_cast<float>(x0), static_cast<float>(y0)
+        , static_cast<float>(x1), static_cast<float>(y1) }, applied, over);
+
+    gs_viewport_push();
+    gs_projection_push();
+    gs_set_viewport(x0, y0, x1 - x0, y1 - y0);
+    gs_ortho(static_cast<float>(x0), static_cast<float>(x1), static_cast<float>(y0), static_cast<float>(y1),
+        -100.0f, 100.0f);
+
+    // a clear would reach the rest of the page
+    fill_clear(static_cast<float>(x0), static_cast<float>(y0), static_cast<float>(x1), static_cast<float>(y1));
+    if (base) {
+        gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+        gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), base);
+
+        gs_blend_state_push();
+        gs_enable_blending(false);
+        while (gs_effect_loop(effect, "Draw"))
+            gs_draw_sprite(base, 0, width, height);
+        gs_blend_state_pop();
+    }
+    for (uint32_t index : over) {
+        if (index >= first && shown(texture, index, applied))
+            replay_command(context, texture, commands[index], index, width, height);
+    }
+
+    gs_projection_pop();
+    gs_viewport_pop();
+}
+
+/* Draws the commands at places of the history into the current target. */
+static void replay_range(SourceManager *context, gs_drawing_texture *texture, size_t from, size_t to,
+    uint32_t width, uint32_t height)
+{
+    const auto &commands = texture->history.Commands();
+    for (size_t i = from; i < to; i++) {
+        if (commands[i].type != DRAW_ERASE) {
+            replay_command(context, texture, commands[i], i, width, height);
+            continue;
+        }
+
+        // the region the erased commands covered, as of just after the erase
+        sync_index(context, texture);
+        index_rect region = empty_rect();
+        for (uint32_t target : commands[i].targets) {
+            if (target && target <= i)
+                grow_rect(region, texture->index.Bounds(i - target));
+        }
+        redraw_region(context, texture, region, i + 1);
+    }
+}
+
+/*
+ * Draws tiles of an infinite page into the atlas from the base of its
+ * history and the commands over them, found through the stroke index, each
+ * clipped to its slot by the viewport.  Tiles nothing is drawn on take no
+ * slot.
+ */
+static void render_world_tiles(SourceManager *context, gs_drawing_texture *texture,
+    const std::vector<std::pair<int32_t, int32_t>> &wanted)
+{
+    if (wanted.empty())
+        return;
+
+    const uint32_t width = texture->width;
+    const uint32_t height = texture->height;
+    const float zoom = texture->world.zoom;
+    const float tile_size = static_cast<float>(PAGE_TILE_SIZE) / zoom;
+    const float border = 1.0f / zoom;
+    const auto &commands = texture->history.Commands();
+    const size_t applied = texture->history.Applied();
+
+    // nothing before the last clear shows
+    const size_t first = first_shown(texture, applied);
+    gs_texture_t *base = first ? nullptr : texture->history.Base();
+    sync_index(context, texture);
+
+    // the commands over each tile, and a slot for the ones with any
+    std::vector<std::pair<world_tile *, std::vector<uint32_t>>> drawn;
+    std::vector<std::pair<int32_t, int32_t>> places;
+    std::vector<uint32_t> found;
+    for (const auto &place : wanted) {
+        const float x0 = static_cast<float>(place.first) * tile_size - border;
+        const float y0 = static_cast<float>(place.second) * tile_size - border;
+        const float x1 = x0 + tile_size + 2.0f * border;
+        const float y1 = y0 + tile_size + 2.0f * border;
+
+        std::vector<uint32_t> over;
+        texture->index.Query({ x0, y0, x1, y1 }, applied, found);
+        for (uint32_t index : found) {
+            if (index >= first && shown(texture, index, applied))
+                over.push_back(index);
+        }
+        const bool under_base = base && x0 < static_cast<float>(width) && x1 > 0.0f
+            && y0 < static_cast<float>(height) && y1 > 0.0f;
+
+        world_tile &tile = texture->world.tiles[world_key(place.first, place.second)];
+        tile.used = texture->world.frame;
+        tile.empty = over.empty() && !under_base;
+        if (!tile.empty && !context->GetTiles().Allocate(tile.slot))
+            tile.empty = true;
+        if (!tile.empty) {
+            drawn.emplace_back(&tile, std::move(over));
+            places.push_back(place);
+        }
+    }
+
+    std::vector<size_t> order(drawn.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&drawn](size_t a, size_t b) {
+        return drawn[a].first->slot.atlas < drawn[b].first->slot.atlas;
+    });
+
+    TileAtlas &atlas = context->GetTiles();
+    gs_blend_state_push();
+    gs_enable_blending(true);
+    gs_blend_function_separate(GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA
+        , GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
+    for (size_t i = 0; i < order.size();) {
+        const uint32_t atlas_index = drawn[order[i]].first->slot.atlas;
+        const bool bound = atlas.Begin(atlas_index);
+
+        for (; i < order.size() && drawn[order[i]].first->slot.atlas == atlas_index; i++) {
+            if (!bound)
+                continue;
+
+            const tile_slot &slot = drawn[order[i]].first->slot;
+            const auto &place = places[order[i]];
+            const float x0 = static_cast<float>(place.first) * tile_size - border;
+            const float y0 = static_cast<float>(place.second) * tile_size - border;
+            const float x1 = x0 + tile_size + 2.0f * border;
+            const float y1 = y0 + tile_size + 2.0f * border;
+
+            gs_set_viewport(static_cast<int>(slot.x) - 1, static_cast<int>(slot.y) - 1
+                , PAGE_TILE_SIZE + 2, PAGE_TILE_SIZE + 2);
+            gs_ortho(x0, x1, y0, y1, -100.0f, 100.0f);
+
+            // a clear would reach the other tiles of the atlas
+            fill_clear(x0, y0, x1, y1);
+            if (base) {
+                // copied, as restore_page does; its edges are blended already
+                gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+                gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), base);
+                gs_enable_blending(false);
+                while (gs_effect_loop(effect, "Draw"))
+                    gs_draw_sprite(base, 0, width, height);
+                gs_enable_blending(true);
+            }
+            for (uint32_t index : drawn[order[i]].second)
+                replay_command(context, texture, commands[index], index, width, height);
+        }
+
+        if (bound)
+            atlas.End(atlas_index);
+    }
+
+    gs_blend_state_pop();
+}
+
+/* Tiles of the zoomed page the view shows, as x0, y0, x1, y1 inclusive. */
+static void view_tile_range(const gs_drawing_texture *texture, int32_t range[4])
+{
+    float origin_x, origin_y;
+    view_origin(texture, origin_x, origin_y);
+    const auto size = static_cast<float>(PAGE_TILE_SIZE);
+    range[0] = static_cast<int32_t>(std::floor(origin_x / size));
+    range[1] = static_cast<int32_t>(std::floor(origin_y / size));
+    range[2] = static_cast<int32_t>(std::floor((origin_x + static_cast<float>(texture->width) - 1.0f) / size));
+    range[3] = static_cast<int32_t>(std::floor((origin_y + static_cast<float>(texture->height) - 1.0f) / size));
+}
+
+/* Drops the least recently shown tiles past the budget, never visible ones. */
+static void evict_world_tiles(SourceManager *context, gs_drawing_texture *texture)
+{
+    auto &tiles = texture->world.tiles;
+    if (tiles.size() <= WORLD_TILE_BUDGET)
+        return;
+
+    std::vector<std::pair<uint64_t, uint64_t>> by_use;
+    for (const auto &tile : tiles) {
+        if (tile.second.used != texture->world.frame)
+            by_use.emplace_back(tile.second.used, tile.first);
+    }
+    std::sort(by_use.begin(), by_use.end());
+
+    for (size_t i = 0; i < by_use.size() && tiles.size() > WORLD_TILE_BUDGET; i++) {
+        const auto find_item = tiles.find(by_use[i].second);
+        if (!find_item->second.empty)
+            context->GetTiles().Free(find_item->second.slot);
+        tiles.erase(find_item);
+    }
+}
+
+/*
+ * Draws the view of an infinite page into its target from the tiles under
+ * it, drawing the ones it does not have yet.  Graphics context entered.
+ */
+static void compose_view(SourceManager *context, gs_drawing_texture *texture)
+{
+    if (texture->world.zoom != texture->view.zoom) {
+        release_world_tiles(context, texture);
+        texture->world.zoom = texture->view.zoom;
+    }
+    texture->world.frame++;
+
+    int32_t range[4];
+    view_tile_range(texture, range);
+
+    std::vector<std::pair<int32_t, int32_t>> wanted;
+    for (int32_t y = range[1]; y <= range[3]; y++) {
+        for (int32_t x = range[0]; x <= range[2]; x++) {
+            const auto find_item = texture->world.tiles.find(world_key(x, y));
+            if (find_item == texture->world.tiles.end())
+                wanted.emplace_back(x, y);
+            else
+                find_item->second.used = texture->world.frame;
+        }
+    }
+    render_world_tiles(context, texture, wanted);
+
+    float origin_x, origin_y;
+    view_origin(texture, origin_x, origin_y);
+    std::vector<tile_quad> quads;
+    for (int32_t y = range[1]; y <= range[3]; y++) {
+        for (int32_t x = range[0]; x <= range[2]; x++) {
+            const world_tile &tile = texture->world.tiles[world_key(x, y)];
+            if (!tile.empty)
+                quads.push_back({ tile.slot
+                    , static_cast<float>(x) * PAGE_TILE_SIZE - origin_x
+                    , static_cast<float>(y) * PAGE_TILE_SIZE - origin_y
+                    , PAGE_TILE_SIZE, PAGE_TILE_SIZE });
+        }
+    }
+
+    gs_texrender_reset(texture->texrender);
+    if (gs_texrender_begin(texture->texrender, texture->width, texture->height)) {
+        gs_ortho(0.0f, static_cast<float>(texture->width), 0.0f, static_cast<float>(texture->height),
+            -100.0f, 100.0f);
+
+        vec4 clear_color;
+        vec4_set(&clear_color, 1.0, 1.0, 1.0, 0.0);
+        gs_clear(GS_CLEAR_COLOR, &clear_color, 1.0f, 0);
+
+        gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+        gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
+        gs_blend_state_push();
+        gs_enable_blending(false);
+        while (gs_effect_loop(effect, "Draw"))
+            draw_tile_quads(context, quads, image);
+        gs_blend_state_pop();
+
+        gs_texrender_end(texture->texrender);
+    }
+
+    evict_world_tiles(context, texture);
+    texture->world.dirty = false;
+}
+
+/*
+ * Draws a few of the tiles just past the view of an infinite page, on the
+ * sides it last panned towards, so they are ready when they come into view.
+ */
+static void prefetch_view(SourceManager *context, gs_drawing_texture *texture)
+{
+    if (!texture->infinite || texture->world.dirty || !texture->width
+        || (texture->world.pan_x == 0.0f && texture->world.pan_y == 0.0f))
+        return;
+
+    int32_t range[4];
+    view_tile_range(texture, range);
+
+    int32_t ahead[4] = { range[0], range[1], range[2], range[3] };
+    if (texture->world.pan_x > 0.0f)
+        ahead[2] += WORLD_PREFETCH_TILES;
+    else if (texture->world.pan_x < 0.0f)
+        ahead[0] -= WORLD_PREFETCH_TILES;
+    if (texture->world.pan_y > 0.0f)
+        ahead[3] += WORLD_PREFETCH_TILES;
+    else if (texture->world.pan_y < 0.0f)
+        ahead[1] -= WORLD_PREFETCH_TILES;
+
+    std::vector<std::pair<int32_t, int32_t>> wanted;
+    for (int32_t y = ahead[1]; y <= ahead[3] && wanted.size() < WORLD_PREFETCH_PER_FRAME; y++) {
+        for (int32_t x = ahead[0]; x <= ahead[2] && wanted.size() < WORLD_PREFETCH_PER_FRAME; x++) {
+            if (x >= range[0] && x <= range[2] && y >= range[1] && y <= range[3])
+                continue;
+            if (texture->world.tiles.find(world_key(x, y)) == texture->world.tiles.end())
+                wanted.emplace_back(x, y);
+        }
+    }
+
+    // nothing left to fetch in that direction
+    if (wanted.empty()) {
+        texture->world.pan_x = 0.0f;
+        texture->world.pan_y = 0.0f;
+        return;
+    }
+    render_world_tiles(context, texture, wanted);
+}
+
+/*
+ * Redraws the page from the nearest checkpoint.  With capture set, every
+ * UNDO_CHECKPOINT_INTERVAL commands are drawn separately and checkpointed,
+ * for a page whose checkpoints were dropped.
+ */
+static void rebuild_page(SourceManager *context, gs_drawing_texture *texture, bool capture)
+{
+    const auto [width, height] = context->GetCanvasSize();
+    size_t applied = texture->history.Applied();
+    size_t from = 0;
+    bool first = true;
+
+    // the tiles of a parked page are redrawn from the history as well
+    release_tiles(context, texture);
+
+    do {
+        gs_texrender_reset(texture->texrender);
+        if (!gs_texrender_begin(texture->texrender, width, height))
+            return;
+
+        gs_ortho(0.0f, static_cast<float>(width), 0.0f, static_cast<float>(height),
+            -100.0f, 100.0f);
+
+        if (first)
+            from = restore_page(texture, width, height);
+        first = false;
+
+        const size_t to = capture ? std::min(applied, from + UNDO_CHECKPOINT_INTERVAL) : applied;
+        replay_range(context, texture, from, to, width, height);
+
+        gs_texrender_end(texture->texrender);
+
+        if (capture && to - from == UNDO_CHECKPOINT_INTERVAL) {
+            // going over the memory cap folds the oldest commands away
+            const size_t before = texture->history.Applied();
+            capture_checkpoint(texture, to);
+            const size_t folded = before - texture->history.Applied();
+            applied -= folded;
+            from = to - folded;
+        }
+        else {
+            from = to;
+        }
+    } while (from < applied);
+}
+
+/*
+ * Clears the page when it is first drawn, or redraws it from its history
+ * when the canvas size changed.
+ */
+static void prepare_page_target(SourceManager *context, gs_drawing_texture *texture)
+{
+    const auto [width, height] = context->GetCanvasSize();
+    if (!width || !height)
+        return;
+
+    if (texture->infinite) {
+        if (texture->width != width || texture->height != height) {
+            texture->width = width;
+            texture->height = height;
+            release_world_tiles(context, texture);
+            texture->world.dirty = true;
+        }
+        if (texture->world.dirty)
+            compose_view(context, texture);
+        return;
+    }
+
+    if (texture->width == width && texture->height == height)
+        return;
+
+    // erases redraw their regions at the new size
+    texture->width = width;
+    texture->height = height;
+
+    texture->history.DropCheckpoints();
+    rebuild_page(context, texture, true);
+
+    // the base may cover any tile
+    const auto &commands = texture->history.Commands();
+    texture->ink.assign(static_cast<size_t>(tile_count(width)) * tile_count(height)
+        , texture->history.Base() != nullptr);
+    for (size_t i = 0; i < texture->history.Applied(); i++)
+        mark_command_ink(context, texture, commands[i]);
+}
+
+static void page_undo(SourceManager *context, gs_drawing_texture *texture)
+{
+    if (!texture->history.Undo())
+        return;
+
+    context->LogOperation(JOURNAL_UNDO);
+    texture->revision++;
+    set_selection(context, texture, {});
+
+    if (texture->infinite) {
+        const size_t position = texture->history.Applied();
+        invalidate_world(context, texture, texture->history.Commands()[position], position);
+        compose_view(context, texture);
+        return;
+    }
+
+    // a page that was parked has lost its checkpoints
+    rebuild_page(context, texture, !texture->history.HasCheckpoints());
+}
+
+static void page_redo(SourceManager *context, gs_drawing_texture *texture)
+{
+    if (!texture->history.Redo())
+        return;
+
+    const draw_command &command = texture->history.Commands()[texture->history.Applied() - 1];
+    context->LogOperation(JOURNAL_REDO, &command);
+    texture->revision++;
+    set_selection(context, texture, {});
+
+    if (texture->infinite) {
+        invalidate_world(context, texture, command, texture->history.Applied() - 1);
+        compose_view(context, texture);
+        return;
+    }
+
+    mark_command_ink(context, texture, command);
+    if (!unpark_page(context, texture))
+        return;
+
+    const auto [width, height] = context->GetCanvasSize();
+    gs_texrender_reset(texture->texrender);
+    if (!gs_texrender_begin(texture->texrender, width, height))
+        return;
+
+    gs_ortho(0.0f, static_cast<float>(width), 0.0f, static_cast<float>(height),
+        -100.0f, 100.0f);
+    replay_range(context, texture, texture->history.Applied() - 1, texture->history.Applied(), width, height);
+    gs_texrender_end(texture->texrender);
+}
+
+/* Draws the text preview into the current target and records it. */
+static void commit_text(SourceManager *context, gs_drawing_texture *texture)
+{
+    const auto [width, height] = context->GetCanvasSize();
+    push_view(texture);
+    text_draw(context->GetGlyphAtlas().get(), texture->text_preview, width, height);
+    gs_matrix_pop();
+
+    commit_command(context, texture, std::move(texture->text_preview));
+    texture->text_preview = draw_command();
+    texture->text_pending = false;
+}
+
+static void flush_canvas_events(SourceManager *context);
+static bool begin_page_target(SourceManager *context, gs_drawing_texture *texture);
+static void draw_source_draw_canvas_batch_proc(void *data, calldata_t *cd);
+
+/*
+ * Shows text at (x, y) on the current page, or draws it into the page when
+ * commit is set.  Size is the pixel height of a line.  Only glyphs not used
+ * before are uploaded, so typing costs a few quads per frame.
+ */
+static void draw_source_draw_text_proc(void *data, calldata_t *cd)
+{
+    const auto context = reinterpret_cast<SourceManager *>(data);
+    const auto texture = context->GetCurrentPageTexture();
+    const auto [width, height] = context->GetCanvasSize();
+    if (!texture || !width || !height)
+        return;
+
+    draw_command command;
+    command.type = DRAW_TEXT;
+    command.color = static_cast<uint32_t>(calldata_int(cd, "color"));
+    command.text = calldata_string(cd, "text") ? calldata_string(cd, "text") : "";
+
+    obs_enter_graphics();
+    flush_canvas_events(context);
+
+    // the view only changes with graphics entered
+    command.size = static_cast<float>(calldata_int(cd, "size")) / static_cast<float>(height) / texture->view.zoom;
+    command.points.push_back(page_fraction(texture, static_cast<float>(calldata_int(cd, "x"))
+        , static_cast<float>(calldata_int(cd, "y")), width, height));
+
+    texture->text_preview = std::move(command);
+    texture->text_pending = !texture->text_preview.text.empty();
+
+    if (texture->text_pending && calldata_bool(cd, "commit")) {
+        prepare_page_target(context, texture);
+        const bool unparked = unpark_page(context, texture);
+        gs_texrender_reset(texture->texrender);
+        if (unparked && gs_texrender_begin(texture->texrender, width, height)) {
+            gs_ortho(0.0f, static_cast<float>(width), 0.0f, static_cast<float>(height),
+                -100.0f, 100.0f);
+            commit_text(context, texture);
+            gs_texrender_end(texture->texrender);
+
+            if (!texture->infinite && texture->history.NeedsCheckpoint())
+                capture_checkpoint(texture, texture->history.Applied());
+        }
+    }
+    obs_leave_graphics();
+}
+
+static void emit_thumbnail(SourceManager *context, const std::string &key, int32_t page_index,
+    const page_thumbnail &thumbnail)
+{
+    obs_source_frame frame = {};
+    frame.data[0] = reinterpret_cast<uint8_t *>(const_cast<uint32_t *>(thumbnail.pixels.data()));
+    frame.linesize[0] = thumbnail.width * 4;
+    frame.width = thumbnail.width;
+    frame.height = thumbnail.height;
+    frame.format = VIDEO_FORMAT_RGBA;
+
+    calldata_t cd;
+    calldata_init(&cd);
+    calldata_set_ptr(&cd, "source", context->source);
+    calldata_set_string(&cd, "key", key.c_str());
+    calldata_set_int(&cd, "page_index", page_index);
+    calldata_set_ptr(&cd, "frame", &frame);
+    signal_handler_signal(obs_source_get_signal_handler(context->source), "thumbnail_ready", &cd);
+    calldata_free(&cd);
+}
+
+/*
+ * Makes the thumbnail of one page whose content changed since its last
+ * one, so a session with many pages is covered over several frames.
+ * Graphics context entered.
+ */
+static void update_thumbnails(SourceManager *context)
+{
+    ThumbnailCache &thumbnails = context->GetThumbnails();
+    const auto ready = [context](const std::string &key, int32_t page_index, const page_thumbnail &thumbnail) {
+        emit_thumbnail(context, key, page_index, thumbnail);
+    };
+
+    thumbnails.Poll(ready);
+    if (thumbnails.Busy())
+        return;
+
+    for (const auto &page : context->ListPages()) {
+        if (thumbnails.Current(page.key, page.page_index, page.texture ? page.texture->revision : 0))
+            continue;
+
+        if (!page.texture) {
+            // drawn on the CPU from the saved raster, without loading the page
+            session_page saved;
+            if (context->ReadSavedPage(page.key, page.page_index, saved)) {
+                raster_image image;
+                if (!saved.base_pixels.empty()) {
+                    image.width = saved.base_width;
+                    image.height = saved.base_height;
+                    image.pixels = std::move(saved.base_pixels);
+                }
+                else {
+                    const auto [width, height] = context->GetCanvasSize();
+                    if (!width || !height)
+                        continue;
+                    if (saved.commands.empty()) {
+                        thumbnails.Store(page.key, page.page_index, 0, nullptr, width, height, ready);
+                        return;
+                    }
+                    raster_clear(image, width, height);
+                }
+
+                raster_commands(image, saved.commands.data(), saved.commands.size()
+                    , context->GetGlyphAtlas().get());
+                thumbnails.Store(page.key, page.page_index, 0, image.pixels.data()
+                    , image.width, image.height, ready);
+                return;
+            }
+            context->AddPage(page.key, page.page_index);
+        }
+
+        gs_drawing_texture *texture = context->GetPageTexture(page.key, page.page_index);
+        if (!texture)
+            continue;
+
+        // a parked page is drawn back for the thumbnail, and pages not
+        // shown are parked after it
+        prepare_page_target(context, texture);
+        const bool park = texture->parked || !texture->shown;
+        if (!unpark_page(context, texture))
+            continue;
+
+        gs_texture_t *tex = gs_texrender_get_texture(texture->texrender);
+        if (!tex)
+            continue;
+
+        thumbnails.Render(page.key, page.page_index, texture->revision, tex);
+        if (park)
+            park_page(context, texture);
+        return;
+    }
+}
+
+/*
+ * Starts making thumbnails of every page, and sends the ones already made.
+ * Each is sent with the thumbnail_ready signal, and again whenever its
+ * page changes.
+ */
+static void draw_source_get_thumbnails_proc(void *data, calldata_t *cd)
+{
+    UNUSED_PARAMETER(cd);
+    const auto context = reinterpret_cast<SourceManager *>(data);
+
+    context->EnableThumbnails();
+    context->GetThumbnails().ForEach(
+        [context](const std::string &key, int32_t page_index, const page_thumbnail &thumbnail) {
+            emit_thumbnail(context, key, page_index, thumbnail);
+        });
+}
+
+/*
+ * Pans and zooms the current page, which from then on reaches past the
+ * canvas.  (x, y) is the page point shown at the top left, in canvas
+ * pixels, and zoom the scale it is shown at.
+ */
+static void draw_source_set_viewport_proc(void *data, calldata_t *cd)
+{
+    const auto context = reinterpret_cast<SourceManager *>(data);
+    const auto texture = context->GetCurrentPageTexture();
+    if (!texture)
+        return;
+
+    const auto x = static_cast<float>(calldata_float(cd, "x"));
+    const auto y = static_cast<float>(calldata_float(cd, "y"));
+    auto zoom = static_cast<float>(calldata_float(cd, "zoom"));
+    if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(zoom))
+        return;
+    zoom = std::min(std::max(zoom, 0.05f), 20.0f);
+
+    obs_enter_graphics();
+    flush_canvas_events(context);
+
+    if (!texture->infinite) {
+        // the view is drawn from world tiles instead of page tiles and
+        // checkpoints.  They hold nothing the history does not: world tiles
+        // are drawn from its base and commands, committed blits included.
+        release_tiles(context, texture);
+        texture->history.DropCheckpoints();
+        texture->world.zoom = zoom;
+        texture->infinite = true;
+    }
+
+    texture->world.pan_x = x - texture->view.x;
+    texture->world.pan_y = y - texture->view.y;
+    texture->view.x = x;
+    texture->view.y = y;
+    texture->view.zoom = zoom;
+    texture->world.dirty = true;
+    obs_leave_graphics();
+}
+
+/* Erases the commands the lasso selected on the current page, as one undo step. */
+static void draw_source_erase_selection_proc(void *data, calldata_t *cd)
+{
+    UNUSED_PARAMETER(cd);
+    const auto context = reinterpret_cast<SourceManager *>(data);
+    const auto texture = context->GetCurrentPageTexture();
+    if (!texture)
+        return;
+
+    obs_enter_graphics();
+    flush_canvas_events(context);
+
+    // a selection is lost when the history is renumbered
+    if (texture->selection.empty() || texture->selection_generation != texture->history.Generation()) {
+        obs_leave_graphics();
+        return;
+    }
+
+    prepare_page_target(context, texture);
+    const bool bound = !texture->infinite && unpark_page(context, texture) && begin_page_target(context, texture);
+    if (!texture->infinite && !bound) {
+        obs_leave_graphics();
+        return;
+    }
+
+    sync_index(context, texture);
+    index_rect region = empty_rect();
+    draw_command command;
+    command.type = DRAW_ERASE;
+    const size_t position = texture->history.Applied();
+    for (uint32_t index : texture->selection) {
+        command.targets.push_back(static_cast<uint32_t>(position - index));
+        grow_rect(region, texture->index.Bounds(index));
+    }
+    commit_command(context, texture, std::move(command));
+
+    if (texture->infinite) {
+        texture->world.dirty = true;
+    }
+    else {
+        redraw_region(context, texture, region, texture->history.Applied());
+        gs_texrender_end(texture->texrender);
+        if (texture->history.NeedsCheckpoint())
+            capture_checkpoint(texture, texture->history.Applied());
+    }
+    obs_leave_graphics();
+}
+
+static const char *draw_source_get_name(void *unused)
+{
+    UNUSED_PARAMETER(unused);
+    return obs_module_text("DrawingInput");
+}
+
+/* Caches the canvas size, which only changes when video is reset. */
+static void refresh_canvas_size(SourceManager *context)
+{
+    obs_video_info ovi;
+    if (obs_get_video_info(&ovi))
+        context->UpdateCanvasSize(ovi.base_width, ovi.base_height);
+}
+
+static void draw_source_video_reset(void *data, calldata_t *cd)
+{
+    UNUSED_PARAMETER(cd);
+    refresh_canvas_size(reinterpret_cast<SourceManager *>(data));
+}
+
+static void *draw_source_create(obs_data_t *settings, obs_source_t *source)
+{
+    UNUSED_PARAMETER(settings);
+    const auto context = new SourceManager(source);
+    refresh_canvas_size(context);
+    signal_handler_connect(obs_get_signal_handler(), "video_reset", draw_source_video_reset, context);
+
+    proc_handler_t *ph = obs_source_get_proc_handler(source);
+    proc_handler_add(ph, "void draw_text(in int x, in int y, in string text, "
+        "in int color, in int size, in bool commit)",
+        draw_source_draw_text_proc, context);
+    proc_handler_add(ph, "void get_thumbnails()", draw_source_get_thumbnails_proc, context);
+    proc_handler_add(ph, "void set_viewport(in float x, in float y, in float zoom)",
+        draw_source_set_viewport_proc, context);
+    proc_handler_add(ph, "void erase_selection()", draw_source_erase_selection_proc, context);
+    proc_handler_add(ph, "void draw_canvas_batch(in ptr samples, in int count)",
+        draw_source_draw_canvas_batch_proc, context);
+
+    signal_handler_t *sh = obs_source_get_signal_handler(source);
+    signal_handler_add(sh, "void thumbnail_ready(ptr source, string key, int page_index, ptr frame)");
+    signal_handler_add(sh, "void selection_changed(ptr source, int count)");
+
+    return context;
+}
+
+/* One file in the module config directory for every source that names no
+ * session, so sources showing the same key share its pages. */
+static std::string default_session_path()
+{
+    char *dir = obs_module_config_path("sessions");
+    os_mkdirs(dir);
+    std::string path = std::string(dir) + "/default.drws";
+    bfree(dir);
+    return path;
+}
+
+static void draw_source_update(void *data, obs_data_t *settings)
+{
+    auto *context = (SourceManager *)data;
+
+    if (!context)
+        return;
+
+    std::string session_file = obs_data_get_string(settings, "session_file");
+    if (session_file.empty()) {
+        session_file = default_session_path();
+        obs_data_set_string(settings, "session_file", session_file.c_str());
+    }
+    context->OpenSession(session_file);
+
+    std::string key = obs_data_get_string(settings, "key");
+    if (!context->HasKey(key)) {
+        if (!context->AddKey(key))
+            return;
+    }
+    context->SetCurrentKey(key);
+    context->SetFont(obs_data_get_string(settings, "text_font"));
+
+    draw_info_changed(data, context->props);
+}
+
+static void draw_source_defaults(obs_data_t *settings)
+{
+    obs_data_set_default_string(settings, "text_font", DEFAULT_TEXT_FONT);
+}
+
+static void draw_source_show(void *data)
+{
+    UNUSED_PARAMETER(data);
+}
+
+static void draw_source_hide(void *data)
+{
+    UNUSED_PARAMETER(data);
+}
+
+static uint32_t draw_source_get_width(void *data)
+{
+    const auto context = reinterpret_cast<SourceManager *>(data);
+    return context ? std::get<0>(context->GetCanvasSize()) : 0;
+}
+
+static uint32_t draw_source_get_height(void *data)
+{
+    const auto context = reinterpret_cast<SourceManager *>(data);
+    return context ? std::get<1>(context->GetCanvasSize()) : 0;
+}
+
+static obs_properties_t *draw_source_properties(void *data)
+{
+    const auto context = reinterpret_cast<SourceManager *>(data);
+
+    if (!context)
+        return nullptr;
+
+    obs_properties_t *props = obs_properties_create();
+    context->props = props;
+
+    obs_properties_add_path(props, "text_font", obs_module_text("TextFont"),
+        OBS_PATH_FILE, "Fonts (*.ttf *.otf *.ttc)", nullptr);
+
+    draw_info_changed(data, props);
+
+    return props;
+}
+
+/* Outlines the bounds of the lasso selection in the view. */
+static void draw_selection(SourceManager *context, gs_drawing_texture *texture)
+{
+    sync_index(context, texture);
+    index_rect bounds = empty_rect();
+    for (uint32_t index : texture->selection)
+        grow_rect(bounds, texture->index.Bounds(index));
+    if (bounds.x1 < bounds.x0)
+        return;
+
+    float origin_x, origin_y;
+    view_origin(texture, origin_x, origin_y);
+    const float zoom = texture->view.zoom;
+    texture->shapes.Reset();
+    texture->shapes.AddRect(bounds.x0 * zoom - origin_x, bounds.y0 * zoom - origin_y
+        , bounds.x1 * zoom - origin_x, bounds.y1 * zoom - origin_y, 0.0f, 2.0f, false);
+
+    gs_effect_t *solid = obs_get_base_effect(OBS_EFFECT_SOLID);
+    vec4 color;
+    vec4_set(&color, 0.0f, 0.47f, 0.84f, 1.0f);
+    gs_effect_set_vec4(gs_effect_get_param_by_name(solid, "color"), &color);
+    while (gs_effect_loop(solid, "Solid"))
+        texture->shapes.Draw();
+}
+
+static void draw_source_render(void *data, gs_effect_t *effect, bool is_display)
+{
+    const auto context = reinterpret_cast<SourceManager *>(data);
+    if (!context)
+        return;
+
+    const auto texture = context->GetCurrentPageTexture();
+    if (!texture)
+        return;
+
+    prepare_page_target(context, texture);
+
+    gs_texrender_reset(texture->texrender);
+    gs_technique_t *tech = gs_effect_get_technique(effect, "Draw");
+    gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
+    size_t      passes;
+    gs_texture_t *tex = gs_texrender_get_texture(texture->texrender);
+    passes = gs_technique_begin(tech);
+    for (size_t i = 0; i < passes; i++) {
+        if (gs_technique_begin_pass(tech, i)) {
+            if (texture->parked) {
+                draw_page_tiles(context, texture, image);
+            }
+            else {
+                gs_effect_set_texture(image, tex);
+                gs_draw_sprite(tex
+                    , 0
+                    , std::get<0>(context->GetCanvasSize())
+                    , std::get<1>(context->GetCanvasSize()));
+            }
+
+            if (texture->blit_pending) {
+                gs_effect_set_texture(image, texture->blit_texture);
+                gs_matrix_push();
+                gs_matrix_translate3f(static_cast<float>(texture->blit_x)
+                    , static_cast<float>(texture->blit_y), 0.0f);
+                gs_draw_sprite_subregion(texture->blit_texture, 0, 0, 0
+                    , texture->blit_width, texture->blit_height);
+                gs_matrix_pop();
+            }
+            gs_technique_end_pass(tech);
+        }
+    }
+    gs_technique_end(tech);
+
+    if (!texture->selection.empty() && texture->selection_generation == texture->history.Generation())
+        draw_selection(context, texture);
+
+    if (texture->text_pending) {
+        push_view(texture);
+        text_draw(context->GetGlyphAtlas().get(), texture->text_preview
+            , std::get<0>(context->GetCanvasSize())
+            , std::get<1>(context->GetCanvasSize()));
+        gs_matrix_pop();
+    }
+}
+
+/*
+ * Redraws one page left at an old canvas size from its commands, so after
+ * a video reset the pages are resized over a few frames instead of all at
+ * once, or when each is next shown.  Pages a source shows are resized
+ * when they are drawn.  Graphics context entered.
+ */
+static void resize_pages(SourceManager *context)
+{
+    // a reset while this runs sets it again
+    context->SetResizePending(false);
+
+    const auto [width, height] = context->GetCanvasSize();
+    for (const auto &page : context->ListPages()) {
+        // pages never drawn are drawn at the new size when they are
+        gs_drawing_texture *texture = page.texture;
+        if (!texture || texture->shown || !texture->restored || !texture->width
+            || (texture->width == width && texture->height == height))
+            continue;
+
+        prepare_page_target(context, texture);
+        park_page(context, texture);
+        context->SetResizePending(true);
+        return;
+    }
+}
+
+static void draw_source_tick(void *data, float seconds)
+{
+    UNUSED_PARAMETER(seconds);
+    const auto context = reinterpret_cast<SourceManager *>(data);
+    if (!context)
+        return;
+
+    gs_drawing_texture *texture = context->GetCurrentPageTexture();
+    const bool prefetch = texture && texture->infinite;
+    const bool resize = context->ResizePending();
+    if (context->HasCanvasEvents() || context->ThumbnailsEnabled() || prefetch || resize) {
+        obs_enter_graphics();
+        flush_canvas_events(context);
+        if (resize)
+            resize_pages(context);
+        if (context->ThumbnailsEnabled())
+            update_thumbnails(context);
+        if (prefetch)
+            prefetch_view(context, texture);
+        obs_leave_graphics();
+    }
+
+    if (context->JournalCompactionDue())
+        context->SaveSession();
+}
+
+static void draw_source_save(void *data, obs_data_t *settings)
+{
+    UNUSED_PARAMETER(settings);
+    const auto context = reinterpret_cast<SourceManager *>(data);
+    if (context)
+        context->SaveSession();
+}
+
+static void draw_source_destroy(void *data)
+{
+    const auto context = (SourceManager *)data;
+    signal_handler_disconnect(obs_get_signal_handler(), "video_reset", draw_source_video_reset, context);
+    if (context)
+        context->SaveSession();
+
+    delete context;
+}
+
+OBS_DECLARE_MODULE()
+OBS_MODULE_USE_DEFAULT_LOCALE("drawing-source", "en-US")
+MODULE_EXPORT const char *obs_module_description(void)
+{
+    return "drawing source";
+}
+
+/*
+ * Composites the pending blit into the page, between texrender begin and
+ * end, and records it in the history with its pixels.
+ */
+static void commit_blit(SourceManager *context, gs_drawing_texture *texture)
+{
+    texture->blit_pending = false;
+
+    const auto [width, height] = context->GetCanvasSize();
+    if (!width || !height)
+        return;
+
+    draw_command command;
+    command.type = DRAW_IMAGE;
+    command.image_width = texture->blit_width;
+    command.pixels = std::move(texture->blit_pixels);
+    texture->blit_pixels.clear();
+    command.points.push_back(page_fraction(texture, static_cast<float>(texture->blit_x)
+        , static_cast<float>(texture->blit_y), width, height));
+    command.points.push_back(page_fraction(texture
+        , static_cast<float>(texture->blit_x + static_cast<int32_t>(texture->blit_width))
+        , static_cast<float>(texture->blit_y + static_cast<int32_t>(texture->blit_height)), width, height));
+
+    // infinite pages take no checkpoints, so their log cannot be folded
+    if (texture->infinite && !texture->history.Fits(command)) {
+        warn("page history is full, image of %ux%u dropped", texture->blit_width, texture->blit_height);
+        return;
+    }
+
+    gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+    gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
+
+    gs_blend_state_push();
+    gs_enable_blending(true);
+    gs_blend_function_separate(GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA
+        , GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
+    gs_effect_set_texture(image, texture->blit_texture);
+    gs_matrix_push();
+    gs_matrix_translate3f(static_cast<float>(texture->blit_x)
+        , static_cast<float>(texture->blit_y), 0.0f);
+    while (gs_effect_loop(effect, "Draw"))
+        gs_draw_sprite_subregion(texture->blit_texture, 0, 0, 0
+            , texture->blit_width, texture->blit_height);
+    gs_matrix_pop();
+
+    gs_blend_state_pop();
+    commit_command(context, texture, std::move(command));
+}
+
+/* Distance from p to the segment a-b. */
+static float point_segment_distance(const z_point &p, const z_point &a, const z_point &b)
+{
+    const float dx = b.x - a.x;
+    const float dy = b.y - a.y;
+    const float length = dx * dx + dy * dy;
+    const float t = length > 0.0f
+        ? std::min(std::max(((p.x - a.x) * dx + (p.y - a.y) * dy) / length, 0.0f), 1.0f) : 0.0f;
+    const float x = a.x + t * dx - p.x;
+    const float y = a.y + t * dy - p.y;
+    return std::sqrt(x * x + y * y);
+}
+
+static float segment_distance(const z_point &a, const z_point &b, const z_point &c, const z_point &d)
+{
+    const auto side = [](const z_point &p, const z_point &q, const z_point &r) {
+        return (q.x - p.x) * (r.y - p.y) - (q.y - p.y) * (r.x - p.x);
+    };
+
+    // segments that cross touch
+    if (side(a, b, c) * side(a, b, d) < 0.0f && side(c, d, a) * side(c, d, b) < 0.0f)
+        return 0.0f;
+
+    return std::min({ point_segment_distance(a, c, d), point_segment_distance(b, c, d)
+        , point_segment_distance(c, a, b), point_segment_distance(d, a, b) });
+}
+
+/* The points a command is drawn through, in page pixels; empty for text. */
+static void command_outline(const gs_drawing_texture *texture, const draw_command &command,
+    std::vector<z_point> &outline)
+{
+    const auto width = static_cast<float>(texture->width);
+    const auto height = static_cast<float>(texture->height);
+    outline.clear();
+
+    if (command.type == DRAW_PEN || command.type == DRAW_LINE) {
+        for (const auto &point : command.points)
+            outline.push_back({ point.x * width, point.y * height });
+        return;
+    }
+
+    if ((command.type != DRAW_RECT && command.type != DRAW_CIRCLE) || command.points.size() < 2)
+        return;
+
+    const float x0 = command.points[0].x * width;
+    const float y0 = command.points[0].y * height;
+    const float x1 = command.points[1].x * width;
+    const float y1 = command.points[1].y * height;
+    if (command.type == DRAW_RECT) {
+        outline = { { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y1 }, { x0, y0 } };
+        return;
+    }
+
+    const size_t segments = 48;
+    for (size_t i = 0; i <= segments; i++) {
+        const float angle = 6.28318530717958647692f * static_cast<float>(i) / static_cast<float>(segments);
+        outline.push_back({ (x0 + x1) * 0.5f + std::cos(angle) * (x1 - x0) * 0.5f
+            , (y0 + y1) * 0.5f + std::sin(angle) * (y1 - y0) * 0.5f });
+    }
+}
+
+/* Whether the eraser moving from a to b, in page pixels, touches a command. */
+static bool eraser_hits(const gs_drawing_texture *texture, const draw_command &command,
+    const z_point &a, const z_point &b, float radius)
+{
+    // text and images are taken anywhere in their bounds, which the caller
+    // found them by
+    std::vector<z_point> outline;
+    command_outline(texture, command, outline);
+    if (outline.empty())
+        return command.type == DRAW_TEXT || command.type == DRAW_IMAGE;
+
+    const float reach = radius + std::max(command.size * static_cast<float>(texture->height), 1.0f) * 0.5f;
+    if (outline.size() == 1)
+        return point_segment_distance(outline[0], a, b) <= reach;
+
+    for (size_t i = 1; i < outline.size(); i++) {
+        if (segment_distance(outline[i - 1], outline[i], a, b) <= reach)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Takes the commands the eraser touches moving from a to b out of the
+ * page, and draws the region they covered again without them.  The index
+ * keeps this to the commands near the eraser.  Page target bound.
+ */
+static void erase_under(SourceManager *context, gs_drawing_texture *texture, const z_point &a, const z_point &b,
+    float radius)
+{
+    sync_index(context, texture);
+    const auto &commands = texture->history.Commands();
+    const size_t applied = texture->history.Applied();
+    const size_t first = first_shown(texture, applied);
+
+    std::vector<uint32_t> found;
+    texture->index.Query({ std::min(a.x, b.x) - radius, std::min(a.y, b.y) - radius
+        , std::max(a.x, b.x) + radius, std::max(a.y, b.y) + radius }, applied, found);
+
+    index_rect region = empty_rect();
+    for (uint32_t index : found) {
+        if (index < first || !shown(texture, index, applied)
+            || !eraser_hits(texture, commands[index], a, b, radius))
+            continue;
+
+        auto &erasing = texture->erasing;
+        erasing.insert(std::upper_bound(erasing.begin(), erasing.end(), index), index);
+        grow_rect(region, texture->index.Bounds(index));
+    }
+    if (region.x1 < region.x0)
+        return;
+
+    if (texture->infinite) {
+        invalidate_world_rect(context, texture, region);
+        texture->world.dirty = true;
+    }
+    else {
+        redraw_region(context, texture, region, applied);
+    }
+}
+
+/* Moves of the eraser take commands out of the page, committed as one erase on release. */
+static void eraser_event(SourceManager *context, gs_drawing_texture *texture, const canvas_event &event)
+{
+    const z_point point = page_point(texture, static_cast<float>(event.x), static_cast<float>(event.y));
+    const float radius = static_cast<float>(std::max(context->GetLineWidth(), 1)) * 0.5f / texture->view.zoom;
+
+    if (event.pressed)
+        texture->erasing.clear();
+
+    if (event.pressed || event.moving) {
+        const z_point from = event.pressed ? point : page_point(texture
+            , static_cast<float>(texture->line.start_x), static_cast<float>(texture->line.start_y));
+        erase_under(context, texture, from, point, radius);
+        texture->line.start_x = event.x;
+        texture->line.start_y = event.y;
+    }
+
+    if (event.released && !texture->erasing.empty()) {
+        // the erased commands as distances back from the erase
+        draw_command command;
+        command.type = DRAW_ERASE;
+        const size_t position = texture->history.Applied();
+        for (uint32_t index : texture->erasing)
+            command.targets.push_back(static_cast<uint32_t>(position - index));
+        texture->erasing.clear();
+        commit_command(context, texture, std::move(command));
+    }
+}
+
+/* Even-odd test of a point against a closed polygon. */
+static bool polygon_contains(const std::vector<z_point> &polygon, float x, float y)
+{
+    bool inside = false;
+    for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        const z_point &a = polygon[i];
+        const z_point &b = polygon[j];
+        if ((a.y > y) != (b.y > y) && x < (b.x - a.x) * (y - a.y) / (b.y - a.y) + a.x)
+            inside = !inside;
+    }
+    return inside;
+}
+
+/* Selects the shown commands the lasso closes around, wholly inside it. */
+static void select_lasso(SourceManager *context, gs_drawing_texture *texture)
+{
+    std::vector<z_point> polygon;
+    index_rect rect = empty_rect();
+    for (const auto &point : texture->lasso) {
+        polygon.push_back(page_point(texture, point.x, point.y));
+        grow_rect(rect, { polygon.back().x, polygon.back().y, polygon.back().x, polygon.back().y });
+    }
+
+    std::vector<uint32_t> selection;
+    if (polygon.size() >= 3) {
+        sync_index(context, texture);
+        const auto &commands = texture->history.Commands();
+        const size_t applied = texture->history.Applied();
+        const size_t first = first_shown(texture, applied);
+
+        std::vector<uint32_t> found;
+        std::vector<z_point> outline;
+        texture->index.Query(rect, applied, found);
+        for (uint32_t index : found) {
+            if (index < first || !shown(texture, index, applied))
+                continue;
+
+            // shapes and text by their bounds, strokes by their points
+            const index_rect &bounds = texture->index.Bounds(index);
+            command_outline(texture, commands[index], outline);
+            if (commands[index].type != DRAW_PEN && commands[index].type != DRAW_LINE)
+                outline = { { bounds.x0, bounds.y0 }, { bounds.x1, bounds.y0 }
+                    , { bounds.x1, bounds.y1 }, { bounds.x0, bounds.y1 } };
+
+            const bool inside = std::all_of(outline.begin(), outline.end(), [&polygon](const z_point &point) {
+                return polygon_contains(polygon, point.x, point.y);
+            });
+            if (inside && !outline.empty())
+                selection.push_back(index);
+        }
+    }
+    set_selection(context, texture, std::move(selection));
+}
+
+/*
+ * Draws the lasso over a copy of the page while it is dragged, and selects
+ * what it closes around on release.  Page target bound.
+ */
+static void lasso_event(SourceManager *context, gs_drawing_texture *texture, const canvas_event &event)
+{
+    const auto [width, height] = context->GetCanvasSize();
+    gs_texture_t *target = gs_texrender_get_texture(texture->texrender);
+
+    if (event.pressed) {
+        texture->lasso.clear();
+
+        // the page without the lasso, put back before each move draws it
+        gs_texrender_destroy(texture->tmp_render);
+        texture->tmp_render = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+        gs_texrender_reset(texture->tmp_render);
+        gs_texrender_begin(texture->tmp_render, width, height);
+        texture->copy_texture = gs_texrender_get_texture(texture->tmp_render);
+        gs_copy_texture(texture->copy_texture, target);
+        gs_texrender_end(texture->tmp_render);
+    }
+
+    if ((event.pressed || event.moving) && texture->copy_texture) {
+        z_point point;
+        point.x = static_cast<float>(event.x);
+        point.y = static_cast<float>(event.y);
+        if (texture->lasso.empty() || std::hypot(point.x - texture->lasso.back().x
+            , point.y - texture->lasso.back().y) >= 2.0f)
+            texture->lasso.push_back(point);
+
+        gs_copy_texture(target, texture->copy_texture);
+
+        draw_command path;
+        path.type = DRAW_LINE;
+        path.color = event.color;
+        path.size = 2.0f / static_cast<float>(height);
+        for (const auto &item : texture->lasso)
+            path.points.push_back(canvas_fraction(item.x, item.y, width, height));
+        replay_command(context, texture, path, NOT_IN_HISTORY, width, height);
+    }
+
+    if (event.released) {
+        if (texture->copy_texture)
+            gs_copy_texture(target, texture->copy_texture);
+        gs_texrender_destroy(texture->tmp_render);
+        texture->tmp_render = NULL;
+        texture->copy_texture = NULL;
+
+        select_lasso(context, texture);
+        texture->lasso.clear();
+    }
+}
+
+/*
+ * Adds the segments of a translucent pen stroke to its coverage and draws
+ * the stroke so far over the page as it was at the press, so the ink of
+ * its joints is laid once.  Page target bound, stroke blending set.
+ */
+static void draw_pen_coverage(gs_drawing_texture *texture, const std::vector<stroke_vertex> &segments, const vec4 *color)
+{
+    gs_effect_t *effect = stroke_effect();
+    const bool first = texture->pen_bounds[0] > texture->pen_bounds[2];
+
+    if (!texture->copy_texture || !texture->pen_coverage.Begin(first)) {
+        while (gs_effect_loop(effect, "Draw"))
+            stroke_draw(segments.data(), segments.size());
+        return;
+    }
+
+    while (gs_effect_loop(effect, "Coverage"))
+        stroke_draw(segments.data(), segments.size());
+    texture->pen_coverage.End();
+    stroke_grow_bounds(segments.data(), segments.size(), texture->pen_bounds);
+
+    gs_copy_texture(gs_texrender_get_texture(texture->texrender), texture->copy_texture);
+    texture->pen_coverage.Composite(color, texture->pen_bounds);
+}
+
+/* Draws one input event into the page, whose target is bound. */
+static void draw_canvas_event(SourceManager *context, gs_drawing_texture *draw_texture, const canvas_event &event)
+{
+    const int32_t mouse_x = event.x;
+    const int32_t mouse_y = event.y;
+    const bool pressed = event.pressed;
+    const bool moving = event.moving;
+    const bool released = event.released;
+    const uint32_t color = event.color;
+    const int shapeType = event.shape_type;
+
+    // the eraser and lasso draw into the page themselves
+    if (shapeType == DRAW_ERASE || shapeType == DRAW_LASSO) {
+        if (event.size > 0)
+            context->SetLineWidth(event.size);
+        if (shapeType == DRAW_ERASE)
+            eraser_event(context, draw_texture, event);
+        else
+            lasso_event(context, draw_texture, event);
+        return;
+    }
+
+    // pens and lines get smooth edges, shapes stay solid
+    gs_effect_t *stroke = shapeType == DRAW_PEN || shapeType == DRAW_LINE ? stroke_effect() : nullptr;
+    gs_effect_t *solid = stroke ? stroke : obs_get_base_effect(OBS_EFFECT_SOLID);
+    const bool smooth = stroke != nullptr;
+    // capsules of the segments drawn by this event, when smooth
+    std::vector<stroke_vertex> segments;
+    std::vector<stroke_vertex> *capsules = smooth ? &segments : nullptr;
+
+    gs_eparam_t *effectcolor = gs_effect_get_param_by_name(solid, "color");
+    gs_technique_t *tech = gs_effect_get_technique(solid, smooth ? "Draw" : "Solid");
+
+    vec4 colorVal;
+    mis_rgba_to_vec4(color, &colorVal);
+    // translucent pens are composited from their coverage, see draw_pen_coverage
+    const bool layered = smooth && shapeType == DRAW_PEN && colorVal.w < 1.0f;
+
+    const auto [canvas_width, canvas_height] = context->GetCanvasSize();
+
+    if (event.size > 0)
+        context->SetLineWidth(event.size);
+
+    gs_effect_set_vec4(effectcolor, &colorVal);
+
+    if (smooth) {
+        gs_blend_state_push();
+        gs_enable_blending(true);
+        gs_blend_function_separate(GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA
+            , GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+    }
+
+    gs_technique_begin(tech);
+    gs_technique_begin_pass(tech, 0);
+    gs_render_start(false);
+
+    z_point p;
+    p.x = static_cast<float>(mouse_x);
     p.y = static_cast<float>(mouse_y);
 
     if (!draw_texture->point_array)
@@ -675,7 +2709,7 @@ static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool
 
     if (pressed && context) {
 
-        if (shapeType != DRAW_PEN) {
+        if (shapeType != DRAW_PEN || layered) {
             if (!draw_texture->tmp_render) {
                 gs_texrender_destroy(draw_texture->tmp_render);
                 draw_texture->tmp_render = NULL;
@@ -696,12 +2730,25 @@ static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool
 
         switch (shapeType) {
 
-        case DRAW_PEN:
+        case DRAW_PEN: {
+            // a stroke keeps the width of its press
+            const int32_t pen_width = event.pressure < 0.0f ? context->GetLineWidth()
+                : std::max(static_cast<int32_t>(std::lround(static_cast<float>(context->GetLineWidth())
+                    * std::min(event.pressure, 1.0f))), 1);
 
             draw_texture->line.start_x = mouse_x;
             draw_texture->line.start_y = mouse_y;
             draw_texture->line.base.rgba = color;
-            draw_texture->line.base.width = context->GetLineWidth();
+            draw_texture->line.base.width = pen_width;
+            draw_texture->pen_bounds[0] = draw_texture->pen_bounds[1] = FLT_MAX;
+            draw_texture->pen_bounds[2] = draw_texture->pen_bounds[3] = -FLT_MAX;
+
+            draw_texture->stroke = draw_command();
+            draw_texture->stroke.type = DRAW_PEN;
+            draw_texture->stroke.color = color;
+            draw_texture->stroke.size = canvas_height ? static_cast<float>(pen_width)
+                / static_cast<float>(canvas_height) / draw_texture->view.zoom : 0.0f;
+
             if (draw_texture->point_array) {
                 z_insert_point(draw_texture->point_array, p);
                 for (int i = 0; i < draw_texture->point_array->len - 1; ++i) {
@@ -712,21 +2759,26 @@ static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool
                     }
                     draw_texture->line.end_x = static_cast<int32_t>(draw_texture->point_array->point[i + 1].p.x);
                     draw_texture->line.end_y = static_cast<int32_t>(draw_texture->point_array->point[i + 1].p.y);
-                    mis_setup_line(&draw_texture->line);
+                    record_pen_segment(context, draw_texture);
+                    emit_segment(&draw_texture->line, capsules);
                 }
                 draw_texture->point.index = draw_texture->point_array->len - 1;
 
                 draw_texture->line.end_x = static_cast<int32_t>(draw_texture->point_array->point[draw_texture->point.index].p.x);
                 draw_texture->line.end_y = static_cast<int32_t>(draw_texture->point_array->point[draw_texture->point.index].p.y);
 
-                mis_setup_line(&draw_texture->line);
+                record_pen_segment(context, draw_texture);
+                emit_segment(&draw_texture->line, capsules);
             }
 
             break;
+        }
         case DRAW_LINE:
 
             draw_texture->line.start_x = mouse_x;
             draw_texture->line.start_y = mouse_y;
+            draw_texture->line.end_x = mouse_x;
+            draw_texture->line.end_y = mouse_y;
             draw_texture->line.base.rgba = color;
             draw_texture->line.base.width = context->GetLineWidth();
 
@@ -735,6 +2787,8 @@ static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool
 
             draw_texture->rect.x = mouse_x;
             draw_texture->rect.y = mouse_y;
+            draw_texture->rect.width = 0;
+            draw_texture->rect.height = 0;
             draw_texture->rect.base.rgba = color;
             draw_texture->rect.base.width = context->GetLineWidth();
 
@@ -743,6 +2797,8 @@ static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool
 
             draw_texture->point.x = mouse_x;
             draw_texture->point.y = mouse_y;
+            draw_texture->point.width = 0;
+            draw_texture->point.height = 0;
 
             draw_texture->point.base.rgba = color;
             draw_texture->point.radius = 1;
@@ -782,7 +2838,8 @@ static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool
 
                 draw_texture->line.end_x = x;
                 draw_texture->line.end_y = y;
-                mis_setup_line(&draw_texture->line);
+                record_pen_segment(context, draw_texture);
+                emit_segment(&draw_texture->line, capsules);
                 draw_texture->line.start_x = x;
                 draw_texture->line.start_y = y;
             }
@@ -798,22 +2855,21 @@ static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool
             draw_texture->line.end_x = mouse_x;
             draw_texture->line.end_y = mouse_y;
 
-            mis_setup_line(&draw_texture->line);
+            emit_segment(&draw_texture->line, capsules);
             break;
 
         case DRAW_RECT:
             draw_texture->rect.width = mouse_x - draw_texture->rect.x;
             draw_texture->rect.height = mouse_y - draw_texture->rect.y;
 
-            mis_setup_rectangle(&draw_texture->rect);
+            mis_draw_rectangle(draw_texture);
             break;
 
         case DRAW_CIRCLE:
-            draw_texture->point.radius = (mouse_x - draw_texture->point.x) / 2;
             draw_texture->point.width = mouse_x - draw_texture->point.x;
             draw_texture->point.height = mouse_y - draw_texture->point.y;
 
-            mis_setup_circle_point(&draw_texture->point);
+            mis_draw_ellipse(draw_texture);
             break;
 
         default:
@@ -822,37 +2878,35 @@ static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool
 
     }
     if (released) {
-        int32_t page_index = 0;
-        std::string cur_str = "";
+        draw_command clear;
         switch (shapeType) {
         case DRAW_PEN:
             z_drop_fpoint_array(draw_texture->point_array);
             draw_texture->point_array = nullptr;
             draw_texture->point.index = 0;
-            break;
-        case DRAW_TEXT:
-            if (draw_texture->image_texture) {
-                gs_texture_t *render_targat = gs_texrender_get_texture(draw_texture->texrender);
-                gs_copy_texture(render_targat, draw_texture->image_texture);
-                draw_texture->render_text = false;
-                gs_texture_destroy(draw_texture->image_texture);
-                draw_texture->image_texture = nullptr;
-            }
-            break;
 
+            if (draw_texture->stroke.points.size() >= 2)
+                commit_command(context, draw_texture, std::move(draw_texture->stroke));
+            draw_texture->stroke = draw_command();
+
+            gs_texrender_destroy(draw_texture->tmp_render);
+            draw_texture->tmp_render = NULL;
+            draw_texture->copy_texture = NULL;
+            draw_texture->pen_coverage.Free();
+            break;
         case DRAW_LINE:
         case DRAW_RECT:
         case DRAW_CIRCLE:
             gs_texrender_destroy(draw_texture->tmp_render);
             draw_texture->tmp_render = NULL;
             draw_texture->copy_texture = NULL;
+            record_shape(context, draw_texture, static_cast<draw_type>(shapeType));
             break;
 
         case DRAW_CLEAR:
-            page_index = context->GetCurrentKeyCurrentPage();
-            cur_str = context->GetCurrentKey();
-            context->RemovePage(cur_str, page_index);
-            context->AddPage(cur_str, page_index);
+            clear.type = DRAW_CLEAR;
+            replay_command(context, draw_texture, clear, NOT_IN_HISTORY, canvas_width, canvas_height);
+            commit_command(context, draw_texture, std::move(clear));
             break;
 
         default:
@@ -861,10 +2915,193 @@ static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool
     }
 
     gs_render_stop(GS_TRISTRIP);
+    if (smooth && !layered)
+        stroke_draw(segments.data(), segments.size());
 
     gs_technique_end_pass(tech);
     gs_technique_end(tech);
-    gs_texrender_end(draw_texture->texrender);
+    if (layered && !segments.empty())
+        draw_pen_coverage(draw_texture, segments, &colorVal);
+    if (smooth)
+        gs_blend_state_pop();
+
+    if (released && shapeType == DRAW_TEXT && draw_texture->blit_pending)
+        commit_blit(context, draw_texture);
+    if (released && shapeType == DRAW_TEXT && draw_texture->text_pending)
+        commit_text(context, draw_texture);
+}
+
+static bool begin_page_target(SourceManager *context, gs_drawing_texture *texture)
+{
+    const auto [width, height] = context->GetCanvasSize();
+    gs_texrender_reset(texture->texrender);
+    if (!gs_texrender_begin(texture->texrender, width, height))
+        return false;
+
+    gs_ortho(0.0f, static_cast<float>(width), 0.0f, static_cast<float>(height),
+        -100.0f, 100.0f);
+    return true;
+}
+
+static bool is_shape_move(const canvas_event &event)
+{
+    return event.moving && !event.pressed && !event.released
+        && (event.shape_type == DRAW_LINE || event.shape_type == DRAW_RECT || event.shape_type == DRAW_CIRCLE);
+}
+
+/* Adds an event to a run to draw; moves of a shape replace the move before. */
+static void add_canvas_event(std::vector<canvas_event> &events, const canvas_event &event)
+{
+    if (!events.empty() && is_shape_move(event) && is_shape_move(events.back())
+        && events.back().shape_type == event.shape_type)
+        events.back() = event;
+    else
+        events.push_back(event);
+}
+
+/*
+ * Draws a run of input events into the current page, binding the page
+ * once however many there are.  Graphics context entered.
+ */
+static void draw_canvas_events(SourceManager *context, const std::vector<canvas_event> &events)
+{
+    gs_drawing_texture *texture = context->GetCurrentPageTexture();
+    if (events.empty() || !texture)
+        return;
+
+    prepare_page_target(context, texture);
+    if (!unpark_page(context, texture))
+        return;
+
+    bool bound = false;
+    for (const auto &item : events) {
+        if (item.shape_type == DRAW_UNDO || item.shape_type == DRAW_REDO) {
+            if (!item.released)
+                continue;
+
+            // undo redraws the page itself
+            if (bound)
+                gs_texrender_end(texture->texrender);
+            bound = false;
+
+            if (item.shape_type == DRAW_UNDO)
+                page_undo(context, texture);
+            else
+                page_redo(context, texture);
+            continue;
+        }
+
+        if (!bound && !(bound = begin_page_target(context, texture)))
+            return;
+
+        draw_canvas_event(context, texture, item);
+
+        if (item.released && !texture->infinite && texture->history.NeedsCheckpoint()) {
+            gs_texrender_end(texture->texrender);
+            bound = false;
+            capture_checkpoint(texture, texture->history.Applied());
+        }
+    }
+
+    if (bound)
+        gs_texrender_end(texture->texrender);
+}
+
+/*
+ * Draws the input queued since the last frame into the current page.
+ * Moves of a shape redraw the whole preview, so only the last of a run is
+ * drawn.  Graphics context entered.
+ */
+static void flush_canvas_events(SourceManager *context)
+{
+    std::vector<canvas_event> events;
+    canvas_event event;
+    while (context->PopCanvasEvent(event))
+        add_canvas_event(events, event);
+
+    draw_canvas_events(context, events);
+}
+
+/*
+ * Queues an input event for the next frame.  The host delivers input from
+ * one thread, which never takes the graphics lock unless frames stall
+ * long enough to fill the queue.
+ */
+static void draw_canvas_data(void *data, int32_t mouse_x, int32_t mouse_y, bool pressed, bool moving, bool released, uint32_t color, int shapeType, int size)
+{
+    if (!data)
+        return;
+
+    const auto context = reinterpret_cast<SourceManager *>(data);
+
+    canvas_event event;
+    event.x = mouse_x;
+    event.y = mouse_y;
+    event.color = color;
+    event.shape_type = shapeType;
+    event.size = size;
+    event.pressure = -1.0f;
+    event.pressed = pressed;
+    event.moving = moving;
+    event.released = released;
+    if (context->PushCanvasEvent(event))
+        return;
+
+    obs_enter_graphics();
+    flush_canvas_events(context);
+    context->PushCanvasEvent(event);
+    obs_leave_graphics();
+}
+
+/*
+ * Draws an array of draw_canvas_sample in one graphics section, after the
+ * input already queued, so high rate pens and remote producers pay for
+ * the lock and the page bind once per batch rather than per sample.
+ * Samples are drawn in timestamp order; ones older than the last batch
+ * drawn arrived late and are dropped.
+ */
+static void draw_source_draw_canvas_batch_proc(void *data, calldata_t *cd)
+{
+    const auto context = reinterpret_cast<SourceManager *>(data);
+    const auto samples = static_cast<const draw_canvas_sample *>(calldata_ptr(cd, "samples"));
+    const long long count = calldata_int(cd, "count");
+    if (!samples || count <= 0)
+        return;
+
+    std::vector<const draw_canvas_sample *> order(static_cast<size_t>(count));
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = &samples[i];
+    // without timestamps samples keep the order they were given in
+    if (std::all_of(order.begin(), order.end(), [](const draw_canvas_sample *sample) { return sample->timestamp; }))
+        std::stable_sort(order.begin(), order.end(), [](const draw_canvas_sample *a, const draw_canvas_sample *b) {
+            return a->timestamp < b->timestamp;
+        });
+
+    obs_enter_graphics();
+    flush_canvas_events(context);
+
+    const uint64_t last = context->GetLastSampleTime();
+    std::vector<canvas_event> events;
+    events.reserve(order.size());
+    for (const draw_canvas_sample *sample : order) {
+        if (sample->timestamp && sample->timestamp < last)
+            continue;
+
+        canvas_event event;
+        event.x = sample->x;
+        event.y = sample->y;
+        event.color = sample->color;
+        event.shape_type = sample->shape_type;
+        event.size = sample->size;
+        event.pressure = sample->pressure;
+        event.pressed = sample->pressed;
+        event.moving = sample->moving;
+        event.released = sample->released;
+        add_canvas_event(events, event);
+        context->SetLastSampleTime(std::max(context->GetLastSampleTime(), sample->timestamp));
+    }
+
+    draw_canvas_events(context, events);
     obs_leave_graphics();
 }
 
@@ -874,59 +3111,136 @@ static void draw_page_change(void *data, const char *key, int32_t page_index)
     if (!context || page_index < 0)
         return;
 
+    // input queued before the change belongs to the old page
+    obs_enter_graphics();
+    flush_canvas_events(context);
+    gs_drawing_texture *previous = context->GetCurrentPageTexture();
+
     if (key) {
         if (!context->HasKey(key)) {
-            if (!context->AddKey(key))
+            if (!context->AddKey(key)) {
+                obs_leave_graphics();
                 return;
+            }
         }
         context->SetCurrentKey(key);
     }
 
     context->SetCurrentPage(page_index);
+    context->LogOperation(JOURNAL_PAGE);
+    // another source may still show it
+    if (previous && !previous->shown)
+        park_page(context, previous);
+    obs_leave_graphics();
 
     draw_info_changed(data, context->props);
 }
 
+/* swaps R and B of a row of pixels, four at a time with SSE2 */
+static void bgra_to_rgba(const uint8_t *in, uint8_t *out, uint32_t width, bool opaque)
+{
+    const uint32_t alpha = opaque ? 0xFF000000 : 0;
+    uint32_t x = 0;
+
+#ifdef DRAW_SOURCE_SSE2
+    const __m128i green_alpha = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+    const __m128i low_byte = _mm_set1_epi32(0xFF);
+    const __m128i alpha_bits = _mm_set1_epi32(static_cast<int>(alpha));
+    for (; x + 4 <= width; x += 4) {
+        const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + x * 4));
+        __m128i res = _mm_and_si128(px, green_alpha);
+        res = _mm_or_si128(res, _mm_and_si128(_mm_srli_epi32(px, 16), low_byte));
+        res = _mm_or_si128(res, _mm_slli_epi32(_mm_and_si128(px, low_byte), 16));
+        res = _mm_or_si128(res, alpha_bits);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x * 4), res);
+    }
+#endif
+
+    for (; x < width; x++) {
+        uint32_t px;
+        memcpy(&px, in + x * 4, sizeof(px));
+        px = (px & 0xFF00FF00) | ((px >> 16) & 0xFF) | ((px & 0xFF) << 16) | alpha;
+        memcpy(out + x * 4, &px, sizeof(px));
+    }
+}
+
+/*
+ * Writes the frame into the top left of the page's upload texture, keeping
+ * its RGBA pixels for the history.  The texture grows in steps so a line
+ * of text being typed reuses it.
+ */
+static bool upload_blit(gs_drawing_texture *texture, const obs_source_frame *frame)
+{
+    const uint32_t step = 64;
+    gs_texture_t *tex = texture->blit_texture;
+
+    if (!tex || gs_texture_get_width(tex) < frame->width
+        || gs_texture_get_height(tex) < frame->height) {
+        const uint32_t width = (std::max(frame->width, tex ? gs_texture_get_width(tex) : 0) + step - 1) / step * step;
+        const uint32_t height = (std::max(frame->height, tex ? gs_texture_get_height(tex) : 0) + step - 1) / step * step;
+
+        if (tex)
+            gs_texture_destroy(tex);
+        tex = gs_texture_create(width, height, GS_RGBA, 1, nullptr, GS_DYNAMIC);
+        texture->blit_texture = tex;
+        if (!tex)
+            return false;
+    }
+
+    // converted into the copy the history keeps, then uploaded from it
+    const size_t row_bytes = static_cast<size_t>(frame->width) * 4;
+    texture->blit_pixels.resize(static_cast<size_t>(frame->width) * frame->height);
+    auto *pixels = reinterpret_cast<uint8_t *>(texture->blit_pixels.data());
+    const bool swap = frame->format != VIDEO_FORMAT_RGBA;
+    for (uint32_t y = 0; y < frame->height; y++) {
+        const uint8_t *in = frame->data[0] + static_cast<size_t>(y) * frame->linesize[0];
+        uint8_t *out = pixels + static_cast<size_t>(y) * row_bytes;
+        if (swap)
+            bgra_to_rgba(in, out, frame->width, frame->format == VIDEO_FORMAT_BGRX);
+        else
+            memcpy(out, in, row_bytes);
+    }
+
+    uint8_t *ptr;
+    uint32_t linesize;
+    if (!gs_texture_map(tex, &ptr, &linesize))
+        return false;
+
+    for (uint32_t y = 0; y < frame->height; y++)
+        memcpy(ptr + static_cast<size_t>(y) * linesize, pixels + static_cast<size_t>(y) * row_bytes, row_bytes);
+
+    gs_texture_unmap(tex);
+    return true;
+}
+
 static void draw_source_set_video_frame(void *data, int x, int y, struct obs_source_frame *frame)
 {
     const auto context = reinterpret_cast<SourceManager *>(data);
     if (!context || !frame)
         return;
 
-    const auto texture = context->GetCurrentPageTexture();
-    const uint32_t canvas_width = std::get<0>(context->GetCanvasSize());
-    const uint32_t canvas_height = std::get<1>(context->GetCanvasSize());
+    if (frame->format != VIDEO_FORMAT_RGBA && frame->format != VIDEO_FORMAT_BGRA
+        && frame->format != VIDEO_FORMAT_BGRX) {
+        warn("unsupported blit format %s", get_video_format_name(frame->format));
+        return;
+    }
 
     obs_enter_graphics();
-    if (!texture->image_texture) {
-        texture->image_texture = gs_texture_create(canvas_width
-            , canvas_height
-            , GS_RGBA
-            , 1
-            , nullptr
-            , 0);
-    }
-
-    if (texture->image_texture) {
-        const auto tmp_texture = gs_texture_create(frame->width
-            , frame->height
-            , GS_RGBA
-            , 1
-            , const_cast<const uint8_t **>(&frame->data[0])
-            , 0);
-        gs_texrender_reset(texture->texrender);
-        gs_texrender_begin(texture->texrender
-            , canvas_width
-            , canvas_height);
-        gs_copy_texture(texture->image_texture, gs_texrender_get_texture(texture->texrender));
-        gs_texrender_end(texture->texrender);
-        gs_copy_texture_region(texture->image_texture, x, y
-            , tmp_texture, 0, 0, frame->width,
-            frame->height);
-        texture->render_text = true;
-        gs_texture_destroy(tmp_texture);
+    flush_canvas_events(context);
+
+    const auto texture = context->GetCurrentPageTexture();
+    if (!texture) {
+        obs_leave_graphics();
+        return;
     }
 
+    if (upload_blit(texture, frame)) {
+        texture->blit_x = x;
+        texture->blit_y = y;
+        texture->blit_width = frame->width;
+        texture->blit_height = frame->height;
+        texture->blit_pending = true;
+    }
     obs_leave_graphics();
 }
 
@@ -940,6 +3254,8 @@ bool obs_module_load(void)
     drawing_source_info.create = draw_source_create;
     drawing_source_info.destroy = draw_source_destroy;
     drawing_source_info.update = draw_source_update;
+    drawing_source_info.get_defaults = draw_source_defaults;
+    drawing_source_info.save = draw_source_save;
     drawing_source_info.show = draw_source_show;
     drawing_source_info.hide = draw_source_hide;
     drawing_source_info.get_properties = draw_source_properties;
@@ -956,5 +3272,9 @@ bool obs_module_load(void)
     return true;
 }
 
-
+void obs_module_unload(void)
+{
+    text_free_resources();
+    stroke_free_resources();
+}
 
@@ -1,5 +1,42 @@
 #pragma once
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DRAW_SOURCE_SSE2
+#endif
+
+enum draw_type {
+    DRAW_NONE = 0,
+    DRAW_PEN = 1,
+    DRAW_CIRCLE = 2,
+    DRAW_RECT = 3,
+    DRAW_LINE = 4,
+    DRAW_TEXT = 9,
+    DRAW_CLEAR = 10,
+    DRAW_UNDO = 11,
+    DRAW_REDO = 12,
+    DRAW_ERASE = 13,
+    DRAW_LASSO = 14,
+    DRAW_IMAGE = 15,
+};
+
+// One input sample for the draw_canvas_batch proc, which draws a whole
+// array of them in one graphics section.  Fields match set_canvas_data;
+// timestamp is in nanoseconds, 0 when unknown, and pressure from 0 to 1,
+// or negative when the device has none.
+struct draw_canvas_sample {
+    uint64_t timestamp;
+    int32_t x;
+    int32_t y;
+    float pressure;
+    uint32_t color;
+    int32_t shape_type;
+    int32_t size;
+    bool pressed;
+    bool moving;
+    bool released;
+};
+
 struct draw_base
 {
     int32_t x1;
@@ -44,7 +81,6 @@ struct draw_point {
     int height;
     int line_width;
 
-    bool is_frist_draw;
     int index;
 };
 
@@ -0,0 +1,361 @@
+#include "glyph-atlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define warn(format, ...) blog(LOG_WARNING, "[draw_source] " format, ##__VA_ARGS__)
+
+// immediate mode holds 512 vertices, six per glyph
+#define QUADS_PER_BATCH 64
+
+#define MIN_PIXEL_SIZE 4
+#define MAX_PIXEL_SIZE 256
+
+static gs_effect_t *glyph_effect = nullptr;
+
+static uint32_t next_codepoint(const std::string &utf8, size_t &pos)
+{
+    const auto c = static_cast<uint8_t>(utf8[pos++]);
+    uint32_t cp;
+    int extra;
+
+    if (c < 0x80)
+        return c;
+    if ((c & 0xE0) == 0xC0) {
+        cp = c & 0x1F;
+        extra = 1;
+    }
+    else if ((c & 0xF0) == 0xE0) {
+        cp = c & 0x0F;
+        extra = 2;
+    }
+    else if ((c & 0xF8) == 0xF0) {
+        cp = c & 0x07;
+        extra = 3;
+    }
+    else {
+        return 0xFFFD;
+    }
+
+    for (; extra > 0; extra--) {
+        if (pos >= utf8.size() || (static_cast<uint8_t>(utf8[pos]) & 0xC0) != 0x80)
+            return 0xFFFD;
+        cp = (cp << 6) | (static_cast<uint8_t>(utf8[pos++]) & 0x3F);
+    }
+    return cp;
+}
+
+std::shared_ptr<GlyphAtlas> GlyphAtlas::Get(const std::string &font_file)
+{
+    static std::mutex registry_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<GlyphAtlas>> registry;
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto &entry = registry[font_file];
+    auto atlas = entry.lock();
+    if (!atlas) {
+        atlas = std::make_shared<GlyphAtlas>(font_file);
+        if (!atlas->IsValid())
+            return nullptr;
+        entry = atlas;
+    }
+    return atlas;
+}
+
+GlyphAtlas::GlyphAtlas(const std::string &font_file)
+{
+    if (FT_Init_FreeType(&m_library_) != 0) {
+        m_library_ = nullptr;
+        return;
+    }
+
+    if (FT_New_Face(m_library_, font_file.c_str(), 0, &m_face_) != 0) {
+        warn("failed to load font '%s'", font_file.c_str());
+        m_face_ = nullptr;
+        return;
+    }
+
+    m_pixels_.resize(static_cast<size_t>(ATLAS_SIZE) * ATLAS_SIZE);
+}
+
+GlyphAtlas::~GlyphAtlas()
+{
+    if (m_texture_) {
+        obs_enter_graphics();
+        gs_texture_destroy(m_texture_);
+        obs_leave_graphics();
+    }
+
+    if (m_face_)
+        FT_Done_Face(m_face_);
+    if (m_library_)
+        FT_Done_FreeType(m_library_);
+}
+
+bool GlyphAtlas::IsValid()
+{
+    return m_face_ != nullptr;
+}
+
+void GlyphAtlas::reset()
+{
+    std::fill(m_pixels_.begin(), m_pixels_.end(), 0);
+    m_glyphs_.clear();
+    m_shelf_x_ = 0;
+    m_shelf_y_ = 0;
+    m_shelf_height_ = 0;
+    m_dirty_ = true;
+}
+
+bool GlyphAtlas::pack(uint32_t width, uint32_t height, uint32_t &x, uint32_t &y)
+{
+    // one pixel of padding so linear filtering does not bleed
+    width += 1;
+    height += 1;
+
+    if (width > ATLAS_SIZE || height > ATLAS_SIZE)
+        return false;
+
+    if (m_shelf_x_ + width > ATLAS_SIZE) {
+        m_shelf_y_ += m_shelf_height_;
+        m_shelf_x_ = 0;
+        m_shelf_height_ = 0;
+    }
+    if (m_shelf_y_ + height > ATLAS_SIZE)
+        return false;
+
+    x = m_shelf_x_;
+    y = m_shelf_y_;
+    m_shelf_x_ += width;
+    m_shelf_height_ = std::max(m_shelf_height_, height);
+    return true;
+}
+
+const GlyphAtlas::glyph *GlyphAtlas::find_glyph(uint32_t codepoint, uint32_t pixel_size, bool &full)
+{
+    const uint64_t key = (static_cast<uint64_t>(pixel_size) << 32) | codepoint;
+    const auto find_item = m_glyphs_.find(key);
+    if (find_item != m_glyphs_.end())
+        return &find_item->second;
+
+    if (FT_Load_Char(m_face_, codepoint, FT_LOAD_RENDER) != 0)
+        return nullptr;
+
+    const FT_GlyphSlot slot = m_face_->glyph;
+    const FT_Bitmap &bitmap = slot->bitmap;
+
+    uint32_t x = 0;
+    uint32_t y = 0;
+    if (!pack(bitmap.width, bitmap.rows, x, y)) {
+        full = true;
+        return nullptr;
+    }
+
+    for (uint32_t row = 0; row < bitmap.rows; row++) {
+        const uint8_t *in = bitmap.buffer + static_cast<ptrdiff_t>(row) * bitmap.pitch;
+        memcpy(&m_pixels_[static_cast<size_t>(y + row) * ATLAS_SIZE + x], in, bitmap.width);
+    }
+    if (bitmap.rows)
+        m_dirty_ = true;
+
+    glyph g;
+    g.x = static_cast<uint16_t>(x);
+    g.y = static_cast<uint16_t>(y);
+    g.width = static_cast<uint16_t>(bitmap.width);
+    g.height = static_cast<uint16_t>(bitmap.rows);
+    g.left = static_cast<int16_t>(slot->bitmap_left);
+    g.top = static_cast<int16_t>(slot->bitmap_top);
+    g.advance = static_cast<float>(slot->advance.x) / 64.0f;
+
+    return &m_glyphs_.insert(std::pair(key, g)).first->second;
+}
+
+void GlyphAtlas::BuildQuads(const std::string &utf8, float x, float y, uint32_t pixel_size,
+    std::vector<glyph_quad> &quads)
+{
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    layout(utf8, x, y, pixel_size, quads);
+}
+
+void GlyphAtlas::BuildBitmaps(const std::string &utf8, float x, float y, uint32_t pixel_size,
+    std::vector<glyph_bitmap> &bitmaps)
+{
+    std::lock_guard<std::mutex> lock(m_mutex_);
+
+    std::vector<glyph_quad> quads;
+    layout(utf8, x, y, pixel_size, quads);
+
+    bitmaps.clear();
+    for (const auto &q : quads) {
+        glyph_bitmap bitmap;
+        bitmap.x = static_cast<int32_t>(std::lround(q.x0));
+        bitmap.y = static_cast<int32_t>(std::lround(q.y0));
+        bitmap.width = static_cast<uint32_t>(q.x1 - q.x0);
+        bitmap.height = static_cast<uint32_t>(q.y1 - q.y0);
+
+        const auto u = static_cast<uint32_t>(std::lround(q.u0 * ATLAS_SIZE));
+        const auto v = static_cast<uint32_t>(std::lround(q.v0 * ATLAS_SIZE));
+        bitmap.coverage.resize(static_cast<size_t>(bitmap.width) * bitmap.height);
+        for (uint32_t row = 0; row < bitmap.height; row++)
+            memcpy(&bitmap.coverage[static_cast<size_t>(row) * bitmap.width]
+                , &m_pixels_[static_cast<size_t>(v + row) * ATLAS_SIZE + u], bitmap.width);
+        bitmaps.push_back(std::move(bitmap));
+    }
+}
+
+/* Lays out the text, adding glyphs it needs.  Atlas locked. */
+void GlyphAtlas::layout(const std::string &utf8, float x, float y, uint32_t pixel_size,
+    std::vector<glyph_quad> &quads)
+{
+    quads.clear();
+    if (!m_face_)
+        return;
+
+    pixel_size = std::clamp<uint32_t>(pixel_size, MIN_PIXEL_SIZE, MAX_PIXEL_SIZE);
+    FT_Set_Pixel_Sizes(m_face_, 0, pixel_size);
+
+    const float ascender = static_cast<float>(m_face_->size->metrics.ascender) / 64.0f;
+    const float line_height = static_cast<float>(m_face_->size->metrics.height) / 64.0f;
+    const float scale = 1.0f / static_cast<float>(ATLAS_SIZE);
+
+    // when the atlas fills up mid string it starts over and the string is
+    // laid out again, so every quad refers to the same atlas contents
+    for (int attempt = 0; attempt < 2; attempt++) {
+        float pen_x = x;
+        float baseline = y + ascender;
+        bool full = false;
+
+        quads.clear();
+        for (size_t pos = 0; pos < utf8.size();) {
+            const uint32_t cp = next_codepoint(utf8, pos);
+            if (cp == '\n') {
+                pen_x = x;
+                baseline += line_height;
+                continue;
+            }
+
+            const glyph *g = find_glyph(cp, pixel_size, full);
+            if (full)
+                break;
+            if (!g)
+                continue;
+
+            if (g->width && g->height) {
+                glyph_quad q;
+                q.x0 = pen_x + g->left;
+                q.y0 = baseline - g->top;
+                q.x1 = q.x0 + g->width;
+                q.y1 = q.y0 + g->height;
+                q.u0 = g->x * scale;
+                q.v0 = g->y * scale;
+                q.u1 = (g->x + g->width) * scale;
+                q.v1 = (g->y + g->height) * scale;
+                quads.push_back(q);
+            }
+            pen_x += g->advance;
+        }
+
+        if (!full)
+            return;
+        reset();
+    }
+}
+
+gs_texture_t *GlyphAtlas::GetTexture()
+{
+    std::lock_guard<std::mutex> lock(m_mutex_);
+
+    if (!m_texture_) {
+        m_texture_ = gs_texture_create(ATLAS_SIZE, ATLAS_SIZE, GS_R8, 1, nullptr, GS_DYNAMIC);
+        m_dirty_ = true;
+    }
+
+    if (m_texture_ && m_dirty_) {
+        gs_texture_set_image(m_texture_, m_pixels_.data(), ATLAS_SIZE, false);
+        m_dirty_ = false;
+    }
+    return m_texture_;
+}
+
+static gs_effect_t *get_glyph_effect()
+{
+    if (!glyph_effect) {
+        char *file = obs_module_file("glyph.effect");
+        char *error = nullptr;
+        glyph_effect = gs_effect_create_from_file(file, &error);
+        if (!glyph_effect)
+            warn("failed to load glyph effect: %s", error ? error : "unknown error");
+        bfree(error);
+        bfree(file);
+    }
+    return glyph_effect;
+}
+
+void text_draw(GlyphAtlas *atlas, const draw_command &command,
+    uint32_t canvas_width, uint32_t canvas_height)
+{
+    if (!atlas || command.points.empty() || command.text.empty())
+        return;
+
+    gs_effect_t *effect = get_glyph_effect();
+    if (!effect)
+        return;
+
+    const auto pixel_size = static_cast<uint32_t>(
+        std::lround(command.size * static_cast<float>(canvas_height)));
+
+    std::vector<glyph_quad> quads;
+    atlas->BuildQuads(command.text
+        , command.points[0].x * static_cast<float>(canvas_width)
+        , command.points[0].y * static_cast<float>(canvas_height)
+        , pixel_size, quads);
+
+    gs_texture_t *tex = atlas->GetTexture();
+    if (!tex || quads.empty())
+        return;
+
+    vec4 color;
+    vec4_set(&color, (float)mis_get_rgba_r(command.color) / 0xff,
+        (float)mis_get_rgba_g(command.color) / 0xff,
+        (float)mis_get_rgba_b(command.color) / 0xff,
+        (float)mis_get_rgba_a(command.color) / 0xff);
+
+    gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"), tex);
+    gs_effect_set_vec4(gs_effect_get_param_by_name(effect, "color"), &color);
+
+    gs_blend_state_push();
+    gs_enable_blending(true);
+    gs_blend_function_separate(GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA
+        , GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
+    while (gs_effect_loop(effect, "Draw")) {
+        for (size_t i = 0; i < quads.size(); i += QUADS_PER_BATCH) {
+            const size_t end = std::min(quads.size(), i + QUADS_PER_BATCH);
+            gs_render_start(true);
+            for (size_t j = i; j < end; j++) {
+                const glyph_quad &q = quads[j];
+                gs_texcoord(q.u0, q.v0, 0); gs_vertex2f(q.x0, q.y0);
+                gs_texcoord(q.u1, q.v0, 0); gs_vertex2f(q.x1, q.y0);
+                gs_texcoord(q.u0, q.v1, 0); gs_vertex2f(q.x0, q.y1);
+                gs_texcoord(q.u1, q.v0, 0); gs_vertex2f(q.x1, q.y0);
+                gs_texcoord(q.u1, q.v1, 0); gs_vertex2f(q.x1, q.y1);
+                gs_texcoord(q.u0, q.v1, 0); gs_vertex2f(q.x0, q.y1);
+            }
+            gs_render_stop(GS_TRIS);
+        }
+    }
+
+    gs_blend_state_pop();
+}
+
+void text_free_resources()
+{
+    if (!glyph_effect)
+        return;
+
+    obs_enter_graphics();
+    gs_effect_destroy(glyph_effect);
+    glyph_effect = nullptr;
+    obs_leave_graphics();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "obs-module.h"
+#include "display-list.h"
+
+struct glyph_quad {
+    float x0, y0, x1, y1;
+    float u0, v0, u1, v1;
+};
+
+struct glyph_bitmap {
+    int32_t x, y;
+    uint32_t width, height;
+    // 8 bit coverage
+    std::vector<uint8_t> coverage;
+};
+
+// Glyphs rasterized with FreeType into one R8 texture shared by every
+// drawing source using the same font.  A glyph is rasterized and uploaded
+// the first time it is drawn at a size; after that a string costs one quad
+// per character.  When the atlas is full it starts over.
+class GlyphAtlas {
+public:
+    static std::shared_ptr<GlyphAtlas> Get(const std::string &font_file);
+
+    explicit GlyphAtlas(const std::string &font_file);
+    virtual ~GlyphAtlas();
+
+    bool IsValid();
+
+    // Lays out utf8 text with its top left corner at (x, y), in pixels.
+    void BuildQuads(const std::string &utf8, float x, float y, uint32_t pixel_size,
+        std::vector<glyph_quad> &quads);
+    // The same layout as coverage bitmaps, for drawing on the CPU.
+    void BuildBitmaps(const std::string &utf8, float x, float y, uint32_t pixel_size,
+        std::vector<glyph_bitmap> &bitmaps);
+
+    // Graphics thread.  Uploads glyphs added since the last call.
+    gs_texture_t *GetTexture();
+
+private:
+    struct glyph {
+        uint16_t x, y;
+        uint16_t width, height;
+        int16_t left, top;
+        float advance;
+    };
+
+    void layout(const std::string &utf8, float x, float y, uint32_t pixel_size,
+        std::vector<glyph_quad> &quads);
+    const glyph *find_glyph(uint32_t codepoint, uint32_t pixel_size, bool &full);
+    bool pack(uint32_t width, uint32_t height, uint32_t &x, uint32_t &y);
+    void reset();
+
+private:
+    static const uint32_t ATLAS_SIZE = 1024;
+
+    std::mutex m_mutex_;
+    FT_Library m_library_ { nullptr };
+    FT_Face m_face_ { nullptr };
+
+    std::vector<uint8_t> m_pixels_;
+    std::unordered_map<uint64_t, glyph> m_glyphs_;
+    uint32_t m_shelf_x_ = 0;
+    uint32_t m_shelf_y_ = 0;
+    uint32_t m_shelf_height_ = 0;
+    bool m_dirty_ = false;
+
+    gs_texture_t *m_texture_ { nullptr };
+};
+
+// Draws a DRAW_TEXT command into the current render target, scaled to a
+// canvas of canvas_width x canvas_height.  Graphics thread only.
+void text_draw(GlyphAtlas *atlas, const draw_command &command,
+    uint32_t canvas_width, uint32_t canvas_height);
+
+// Frees the text effect, from obs_module_unload.
+void text_free_resources();
@@ -0,0 +1,316 @@
+#include "journal.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "obs-module.h"
+#include "util/platform.h"
+#include "session-file.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define warn(format, ...) blog(LOG_WARNING, "[draw_source] " format, ##__VA_ARGS__)
+
+// size and checksum
+#define RECORD_HEADER 8
+
+static uint32_t checksum(const uint8_t *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template<typename T> static void put(std::vector<uint8_t> &out, const T &value)
+{
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T> static bool get(const uint8_t *&pos, const uint8_t *end, T &value)
+{
+    if (static_cast<size_t>(end - pos) < sizeof(T))
+        return false;
+    memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+static bool decode(const uint8_t *pos, const uint8_t *end, journal_record &record)
+{
+    uint8_t header[4];
+    uint32_t key_size;
+    if (!get(pos, end, record.sequence) || !get(pos, end, header) || !get(pos, end, record.page_index)
+        || !get(pos, end, key_size) || static_cast<size_t>(end - pos) < key_size)
+        return false;
+
+    record.op = static_cast<journal_op>(header[0]);
+    record.key.assign(reinterpret_cast<const char *>(pos), key_size);
+    pos += key_size;
+
+    if (record.op == JOURNAL_PUSH || record.op == JOURNAL_REDO)
+        return session_read_command(pos, end, record.command);
+    return record.op == JOURNAL_UNDO || record.op == JOURNAL_PAGE;
+}
+
+/*
+ * Copies the records after sequence out of a journal, and decodes them
+ * when records is given.  A torn or damaged record ends the journal.
+ * Returns false when anything was left out.
+ */
+static bool scan(const std::vector<uint8_t> &data, uint32_t sequence, std::vector<uint8_t> &kept,
+    std::vector<journal_record> *records)
+{
+    const uint8_t *pos = data.data();
+    const uint8_t *end = pos + data.size();
+    bool complete = true;
+
+    while (pos != end) {
+        const uint8_t *start = pos;
+        uint32_t size, sum;
+        if (!get(pos, end, size) || !get(pos, end, sum) || static_cast<size_t>(end - pos) < size
+            || checksum(pos, size) != sum)
+            return false;
+        pos += size;
+
+        journal_record record;
+        if (!decode(start + RECORD_HEADER, pos, record))
+            return false;
+
+        if (record.sequence <= sequence) {
+            complete = false;
+            continue;
+        }
+
+        kept.insert(kept.end(), start, pos);
+        if (records)
+            records->push_back(std::move(record));
+    }
+    return complete;
+}
+
+static bool read_file(const std::string &path, std::vector<uint8_t> &data)
+{
+    FILE *file = os_fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    const int64_t size = os_fgetsize(file);
+    if (size > 0) {
+        data.resize(static_cast<size_t>(size));
+        data.resize(fread(data.data(), 1, data.size(), file));
+    }
+    fclose(file);
+    return true;
+}
+
+/* Replaces the journal with the given records. */
+static bool replace_file(const std::string &path, const std::vector<uint8_t> &data)
+{
+    const std::string temp_path = path + ".tmp";
+    FILE *file = os_fopen(temp_path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+    return ok && os_safe_replace(path.c_str(), temp_path.c_str(), nullptr) == 0;
+}
+
+Journal::~Journal()
+{
+    Close();
+}
+
+bool Journal::Open(const std::string &path, uint32_t sequence, std::vector<journal_record> &records)
+{
+    Close();
+    m_path_ = path;
+
+    std::vector<uint8_t> data, kept;
+    if (read_file(path, data) && !scan(data, sequence, kept, &records)) {
+        if (!replace_file(path, kept))
+            warn("failed to trim journal '%s'", path.c_str());
+    }
+
+    m_sequence_ = records.empty() ? sequence : records.back().sequence;
+    m_suspended_ = false;
+
+    m_file_ = os_fopen(path.c_str(), "ab");
+    if (!m_file_) {
+        warn("failed to open journal '%s'", path.c_str());
+        return false;
+    }
+
+    m_file_bytes_ = kept.size();
+    m_unsynced_bytes_ = 0;
+    m_compaction_due_ = false;
+    m_compact_to_ = 0;
+    m_stop_ = false;
+    m_thread_ = std::thread(&Journal::thread_loop, this);
+    return true;
+}
+
+void Journal::Close()
+{
+    if (m_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex_);
+            m_stop_ = true;
+        }
+        m_cond_.notify_all();
+        m_thread_.join();
+    }
+
+    if (m_file_) {
+        fclose(m_file_);
+        m_file_ = nullptr;
+    }
+}
+
+void Journal::Append(journal_op op, const std::string &key, int32_t page_index, const draw_command *command)
+{
+    // the file belongs to the I/O thread, which runs while the journal is open
+    if (!m_thread_.joinable() || m_suspended_)
+        return;
+
+    std::vector<uint8_t> record;
+    record.reserve(64 + key.size() + (command ? command->points.size() * sizeof(z_point) : 0));
+    record.resize(RECORD_HEADER);
+
+    const uint8_t header[4] = { op, 0, 0, 0 };
+    put(record, m_sequence_ + 1);
+    put(record, header);
+    put(record, page_index);
+    put(record, static_cast<uint32_t>(key.size()));
+    record.insert(record.end(), key.begin(), key.end());
+    if (command)
+        session_write_command(*command, record);
+
+    const uint32_t size = static_cast<uint32_t>(record.size() - RECORD_HEADER);
+    const uint32_t sum = checksum(record.data() + RECORD_HEADER, size);
+    memcpy(record.data(), &size, sizeof(size));
+    memcpy(record.data() + sizeof(size), &sum, sizeof(sum));
+
+    if (!m_queue_.Push(std::move(record))) {
+        // the journal has a gap now, so stop until a save covers it
+        warn("journal queue full, saving the session instead");
+        m_suspended_ = true;
+        m_compaction_due_ = true;
+        return;
+    }
+    m_sequence_++;
+}
+
+uint32_t Journal::Checkpoint()
+{
+    m_suspended_ = false;
+    return m_sequence_;
+}
+
+void Journal::Compact(uint32_t sequence)
+{
+    if (sequence)
+        m_compact_to_ = sequence;
+}
+
+bool Journal::CompactionDue()
+{
+    return m_compaction_due_.exchange(false);
+}
+
+void Journal::thread_loop()
+{
+    bool compaction_asked = false;
+
+    std::unique_lock<std::mutex> lock(m_mutex_);
+    for (;;) {
+        m_cond_.wait_for(lock, std::chrono::milliseconds(20), [this] { return m_stop_; });
+        const bool stop = m_stop_;
+        lock.unlock();
+
+        write_pending();
+
+        const uint32_t compact_to = m_compact_to_.exchange(0);
+        if (compact_to) {
+            rewrite(compact_to);
+            compaction_asked = false;
+        }
+
+        if (m_unsynced_bytes_ && (stop || m_unsynced_bytes_ >= JOURNAL_SYNC_BYTES
+            || os_gettime_ns() - m_first_unsynced_ >= JOURNAL_SYNC_MS * 1000000ULL))
+            sync();
+
+        if (!compaction_asked && m_file_bytes_ >= JOURNAL_COMPACT_BYTES) {
+            compaction_asked = true;
+            m_compaction_due_ = true;
+        }
+
+        lock.lock();
+        if (stop)
+            return;
+    }
+}
+
+void Journal::write_pending()
+{
+    std::vector<uint8_t> record;
+    while (m_queue_.Pop(record)) {
+        if (!m_file_)
+            continue;
+
+        if (fwrite(record.data(), 1, record.size(), m_file_) != record.size()) {
+            warn("failed to write journal '%s'", m_path_.c_str());
+            continue;
+        }
+
+        if (!m_unsynced_bytes_)
+            m_first_unsynced_ = os_gettime_ns();
+        m_unsynced_bytes_ += record.size();
+        m_file_bytes_ += record.size();
+    }
+}
+
+void Journal::sync()
+{
+    m_unsynced_bytes_ = 0;
+    if (!m_file_ || fflush(m_file_) != 0)
+        return;
+
+#ifdef _WIN32
+    _commit(_fileno(m_file_));
+#else
+    fsync(fileno(m_file_));
+#endif
+}
+
+/* Drops the records up to sequence, keeping the ones appended since. */
+void Journal::rewrite(uint32_t sequence)
+{
+    if (!m_file_)
+        return;
+
+    sync();
+    fclose(m_file_);
+    m_file_ = nullptr;
+
+    std::vector<uint8_t> data, kept;
+    if (read_file(m_path_, data) && !scan(data, sequence, kept, nullptr)) {
+        if (replace_file(m_path_, kept))
+            data.swap(kept);
+        else
+            warn("failed to compact journal '%s'", m_path_.c_str());
+    }
+    m_file_bytes_ = data.size();
+
+    m_file_ = os_fopen(m_path_.c_str(), "ab");
+    if (!m_file_)
+        warn("failed to reopen journal '%s'", m_path_.c_str());
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "display-list.h"
+#include "spsc-queue.h"
+
+// Append-only log of the operations made since the session was last
+// saved, so a crash loses at most the records not yet synced.  Each
+// record is:
+//
+//   u32 payload size, u32 payload checksum, payload:
+//   u32 sequence, u8 op, u8[3] padding, i32 page index, u32 key length,
+//   key bytes, then the command of push and redo records
+//
+// Records are encoded by the graphics thread and handed to an I/O thread
+// through a lock-free queue, so drawing never waits for the disk.  The
+// I/O thread syncs the file every JOURNAL_SYNC_BYTES or JOURNAL_SYNC_MS,
+// and asks for a session save once the journal reaches
+// JOURNAL_COMPACT_BYTES; records the saved session includes are then
+// dropped from the file.
+#define JOURNAL_QUEUE_SIZE 4096
+#define JOURNAL_SYNC_BYTES (256 * 1024)
+#define JOURNAL_SYNC_MS 500
+#define JOURNAL_COMPACT_BYTES (4 * 1024 * 1024)
+
+enum journal_op : uint8_t {
+    JOURNAL_PUSH = 1,
+    JOURNAL_UNDO,
+    JOURNAL_REDO,
+    JOURNAL_PAGE,
+};
+
+struct journal_record {
+    uint32_t sequence;
+    journal_op op;
+    std::string key;
+    int32_t page_index;
+    draw_command command;
+};
+
+class Journal {
+public:
+    Journal() = default;
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+    virtual ~Journal();
+
+    // Reads the records after sequence, then appends to the file.
+    bool Open(const std::string &path, uint32_t sequence, std::vector<journal_record> &records);
+    // Writes and syncs everything appended so far.
+    void Close();
+
+    // Graphics thread only.
+    void Append(journal_op op, const std::string &key, int32_t page_index,
+        const draw_command *command = nullptr);
+    // Last sequence appended; a snapshot taken now includes it.
+    uint32_t Checkpoint();
+
+    // Drops the records up to sequence once a session including them is saved.
+    void Compact(uint32_t sequence);
+    // Set once, when the journal has grown enough to be worth a save.
+    bool CompactionDue();
+
+private:
+    void thread_loop();
+    void write_pending();
+    void sync();
+    void rewrite(uint32_t sequence);
+
+private:
+    std::string m_path_;
+    FILE *m_file_ { nullptr };
+
+    // producer side
+    uint32_t m_sequence_ = 0;
+    bool m_suspended_ = false;
+
+    SpscQueue<std::vector<uint8_t>, JOURNAL_QUEUE_SIZE> m_queue_;
+
+    // I/O thread side
+    size_t m_file_bytes_ = 0;
+    size_t m_unsynced_bytes_ = 0;
+    uint64_t m_first_unsynced_ = 0;
+
+    std::atomic<uint32_t> m_compact_to_ { 0 };
+    std::atomic<bool> m_compaction_due_ { false };
+
+    std::mutex m_mutex_;
+    std::condition_variable m_cond_;
+    bool m_stop_ = false;
+    std::thread m_thread_;
+};
@@ -0,0 +1,163 @@
+#include "page-history.h"
+
+static size_t command_bytes(const draw_command &command)
+{
+    return sizeof(command) + command.points.size() * sizeof(z_point) + command.text.size()
+        + command.targets.size() * sizeof(uint32_t) + command.pixels.size() * sizeof(uint32_t);
+}
+
+static size_t texture_bytes(gs_texture_t *texture)
+{
+    return static_cast<size_t>(gs_texture_get_width(texture)) * gs_texture_get_height(texture) * 4;
+}
+
+PageHistory::~PageHistory()
+{
+    DropCheckpoints();
+    gs_texture_destroy(m_base_);
+}
+
+void PageHistory::Restore(display_list &&commands, gs_texture_t *base)
+{
+    DropCheckpoints();
+    gs_texture_destroy(m_base_);
+
+    m_commands_ = std::move(commands);
+    m_applied_ = m_commands_.size();
+    m_log_bytes_ = 0;
+    for (const auto &command : m_commands_)
+        m_log_bytes_ += command_bytes(command);
+    m_base_ = base;
+    m_generation_++;
+}
+
+void PageHistory::Push(draw_command &&command)
+{
+    while (m_commands_.size() > m_applied_) {
+        m_log_bytes_ -= command_bytes(m_commands_.back());
+        m_commands_.pop_back();
+    }
+
+    while (!m_checkpoints_.empty() && m_checkpoints_.back().index > m_applied_) {
+        m_checkpoint_bytes_ -= texture_bytes(m_checkpoints_.back().texture);
+        gs_texture_destroy(m_checkpoints_.back().texture);
+        m_checkpoints_.pop_back();
+    }
+
+    m_log_bytes_ += command_bytes(command);
+    m_commands_.push_back(std::move(command));
+    m_applied_ = m_commands_.size();
+    fold_log();
+}
+
+bool PageHistory::Undo()
+{
+    if (m_applied_ == 0)
+        return false;
+
+    m_applied_--;
+    return true;
+}
+
+bool PageHistory::Redo()
+{
+    if (m_applied_ >= m_commands_.size())
+        return false;
+
+    m_applied_++;
+    return true;
+}
+
+const page_checkpoint *PageHistory::Nearest() const
+{
+    for (auto it = m_checkpoints_.rbegin(); it != m_checkpoints_.rend(); ++it) {
+        if (it->index <= m_applied_)
+            return &*it;
+    }
+    return nullptr;
+}
+
+bool PageHistory::NeedsCheckpoint() const
+{
+    const page_checkpoint *nearest = Nearest();
+    const size_t from = nearest ? nearest->index : 0;
+    return m_applied_ >= from + UNDO_CHECKPOINT_INTERVAL || m_log_bytes_ > UNDO_LOG_BYTES;
+}
+
+void PageHistory::AddCheckpoint(gs_texture_t *texture, size_t index)
+{
+    if (!texture)
+        return;
+
+    m_checkpoints_.push_back({ index, texture });
+    m_checkpoint_bytes_ += texture_bytes(texture);
+
+    // the base counts against the budget, and one checkpoint is always kept
+    while (m_checkpoints_.size() > 1
+        && m_checkpoint_bytes_ + (m_base_ ? texture_bytes(m_base_) : 0) > UNDO_CHECKPOINT_BYTES) {
+        if (!can_fold(m_checkpoints_.front()))
+            break;
+        fold(0);
+    }
+    fold_log();
+}
+
+void PageHistory::DropCheckpoints()
+{
+    for (const auto &checkpoint : m_checkpoints_)
+        gs_texture_destroy(checkpoint.texture);
+    m_checkpoints_.clear();
+    m_checkpoint_bytes_ = 0;
+}
+
+bool PageHistory::Fits(const draw_command &command) const
+{
+    return m_log_bytes_ + command_bytes(command) <= UNDO_LOG_BYTES;
+}
+
+bool PageHistory::can_fold(const page_checkpoint &checkpoint) const
+{
+    for (size_t i = checkpoint.index; i < m_commands_.size(); i++) {
+        for (uint32_t target : m_commands_[i].targets) {
+            if (target > i - checkpoint.index)
+                return false;
+        }
+    }
+    return true;
+}
+
+void PageHistory::fold(size_t position)
+{
+    const page_checkpoint folded = m_checkpoints_[position];
+    for (size_t i = 0; i < position; i++) {
+        m_checkpoint_bytes_ -= texture_bytes(m_checkpoints_[i].texture);
+        gs_texture_destroy(m_checkpoints_[i].texture);
+    }
+    m_checkpoints_.erase(m_checkpoints_.begin(), m_checkpoints_.begin() + static_cast<ptrdiff_t>(position) + 1);
+    m_checkpoint_bytes_ -= texture_bytes(folded.texture);
+
+    gs_texture_destroy(m_base_);
+    m_base_ = folded.texture;
+
+    for (size_t i = 0; i < folded.index; i++)
+        m_log_bytes_ -= command_bytes(m_commands_[i]);
+    m_commands_.erase(m_commands_.begin(), m_commands_.begin() + static_cast<ptrdiff_t>(folded.index));
+    m_applied_ -= folded.index;
+
+    for (auto &checkpoint : m_checkpoints_)
+        checkpoint.index -= folded.index;
+    m_generation_++;
+}
+
+/* Folds the oldest checkpoints the erases allow until the log fits. */
+void PageHistory::fold_log()
+{
+    while (m_log_bytes_ > UNDO_LOG_BYTES) {
+        size_t position = 0;
+        while (position < m_checkpoints_.size() && !can_fold(m_checkpoints_[position]))
+            position++;
+        if (position == m_checkpoints_.size())
+            return;
+        fold(position);
+    }
+}
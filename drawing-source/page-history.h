@@ -0,0 +1,87 @@
+#pragma once
+
+#include <deque>
+
+#include "obs-module.h"
+#include "display-list.h"
+
+// Undo history of a page: the log of committed commands plus raster
+// checkpoints taken every UNDO_CHECKPOINT_INTERVAL commands, so undo
+// restores the nearest checkpoint and replays at most that many commands.
+//
+// Checkpoints are limited to UNDO_CHECKPOINT_BYTES and the log to
+// UNDO_LOG_BYTES.  When either is exceeded the oldest checkpoint becomes
+// the base of the page and the commands before it can no longer be undone.
+// A checkpoint is not folded while a later erase still refers to a command
+// before it, since the base could not have that command taken out again;
+// the log then folds a later one.  A log over its limit with nothing to
+// fold asks for a checkpoint of the applied commands, which always folds,
+// so pages whose checkpoints were dropped are capped at the next commit.
+// Pages that take no checkpoints check Fits before they commit.
+//
+// Graphics thread only.
+#define UNDO_CHECKPOINT_INTERVAL 16
+#define UNDO_CHECKPOINT_BYTES (64 * 1024 * 1024)
+#define UNDO_LOG_BYTES (8 * 1024 * 1024)
+
+struct page_checkpoint {
+    // commands applied when the checkpoint was taken
+    size_t index;
+    gs_texture_t *texture;
+};
+
+class PageHistory {
+public:
+    PageHistory() = default;
+    PageHistory(const PageHistory &) = delete;
+    PageHistory &operator=(const PageHistory &) = delete;
+    virtual ~PageHistory();
+
+    // Replaces the history with a saved one; takes the base texture.
+    void Restore(display_list &&commands, gs_texture_t *base);
+
+    // Appends a command and drops everything that could be redone.
+    void Push(draw_command &&command);
+
+    bool Undo();
+    bool Redo();
+
+    const display_list &Commands() const { return m_commands_; }
+    size_t Applied() const { return m_applied_; }
+    // changes whenever commands are renumbered or replaced, other than by Push
+    uint64_t Generation() const { return m_generation_; }
+
+    // Latest checkpoint at or before the applied commands, or null.
+    const page_checkpoint *Nearest() const;
+
+    // Raster of the commands folded out of the log, or null.
+    gs_texture_t *Base() const { return m_base_; }
+
+    bool HasCheckpoints() const { return !m_checkpoints_.empty(); }
+    // also when the log is over UNDO_LOG_BYTES
+    bool NeedsCheckpoint() const;
+    // takes the texture, a raster of the first index commands
+    void AddCheckpoint(gs_texture_t *texture, size_t index);
+    void DropCheckpoints();
+
+    size_t LogBytes() const { return m_log_bytes_; }
+    // whether the log stays within UNDO_LOG_BYTES with the command
+    bool Fits(const draw_command &command) const;
+
+private:
+    bool can_fold(const page_checkpoint &checkpoint) const;
+    // folds the checkpoint at position and drops the ones before it
+    void fold(size_t position);
+    void fold_log();
+
+private:
+    display_list m_commands_;
+    size_t m_applied_ = 0;
+    uint64_t m_generation_ = 0;
+    size_t m_log_bytes_ = 0;
+
+    std::deque<page_checkpoint> m_checkpoints_;
+    size_t m_checkpoint_bytes_ = 0;
+
+    gs_texture_t *m_base_ { nullptr };
+};
@@ -0,0 +1,537 @@
+#include "session-file.h"
+
+#include <cstring>
+
+#include "util/platform.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define warn(format, ...) blog(LOG_WARNING, "[draw_source] " format, ##__VA_ARGS__)
+
+static const char session_magic[4] = { 'D', 'R', 'W', 'S' };
+
+struct session_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t page_count;
+    uint32_t journal_sequence;
+    uint64_t index_offset;
+    uint64_t index_size;
+};
+
+// top bit set: a run of the next pixel, otherwise that many literal pixels
+#define RLE_RUN 0x80000000u
+
+static void rle_encode(const std::vector<uint32_t> &pixels, std::vector<uint32_t> &words)
+{
+    const size_t count = pixels.size();
+    size_t i = 0;
+
+    while (i < count) {
+        size_t run = 1;
+        while (i + run < count && run < 0x7FFFFFFF && pixels[i + run] == pixels[i])
+            run++;
+
+        if (run >= 3) {
+            words.push_back(RLE_RUN | static_cast<uint32_t>(run));
+            words.push_back(pixels[i]);
+            i += run;
+            continue;
+        }
+
+        size_t literal = 0;
+        while (i + literal < count && literal < 0x7FFFFFFF) {
+            const size_t at = i + literal;
+            if (at + 2 < count && pixels[at] == pixels[at + 1] && pixels[at] == pixels[at + 2])
+                break;
+            literal++;
+        }
+        words.push_back(static_cast<uint32_t>(literal));
+        words.insert(words.end(), pixels.begin() + i, pixels.begin() + i + literal);
+        i += literal;
+    }
+}
+
+static bool rle_decode(const uint32_t *words, size_t count, std::vector<uint32_t> &pixels, size_t expected)
+{
+    size_t i = 0;
+    pixels.clear();
+    pixels.reserve(expected);
+
+    while (i < count) {
+        const uint32_t word = words[i++];
+        const size_t n = word & ~RLE_RUN;
+        if (pixels.size() + n > expected)
+            return false;
+
+        if (word & RLE_RUN) {
+            if (i >= count)
+                return false;
+            pixels.insert(pixels.end(), n, words[i++]);
+        }
+        else {
+            if (i + n > count)
+                return false;
+            pixels.insert(pixels.end(), words + i, words + i + n);
+            i += n;
+        }
+    }
+    return pixels.size() == expected;
+}
+
+template<typename T> static void put(std::vector<uint8_t> &out, const T &value)
+{
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void put_bytes(std::vector<uint8_t> &out, const void *data, size_t size)
+{
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+struct reader {
+    const uint8_t *pos;
+    const uint8_t *end;
+
+    template<typename T> bool get(T &value)
+    {
+        if (static_cast<size_t>(end - pos) < sizeof(T))
+            return false;
+        memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    bool get_bytes(void *data, size_t size)
+    {
+        if (static_cast<size_t>(end - pos) < size)
+            return false;
+        memcpy(data, pos, size);
+        pos += size;
+        return true;
+    }
+};
+
+/*
+ * Command:
+ *   u8 type, u8[3] padding, u32 color, f32 size, u32 point count,
+ *   u32 text length, f32 x/y per point, text bytes, then for DRAW_ERASE
+ *   (version 2) u32 target count and u32 per target, and for DRAW_IMAGE
+ *   (version 3) u32 image width, u32 pixel count and RGBA u32 per pixel
+ */
+void session_write_command(const draw_command &command, std::vector<uint8_t> &out)
+{
+    const uint8_t header[4] = { static_cast<uint8_t>(command.type), 0, 0, 0 };
+    put_bytes(out, header, sizeof(header));
+    put(out, command.color);
+    put(out, command.size);
+    put(out, static_cast<uint32_t>(command.points.size()));
+    put(out, static_cast<uint32_t>(command.text.size()));
+    for (const auto &point : command.points) {
+        put(out, point.x);
+        put(out, point.y);
+    }
+    put_bytes(out, command.text.data(), command.text.size());
+
+    if (command.type == DRAW_ERASE) {
+        put(out, static_cast<uint32_t>(command.targets.size()));
+        put_bytes(out, command.targets.data(), command.targets.size() * sizeof(uint32_t));
+    }
+
+    if (command.type == DRAW_IMAGE) {
+        put(out, command.image_width);
+        put(out, static_cast<uint32_t>(command.pixels.size()));
+        put_bytes(out, command.pixels.data(), command.pixels.size() * sizeof(uint32_t));
+    }
+}
+
+static bool read_command(reader &in, draw_command &command)
+{
+    uint8_t header[4];
+    uint32_t point_count, text_size;
+    if (!in.get_bytes(header, sizeof(header)) || !in.get(command.color) || !in.get(command.size)
+        || !in.get(point_count) || !in.get(text_size))
+        return false;
+
+    if (static_cast<size_t>(in.end - in.pos) / sizeof(z_point) < point_count)
+        return false;
+
+    command.type = static_cast<draw_type>(header[0]);
+    command.points.resize(point_count);
+    for (auto &point : command.points) {
+        in.get(point.x);
+        in.get(point.y);
+    }
+
+    command.text.resize(text_size);
+    if (!in.get_bytes(command.text.data(), text_size))
+        return false;
+
+    if (command.type == DRAW_IMAGE) {
+        uint32_t pixel_count;
+        if (!in.get(command.image_width) || !in.get(pixel_count)
+            || static_cast<size_t>(in.end - in.pos) / sizeof(uint32_t) < pixel_count
+            || !command.image_width || pixel_count % command.image_width)
+            return false;
+
+        command.pixels.resize(pixel_count);
+        return in.get_bytes(command.pixels.data(), pixel_count * sizeof(uint32_t));
+    }
+
+    if (command.type != DRAW_ERASE)
+        return true;
+
+    uint32_t target_count;
+    if (!in.get(target_count) || static_cast<size_t>(in.end - in.pos) / sizeof(uint32_t) < target_count)
+        return false;
+
+    command.targets.resize(target_count);
+    return in.get_bytes(command.targets.data(), target_count * sizeof(uint32_t));
+}
+
+bool session_read_command(const uint8_t *&pos, const uint8_t *end, draw_command &command)
+{
+    reader in { pos, end };
+    if (!read_command(in, command))
+        return false;
+
+    pos = in.pos;
+    return true;
+}
+
+/*
+ * Page record:
+ *   u32 command count, u32 base width, u32 base height, u32 base words,
+ *   base raster as rle words, then the commands
+ */
+static void write_page(const session_page &page, std::vector<uint8_t> &out)
+{
+    std::vector<uint32_t> words;
+    rle_encode(page.base_pixels, words);
+
+    put(out, static_cast<uint32_t>(page.commands.size()));
+    put(out, page.base_width);
+    put(out, page.base_height);
+    put(out, static_cast<uint32_t>(words.size()));
+    put_bytes(out, words.data(), words.size() * sizeof(uint32_t));
+
+    for (const auto &command : page.commands)
+        session_write_command(command, out);
+}
+
+static bool read_page(reader &in, session_page &page)
+{
+    uint32_t command_count, words;
+    if (!in.get(command_count) || !in.get(page.base_width) || !in.get(page.base_height) || !in.get(words))
+        return false;
+
+    if (static_cast<size_t>(in.end - in.pos) / sizeof(uint32_t) < words)
+        return false;
+
+    if (words) {
+        std::vector<uint32_t> encoded(words);
+        in.get_bytes(encoded.data(), words * sizeof(uint32_t));
+        const size_t expected = static_cast<size_t>(page.base_width) * page.base_height;
+        if (!rle_decode(encoded.data(), encoded.size(), page.base_pixels, expected))
+            return false;
+    }
+
+    page.commands.clear();
+    for (uint32_t i = 0; i < command_count; i++) {
+        draw_command command;
+        if (!read_command(in, command))
+            return false;
+        page.commands.push_back(std::move(command));
+    }
+    return true;
+}
+
+SessionFile::~SessionFile()
+{
+    Close();
+}
+
+bool SessionFile::Open(const std::string &path)
+{
+    Close();
+    if (!map(path))
+        return false;
+
+    if (!read_index()) {
+        warn("ignoring damaged session '%s'", path.c_str());
+        Close();
+        return false;
+    }
+    return true;
+}
+
+#ifdef _WIN32
+bool SessionFile::map(const std::string &path)
+{
+    wchar_t *wpath = nullptr;
+    os_utf8_to_wcs_ptr(path.c_str(), 0, &wpath);
+    HANDLE file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    bfree(wpath);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!data) {
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    m_file_ = file;
+    m_mapping_ = mapping;
+    m_data_ = static_cast<const uint8_t *>(data);
+    m_size_ = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void SessionFile::Close()
+{
+    if (m_data_)
+        UnmapViewOfFile(m_data_);
+    if (m_mapping_)
+        CloseHandle(m_mapping_);
+    if (m_file_)
+        CloseHandle(m_file_);
+
+    m_data_ = nullptr;
+    m_mapping_ = nullptr;
+    m_file_ = nullptr;
+    m_size_ = 0;
+    m_journal_sequence_ = 0;
+    m_index_.clear();
+}
+#else
+bool SessionFile::map(const std::string &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    m_fd_ = fd;
+    m_data_ = static_cast<const uint8_t *>(data);
+    m_size_ = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void SessionFile::Close()
+{
+    if (m_data_)
+        munmap(const_cast<uint8_t *>(m_data_), m_size_);
+    if (m_fd_ >= 0)
+        close(m_fd_);
+
+    m_data_ = nullptr;
+    m_fd_ = -1;
+    m_size_ = 0;
+    m_journal_sequence_ = 0;
+    m_index_.clear();
+}
+#endif
+
+bool SessionFile::read_index()
+{
+    reader in { m_data_, m_data_ + m_size_ };
+    session_header header;
+    if (!in.get(header) || memcmp(header.magic, session_magic, sizeof(session_magic)) != 0)
+        return false;
+
+    if (header.version > SESSION_VERSION) {
+        warn("session version %u is newer than %u", header.version, SESSION_VERSION);
+        return false;
+    }
+
+    if (header.index_offset > m_size_ || header.index_size > m_size_ - header.index_offset)
+        return false;
+
+    m_journal_sequence_ = header.journal_sequence;
+
+    in.pos = m_data_ + header.index_offset;
+    in.end = in.pos + header.index_size;
+
+    m_index_.reserve(header.page_count);
+    for (uint32_t i = 0; i < header.page_count; i++) {
+        session_index_entry entry;
+        uint32_t key_size;
+        if (!in.get(entry.offset) || !in.get(entry.size) || !in.get(entry.page_index)
+            || !in.get(entry.flags) || !in.get(key_size))
+            return false;
+
+        if (entry.offset > m_size_ || entry.size > m_size_ - entry.offset)
+            return false;
+
+        entry.key.resize(key_size);
+        if (!in.get_bytes(entry.key.data(), key_size))
+            return false;
+
+        m_index_.push_back(std::move(entry));
+    }
+    return true;
+}
+
+const session_index_entry *SessionFile::Find(const std::string &key, int32_t page_index) const
+{
+    for (const auto &entry : m_index_) {
+        if (entry.page_index == page_index && entry.key == key)
+            return &entry;
+    }
+    return nullptr;
+}
+
+bool SessionFile::ReadPage(const session_index_entry &entry, session_page &page) const
+{
+    if (!m_data_)
+        return false;
+
+    reader in { m_data_ + entry.offset, m_data_ + entry.offset + entry.size };
+    page.key = entry.key;
+    page.page_index = entry.page_index;
+    page.current = (entry.flags & SESSION_PAGE_CURRENT) != 0;
+    return read_page(in, page);
+}
+
+std::vector<uint8_t> SessionFile::ReadRecord(const session_index_entry &entry) const
+{
+    if (!m_data_)
+        return {};
+
+    return std::vector<uint8_t>(m_data_ + entry.offset, m_data_ + entry.offset + entry.size);
+}
+
+bool SessionFile::Write(const std::string &path, const std::vector<session_page> &pages,
+    uint32_t journal_sequence)
+{
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> index;
+
+    session_header header = {};
+    memcpy(header.magic, session_magic, sizeof(session_magic));
+    header.version = SESSION_VERSION;
+    header.page_count = static_cast<uint32_t>(pages.size());
+    header.journal_sequence = journal_sequence;
+    put(out, header);
+
+    for (const auto &page : pages) {
+        const uint64_t offset = out.size();
+        if (!page.record.empty())
+            put_bytes(out, page.record.data(), page.record.size());
+        else
+            write_page(page, out);
+
+        put(index, offset);
+        put(index, static_cast<uint64_t>(out.size() - offset));
+        put(index, page.page_index);
+        put(index, static_cast<uint32_t>(page.current ? SESSION_PAGE_CURRENT : 0));
+        put(index, static_cast<uint32_t>(page.key.size()));
+        put_bytes(index, page.key.data(), page.key.size());
+    }
+
+    header.index_offset = out.size();
+    header.index_size = index.size();
+    memcpy(out.data(), &header, sizeof(header));
+    put_bytes(out, index.data(), index.size());
+
+    FILE *file = os_fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    const bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+    fclose(file);
+    return ok;
+}
+
+SessionWriter::SessionWriter(write_func write) : m_write_(std::move(write))
+{
+}
+
+SessionWriter::~SessionWriter()
+{
+    Flush();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        m_stop_ = true;
+    }
+    m_cond_.notify_all();
+
+    if (m_thread_.joinable())
+        m_thread_.join();
+}
+
+void SessionWriter::Post(std::vector<session_page> &&pages, uint32_t journal_sequence)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        m_pending_ = std::move(pages);
+        m_pending_sequence_ = journal_sequence;
+        m_has_pending_ = true;
+
+        if (!m_thread_.joinable())
+            m_thread_ = std::thread(&SessionWriter::thread_loop, this);
+    }
+    m_cond_.notify_all();
+}
+
+void SessionWriter::Flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex_);
+    m_cond_.wait(lock, [this] { return !m_has_pending_ && !m_writing_; });
+}
+
+void SessionWriter::thread_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex_);
+    for (;;) {
+        m_cond_.wait(lock, [this] { return m_has_pending_ || m_stop_; });
+        if (!m_has_pending_)
+            return;
+
+        std::vector<session_page> pages = std::move(m_pending_);
+        const uint32_t sequence = m_pending_sequence_;
+        m_pending_.clear();
+        m_has_pending_ = false;
+        m_writing_ = true;
+
+        lock.unlock();
+        m_write_(pages, sequence);
+        lock.lock();
+
+        m_writing_ = false;
+        m_cond_.notify_all();
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "display-list.h"
+
+// Saved drawing source sessions.  Layout, little endian:
+//
+//   header        "DRWS", version, page count, last journal record included,
+//                 index offset and size
+//   page records  command log and base raster of one page each
+//   index         key, page index, flags and record offset/size per page
+//
+// Opening a session maps the file and reads the header and index only.
+// Page records are parsed when a page is first viewed, so opening costs
+// the same no matter how much was drawn.
+#define SESSION_VERSION 3
+
+#define SESSION_PAGE_CURRENT 0x1
+
+struct session_page {
+    std::string key;
+    int32_t page_index = 0;
+    bool current = false;
+
+    display_list commands;
+    // commands folded out of the undo log, RGBA
+    uint32_t base_width = 0;
+    uint32_t base_height = 0;
+    std::vector<uint32_t> base_pixels;
+
+    // a page that was never restored is written back from its old record
+    std::vector<uint8_t> record;
+};
+
+struct session_index_entry {
+    std::string key;
+    int32_t page_index;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t size;
+};
+
+class SessionFile {
+public:
+    SessionFile() = default;
+    SessionFile(const SessionFile &) = delete;
+    SessionFile &operator=(const SessionFile &) = delete;
+    virtual ~SessionFile();
+
+    bool Open(const std::string &path);
+    void Close();
+
+    const std::vector<session_index_entry> &Index() const { return m_index_; }
+    const session_index_entry *Find(const std::string &key, int32_t page_index) const;
+
+    bool ReadPage(const session_index_entry &entry, session_page &page) const;
+    std::vector<uint8_t> ReadRecord(const session_index_entry &entry) const;
+
+    // journal records up to this sequence are part of the session
+    uint32_t JournalSequence() const { return m_journal_sequence_; }
+
+    static bool Write(const std::string &path, const std::vector<session_page> &pages,
+        uint32_t journal_sequence);
+
+private:
+    bool map(const std::string &path);
+    bool read_index();
+
+private:
+    const uint8_t *m_data_ { nullptr };
+    size_t m_size_ = 0;
+
+#ifdef _WIN32
+    void *m_file_ { nullptr };
+    void *m_mapping_ { nullptr };
+#else
+    int m_fd_ = -1;
+#endif
+
+    std::vector<session_index_entry> m_index_;
+    uint32_t m_journal_sequence_ = 0;
+};
+
+// Command encoding shared with the journal.
+void session_write_command(const draw_command &command, std::vector<uint8_t> &out);
+bool session_read_command(const uint8_t *&pos, const uint8_t *end, draw_command &command);
+
+// Runs saves on a background thread.  Only the newest snapshot posted
+// while a save is running is written after it.
+class SessionWriter {
+public:
+    typedef std::function<void(std::vector<session_page> &pages, uint32_t journal_sequence)> write_func;
+
+    explicit SessionWriter(write_func write);
+    SessionWriter(const SessionWriter &) = delete;
+    SessionWriter &operator=(const SessionWriter &) = delete;
+    virtual ~SessionWriter();
+
+    void Post(std::vector<session_page> &&pages, uint32_t journal_sequence);
+
+    // Waits until every posted snapshot is written.
+    void Flush();
+
+private:
+    void thread_loop();
+
+private:
+    write_func m_write_;
+
+    std::mutex m_mutex_;
+    std::condition_variable m_cond_;
+    std::vector<session_page> m_pending_;
+    uint32_t m_pending_sequence_ = 0;
+    bool m_has_pending_ = false;
+    bool m_writing_ = false;
+    bool m_stop_ = false;
+
+    std::thread m_thread_;
+};
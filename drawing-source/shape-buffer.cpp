@@ -0,0 +1,227 @@
+#include "shape-buffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define ARC_MAX_SEGMENTS 16
+#define ELLIPSE_MIN_SEGMENTS 32
+#define ELLIPSE_MAX_SEGMENTS 256
+
+// one segment per SEGMENT_LENGTH pixels of the outer contour
+#define SEGMENT_LENGTH 4.0f
+
+static const float two_pi = 6.28318530717958647692f;
+
+/*
+ * Contour of a box with rounded corners, clockwise from the top left
+ * corner.  Every corner gets segments + 1 points, so contours built with
+ * the same segment count can be joined into a ring.
+ */
+static void rounded_contour(float x0, float y0, float x1, float y1, float radius,
+    int segments, std::vector<z_point> &points)
+{
+    radius = std::clamp(radius, 0.0f, std::min(x1 - x0, y1 - y0) * 0.5f);
+
+    const float centers[4][2] = {
+        { x0 + radius, y0 + radius },
+        { x1 - radius, y0 + radius },
+        { x1 - radius, y1 - radius },
+        { x0 + radius, y1 - radius },
+    };
+
+    points.clear();
+    for (int corner = 0; corner < 4; corner++) {
+        const float start = two_pi * 0.25f * static_cast<float>(corner + 2);
+        for (int i = 0; i <= segments; i++) {
+            const float angle = start + two_pi * 0.25f * static_cast<float>(i) / static_cast<float>(segments);
+            z_point p;
+            p.x = centers[corner][0] + radius * cosf(angle);
+            p.y = centers[corner][1] + radius * sinf(angle);
+            points.push_back(p);
+        }
+    }
+}
+
+static void ellipse_contour(float cx, float cy, float rx, float ry, int segments,
+    std::vector<z_point> &points)
+{
+    points.clear();
+    for (int i = 0; i < segments; i++) {
+        const float angle = two_pi * static_cast<float>(i) / static_cast<float>(segments);
+        z_point p;
+        p.x = cx + rx * cosf(angle);
+        p.y = cy + ry * sinf(angle);
+        points.push_back(p);
+    }
+}
+
+ShapeBuffer::~ShapeBuffer()
+{
+    gs_vertexbuffer_destroy(m_vertex_buffer_);
+    gs_indexbuffer_destroy(m_index_buffer_);
+}
+
+void ShapeBuffer::Reset()
+{
+    m_vertices_.clear();
+    m_indices_.clear();
+}
+
+void ShapeBuffer::AddRing(const z_point *outer, const z_point *inner, size_t count)
+{
+    const auto base = static_cast<uint32_t>(m_vertices_.size());
+    const auto n = static_cast<uint32_t>(count);
+
+    for (size_t i = 0; i < count; i++) {
+        m_vertices_.push_back(outer[i]);
+        m_vertices_.push_back(inner[i]);
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        const uint32_t o0 = base + i * 2;
+        const uint32_t i0 = o0 + 1;
+        const uint32_t o1 = base + (i + 1) % n * 2;
+        const uint32_t i1 = o1 + 1;
+        m_indices_.insert(m_indices_.end(), { o0, o1, i0, i0, o1, i1 });
+    }
+}
+
+void ShapeBuffer::AddFan(const z_point *points, size_t count)
+{
+    const auto base = static_cast<uint32_t>(m_vertices_.size());
+    m_vertices_.insert(m_vertices_.end(), points, points + count);
+
+    for (uint32_t i = 1; i + 1 < count; i++)
+        m_indices_.insert(m_indices_.end(), { base, base + i, base + i + 1 });
+}
+
+void ShapeBuffer::AddRect(float x0, float y0, float x1, float y1, float radius, float stroke, bool filled)
+{
+    if (x0 > x1)
+        std::swap(x0, x1);
+    if (y0 > y1)
+        std::swap(y0, y1);
+
+    const float half = std::max(stroke, 0.0f) * 0.5f;
+    radius = std::clamp(radius, 0.0f, std::min(x1 - x0, y1 - y0) * 0.5f);
+
+    const int segments = radius > 0.0f
+        ? std::clamp(static_cast<int>(std::ceil(two_pi * 0.25f * (radius + half) / SEGMENT_LENGTH)), 1, ARC_MAX_SEGMENTS)
+        : 0;
+
+    if (segments == 0) {
+        // corners without arcs: the 4 point contour
+        const z_point outer[4] = {
+            { x0 - half, y0 - half }, { x1 + half, y0 - half },
+            { x1 + half, y1 + half }, { x0 - half, y1 + half },
+        };
+        if (filled) {
+            AddFan(outer, 4);
+            return;
+        }
+
+        const float cx = (x0 + x1) * 0.5f;
+        const float cy = (y0 + y1) * 0.5f;
+        const float ix0 = std::min(x0 + half, cx);
+        const float iy0 = std::min(y0 + half, cy);
+        const float ix1 = std::max(x1 - half, cx);
+        const float iy1 = std::max(y1 - half, cy);
+        const z_point inner[4] = {
+            { ix0, iy0 }, { ix1, iy0 }, { ix1, iy1 }, { ix0, iy1 },
+        };
+        AddRing(outer, inner, 4);
+        return;
+    }
+
+    rounded_contour(x0 - half, y0 - half, x1 + half, y1 + half, radius + half, segments, m_outer_);
+    if (filled) {
+        AddFan(m_outer_.data(), m_outer_.size());
+        return;
+    }
+
+    const float cx = (x0 + x1) * 0.5f;
+    const float cy = (y0 + y1) * 0.5f;
+    rounded_contour(std::min(x0 + half, cx), std::min(y0 + half, cy)
+        , std::max(x1 - half, cx), std::max(y1 - half, cy)
+        , radius - half, segments, m_inner_);
+    AddRing(m_outer_.data(), m_inner_.data(), m_outer_.size());
+}
+
+void ShapeBuffer::AddEllipse(float x0, float y0, float x1, float y1, float stroke, bool filled)
+{
+    const float rx = std::fabs(x1 - x0) * 0.5f;
+    const float ry = std::fabs(y1 - y0) * 0.5f;
+    const float cx = (x0 + x1) * 0.5f;
+    const float cy = (y0 + y1) * 0.5f;
+    const float half = std::max(stroke, 0.0f) * 0.5f;
+
+    const float outer_x = rx + half;
+    const float outer_y = ry + half;
+    const int segments = std::clamp(static_cast<int>(std::ceil(two_pi * std::max(outer_x, outer_y) / SEGMENT_LENGTH))
+        , ELLIPSE_MIN_SEGMENTS, ELLIPSE_MAX_SEGMENTS);
+
+    ellipse_contour(cx, cy, outer_x, outer_y, segments, m_outer_);
+    if (filled) {
+        AddFan(m_outer_.data(), m_outer_.size());
+        return;
+    }
+
+    ellipse_contour(cx, cy, std::max(rx - half, 0.0f), std::max(ry - half, 0.0f), segments, m_inner_);
+    AddRing(m_outer_.data(), m_inner_.data(), m_outer_.size());
+}
+
+bool ShapeBuffer::upload()
+{
+    if (m_vertices_.size() > m_vertex_capacity_) {
+        gs_vertexbuffer_destroy(m_vertex_buffer_);
+
+        m_vertex_capacity_ = std::max<size_t>(m_vertex_capacity_ * 2, 64);
+        while (m_vertex_capacity_ < m_vertices_.size())
+            m_vertex_capacity_ *= 2;
+
+        struct gs_vb_data *vbd = gs_vbdata_create();
+        vbd->num = m_vertex_capacity_;
+        vbd->points = static_cast<vec3 *>(bzalloc(sizeof(vec3) * vbd->num));
+        m_vertex_buffer_ = gs_vertexbuffer_create(vbd, GS_DYNAMIC);
+    }
+
+    if (m_indices_.size() > m_index_capacity_) {
+        gs_indexbuffer_destroy(m_index_buffer_);
+
+        m_index_capacity_ = std::max<size_t>(m_index_capacity_ * 2, 192);
+        while (m_index_capacity_ < m_indices_.size())
+            m_index_capacity_ *= 2;
+
+        void *indices = bzalloc(sizeof(uint32_t) * m_index_capacity_);
+        m_index_buffer_ = gs_indexbuffer_create(GS_UNSIGNED_LONG, indices, m_index_capacity_, GS_DYNAMIC);
+    }
+
+    if (!m_vertex_buffer_ || !m_index_buffer_) {
+        m_vertex_capacity_ = 0;
+        m_index_capacity_ = 0;
+        return false;
+    }
+
+    struct gs_vb_data *vbd = gs_vertexbuffer_get_data(m_vertex_buffer_);
+    for (size_t i = 0; i < m_vertices_.size(); i++)
+        vec3_set(&vbd->points[i], m_vertices_[i].x, m_vertices_[i].y, 0.0f);
+
+    // unused indices point at vertex 0 and are never drawn
+    auto *indices = static_cast<uint32_t *>(gs_indexbuffer_get_data(m_index_buffer_));
+    std::copy(m_indices_.begin(), m_indices_.end(), indices);
+
+    gs_vertexbuffer_flush(m_vertex_buffer_);
+    gs_indexbuffer_flush(m_index_buffer_);
+    return true;
+}
+
+void ShapeBuffer::Draw()
+{
+    if (m_indices_.empty() || !upload())
+        return;
+
+    gs_load_vertexbuffer(m_vertex_buffer_);
+    gs_load_indexbuffer(m_index_buffer_);
+    gs_draw(GS_TRIS, 0, static_cast<uint32_t>(m_indices_.size()));
+    gs_load_indexbuffer(nullptr);
+}
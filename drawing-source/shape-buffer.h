@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include "obs-module.h"
+#include "zmath.h"
+
+// Indexed triangles for shape previews, in canvas pixels.  Outlines are
+// rings between an outer and an inner contour of n points each, 2n
+// vertices and 2n triangles, so a rectangle costs 8 vertices and 8
+// triangles.  Filled shapes are fans over their outer contour.
+//
+// The vertex and index buffers are kept and rewritten for every preview
+// frame, and only grow.  Graphics thread only.
+class ShapeBuffer {
+public:
+    ShapeBuffer() = default;
+    ShapeBuffer(const ShapeBuffer &) = delete;
+    ShapeBuffer &operator=(const ShapeBuffer &) = delete;
+    virtual ~ShapeBuffer();
+
+    void Reset();
+
+    // stroke is centered on the edges of the box; radius rounds the corners
+    void AddRect(float x0, float y0, float x1, float y1, float radius, float stroke, bool filled);
+    void AddEllipse(float x0, float y0, float x1, float y1, float stroke, bool filled);
+
+    void AddRing(const z_point *outer, const z_point *inner, size_t count);
+    void AddFan(const z_point *points, size_t count);
+
+    // Draws everything added since Reset, inside an effect pass.
+    void Draw();
+
+private:
+    bool upload();
+
+private:
+    std::vector<z_point> m_vertices_;
+    std::vector<uint32_t> m_indices_;
+
+    // scratch contours
+    std::vector<z_point> m_outer_;
+    std::vector<z_point> m_inner_;
+
+    gs_vertbuffer_t *m_vertex_buffer_ { nullptr };
+    gs_indexbuffer_t *m_index_buffer_ { nullptr };
+    size_t m_vertex_capacity_ = 0;
+    size_t m_index_capacity_ = 0;
+};
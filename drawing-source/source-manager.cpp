@@ -1,6 +1,12 @@
 #include "source-manager.h"
+#include "glyph-atlas.h"
+#include "util/platform.h"
+#include <algorithm>
+
+#define warn(format, ...) blog(LOG_WARNING, "[draw_source] " format, ##__VA_ARGS__)
 
 KeySource::KeySource()
+    : m_tiles_(TileAtlas::Get())
 {
     // Add an initial page at initialization
     AddPage(0);
@@ -9,25 +15,34 @@ KeySource::KeySource()
 KeySource::~KeySource()
 {
     for (const auto &page : m_page_list_) {
+        if (!page)
+            continue;
         obs_enter_graphics();
-        release_draw_texture(page.second);
+        release_draw_texture(page);
         obs_leave_graphics();
     }
 }
 
 bool KeySource::AddPage(int32_t page_index)
 {
-    const auto find_page_item = m_page_list_.find(page_index);
-    if (find_page_item == m_page_list_.end()) {
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    return add_page(page_index);
+}
+
+bool KeySource::add_page(int32_t page_index)
+{
+    if (page_index < 0 || page_index >= KEY_MAX_PAGES)
+        return false;
+
+    const auto index = static_cast<size_t>(page_index);
+    if (index >= m_page_list_.size())
+        m_page_list_.resize(index + 1, nullptr);
+
+    if (!m_page_list_[index]) {
         const auto texture = new gs_drawing_texture();
         texture->texrender = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
-        texture->point.is_frist_draw = true;
-        const bool insert_ret = m_page_list_.insert(std::pair(page_index, texture)).second;
-        if (!insert_ret) {
-            gs_texrender_destroy(texture->texrender);
-            delete texture;
-        }
-        return insert_ret;
+        m_page_list_[index] = texture;
+        m_page_count_++;
     }
 
     return true;
@@ -35,55 +50,47 @@ bool KeySource::AddPage(int32_t page_index)
 
 bool KeySource::RemovePage(int32_t page_index)
 {
-    const auto find_page_item = m_page_list_.find(page_index);
-    if (find_page_item == m_page_list_.end())
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    if (page_index < 0 || static_cast<size_t>(page_index) >= m_page_list_.size()
+        || !m_page_list_[page_index])
         return true;
-    // release_draw_texture(find_page_item->second);
-    m_page_list_.erase(find_page_item);
+    // release_draw_texture(m_page_list_[page_index]);
+    m_page_list_[page_index] = nullptr;
+    m_page_count_--;
     return true;
 }
 
-bool KeySource::SetCurrentPage(int32_t page_index)
-{
-    bool ret = true;
-    if (m_page_list_.find(page_index) == m_page_list_.end()) {
-        // If not found, add it.
-        ret = AddPage(page_index);
-    }
-
-    if (ret)
-        m_cur_page_idx_ = page_index;
-
-    return ret;
-}
-
 bool KeySource::UpdateTexture(int32_t page_index, gs_drawing_texture *texture)
 {
-    const auto find_item = m_page_list_.find(page_index);
-    if (find_item == m_page_list_.end())
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    if (page_index < 0 || static_cast<size_t>(page_index) >= m_page_list_.size()
+        || !m_page_list_[page_index])
         return false;
 
-    find_item->second = texture;
+    m_page_list_[page_index] = texture;
     return true;
 }
 
 gs_drawing_texture *KeySource::GetPageIndexTexture(int32_t page_index)
 {
-    const auto find_item = m_page_list_.find(page_index);
-    if (find_item == m_page_list_.end())
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    if (page_index < 0 || static_cast<size_t>(page_index) >= m_page_list_.size())
         return nullptr;
 
-    return find_item->second;
+    return m_page_list_[page_index];
 }
 
 int32_t KeySource::GetPageSize()
 {
-    return static_cast<int32_t>(m_page_list_.size());
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    return m_page_count_;
 }
 
-int32_t KeySource::GetCurrentPage()
+
+std::vector<gs_drawing_texture *> KeySource::GetPages()
 {
-    return m_cur_page_idx_;
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    return m_page_list_;
 }
 
 void KeySource::release_draw_texture(gs_drawing_texture *texture)
@@ -104,122 +111,213 @@ void KeySource::release_draw_texture(gs_drawing_texture *texture)
         texture->copy_texture = nullptr;
     }
 
-    if (texture->image_texture) {
-        gs_texture_destroy(texture->image_texture);
-        texture->image_texture = nullptr;
+    if (texture->blit_texture) {
+        gs_texture_destroy(texture->blit_texture);
+        texture->blit_texture = nullptr;
     }
 
     if (texture->point_array) {
         z_drop_fpoint_array(texture->point_array);
         texture->point_array = nullptr;
     }
-    texture->render_text = false;
+    texture->blit_pending = false;
+    texture->blit_pixels.clear();
+    texture->text_pending = false;
+
+    // the atlases outlive the source that parked the page
+    for (const auto &tile : texture->tiles)
+        m_tiles_->Free(tile.second);
+    for (const auto &tile : texture->world.tiles) {
+        if (!tile.second.empty)
+            m_tiles_->Free(tile.second.slot);
+    }
     delete texture;
     obs_leave_graphics();
 }
 
 // source manager
-SourceManager::SourceManager(obs_source_t *source_) : source(source_)
+SourceManager::SourceManager(obs_source_t *source_)
+    : source(source_)
+    , m_session_(DrawSession::Get(std::string()))
+    , m_tiles_(TileAtlas::Get())
 {
 
 }
 
 SourceManager::~SourceManager()
 {
+    gs_drawing_texture *texture = m_current_texture_.exchange(nullptr);
+    if (texture)
+        texture->shown--;
+}
 
+uint32_t SourceManager::intern_key(const std::string &key)
+{
+    const auto find_item = m_key_ids_.find(key);
+    if (find_item != m_key_ids_.end())
+        return find_item->second;
+
+    const auto key_id = static_cast<uint32_t>(m_key_names_.size());
+    m_key_ids_.emplace(key, key_id);
+    m_key_names_.push_back(key);
+    m_draw_list.push_back(nullptr);
+    m_current_pages_.push_back(0);
+    return key_id;
 }
 
-bool SourceManager::HasKey(const std::string &key)
+KeySource *SourceManager::find_key(const std::string &key)
 {
-    const auto find_item = m_draw_list.find(key);
-    if (find_item == m_draw_list.end())
-        return false;
+    const auto find_item = m_key_ids_.find(key);
+    return find_item == m_key_ids_.end() ? nullptr : m_draw_list[find_item->second].get();
+}
 
-    return true;
+KeySource *SourceManager::find_key(uint32_t key_id)
+{
+    return key_id < m_draw_list.size() ? m_draw_list[key_id].get() : nullptr;
+}
+
+bool SourceManager::HasKey(const std::string &key)
+{
+    std::shared_lock<std::shared_mutex> lock(m_keys_mutex_);
+    return find_key(key) != nullptr;
 }
 
 bool SourceManager::AddKey(const std::string &key)
 {
-    const auto find_item = m_draw_list.find(key);
-    if (find_item == m_draw_list.end()) {
-        // inset new map
-        const auto key_source = new KeySource();
-        return m_draw_list.insert(std::pair(key, key_source)).second;
+    std::unique_lock<std::shared_mutex> lock(m_keys_mutex_);
+    const uint32_t key_id = intern_key(key);
+    if (!m_draw_list[key_id]) {
+        m_draw_list[key_id] = m_session_->GetKey(key);
+        m_current_pages_[key_id] = m_session_->GetCurrentPage(key);
+        update_current_texture();
     }
     return true;
 }
 
 bool SourceManager::AddPage(const std::string &key, int32_t page_index)
 {
-    const auto find_key_item = m_draw_list.find(key);
-    if (find_key_item == m_draw_list.end())
+    std::unique_lock<std::shared_mutex> lock(m_keys_mutex_);
+    KeySource *key_item = find_key(key);
+    if (!key_item)
         return false;
 
-    return find_key_item->second->AddPage(page_index);
+    const bool ret = key_item->AddPage(page_index);
+    update_current_texture();
+    return ret;
 }
 
 bool SourceManager::UpdateDrawingTexture(const std::string &key, int32_t page_index, gs_drawing_texture *texture)
 {
-    const bool ret = AddPage(key, page_index);
-    if (!ret)
+    std::unique_lock<std::shared_mutex> lock(m_keys_mutex_);
+    KeySource *key_item = find_key(key);
+    if (!key_item || !key_item->AddPage(page_index))
         return false;
 
     // update texture
-    m_draw_list.find(key)->second->UpdateTexture(page_index, texture);
+    key_item->UpdateTexture(page_index, texture);
+    update_current_texture();
     return true;
 }
 
 bool SourceManager::RemoveKey(const std::string &key)
 {
-    const auto find_item = m_draw_list.find(key);
-    if (find_item == m_draw_list.end())
+    std::unique_lock<std::shared_mutex> lock(m_keys_mutex_);
+    const auto find_item = m_key_ids_.find(key);
+    if (find_item == m_key_ids_.end())
         return true;
 
-    m_draw_list.erase(find_item);
+    // the id stays interned for when the key comes back, and the pages are
+    // kept while the source exists
+    auto &key_item = m_draw_list[find_item->second];
+    if (!key_item)
+        return true;
+    m_session_->ForgetKey(key, key_item);
+    m_removed_keys_.push_back(std::move(key_item));
+    m_current_pages_[find_item->second] = 0;
+    update_current_texture();
     return true;
 }
 
 bool SourceManager::RemovePage(const std::string &key, int32_t page_index)
 {
-    const auto find_item = m_draw_list.find(key);
-    if (find_item == m_draw_list.end())
+    std::unique_lock<std::shared_mutex> lock(m_keys_mutex_);
+    KeySource *key_item = find_key(key);
+    if (!key_item)
         return true;
 
-    return find_item->second->RemovePage(page_index);
+    const bool ret = key_item->RemovePage(page_index);
+    update_current_texture();
+    return ret;
 }
 
 gs_drawing_texture *SourceManager::GetPageTexture(const std::string &key, int32_t page_index)
 {
-    const auto find_key_item = m_draw_list.find(key);
-    if (find_key_item == m_draw_list.end())
-        return nullptr;
+    uint32_t key_id;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_keys_mutex_);
+        const auto find_item = m_key_ids_.find(key);
+        if (find_item == m_key_ids_.end())
+            return nullptr;
+        key_id = find_item->second;
+    }
+    return get_page_texture(key_id, page_index);
+}
 
-    return find_key_item->second->GetPageIndexTexture(page_index);
+gs_drawing_texture *SourceManager::get_page_texture(uint32_t key_id, int32_t page_index)
+{
+    gs_drawing_texture *texture;
+    std::string key;
+    std::shared_ptr<DrawSession> session;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_keys_mutex_);
+        KeySource *key_item = find_key(key_id);
+        if (!key_item)
+            return nullptr;
+
+        texture = key_item->GetPageIndexTexture(page_index);
+        if (!texture || texture->restored)
+            return texture;
+        key = m_key_names_[key_id];
+        session = m_session_;
+    }
+
+    session->RestorePage(key, page_index, texture);
+    return texture;
 }
 
 gs_drawing_texture *SourceManager::GetCurrentPageTexture()
 {
-    return GetPageTexture(m_current_key_, m_current_idx_);
+    gs_drawing_texture *texture = m_current_texture_.load(std::memory_order_acquire);
+    if (texture && !texture->restored) {
+        uint32_t key_id;
+        {
+            std::shared_lock<std::shared_mutex> lock(m_keys_mutex_);
+            key_id = m_current_key_id_;
+        }
+        return get_page_texture(key_id, m_current_idx_);
+    }
+
+    return texture;
 }
 
 int32_t SourceManager::GetPageSize(const std::string &key)
 {
-    const auto find_item = m_draw_list.find(key);
-    if (find_item == m_draw_list.end())
-        return 0;
-
-    return find_item->second->GetPageSize();
+    std::shared_lock<std::shared_mutex> lock(m_keys_mutex_);
+    KeySource *key_item = find_key(key);
+    return key_item ? key_item->GetPageSize() : 0;
 }
 
 void SourceManager::UpdateCanvasSize(uint32_t width, uint32_t height)
 {
-    m_canvas_width_ = width;
-    m_canvas_height_ = height;
+    const uint64_t size = static_cast<uint64_t>(width) << 32 | height;
+    if (m_canvas_size_.exchange(size) != size)
+        m_resize_pending_ = true;
 }
 
 std::tuple<uint32_t, uint32_t> SourceManager::GetCanvasSize()
 {
-    return { m_canvas_width_, m_canvas_height_ };
+    const uint64_t size = m_canvas_size_;
+    return { static_cast<uint32_t>(size >> 32), static_cast<uint32_t>(size) };
 }
 
 void SourceManager::SetLineWidth(int32_t width)
@@ -234,46 +332,510 @@ int32_t SourceManager::GetLineWidth()
 
 void SourceManager::SetCurrentKey(const std::string &key)
 {
-    m_current_key_ = key;
-    const auto find_item = m_draw_list.find(m_current_key_);
-    if (find_item == m_draw_list.end()) {
-        m_current_idx_ = 0;
-        return;
-    }
-
-    m_current_idx_ = find_item->second->GetCurrentPage();
+    std::unique_lock<std::shared_mutex> lock(m_keys_mutex_);
+    m_current_key_id_ = intern_key(key);
+    m_current_idx_ = find_key(m_current_key_id_) ? m_current_pages_[m_current_key_id_] : 0;
+    update_current_texture();
 }
 
 std::string SourceManager::GetCurrentKey()
 {
-    return m_current_key_;
+    std::shared_lock<std::shared_mutex> lock(m_keys_mutex_);
+    return m_current_key_id_ < m_key_names_.size() ? m_key_names_[m_current_key_id_] : std::string();
 }
 
 void SourceManager::SetCurrentPage(int32_t page_index)
 {
+    std::unique_lock<std::shared_mutex> lock(m_keys_mutex_);
     m_current_idx_ = page_index;
-    const auto find_item = m_draw_list.find(m_current_key_);
-    if (find_item == m_draw_list.end())
+    // If not found, add it.
+    KeySource *key_item = find_key(m_current_key_id_);
+    if (key_item && key_item->AddPage(page_index)) {
+        m_current_pages_[m_current_key_id_] = page_index;
+        m_session_->SetCurrentPage(m_key_names_[m_current_key_id_], page_index);
+    }
+    update_current_texture();
+}
+
+int32_t SourceManager::GetCurrentKeyCurrentPage()
+{
+    std::shared_lock<std::shared_mutex> lock(m_keys_mutex_);
+    return find_key(m_current_key_id_) ? m_current_pages_[m_current_key_id_] : -1;
+}
+
+std::vector<std::pair<std::string, int32_t>> SourceManager::GetKeyInfo()
+{
+    std::shared_lock<std::shared_mutex> lock(m_keys_mutex_);
+    std::vector<std::pair<std::string, int32_t>> info;
+    info.reserve(m_draw_list.size());
+    for (uint32_t key_id = 0; key_id < m_draw_list.size(); key_id++) {
+        if (m_draw_list[key_id])
+            info.emplace_back(m_key_names_[key_id], m_current_pages_[key_id]);
+    }
+    return info;
+}
+
+/* Publishes the page the render path draws.  Keys locked for writing. */
+void SourceManager::update_current_texture()
+{
+    KeySource *key_item = find_key(m_current_key_id_);
+    gs_drawing_texture *texture = key_item ? key_item->GetPageIndexTexture(m_current_idx_) : nullptr;
+    gs_drawing_texture *previous = m_current_texture_.exchange(texture, std::memory_order_acq_rel);
+    if (previous == texture)
         return;
 
-    find_item->second->SetCurrentPage(page_index);
+    if (texture)
+        texture->shown++;
+    if (previous)
+        previous->shown--;
 }
 
-int32_t SourceManager::GetCurrentKeyCurrentPage()
+void SourceManager::SetFont(const std::string &font_file)
+{
+    std::lock_guard<std::mutex> lock(m_font_mutex_);
+    if (font_file == m_font_file_ && m_glyph_atlas_)
+        return;
+
+    m_font_file_ = font_file;
+    m_glyph_atlas_ = GlyphAtlas::Get(font_file);
+}
+
+std::shared_ptr<GlyphAtlas> SourceManager::GetGlyphAtlas()
+{
+    std::lock_guard<std::mutex> lock(m_font_mutex_);
+    return m_glyph_atlas_;
+}
+
+std::shared_ptr<DrawSession> SourceManager::get_session()
+{
+    std::shared_lock<std::shared_mutex> lock(m_keys_mutex_);
+    return m_session_;
+}
+
+bool SourceManager::OpenSession(const std::string &path)
+{
+    if (path == get_session()->GetPath())
+        return true;
+
+    std::shared_ptr<DrawSession> session = DrawSession::Get(path);
+    const auto key_info = session->GetKeyInfo();
+
+    // nothing is journaled on the old session once the keys are switched
+    obs_enter_graphics();
+    {
+        std::unique_lock<std::shared_mutex> keys_lock(m_keys_mutex_);
+
+        // the pages shown so far belong to the old session; the keys show
+        // the pages of this one from now on
+        for (uint32_t key_id = 0; key_id < m_draw_list.size(); key_id++) {
+            auto &key_item = m_draw_list[key_id];
+            if (!key_item)
+                continue;
+            m_session_->ForgetKey(m_key_names_[key_id], key_item);
+            m_removed_keys_.push_back(std::move(key_item));
+            key_item = session->GetKey(m_key_names_[key_id]);
+            m_current_pages_[key_id] = session->GetCurrentPage(m_key_names_[key_id]);
+        }
+        m_session_ = session;
+
+        for (const auto &info : key_info) {
+            const uint32_t key_id = intern_key(info.first);
+            if (!m_draw_list[key_id])
+                m_draw_list[key_id] = m_session_->GetKey(info.first);
+            m_current_pages_[key_id] = info.second;
+        }
+        if (find_key(m_current_key_id_))
+            m_current_idx_ = m_current_pages_[m_current_key_id_];
+        update_current_texture();
+    }
+    obs_leave_graphics();
+    return session->IsOpen();
+}
+
+void SourceManager::LogOperation(journal_op op, const draw_command *command)
+{
+    std::shared_lock<std::shared_mutex> lock(m_keys_mutex_);
+    if (m_current_key_id_ < m_key_names_.size())
+        m_session_->LogOperation(op, m_key_names_[m_current_key_id_], m_current_idx_, command);
+}
+
+bool SourceManager::JournalCompactionDue()
+{
+    return get_session()->JournalCompactionDue();
+}
+
+std::vector<page_ref> SourceManager::ListPages()
+{
+    std::vector<page_ref> pages;
+    const auto saved = get_session()->GetSavedPages();
+    std::shared_lock<std::shared_mutex> keys_lock(m_keys_mutex_);
+
+    for (uint32_t key_id = 0; key_id < m_draw_list.size(); key_id++) {
+        if (!m_draw_list[key_id])
+            continue;
+        const auto &textures = m_draw_list[key_id]->GetPages();
+        for (size_t i = 0; i < textures.size(); i++) {
+            if (textures[i])
+                pages.push_back({ m_key_names_[key_id], static_cast<int32_t>(i), textures[i] });
+        }
+    }
+
+    for (const auto &item : saved) {
+        KeySource *key_item = find_key(item.first);
+        if (!key_item || !key_item->GetPageIndexTexture(item.second))
+            pages.push_back({ item.first, item.second, nullptr });
+    }
+    return pages;
+}
+
+bool SourceManager::ReadSavedPage(const std::string &key, int32_t page_index, session_page &page)
+{
+    return get_session()->ReadSavedPage(key, page_index, page);
+}
+
+void SourceManager::SaveSession()
+{
+    get_session()->Save();
+}
+
+// sessions some source has open, by path
+static std::mutex session_registry_mutex;
+static std::unordered_map<std::string, std::weak_ptr<DrawSession>> session_registry;
+
+std::shared_ptr<DrawSession> DrawSession::Get(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(session_registry_mutex);
+    auto &entry = session_registry[path];
+    auto session = entry.lock();
+    if (!session) {
+        // closed under the registry lock, so the file is never open twice
+        session = std::shared_ptr<DrawSession>(new DrawSession(path), [](DrawSession *closing) {
+            std::lock_guard<std::mutex> registry_lock(session_registry_mutex);
+            const auto find_item = session_registry.find(closing->GetPath());
+            if (find_item != session_registry.end() && find_item->second.expired())
+                session_registry.erase(find_item);
+            delete closing;
+        });
+        entry = session;
+    }
+    return session;
+}
+
+DrawSession::DrawSession(const std::string &path)
+    : m_path_(path)
+    , m_writer_([this](std::vector<session_page> &pages, uint32_t journal_sequence) {
+        write(pages, journal_sequence);
+    })
+{
+    if (m_path_.empty())
+        return;
+
+    m_opened_ = m_file_.Open(m_path_);
+    std::vector<journal_record> records;
+    m_journal_.Open(m_path_ + ".journal", m_file_.JournalSequence(), records);
+
+    const auto add_key = [this](const std::string &key) {
+        if (m_current_pages_.emplace(key, 0).second)
+            m_saved_keys_.push_back(key);
+    };
+
+    for (const auto &entry : m_file_.Index()) {
+        add_key(entry.key);
+        if (entry.flags & SESSION_PAGE_CURRENT)
+            m_current_pages_[entry.key] = entry.page_index;
+    }
+
+    for (auto &record : records) {
+        add_key(record.key);
+        if (record.op == JOURNAL_PAGE) {
+            m_current_pages_[record.key] = record.page_index;
+            continue;
+        }
+
+        auto &journaled = m_journaled_pages_[record.key];
+        if (std::find(journaled.begin(), journaled.end(), record.page_index) == journaled.end())
+            journaled.push_back(record.page_index);
+        m_journal_pages_[{ record.key, record.page_index }].push_back(std::move(record));
+    }
+}
+
+DrawSession::~DrawSession()
+{
+    m_writer_.Flush();
+    m_journal_.Close();
+}
+
+std::shared_ptr<KeySource> DrawSession::GetKey(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(m_keys_mutex_);
+    auto &entry = m_keys_[key];
+    auto key_item = entry.lock();
+    if (key_item)
+        return key_item;
+
+    key_item = std::make_shared<KeySource>();
+    entry = key_item;
+
+    // the pages the session has changes for, and the one it was left on
+    const auto find_journaled = m_journaled_pages_.find(key);
+    if (find_journaled != m_journaled_pages_.end()) {
+        for (int32_t page_index : find_journaled->second)
+            key_item->AddPage(page_index);
+    }
+    const auto find_current = m_current_pages_.find(key);
+    if (find_current != m_current_pages_.end() && !key_item->AddPage(find_current->second))
+        find_current->second = 0;
+    return key_item;
+}
+
+void DrawSession::ForgetKey(const std::string &key, const std::shared_ptr<KeySource> &key_item)
+{
+    std::lock_guard<std::mutex> lock(m_keys_mutex_);
+    const auto find_item = m_keys_.find(key);
+    if (find_item != m_keys_.end() && key_item.use_count() == 1
+        && find_item->second.lock() == key_item)
+        m_keys_.erase(find_item);
+}
+
+std::shared_ptr<KeySource> DrawSession::find_key(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(m_keys_mutex_);
+    const auto find_item = m_keys_.find(key);
+    return find_item == m_keys_.end() ? nullptr : find_item->second.lock();
+}
+
+std::vector<std::pair<std::string, int32_t>> DrawSession::GetKeyInfo()
+{
+    std::lock_guard<std::mutex> lock(m_keys_mutex_);
+    std::vector<std::pair<std::string, int32_t>> info;
+    info.reserve(m_saved_keys_.size());
+    for (const auto &key : m_saved_keys_)
+        info.emplace_back(key, m_current_pages_[key]);
+    return info;
+}
+
+int32_t DrawSession::GetCurrentPage(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(m_keys_mutex_);
+    const auto find_item = m_current_pages_.find(key);
+    return find_item == m_current_pages_.end() ? 0 : find_item->second;
+}
+
+void DrawSession::SetCurrentPage(const std::string &key, int32_t page_index)
+{
+    std::lock_guard<std::mutex> lock(m_keys_mutex_);
+    m_current_pages_[key] = page_index;
+}
+
+void DrawSession::LogOperation(journal_op op, const std::string &key, int32_t page_index,
+    const draw_command *command)
+{
+    m_journal_.Append(op, key, page_index, command);
+}
+
+void DrawSession::RestorePage(const std::string &key, int32_t page_index, gs_drawing_texture *texture)
 {
-    const auto find_item = m_draw_list.find(m_current_key_);
-    if (find_item == m_draw_list.end())
-        return -1;
+    obs_enter_graphics();
+    std::lock_guard<std::mutex> page_lock(texture->mutex);
+    if (texture->restored) {
+        obs_leave_graphics();
+        return;
+    }
+
+    session_page page;
+    std::vector<journal_record> records;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        const session_index_entry *entry = m_file_.Find(key, page_index);
+        if (entry && !m_file_.ReadPage(*entry, page))
+            warn("failed to restore page %d of '%s'", page_index, key.c_str());
+
+        const auto find_item = m_journal_pages_.find({ key, page_index });
+        if (find_item != m_journal_pages_.end()) {
+            records = std::move(find_item->second);
+            m_journal_pages_.erase(find_item);
+        }
+
+        if (!entry && records.empty()) {
+            texture->restored = true;
+            obs_leave_graphics();
+            return;
+        }
+    }
+
+    gs_texture_t *base = nullptr;
+    if (!page.base_pixels.empty()) {
+        const auto *data = reinterpret_cast<const uint8_t *>(page.base_pixels.data());
+        base = gs_texture_create(page.base_width, page.base_height, GS_RGBA, 1, &data, 0);
+    }
+    texture->history.Restore(std::move(page.commands), base);
+    texture->revision++;
+
+    for (auto &record : records) {
+        if (record.op == JOURNAL_PUSH)
+            texture->history.Push(std::move(record.command));
+        else if (record.op == JOURNAL_UNDO)
+            texture->history.Undo();
+        // the saved session drops what could be redone
+        else if (record.op == JOURNAL_REDO && !texture->history.Redo())
+            texture->history.Push(std::move(record.command));
+    }
+    // redrawn from the history when next prepared
+    texture->width = 0;
+    texture->height = 0;
+    texture->restored = true;
+    obs_leave_graphics();
+}
+
+std::vector<std::pair<std::string, int32_t>> DrawSession::GetSavedPages()
+{
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    std::vector<std::pair<std::string, int32_t>> pages;
+    pages.reserve(m_file_.Index().size());
+    for (const auto &entry : m_file_.Index())
+        pages.emplace_back(entry.key, entry.page_index);
+    return pages;
+}
+
+bool DrawSession::ReadSavedPage(const std::string &key, int32_t page_index, session_page &page)
+{
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    // the journal has changes the saved page lacks
+    if (m_journal_pages_.count({ key, page_index }))
+        return false;
 
-    return find_item->second->GetCurrentPage();
+    const session_index_entry *entry = m_file_.Find(key, page_index);
+    return entry && m_file_.ReadPage(*entry, page);
 }
 
-std::unordered_map<std::string, int32_t> SourceManager::GetKeyInfo()
+static void read_base(gs_texture_t *base, session_page &page)
 {
-    std::unordered_map<std::string, int32_t> map;
-    for (const auto &draw : m_draw_list) {
-        map.insert(std::pair(draw.first, draw.second->GetCurrentPage()));
+    const uint32_t width = gs_texture_get_width(base);
+    const uint32_t height = gs_texture_get_height(base);
+
+    gs_stagesurf_t *stage = gs_stagesurface_create(width, height, GS_RGBA);
+    if (!stage)
+        return;
+
+    uint8_t *data;
+    uint32_t linesize;
+    gs_stage_texture(stage, base);
+    if (gs_stagesurface_map(stage, &data, &linesize)) {
+        page.base_width = width;
+        page.base_height = height;
+        page.base_pixels.resize(static_cast<size_t>(width) * height);
+        for (uint32_t y = 0; y < height; y++)
+            memcpy(&page.base_pixels[static_cast<size_t>(y) * width]
+                , data + static_cast<size_t>(y) * linesize, static_cast<size_t>(width) * 4);
+        gs_stagesurface_unmap(stage);
     }
-    return map;
+    gs_stagesurface_destroy(stage);
 }
 
+void DrawSession::Save()
+{
+    if (m_path_.empty())
+        return;
+
+    std::vector<session_page> pages;
+    obs_enter_graphics();
+
+    // journaled pages are only in the journal until they are restored
+    std::vector<std::pair<std::string, int32_t>> journaled;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        for (const auto &item : m_journal_pages_)
+            journaled.push_back(item.first);
+    }
+    for (const auto &item : journaled) {
+        std::shared_ptr<KeySource> key_item = find_key(item.first);
+        gs_drawing_texture *texture = key_item ? key_item->GetPageIndexTexture(item.second) : nullptr;
+        if (texture)
+            RestorePage(item.first, item.second, texture);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    const uint32_t journal_sequence = m_journal_.Checkpoint();
+
+    // held until the snapshot is taken, whichever source lets go of them
+    std::vector<std::pair<std::string, std::shared_ptr<KeySource>>> keys;
+    std::map<std::string, int32_t> current_pages;
+    {
+        std::lock_guard<std::mutex> keys_lock(m_keys_mutex_);
+        for (const auto &item : m_keys_) {
+            auto key_item = item.second.lock();
+            if (key_item)
+                keys.emplace_back(item.first, std::move(key_item));
+        }
+        current_pages = m_current_pages_;
+    }
+
+    const auto find_texture = [&keys](const std::string &key, int32_t page_index) {
+        const auto find_item = std::find_if(keys.begin(), keys.end(), [&key](const auto &item) {
+            return item.first == key;
+        });
+        return find_item == keys.end() ? nullptr : find_item->second->GetPageIndexTexture(page_index);
+    };
+
+    for (const auto &item : keys) {
+        const auto &textures = item.second->GetPages();
+        for (size_t i = 0; i < textures.size(); i++) {
+            const gs_drawing_texture *texture = textures[i];
+            if (!texture)
+                continue;
+
+            session_page page;
+            page.key = item.first;
+            page.page_index = static_cast<int32_t>(i);
+            page.current = page.page_index == current_pages[item.first];
+
+            if (!texture->restored) {
+                const session_index_entry *entry = m_file_.Find(page.key, page.page_index);
+                if (entry)
+                    page.record = m_file_.ReadRecord(*entry);
+            }
+            else {
+                const auto &commands = texture->history.Commands();
+                page.commands.assign(commands.begin()
+                    , commands.begin() + static_cast<ptrdiff_t>(texture->history.Applied()));
+                if (texture->history.Base())
+                    read_base(texture->history.Base(), page);
+            }
+            pages.push_back(std::move(page));
+        }
+    }
+
+    // pages that were saved but never opened this time
+    for (const auto &entry : m_file_.Index()) {
+        if (find_texture(entry.key, entry.page_index))
+            continue;
+
+        session_page page;
+        page.key = entry.key;
+        page.page_index = entry.page_index;
+        page.current = (entry.flags & SESSION_PAGE_CURRENT) != 0;
+        page.record = m_file_.ReadRecord(entry);
+        pages.push_back(std::move(page));
+    }
+
+    m_writer_.Post(std::move(pages), journal_sequence);
+    obs_leave_graphics();
+}
+
+void DrawSession::write(std::vector<session_page> &pages, uint32_t journal_sequence)
+{
+    const std::string temp_path = m_path_ + ".tmp";
+    if (!SessionFile::Write(temp_path, pages, journal_sequence)) {
+        warn("failed to write session '%s'", temp_path.c_str());
+        return;
+    }
+
+    // the old file is mapped until it is replaced
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    m_file_.Close();
+    if (os_safe_replace(m_path_.c_str(), temp_path.c_str(), nullptr) != 0)
+        warn("failed to replace session '%s'", m_path_.c_str());
+    else
+        m_journal_.Compact(journal_sequence);
+    m_file_.Open(m_path_);
+}
@@ -1,28 +1,135 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "obs-module.h"
 #include "obs-source.h"
 #include "drawing-source.h"
 #include "zmath.h"
+#include "display-list.h"
+#include "journal.h"
+#include "page-history.h"
+#include "session-file.h"
+#include "shape-buffer.h"
+#include "spsc-queue.h"
+#include "stroke-cache.h"
+#include "stroke-index.h"
+#include "thumbnail-cache.h"
+#include "tile-atlas.h"
+#include <map>
 #include <mutex>
+#include <shared_mutex>
+
+class GlyphAtlas;
+
+// An infinite page is shown through a view that pans and zooms over an
+// unbounded page.  Its content is drawn into PAGE_TILE_SIZE tiles of the
+// zoomed page around the view, which the view is composed from; tiles
+// are drawn from the commands over them when they come into view or just
+// before, in the direction the view pans, and the least recently shown
+// are dropped past WORLD_TILE_BUDGET.
+#define WORLD_TILE_BUDGET 768
+#define WORLD_PREFETCH_TILES 2
+#define WORLD_PREFETCH_PER_FRAME 8
+
+struct page_view {
+    // page point at the top left, in canvas pixels
+    float x = 0.0f;
+    float y = 0.0f;
+    float zoom = 1.0f;
+};
+
+struct world_tile {
+    // no slot when nothing is drawn on the tile
+    bool empty;
+    tile_slot slot;
+    uint64_t used;
+};
+
+struct world_tiles {
+    float zoom = 1.0f;
+    std::unordered_map<uint64_t, world_tile> tiles;
+    uint64_t frame = 0;
+    // the last pan, for prefetch
+    float pan_x = 0.0f;
+    float pan_y = 0.0f;
+    // the view must be composed again
+    bool dirty = false;
+};
 
 struct gs_drawing_texture {
     gs_texrender_t *texrender;
     gs_texrender_t *tmp_render;
     gs_texture_t  *copy_texture;
 
-    gs_texture_t *image_texture;
     z_fpoint_array *point_array;
-    bool render_text;
+
+    // rect and ellipse previews
+    ShapeBuffer shapes;
+
+    // text/image blit shown over the page until DRAW_TEXT is released;
+    // the upload texture only grows, so it is reused while typing
+    gs_texture_t *blit_texture;
+    int32_t blit_x;
+    int32_t blit_y;
+    uint32_t blit_width;
+    uint32_t blit_height;
+    bool blit_pending;
+    // the pixels of the blit, RGBA, recorded in the history when committed
+    std::vector<uint32_t> blit_pixels;
+
+    // text being typed, drawn over the page until it is committed
+    draw_command text_preview;
+    bool text_pending;
+
+    // committed items for undo, and replayed when the canvas size changes
+    PageHistory history;
+    // bounds of the commands in the history, at width x height
+    StrokeIndex index;
+    // tessellated strokes of the history, at width x height
+    StrokeCache strokes;
+    // pen stroke being drawn
+    draw_command stroke;
+    // coverage of the translucent pen stroke being drawn, composited over
+    // the page as it was at the press, and its bounds in view pixels
+    StrokeCoverage pen_coverage;
+    float pen_bounds[4];
+    // the saved contents were loaded, or there were none
+    std::atomic<bool> restored;
+    // sources whose current page this is; pages are parked when none is
+    std::atomic<int32_t> shown;
+    // changes whenever committed content does, for thumbnails
+    uint32_t revision;
 
     enum gs_color_format format;
     uint32_t width;
     uint32_t height;
 
+    // while nothing is drawn on the page it lives in tiles of the source's
+    // TileAtlas instead of texrender, by tile index
+    bool parked;
+    std::unordered_map<uint32_t, tile_slot> tiles;
+    // tiles committed content may cover, at width x height
+    std::vector<bool> ink;
+
+    std::atomic<bool> infinite;
+    page_view view;
+    world_tiles world;
+
+    // commands the eraser has gone over in this drag, not committed yet
+    std::vector<uint32_t> erasing;
+    // lasso being drawn, in view pixels
+    std::vector<z_point> lasso;
+    // commands the last lasso took, while the history is as it was then
+    std::vector<uint32_t> selection;
+    uint64_t selection_generation;
+
+    // held while the page is restored
     std::mutex mutex;
 
     union {
@@ -32,28 +139,151 @@ struct gs_drawing_texture {
     };
 };
 
+// input from set_canvas_data, drawn on the next frame
+#define CANVAS_EVENT_QUEUE_SIZE 4096
+
+struct canvas_event {
+    int32_t x;
+    int32_t y;
+    uint32_t color;
+    int shape_type;
+    int size;
+    // scales the pen width at the press; negative without pressure
+    float pressure;
+    bool pressed;
+    bool moving;
+    bool released;
+};
+
+struct page_ref {
+    std::string key;
+    int32_t page_index;
+    // null for a page only in the session file
+    gs_drawing_texture *texture;
+};
+
+// Pages of one key, in a flat vector indexed by page index, so page
+// indices are expected to be dense and are limited to KEY_MAX_PAGES.
+//
+// The pages of a key are shared by every source showing it from the same
+// session, which hands them out: they are drawn into once, by whichever
+// source is fed the input, and every source renders the same textures,
+// though each source keeps its own current page of the key.  Sources with
+// different sessions keep their own pages of a key.  The pages go when
+// the last source holding the key does.
+#define KEY_MAX_PAGES 4096
+
 class KeySource {
 public:
     KeySource();
+    KeySource(const KeySource &) = delete;
+    KeySource &operator=(const KeySource &) = delete;
     virtual ~KeySource();
 
     bool AddPage(int32_t page_index);
     bool RemovePage(int32_t page_index);
-    bool SetCurrentPage(int32_t page_index);
     bool UpdateTexture(int32_t page_index, gs_drawing_texture* texture);
     gs_drawing_texture *GetPageIndexTexture(int32_t page_index);
     int32_t GetPageSize();
-    int32_t GetCurrentPage();
+    // by page index, null where there is no page
+    std::vector<gs_drawing_texture *> GetPages();
 
 private:
+    bool add_page(int32_t page_index);
     void release_draw_texture(gs_drawing_texture* texture);
 
 private:
-    int32_t m_cur_page_idx_ = 0;
-    std::unordered_map<int32_t, gs_drawing_texture *> m_page_list_;
+    // guards the pages, which sources on other threads share; taken last
+    std::mutex m_mutex_;
+    // where the pages are parked
+    std::shared_ptr<TileAtlas> m_tiles_;
+
+    int32_t m_page_count_ = 0;
+    std::vector<gs_drawing_texture *> m_page_list_;
+
+};
+
+// A session file with its journal and writer, and the keys drawn from
+// it.  Every source opening the same path shares one, through a registry
+// of the module keyed by path, so the file has one owner: operations of
+// all its sources go to one journal, in the order the graphics thread
+// draws them, and their saves to one writer.  Sources without a session
+// share the one of the empty path, which is never read or written.
+class DrawSession {
+public:
+    static std::shared_ptr<DrawSession> Get(const std::string &path);
+
+    explicit DrawSession(const std::string &path);
+    DrawSession(const DrawSession &) = delete;
+    DrawSession &operator=(const DrawSession &) = delete;
+    virtual ~DrawSession();
+
+    const std::string &GetPath() const { return m_path_; }
+    // false when the file could not be read
+    bool IsOpen() const { return m_opened_; }
+
+    // The pages of the key, shared with the other sources of the session.
+    std::shared_ptr<KeySource> GetKey(const std::string &key);
+    // Takes the key out when no other source holds it, so adding it again
+    // starts blank.
+    void ForgetKey(const std::string &key, const std::shared_ptr<KeySource> &key_item);
+
+    // Each key saved or journaled in the session, with its current page.
+    std::vector<std::pair<std::string, int32_t>> GetKeyInfo();
+    int32_t GetCurrentPage(const std::string &key);
+    // The page of the key some source turned to last, saved as current.
+    void SetCurrentPage(const std::string &key, int32_t page_index);
+
+    // Graphics thread only.
+    void LogOperation(journal_op op, const std::string &key, int32_t page_index,
+        const draw_command *command);
+    bool JournalCompactionDue() { return m_journal_.CompactionDue(); }
+
+    // Loads a page from the file and replays its journaled operations.
+    void RestorePage(const std::string &key, int32_t page_index, gs_drawing_texture *texture);
+    // The pages in the file, loaded or not.
+    std::vector<std::pair<std::string, int32_t>> GetSavedPages();
+    bool ReadSavedPage(const std::string &key, int32_t page_index, session_page &page);
+
+    // Snapshots the pages of every key and writes them in the background.
+    void Save();
+
+private:
+    std::shared_ptr<KeySource> find_key(const std::string &key);
+    void write(std::vector<session_page> &pages, uint32_t journal_sequence);
+
+private:
+    const std::string m_path_;
+    bool m_opened_ = false;
+
+    // guards the file and the journaled pages; taken before the keys of
+    // any source
+    std::mutex m_mutex_;
+    SessionFile m_file_;
+    SessionWriter m_writer_;
 
+    Journal m_journal_;
+    // journaled operations of pages not restored yet
+    std::map<std::pair<std::string, int32_t>, std::vector<journal_record>> m_journal_pages_;
+
+    // guards the keys and their current pages; taken after the keys of a
+    // source and before the pages of a key
+    std::mutex m_keys_mutex_;
+    std::map<std::string, std::weak_ptr<KeySource>> m_keys_;
+    std::map<std::string, int32_t> m_current_pages_;
+    // keys of the file and the journal, in the order they appear, and the
+    // pages each has in the journal, which a key gets when it is made
+    std::vector<std::string> m_saved_keys_;
+    std::map<std::string, std::vector<int32_t>> m_journaled_pages_;
 };
 
+// Threads: the UI thread changes keys, pages and settings, the input
+// thread only queues events, and the graphics thread draws.  Pages are
+// drawn and changed with the graphics context entered, which orders all
+// raster work.  Locks are taken in the order graphics, page, session,
+// keys, keys of the session, then the pages of a key, and keys are never
+// held while entering graphics.  Pages are not freed while the source exists, so the current
+// page is published through an atomic pointer for the render path.
 class SourceManager {
 public:
     SourceManager(obs_source_t *source);
@@ -75,9 +305,13 @@ public:
 
     int32_t GetPageSize(const std::string &key);
 
+    // The size of the video canvas, cached from the last video reset.
     void UpdateCanvasSize(uint32_t width, uint32_t height);
 
     std::tuple<uint32_t, uint32_t> GetCanvasSize();
+    // set when the canvas size changed, until every page is redrawn at it
+    bool ResizePending() const { return m_resize_pending_; }
+    void SetResizePending(bool pending) { m_resize_pending_ = pending; }
 
     void SetLineWidth(int32_t width);
     int32_t GetLineWidth();
@@ -89,22 +323,96 @@ public:
 
     int32_t GetCurrentKeyCurrentPage();
 
-    std::unordered_map<std::string, int32_t> GetKeyInfo();
+    // Each key and its current page, in the order keys were first added.
+    std::vector<std::pair<std::string, int32_t>> GetKeyInfo();
+
+    void SetFont(const std::string &font_file);
+    std::shared_ptr<GlyphAtlas> GetGlyphAtlas();
+
+    // Opens a saved session, shared with the other sources opening it;
+    // pages are loaded when first used.
+    bool OpenSession(const std::string &path);
+    // Snapshots all pages of the session and writes them in the background.
+    void SaveSession();
+
+    // Input thread only; false when the queue is full.
+    bool PushCanvasEvent(const canvas_event &event) { return m_canvas_events_.Push(canvas_event(event)); }
+    // Graphics context entered.
+    bool PopCanvasEvent(canvas_event &event) { return m_canvas_events_.Pop(event); }
+    bool HasCanvasEvents() const { return !m_canvas_events_.Empty(); }
+
+    // Latest timestamp of the batched samples drawn; graphics context entered.
+    uint64_t GetLastSampleTime() const { return m_last_sample_time_; }
+    void SetLastSampleTime(uint64_t timestamp) { m_last_sample_time_ = timestamp; }
+
+    // Every page, including the saved ones not loaded yet.
+    std::vector<page_ref> ListPages();
+    bool ReadSavedPage(const std::string &key, int32_t page_index, session_page &page);
+
+    // Graphics thread only.
+    TileAtlas &GetTiles() { return *m_tiles_; }
+
+    ThumbnailCache &GetThumbnails() { return m_thumbnails_; }
+    // thumbnails are only made once something asked for them
+    void EnableThumbnails() { m_thumbnails_enabled_ = true; }
+    bool ThumbnailsEnabled() const { return m_thumbnails_enabled_; }
+
+    // Journals an operation on the current page; graphics thread only.
+    void LogOperation(journal_op op, const draw_command *command = nullptr);
+    bool JournalCompactionDue();
 
 public:
     obs_source_t *source { nullptr };
     obs_properties_t *props { nullptr };
 
 private:
-    
-    std::string m_current_key_ = "";
-    int32_t m_current_idx_ = 0;
+    // Keys locked for writing.
+    uint32_t intern_key(const std::string &key);
+    // Keys locked; null for a key that was never added or was removed.
+    KeySource *find_key(const std::string &key);
+    KeySource *find_key(uint32_t key_id);
+
+    void update_current_texture();
+    gs_drawing_texture *get_page_texture(uint32_t key_id, int32_t page_index);
+    std::shared_ptr<DrawSession> get_session();
+
+private:
+    // guards the keys, the pages of each key and the current key
+    std::shared_mutex m_keys_mutex_;
+    // keys are interned into ids once, and looked up by id after that
+    std::unordered_map<std::string, uint32_t> m_key_ids_;
+    std::vector<std::string> m_key_names_;
+    // the page this source shows of each key, by key id; sources showing
+    // the same key share its pages but not where they are in it
+    std::vector<int32_t> m_current_pages_;
+    // where the keys come from; replaced with the keys locked for writing
+    std::shared_ptr<DrawSession> m_session_;
+    uint32_t m_current_key_id_ = UINT32_MAX;
+    std::atomic<int32_t> m_current_idx_ { 0 };
+    // the current page, read by the render path without locking
+    std::atomic<gs_drawing_texture *> m_current_texture_ { nullptr };
+
+    // canvas_data, width in the high half
+    std::atomic<uint64_t> m_canvas_size_ { 0 };
+    std::atomic<bool> m_resize_pending_ { false };
+    std::atomic<int32_t> m_line_width_ { 0 };
+
+    std::mutex m_font_mutex_;
+    std::string m_font_file_;
+    std::shared_ptr<GlyphAtlas> m_glyph_atlas_;
+
+    SpscQueue<canvas_event, CANVAS_EVENT_QUEUE_SIZE> m_canvas_events_;
+    uint64_t m_last_sample_time_ = 0;
+
+    std::shared_ptr<TileAtlas> m_tiles_;
 
-    // canvas_data
-    uint32_t m_canvas_width_ = 0;
-    uint32_t m_canvas_height_ = 0;
-    int32_t m_line_width_ = 0;
+    ThumbnailCache m_thumbnails_;
+    std::atomic<bool> m_thumbnails_enabled_ { false };
 
-    std::unordered_map<std::string, KeySource *> m_draw_list;
+    // by key id, null for a removed key
+    std::vector<std::shared_ptr<KeySource>> m_draw_list;
+    // removed keys and keys of a previous session, whose pages the render
+    // path may still be drawing
+    std::vector<std::shared_ptr<KeySource>> m_removed_keys_;
 
 };
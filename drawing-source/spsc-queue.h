@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded lock-free queue for one producer and one consumer thread.
+// Push fails instead of waiting when the queue is full.
+template<typename T, size_t Capacity> class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    bool Push(T &&item)
+    {
+        const size_t tail = m_tail_.load(std::memory_order_relaxed);
+        if (tail - m_head_.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        m_items_[tail & (Capacity - 1)] = std::move(item);
+        m_tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T &item)
+    {
+        const size_t head = m_head_.load(std::memory_order_relaxed);
+        if (head == m_tail_.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(m_items_[head & (Capacity - 1)]);
+        m_head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Empty() const
+    {
+        return m_head_.load(std::memory_order_acquire) == m_tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    T m_items_[Capacity];
+
+    // on separate cache lines so the threads do not share one
+    alignas(64) std::atomic<size_t> m_head_ { 0 };
+    alignas(64) std::atomic<size_t> m_tail_ { 0 };
+};
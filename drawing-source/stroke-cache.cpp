@@ -0,0 +1,110 @@
+#include "stroke-cache.h"
+
+#include <algorithm>
+
+static size_t stroke_bytes(uint32_t count)
+{
+    return (sizeof(vec3) + 2 * sizeof(vec2)) * count;
+}
+
+StrokeCache::~StrokeCache()
+{
+    Clear();
+}
+
+void StrokeCache::Reset(uint32_t width, uint32_t height, uint64_t generation)
+{
+    Clear();
+    m_strokes_.clear();
+    m_width_ = width;
+    m_height_ = height;
+    m_generation_ = generation;
+}
+
+bool StrokeCache::Matches(uint32_t width, uint32_t height, uint64_t generation) const
+{
+    return m_width_ == width && m_height_ == height && m_generation_ == generation;
+}
+
+void StrokeCache::release(cached_stroke &stroke)
+{
+    if (!stroke.buffer)
+        return;
+
+    gs_vertexbuffer_destroy(stroke.buffer);
+    m_bytes_ -= stroke_bytes(stroke.count);
+    stroke = { nullptr, 0, 0 };
+}
+
+void StrokeCache::Truncate(size_t count)
+{
+    if (count >= m_strokes_.size())
+        return;
+
+    for (size_t i = count; i < m_strokes_.size(); i++)
+        release(m_strokes_[i]);
+    m_strokes_.resize(count);
+}
+
+void StrokeCache::Clear()
+{
+    for (auto &stroke : m_strokes_)
+        release(stroke);
+}
+
+bool StrokeCache::Draw(size_t position)
+{
+    if (position >= m_strokes_.size() || !m_strokes_[position].buffer)
+        return false;
+
+    cached_stroke &stroke = m_strokes_[position];
+    stroke.used = ++m_clock_;
+    gs_load_vertexbuffer(stroke.buffer);
+    gs_load_indexbuffer(nullptr);
+    gs_draw(GS_TRIS, 0, stroke.count);
+    return true;
+}
+
+bool StrokeCache::Store(size_t position, const std::vector<stroke_vertex> &vertices)
+{
+    if (vertices.empty() || stroke_bytes(static_cast<uint32_t>(vertices.size())) > STROKE_CACHE_BYTES / 4)
+        return false;
+
+    if (position >= m_strokes_.size())
+        m_strokes_.resize(position + 1, { nullptr, 0, 0 });
+    release(m_strokes_[position]);
+
+    struct gs_vb_data *vbd = stroke_vbdata(vertices.size());
+    stroke_fill(vbd, vertices.data(), vertices.size());
+
+    // the buffer takes the data
+    gs_vertbuffer_t *buffer = gs_vertexbuffer_create(vbd, 0);
+    if (!buffer)
+        return false;
+
+    const auto count = static_cast<uint32_t>(vertices.size());
+    m_strokes_[position] = { buffer, count, 0 };
+    m_bytes_ += stroke_bytes(count);
+    evict();
+    return Draw(position);
+}
+
+/* Drops the least recently drawn strokes until a quarter of the budget is free. */
+void StrokeCache::evict()
+{
+    if (m_bytes_ <= STROKE_CACHE_BYTES)
+        return;
+
+    std::vector<std::pair<uint64_t, size_t>> by_use;
+    for (size_t i = 0; i < m_strokes_.size(); i++) {
+        if (m_strokes_[i].buffer)
+            by_use.emplace_back(m_strokes_[i].used, i);
+    }
+    std::sort(by_use.begin(), by_use.end());
+
+    // the stroke just stored is not drawn yet and stays
+    for (size_t i = 0; i < by_use.size() && m_bytes_ > STROKE_CACHE_BYTES / 4 * 3; i++) {
+        if (m_strokes_[by_use[i].second].used)
+            release(m_strokes_[by_use[i].second]);
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "obs-module.h"
+#include "stroke-effect.h"
+
+// Tessellated pen and line strokes of a page, each in a static vertex
+// buffer, so redrawing a page after an undo, an erase or a restore draws
+// the buffers instead of tessellating and uploading every segment again.
+//
+// Strokes are cached by their place in the page history at one canvas
+// size and history generation, like the StrokeIndex.  Past
+// STROKE_CACHE_BYTES the least recently drawn buffers are dropped, and a
+// parked page drops all of them.
+//
+// Graphics thread only.
+#define STROKE_CACHE_BYTES (16 * 1024 * 1024)
+
+class StrokeCache {
+public:
+    StrokeCache() = default;
+    StrokeCache(const StrokeCache &) = delete;
+    StrokeCache &operator=(const StrokeCache &) = delete;
+    virtual ~StrokeCache();
+
+    // Drops every stroke; the cache is then for the given canvas size and
+    // history generation.
+    void Reset(uint32_t width, uint32_t height, uint64_t generation);
+    bool Matches(uint32_t width, uint32_t height, uint64_t generation) const;
+
+    // Drops the strokes from count on.
+    void Truncate(size_t count);
+    // Drops every buffer, keeping the size and generation.
+    void Clear();
+
+    // Draws the stroke at position, inside a pass of the stroke effect.
+    // False when it is not cached.
+    bool Draw(size_t position);
+    // Caches the segments of the stroke at position and draws it.  False
+    // when no buffer could be made.
+    bool Store(size_t position, const std::vector<stroke_vertex> &vertices);
+
+    size_t Bytes() const { return m_bytes_; }
+
+private:
+    struct cached_stroke {
+        gs_vertbuffer_t *buffer;
+        uint32_t count;
+        uint64_t used;
+    };
+
+    void release(cached_stroke &stroke);
+    void evict();
+
+private:
+    uint32_t m_width_ = 0;
+    uint32_t m_height_ = 0;
+    uint64_t m_generation_ = 0;
+
+    std::vector<cached_stroke> m_strokes_;
+    size_t m_bytes_ = 0;
+    // counts draws, to find the least recently drawn strokes
+    uint64_t m_clock_ = 0;
+};
@@ -0,0 +1,231 @@
+#include "stroke-effect.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define warn(format, ...) blog(LOG_WARNING, "[draw_source] " format, ##__VA_ARGS__)
+
+// room on each side of the stroke for its edge to fade out in
+#define EDGE_PIXELS 1.0f
+
+static gs_effect_t *effect = nullptr;
+static bool load_failed = false;
+
+static gs_vertbuffer_t *vertex_buffer = nullptr;
+static size_t vertex_capacity = 0;
+
+static StrokeCoverage scratch;
+
+float stroke_reach(float width)
+{
+    return width * 0.5f + EDGE_PIXELS;
+}
+
+void stroke_grow_bounds(const stroke_vertex *vertices, size_t count, float bounds[4])
+{
+    for (size_t i = 0; i < count; i++) {
+        bounds[0] = std::min(bounds[0], vertices[i].x);
+        bounds[1] = std::min(bounds[1], vertices[i].y);
+        bounds[2] = std::max(bounds[2], vertices[i].x);
+        bounds[3] = std::max(bounds[3], vertices[i].y);
+    }
+}
+
+size_t stroke_segment(float x0, float y0, float x1, float y1, float width, stroke_vertex *out)
+{
+    if (width <= 0.0f)
+        return 0;
+
+    const float dx = x1 - x0;
+    const float dy = y1 - y0;
+    const float length = sqrtf(dx * dx + dy * dy);
+
+    // a dot is a capsule of no length, pointing anywhere
+    const float ux = length > 0.0f ? dx / length : 1.0f;
+    const float uy = length > 0.0f ? dy / length : 0.0f;
+
+    const float half = width * 0.5f;
+    const float reach = stroke_reach(width);
+    const float corners[4][2] = {
+        { -reach, -reach },
+        { length + reach, -reach },
+        { -reach, reach },
+        { length + reach, reach },
+    };
+
+    stroke_vertex vertices[4];
+    for (int i = 0; i < 4; i++) {
+        const float along = corners[i][0];
+        const float across = corners[i][1];
+        vertices[i] = { x0 + ux * along - uy * across, y0 + uy * along + ux * across
+            , along, across, length, half };
+    }
+
+    out[0] = vertices[0];
+    out[1] = vertices[1];
+    out[2] = vertices[2];
+    out[3] = vertices[1];
+    out[4] = vertices[3];
+    out[5] = vertices[2];
+    return STROKE_SEGMENT_VERTICES;
+}
+
+struct gs_vb_data *stroke_vbdata(size_t count)
+{
+    struct gs_vb_data *vbd = gs_vbdata_create();
+    vbd->num = count;
+    vbd->points = static_cast<vec3 *>(bzalloc(sizeof(vec3) * vbd->num));
+    vbd->num_tex = 2;
+    vbd->tvarray = static_cast<gs_tvertarray *>(bzalloc(sizeof(gs_tvertarray) * vbd->num_tex));
+    for (size_t unit = 0; unit < vbd->num_tex; unit++) {
+        vbd->tvarray[unit].width = 2;
+        vbd->tvarray[unit].array = bzalloc(sizeof(vec2) * vbd->num);
+    }
+    return vbd;
+}
+
+void stroke_fill(struct gs_vb_data *vbd, const stroke_vertex *vertices, size_t count)
+{
+    auto *edge = static_cast<vec2 *>(vbd->tvarray[0].array);
+    auto *shape = static_cast<vec2 *>(vbd->tvarray[1].array);
+    for (size_t i = 0; i < count; i++) {
+        vec3_set(&vbd->points[i], vertices[i].x, vertices[i].y, 0.0f);
+        vec2_set(&edge[i], vertices[i].along, vertices[i].across);
+        vec2_set(&shape[i], vertices[i].length, vertices[i].half_width);
+    }
+}
+
+static bool reserve_vertices(size_t count)
+{
+    if (count <= vertex_capacity)
+        return true;
+
+    gs_vertexbuffer_destroy(vertex_buffer);
+
+    vertex_capacity = std::max<size_t>(vertex_capacity * 2, 64 * STROKE_SEGMENT_VERTICES);
+    while (vertex_capacity < count)
+        vertex_capacity *= 2;
+
+    vertex_buffer = gs_vertexbuffer_create(stroke_vbdata(vertex_capacity), GS_DYNAMIC);
+    if (!vertex_buffer)
+        vertex_capacity = 0;
+    return vertex_buffer != nullptr;
+}
+
+void stroke_draw(const stroke_vertex *vertices, size_t count)
+{
+    if (!count || !reserve_vertices(count))
+        return;
+
+    // vertices past count are left from earlier strokes and not drawn
+    stroke_fill(gs_vertexbuffer_get_data(vertex_buffer), vertices, count);
+    gs_vertexbuffer_flush(vertex_buffer);
+
+    gs_load_vertexbuffer(vertex_buffer);
+    gs_load_indexbuffer(nullptr);
+    gs_draw(GS_TRIS, 0, static_cast<uint32_t>(count));
+}
+
+StrokeCoverage::~StrokeCoverage()
+{
+    Free();
+}
+
+bool StrokeCoverage::Begin(bool clear)
+{
+    gs_texture_t *target = gs_get_render_target();
+    if (!target)
+        return false;
+
+    if (!m_render_)
+        m_render_ = gs_texrender_create(GS_R8, GS_ZS_NONE);
+
+    // the texrender keeps the projection but not the transform
+    struct matrix4 transform;
+    gs_matrix_get(&transform);
+
+    gs_texrender_reset(m_render_);
+    if (!gs_texrender_begin(m_render_, gs_texture_get_width(target), gs_texture_get_height(target)))
+        return false;
+    gs_matrix_set(&transform);
+
+    if (clear) {
+        vec4 empty;
+        vec4_set(&empty, 0.0f, 0.0f, 0.0f, 0.0f);
+        gs_clear(GS_CLEAR_COLOR, &empty, 1.0f, 0);
+    }
+
+    gs_blend_state_push();
+    gs_enable_blending(true);
+    gs_blend_function(GS_BLEND_ONE, GS_BLEND_ONE);
+    gs_blend_op(GS_BLEND_OP_MAX);
+    return true;
+}
+
+void StrokeCoverage::End()
+{
+    gs_blend_state_pop();
+    gs_texrender_end(m_render_);
+}
+
+void StrokeCoverage::Composite(const vec4 *color, const float bounds[4])
+{
+    gs_effect_t *stroke = stroke_effect();
+    if (!stroke || !m_render_ || bounds[0] >= bounds[2] || bounds[1] >= bounds[3])
+        return;
+
+    gs_effect_set_vec4(gs_effect_get_param_by_name(stroke, "color"), color);
+    gs_effect_set_texture(gs_effect_get_param_by_name(stroke, "image"), gs_texrender_get_texture(m_render_));
+
+    while (gs_effect_loop(stroke, "Composite")) {
+        gs_render_start(true);
+        gs_vertex2f(bounds[0], bounds[1]);
+        gs_vertex2f(bounds[2], bounds[1]);
+        gs_vertex2f(bounds[0], bounds[3]);
+        gs_vertex2f(bounds[2], bounds[3]);
+        gs_render_stop(GS_TRISTRIP);
+    }
+}
+
+void StrokeCoverage::Free()
+{
+    gs_texrender_destroy(m_render_);
+    m_render_ = nullptr;
+}
+
+StrokeCoverage &stroke_scratch()
+{
+    return scratch;
+}
+
+gs_effect_t *stroke_effect()
+{
+    if (!effect && !load_failed) {
+        char *file = obs_module_file("stroke.effect");
+        char *error = nullptr;
+        effect = gs_effect_create_from_file(file, &error);
+        if (!effect) {
+            warn("failed to load stroke effect: %s", error ? error : "unknown error");
+            load_failed = true;
+        }
+        bfree(error);
+        bfree(file);
+    }
+    return effect;
+}
+
+void stroke_free_resources()
+{
+    load_failed = false;
+    if (!effect && !vertex_buffer)
+        return;
+
+    obs_enter_graphics();
+    gs_effect_destroy(effect);
+    effect = nullptr;
+    gs_vertexbuffer_destroy(vertex_buffer);
+    vertex_buffer = nullptr;
+    vertex_capacity = 0;
+    scratch.Free();
+    obs_leave_graphics();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+
+#include "obs-module.h"
+
+// Pen and line segments drawn as capsules by stroke.effect, which computes
+// how much of each pixel the capsule covers from the distance to the
+// segment, so strokes get smooth edges at the canvas resolution without
+// multisampled targets.  A segment is two triangles a pixel wider than
+// the stroke on every side, for the edge to fade out in.
+//
+// Draw them with the "Draw" technique and the color in "color", blending
+// alpha with GS_BLEND_ONE so the edges keep their coverage on a
+// transparent page.  Graphics thread only.
+#define STROKE_SEGMENT_VERTICES 6
+
+struct stroke_vertex {
+    float x;
+    float y;
+    // the TEXCOORD0 and TEXCOORD1 of stroke.effect
+    float along;
+    float across;
+    float length;
+    float half_width;
+};
+
+// The vertices of a segment of the given width as triangles; returns how
+// many, STROKE_SEGMENT_VERTICES or 0 when it has no width.
+size_t stroke_segment(float x0, float y0, float x1, float y1, float width, stroke_vertex *out);
+
+// Vertex data for count vertices, with the two texture coordinates of the
+// effect, for a vertex buffer that takes it.
+struct gs_vb_data *stroke_vbdata(size_t count);
+void stroke_fill(struct gs_vb_data *vbd, const stroke_vertex *vertices, size_t count);
+
+// Draws vertices as triangles, inside a pass of the stroke effect.  Immediate
+// mode only has one texture coordinate, so they go through a dynamic vertex
+// buffer that is kept and only grows.
+void stroke_draw(const stroke_vertex *vertices, size_t count);
+
+// How far the capsule of a segment of the given width reaches past the
+// segment, its fading edge included.
+float stroke_reach(float width);
+
+// Grows bounds, x0, y0, x1 and y1, to hold vertices.
+void stroke_grow_bounds(const stroke_vertex *vertices, size_t count, float bounds[4]);
+
+// Capsules of one stroke overlap at every joint, where translucent ink
+// would be blended twice.  Translucent strokes are therefore drawn in two
+// steps: the capsules go into a coverage target with the "Coverage"
+// technique and GS_BLEND_OP_MAX, so each pixel keeps the largest coverage
+// of any segment, then Composite draws that coverage once in the stroke
+// color.  Opaque strokes cover their joints fully and use "Draw".
+class StrokeCoverage {
+public:
+    StrokeCoverage() = default;
+    StrokeCoverage(const StrokeCoverage &) = delete;
+    StrokeCoverage &operator=(const StrokeCoverage &) = delete;
+    virtual ~StrokeCoverage();
+
+    // Binds the coverage target at the size of the current target and with
+    // its transform, so the two line up pixel for pixel.  Cleared when
+    // clear is set, else the capsules add to the coverage already there.
+    // False when there is no render target to match.
+    bool Begin(bool clear);
+    void End();
+
+    // Draws the coverage within bounds, in the units of the capsules, into
+    // the current target, with the blending of the caller.
+    void Composite(const vec4 *color, const float bounds[4]);
+
+    void Free();
+
+private:
+    gs_texrender_t *m_render_ = nullptr;
+};
+
+// The coverage target replays share.
+StrokeCoverage &stroke_scratch();
+
+// Null when the effect could not be loaded; strokes are then drawn solid.
+gs_effect_t *stroke_effect();
+
+// Frees the stroke effect, buffer and scratch coverage, from obs_module_unload.
+void stroke_free_resources();
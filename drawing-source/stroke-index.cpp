@@ -0,0 +1,166 @@
+#include "stroke-index.h"
+
+#include <algorithm>
+#include <cmath>
+
+// commands over more cells than this are checked by every query instead
+#define MAX_CELLS_PER_COMMAND 1024
+
+static const uint32_t NOT_ERASED = UINT32_MAX;
+
+void StrokeIndex::Reset(uint32_t width, uint32_t height, uint64_t generation)
+{
+    m_width_ = width;
+    m_height_ = height;
+    m_generation_ = generation;
+    m_cells_.clear();
+    m_large_.clear();
+    m_bounds_.clear();
+    m_erased_at_.clear();
+    m_seen_.clear();
+}
+
+bool StrokeIndex::Matches(uint32_t width, uint32_t height, uint64_t generation) const
+{
+    return m_width_ == width && m_height_ == height && m_generation_ == generation;
+}
+
+void StrokeIndex::cell_range(const index_rect &rect, int32_t range[4]) const
+{
+    const auto size = static_cast<float>(STROKE_INDEX_CELL);
+    range[0] = static_cast<int32_t>(std::floor(rect.x0 / size));
+    range[1] = static_cast<int32_t>(std::floor(rect.y0 / size));
+    range[2] = static_cast<int32_t>(std::floor(rect.x1 / size));
+    range[3] = static_cast<int32_t>(std::floor(rect.y1 / size));
+}
+
+uint64_t StrokeIndex::cell_key(int32_t x, int32_t y) const
+{
+    return static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32 | static_cast<uint32_t>(y);
+}
+
+void StrokeIndex::Add(const index_rect *bounds)
+{
+    const auto index = static_cast<uint32_t>(m_bounds_.size());
+    m_bounds_.push_back(bounds ? *bounds : index_rect { 0.0f, 0.0f, -1.0f, -1.0f });
+    m_erased_at_.push_back(NOT_ERASED);
+    m_seen_.push_back(0);
+    if (!bounds)
+        return;
+
+    int32_t range[4];
+    cell_range(*bounds, range);
+    if (static_cast<int64_t>(range[2] - range[0] + 1) * (range[3] - range[1] + 1) > MAX_CELLS_PER_COMMAND) {
+        m_large_.push_back(index);
+        return;
+    }
+
+    for (int32_t y = range[1]; y <= range[3]; y++) {
+        for (int32_t x = range[0]; x <= range[2]; x++)
+            m_cells_[cell_key(x, y)].push_back(index);
+    }
+}
+
+void StrokeIndex::Erase(size_t target, size_t at)
+{
+    if (target < m_erased_at_.size() && m_erased_at_[target] == NOT_ERASED)
+        m_erased_at_[target] = static_cast<uint32_t>(at);
+}
+
+void StrokeIndex::Truncate(size_t count)
+{
+    if (count >= m_bounds_.size())
+        return;
+
+    // cells list commands in order, so the dropped ones are at the back
+    for (size_t i = count; i < m_bounds_.size(); i++) {
+        const index_rect &bounds = m_bounds_[i];
+        if (empty(bounds))
+            continue;
+
+        int32_t range[4];
+        cell_range(bounds, range);
+        if (static_cast<int64_t>(range[2] - range[0] + 1) * (range[3] - range[1] + 1) > MAX_CELLS_PER_COMMAND)
+            continue;
+
+        for (int32_t y = range[1]; y <= range[3]; y++) {
+            for (int32_t x = range[0]; x <= range[2]; x++) {
+                const auto find_item = m_cells_.find(cell_key(x, y));
+                if (find_item == m_cells_.end())
+                    continue;
+                auto &cell = find_item->second;
+                while (!cell.empty() && cell.back() >= count)
+                    cell.pop_back();
+                if (cell.empty())
+                    m_cells_.erase(find_item);
+            }
+        }
+    }
+    while (!m_large_.empty() && m_large_.back() >= count)
+        m_large_.pop_back();
+
+    m_bounds_.resize(count);
+    m_erased_at_.resize(count);
+    m_seen_.resize(count);
+    for (auto &at : m_erased_at_) {
+        if (at != NOT_ERASED && at >= count)
+            at = NOT_ERASED;
+    }
+}
+
+bool StrokeIndex::Visible(size_t index, size_t applied) const
+{
+    return index < applied && (m_erased_at_[index] == NOT_ERASED || m_erased_at_[index] >= applied);
+}
+
+void StrokeIndex::Query(const index_rect &rect, size_t limit, std::vector<uint32_t> &out)
+{
+    out.clear();
+    if (empty(rect))
+        return;
+
+    if (++m_query_ == 0) {
+        std::fill(m_seen_.begin(), m_seen_.end(), 0);
+        m_query_ = 1;
+    }
+
+    const auto found = [&](uint32_t index) {
+        if (index >= limit || m_seen_[index] == m_query_)
+            return;
+        m_seen_[index] = m_query_;
+
+        const index_rect &bounds = m_bounds_[index];
+        if (bounds.x0 < rect.x1 && bounds.x1 > rect.x0 && bounds.y0 < rect.y1 && bounds.y1 > rect.y0)
+            out.push_back(index);
+    };
+
+    int32_t range[4];
+    cell_range(rect, range);
+    if (static_cast<int64_t>(range[2] - range[0] + 1) * (range[3] - range[1] + 1)
+        > static_cast<int64_t>(m_cells_.size())) {
+        // a rect over more cells than hold anything, as a zoomed out view is
+        for (const auto &cell : m_cells_) {
+            const auto x = static_cast<int32_t>(cell.first >> 32);
+            const auto y = static_cast<int32_t>(cell.first & 0xFFFFFFFF);
+            if (x < range[0] || x > range[2] || y < range[1] || y > range[3])
+                continue;
+            for (uint32_t index : cell.second)
+                found(index);
+        }
+    }
+    else {
+        for (int32_t y = range[1]; y <= range[3]; y++) {
+            for (int32_t x = range[0]; x <= range[2]; x++) {
+                const auto find_item = m_cells_.find(cell_key(x, y));
+                if (find_item == m_cells_.end())
+                    continue;
+                for (uint32_t index : find_item->second)
+                    found(index);
+            }
+        }
+    }
+    for (uint32_t index : m_large_)
+        found(index);
+
+    std::sort(out.begin(), out.end());
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Bounds of the committed commands of a page in a uniform grid of
+// STROKE_INDEX_CELL page pixel cells, so erasing, selection and drawing
+// part of a page look only at the commands near it.  A query costs the
+// cells it covers plus the commands found, whatever the page holds.
+//
+// Commands are indexed by their place in the page history, and follow it:
+// new commands are added at the end, and commands that were undone and
+// replaced are truncated.  Which erase removed each command is kept as
+// well, so a query can skip the commands erased at any point of the
+// history.
+//
+// Graphics thread only.
+#define STROKE_INDEX_CELL 256
+
+struct index_rect {
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+};
+
+class StrokeIndex {
+public:
+    StrokeIndex() = default;
+    StrokeIndex(const StrokeIndex &) = delete;
+    StrokeIndex &operator=(const StrokeIndex &) = delete;
+    virtual ~StrokeIndex() = default;
+
+    // Drops every command; the index is then for the given canvas size and
+    // history generation.
+    void Reset(uint32_t width, uint32_t height, uint64_t generation);
+    bool Matches(uint32_t width, uint32_t height, uint64_t generation) const;
+
+    size_t Size() const { return m_bounds_.size(); }
+
+    // Adds the next command, with no bounds when it draws nothing.
+    void Add(const index_rect *bounds);
+    // The command at `at` erases the one at `target`.
+    void Erase(size_t target, size_t at);
+    // Drops the commands from count on, and the erases they made.
+    void Truncate(size_t count);
+
+    // Shown once the first `applied` commands are, unless erased by one of them.
+    bool Visible(size_t index, size_t applied) const;
+    const index_rect &Bounds(size_t index) const { return m_bounds_[index]; }
+
+    // Commands below limit whose bounds meet the rect, in order.
+    void Query(const index_rect &rect, size_t limit, std::vector<uint32_t> &out);
+
+private:
+    static bool empty(const index_rect &rect) { return rect.x1 < rect.x0; }
+    void cell_range(const index_rect &rect, int32_t range[4]) const;
+    uint64_t cell_key(int32_t x, int32_t y) const;
+
+private:
+    uint32_t m_width_ = 0;
+    uint32_t m_height_ = 0;
+    uint64_t m_generation_ = 0;
+
+    std::unordered_map<uint64_t, std::vector<uint32_t>> m_cells_;
+    // commands too large for the cells, in order
+    std::vector<uint32_t> m_large_;
+    std::vector<index_rect> m_bounds_;
+    // position of the erase that removed each command, or UINT32_MAX
+    std::vector<uint32_t> m_erased_at_;
+
+    // last query each command was found by, to report it once
+    std::vector<uint32_t> m_seen_;
+    uint32_t m_query_ = 0;
+};
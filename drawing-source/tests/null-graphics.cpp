@@ -0,0 +1,482 @@
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "obs-module.h"
+#include "obs.h"
+#include "graphics/matrix4.h"
+
+// A graphics subsystem without a GPU for the checks, defined in the check
+// itself so it takes the place of the one of libobs.  Textures, render
+// targets and stage surfaces exist and keep their pixels through copies,
+// maps and uploads, and effects run their passes, so the source takes its
+// draw and commit paths; draws themselves leave the pixels as they are.
+// The graphics context is a recursive lock, as libobs makes it.
+
+struct null_texture {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> pixels;
+};
+
+struct null_texrender {
+    null_texture *target;
+};
+
+struct null_effect {
+    bool looping;
+};
+
+struct null_vertex_buffer {
+    gs_vb_data *data;
+};
+
+struct null_index_buffer {
+    void *indices;
+};
+
+static std::recursive_mutex graphics_mutex;
+static std::vector<null_texture *> render_targets;
+static null_effect base_effects[OBS_EFFECT_AREA + 1];
+static char effect_item;
+
+static null_texture *texture_of(const gs_texture_t *tex)
+{
+    return reinterpret_cast<null_texture *>(const_cast<gs_texture_t *>(tex));
+}
+
+static std::vector<uint8_t> &pixels_of(null_texture *texture)
+{
+    texture->pixels.resize(static_cast<size_t>(texture->width) * texture->height * 4);
+    return texture->pixels;
+}
+
+void obs_enter_graphics(void)
+{
+    graphics_mutex.lock();
+}
+
+void obs_leave_graphics(void)
+{
+    graphics_mutex.unlock();
+}
+
+gs_effect_t *obs_get_base_effect(enum obs_base_effect effect)
+{
+    return reinterpret_cast<gs_effect_t *>(&base_effects[effect]);
+}
+
+gs_texture_t *gs_texture_create(uint32_t width, uint32_t height, enum gs_color_format color_format
+    , uint32_t levels, const uint8_t **data, uint32_t flags)
+{
+    UNUSED_PARAMETER(color_format);
+    UNUSED_PARAMETER(levels);
+    UNUSED_PARAMETER(flags);
+
+    auto *texture = new null_texture { width, height, {} };
+    if (data && data[0])
+        pixels_of(texture).assign(data[0], data[0] + static_cast<size_t>(width) * height * 4);
+    return reinterpret_cast<gs_texture_t *>(texture);
+}
+
+void gs_texture_destroy(gs_texture_t *tex)
+{
+    delete texture_of(tex);
+}
+
+uint32_t gs_texture_get_width(const gs_texture_t *tex)
+{
+    return tex ? texture_of(tex)->width : 0;
+}
+
+uint32_t gs_texture_get_height(const gs_texture_t *tex)
+{
+    return tex ? texture_of(tex)->height : 0;
+}
+
+bool gs_texture_map(gs_texture_t *tex, uint8_t **ptr, uint32_t *linesize)
+{
+    null_texture *texture = texture_of(tex);
+    *ptr = pixels_of(texture).data();
+    *linesize = texture->width * 4;
+    return true;
+}
+
+void gs_texture_unmap(gs_texture_t *tex)
+{
+    UNUSED_PARAMETER(tex);
+}
+
+void gs_texture_set_image(gs_texture_t *tex, const uint8_t *data, uint32_t linesize, bool invert)
+{
+    null_texture *texture = texture_of(tex);
+    std::vector<uint8_t> &pixels = pixels_of(texture);
+    const size_t row = static_cast<size_t>(texture->width) * 4;
+    for (uint32_t y = 0; y < texture->height; y++) {
+        const uint32_t from = invert ? texture->height - 1 - y : y;
+        memcpy(pixels.data() + row * y, data + static_cast<size_t>(linesize) * from, row);
+    }
+}
+
+void gs_copy_texture(gs_texture_t *dst, gs_texture_t *src)
+{
+    null_texture *to = texture_of(dst);
+    null_texture *from = texture_of(src);
+    if (to->width == from->width && to->height == from->height)
+        pixels_of(to) = pixels_of(from);
+}
+
+gs_texrender_t *gs_texrender_create(enum gs_color_format format, enum gs_zstencil_format zsformat)
+{
+    UNUSED_PARAMETER(format);
+    UNUSED_PARAMETER(zsformat);
+    return reinterpret_cast<gs_texrender_t *>(new null_texrender { nullptr });
+}
+
+void gs_texrender_destroy(gs_texrender_t *texrender)
+{
+    auto *render = reinterpret_cast<null_texrender *>(texrender);
+    if (!render)
+        return;
+
+    delete render->target;
+    delete render;
+}
+
+bool gs_texrender_begin(gs_texrender_t *texrender, uint32_t cx, uint32_t cy)
+{
+    auto *render = reinterpret_cast<null_texrender *>(texrender);
+    if (!render || !cx || !cy)
+        return false;
+
+    if (!render->target || render->target->width != cx || render->target->height != cy) {
+        delete render->target;
+        render->target = new null_texture { cx, cy, {} };
+    }
+    render_targets.push_back(render->target);
+    return true;
+}
+
+void gs_texrender_end(gs_texrender_t *texrender)
+{
+    UNUSED_PARAMETER(texrender);
+    render_targets.pop_back();
+}
+
+void gs_texrender_reset(gs_texrender_t *texrender)
+{
+    UNUSED_PARAMETER(texrender);
+}
+
+gs_texture_t *gs_texrender_get_texture(const gs_texrender_t *texrender)
+{
+    const auto *render = reinterpret_cast<const null_texrender *>(texrender);
+    return render ? reinterpret_cast<gs_texture_t *>(render->target) : nullptr;
+}
+
+gs_texture_t *gs_get_render_target(void)
+{
+    return render_targets.empty() ? nullptr : reinterpret_cast<gs_texture_t *>(render_targets.back());
+}
+
+gs_stagesurf_t *gs_stagesurface_create(uint32_t width, uint32_t height, enum gs_color_format color_format)
+{
+    UNUSED_PARAMETER(color_format);
+    return reinterpret_cast<gs_stagesurf_t *>(new null_texture { width, height, {} });
+}
+
+void gs_stagesurface_destroy(gs_stagesurf_t *stagesurf)
+{
+    delete reinterpret_cast<null_texture *>(stagesurf);
+}
+
+uint32_t gs_stagesurface_get_width(const gs_stagesurf_t *stagesurf)
+{
+    return reinterpret_cast<const null_texture *>(stagesurf)->width;
+}
+
+uint32_t gs_stagesurface_get_height(const gs_stagesurf_t *stagesurf)
+{
+    return reinterpret_cast<const null_texture *>(stagesurf)->height;
+}
+
+void gs_stage_texture(gs_stagesurf_t *dst, gs_texture_t *src)
+{
+    gs_copy_texture(reinterpret_cast<gs_texture_t *>(dst), src);
+}
+
+bool gs_stagesurface_map(gs_stagesurf_t *stagesurf, uint8_t **data, uint32_t *linesize)
+{
+    return gs_texture_map(reinterpret_cast<gs_texture_t *>(stagesurf), data, linesize);
+}
+
+void gs_stagesurface_unmap(gs_stagesurf_t *stagesurf)
+{
+    UNUSED_PARAMETER(stagesurf);
+}
+
+gs_vertbuffer_t *gs_vertexbuffer_create(struct gs_vb_data *data, uint32_t flags)
+{
+    UNUSED_PARAMETER(flags);
+    return reinterpret_cast<gs_vertbuffer_t *>(new null_vertex_buffer { data });
+}
+
+void gs_vertexbuffer_destroy(gs_vertbuffer_t *vertbuffer)
+{
+    auto *buffer = reinterpret_cast<null_vertex_buffer *>(vertbuffer);
+    if (!buffer)
+        return;
+
+    gs_vbdata_destroy(buffer->data);
+    delete buffer;
+}
+
+void gs_vertexbuffer_flush(gs_vertbuffer_t *vertbuffer)
+{
+    UNUSED_PARAMETER(vertbuffer);
+}
+
+struct gs_vb_data *gs_vertexbuffer_get_data(const gs_vertbuffer_t *vertbuffer)
+{
+    return reinterpret_cast<const null_vertex_buffer *>(vertbuffer)->data;
+}
+
+gs_indexbuffer_t *gs_indexbuffer_create(enum gs_index_type type, void *indices, size_t num, uint32_t flags)
+{
+    UNUSED_PARAMETER(type);
+    UNUSED_PARAMETER(num);
+    UNUSED_PARAMETER(flags);
+    return reinterpret_cast<gs_indexbuffer_t *>(new null_index_buffer { indices });
+}
+
+void gs_indexbuffer_destroy(gs_indexbuffer_t *indexbuffer)
+{
+    auto *buffer = reinterpret_cast<null_index_buffer *>(indexbuffer);
+    if (!buffer)
+        return;
+
+    bfree(buffer->indices);
+    delete buffer;
+}
+
+void gs_indexbuffer_flush(gs_indexbuffer_t *indexbuffer)
+{
+    UNUSED_PARAMETER(indexbuffer);
+}
+
+void *gs_indexbuffer_get_data(const gs_indexbuffer_t *indexbuffer)
+{
+    return reinterpret_cast<const null_index_buffer *>(indexbuffer)->indices;
+}
+
+gs_effect_t *gs_effect_create_from_file(const char *file, char **error_string)
+{
+    if (error_string)
+        *error_string = nullptr;
+    return file ? reinterpret_cast<gs_effect_t *>(new null_effect { false }) : nullptr;
+}
+
+void gs_effect_destroy(gs_effect_t *effect)
+{
+    delete reinterpret_cast<null_effect *>(effect);
+}
+
+gs_eparam_t *gs_effect_get_param_by_name(const gs_effect_t *effect, const char *name)
+{
+    UNUSED_PARAMETER(effect);
+    UNUSED_PARAMETER(name);
+    return reinterpret_cast<gs_eparam_t *>(&effect_item);
+}
+
+gs_technique_t *gs_effect_get_technique(const gs_effect_t *effect, const char *name)
+{
+    UNUSED_PARAMETER(effect);
+    UNUSED_PARAMETER(name);
+    return reinterpret_cast<gs_technique_t *>(&effect_item);
+}
+
+/* One pass, as the techniques of the base effects have. */
+bool gs_effect_loop(gs_effect_t *effect, const char *name)
+{
+    UNUSED_PARAMETER(name);
+    auto *loop = reinterpret_cast<null_effect *>(effect);
+    loop->looping = !loop->looping;
+    return loop->looping;
+}
+
+void gs_effect_set_texture(gs_eparam_t *param, gs_texture_t *val)
+{
+    UNUSED_PARAMETER(param);
+    UNUSED_PARAMETER(val);
+}
+
+void gs_effect_set_vec4(gs_eparam_t *param, const struct vec4 *val)
+{
+    UNUSED_PARAMETER(param);
+    UNUSED_PARAMETER(val);
+}
+
+size_t gs_technique_begin(gs_technique_t *technique)
+{
+    UNUSED_PARAMETER(technique);
+    return 1;
+}
+
+void gs_technique_end(gs_technique_t *technique)
+{
+    UNUSED_PARAMETER(technique);
+}
+
+bool gs_technique_begin_pass(gs_technique_t *technique, size_t pass)
+{
+    UNUSED_PARAMETER(technique);
+    return pass == 0;
+}
+
+void gs_technique_end_pass(gs_technique_t *technique)
+{
+    UNUSED_PARAMETER(technique);
+}
+
+void gs_load_vertexbuffer(gs_vertbuffer_t *vertbuffer)
+{
+    UNUSED_PARAMETER(vertbuffer);
+}
+
+void gs_load_indexbuffer(gs_indexbuffer_t *indexbuffer)
+{
+    UNUSED_PARAMETER(indexbuffer);
+}
+
+void gs_draw(enum gs_draw_mode draw_mode, uint32_t start_vert, uint32_t num_verts)
+{
+    UNUSED_PARAMETER(draw_mode);
+    UNUSED_PARAMETER(start_vert);
+    UNUSED_PARAMETER(num_verts);
+}
+
+void gs_draw_sprite(gs_texture_t *tex, uint32_t flip, uint32_t width, uint32_t height)
+{
+    UNUSED_PARAMETER(tex);
+    UNUSED_PARAMETER(flip);
+    UNUSED_PARAMETER(width);
+    UNUSED_PARAMETER(height);
+}
+
+void gs_draw_sprite_subregion(gs_texture_t *tex, uint32_t flip, uint32_t x, uint32_t y, uint32_t cx, uint32_t cy)
+{
+    UNUSED_PARAMETER(tex);
+    UNUSED_PARAMETER(flip);
+    UNUSED_PARAMETER(x);
+    UNUSED_PARAMETER(y);
+    UNUSED_PARAMETER(cx);
+    UNUSED_PARAMETER(cy);
+}
+
+void gs_render_start(bool b_new)
+{
+    UNUSED_PARAMETER(b_new);
+}
+
+void gs_render_stop(enum gs_draw_mode mode)
+{
+    UNUSED_PARAMETER(mode);
+}
+
+void gs_vertex2f(float x, float y)
+{
+    UNUSED_PARAMETER(x);
+    UNUSED_PARAMETER(y);
+}
+
+void gs_texcoord(float x, float y, int unit)
+{
+    UNUSED_PARAMETER(x);
+    UNUSED_PARAMETER(y);
+    UNUSED_PARAMETER(unit);
+}
+
+void gs_clear(uint32_t clear_flags, const struct vec4 *color, float depth, uint8_t stencil)
+{
+    UNUSED_PARAMETER(clear_flags);
+    UNUSED_PARAMETER(color);
+    UNUSED_PARAMETER(depth);
+    UNUSED_PARAMETER(stencil);
+}
+
+void gs_enable_blending(bool enable)
+{
+    UNUSED_PARAMETER(enable);
+}
+
+void gs_blend_state_push(void) {}
+void gs_blend_state_pop(void) {}
+
+void gs_blend_function(enum gs_blend_type src, enum gs_blend_type dest)
+{
+    UNUSED_PARAMETER(src);
+    UNUSED_PARAMETER(dest);
+}
+
+void gs_blend_function_separate(enum gs_blend_type src_c, enum gs_blend_type dest_c
+    , enum gs_blend_type src_a, enum gs_blend_type dest_a)
+{
+    UNUSED_PARAMETER(src_c);
+    UNUSED_PARAMETER(dest_c);
+    UNUSED_PARAMETER(src_a);
+    UNUSED_PARAMETER(dest_a);
+}
+
+void gs_blend_op(enum gs_blend_op_type op)
+{
+    UNUSED_PARAMETER(op);
+}
+
+void gs_ortho(float left, float right, float top, float bottom, float znear, float zfar)
+{
+    UNUSED_PARAMETER(left);
+    UNUSED_PARAMETER(right);
+    UNUSED_PARAMETER(top);
+    UNUSED_PARAMETER(bottom);
+    UNUSED_PARAMETER(znear);
+    UNUSED_PARAMETER(zfar);
+}
+
+void gs_set_viewport(int x, int y, int width, int height)
+{
+    UNUSED_PARAMETER(x);
+    UNUSED_PARAMETER(y);
+    UNUSED_PARAMETER(width);
+    UNUSED_PARAMETER(height);
+}
+
+void gs_projection_push(void) {}
+void gs_projection_pop(void) {}
+void gs_viewport_push(void) {}
+void gs_viewport_pop(void) {}
+void gs_matrix_push(void) {}
+void gs_matrix_pop(void) {}
+
+void gs_matrix_get(struct matrix4 *dst)
+{
+    matrix4_identity(dst);
+}
+
+void gs_matrix_set(const struct matrix4 *matrix)
+{
+    UNUSED_PARAMETER(matrix);
+}
+
+void gs_matrix_translate3f(float x, float y, float z)
+{
+    UNUSED_PARAMETER(x);
+    UNUSED_PARAMETER(y);
+    UNUSED_PARAMETER(z);
+}
+
+void gs_matrix_scale3f(float x, float y, float z)
+{
+    UNUSED_PARAMETER(x);
+    UNUSED_PARAMETER(y);
+    UNUSED_PARAMETER(z);
+}
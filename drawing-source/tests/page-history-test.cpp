@@ -0,0 +1,67 @@
+#include <cstdio>
+
+#include "page-history.h"
+
+// The undo log of a page stays within UNDO_LOG_BYTES as images are
+// committed, as drawing-source.cpp commits them: a checkpoint whenever the
+// history asks for one.  Once with no checkpoints at all, as a page has
+// after it was parked, and once with an erase that keeps the only
+// checkpoint from being folded.
+#define IMAGE_SIZE 1024
+#define IMAGE_COUNT 8
+#define PAGE_SIZE 64
+
+static draw_command image_command()
+{
+    draw_command command;
+    command.type = DRAW_IMAGE;
+    command.image_width = IMAGE_SIZE;
+    command.pixels.assign(IMAGE_SIZE * IMAGE_SIZE, 0xFF0000FFu);
+    command.points.resize(2);
+    return command;
+}
+
+static gs_texture_t *page_raster()
+{
+    return gs_texture_create(PAGE_SIZE, PAGE_SIZE, GS_RGBA, 1, nullptr, 0);
+}
+
+static bool commit_images(PageHistory &history, const char *what)
+{
+    for (int i = 0; i < IMAGE_COUNT; i++) {
+        history.Push(image_command());
+        if (history.NeedsCheckpoint())
+            history.AddCheckpoint(page_raster(), history.Applied());
+
+        if (history.LogBytes() > UNDO_LOG_BYTES) {
+            fprintf(stderr, "%s: log of %zu bytes after %d images\n", what, history.LogBytes(), i + 1);
+            return false;
+        }
+    }
+
+    if (!history.Base()) {
+        fprintf(stderr, "%s: nothing was folded\n", what);
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+
+    PageHistory parked;
+    ok &= commit_images(parked, "without checkpoints");
+
+    // the erase takes out the command before the checkpoint
+    PageHistory erased;
+    erased.Push(image_command());
+    erased.AddCheckpoint(page_raster(), erased.Applied());
+    draw_command erase;
+    erase.type = DRAW_ERASE;
+    erase.targets.push_back(1);
+    erased.Push(std::move(erase));
+    ok &= commit_images(erased, "with an erase before the checkpoint");
+
+    return ok ? 0 : 1;
+}
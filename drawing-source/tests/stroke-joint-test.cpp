@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "cpu-raster.h"
+
+OBS_DECLARE_MODULE()
+
+// Translucent pen strokes must lay their ink once, also where the capsules
+// of neighbouring segments overlap at a joint.  Draws a stroke of short
+// segments and a bent one in half transparent red and compares the alpha
+// at the joints with the alpha in the middle of a segment.
+#define SIZE 256
+#define PEN_WIDTH 15.0f
+#define PEN_COLOR 0x800000FFu
+
+static z_point point(float x, float y)
+{
+    z_point p;
+    p.x = x / SIZE;
+    p.y = y / SIZE;
+    return p;
+}
+
+static uint32_t alpha_at(const raster_image &image, int32_t x, int32_t y)
+{
+    return image.pixels[static_cast<size_t>(y) * image.width + x] >> 24;
+}
+
+static bool check(const raster_image &image, const char *what, int32_t x, int32_t y, uint32_t expected)
+{
+    const uint32_t alpha = alpha_at(image, x, y);
+    if (alpha + 1 >= expected && alpha <= expected + 1)
+        return true;
+
+    fprintf(stderr, "%s at %d,%d: alpha %u, expected %u\n", what, x, y, alpha, expected);
+    return false;
+}
+
+int main()
+{
+    draw_command dense;
+    dense.type = DRAW_PEN;
+    dense.color = PEN_COLOR;
+    dense.size = PEN_WIDTH / SIZE;
+    // segments shorter than the pen is wide, as a pen samples them
+    for (int i = 0; i <= 40; i++)
+        dense.points.push_back(point(48.0f + 4.0f * static_cast<float>(i), 64.0f));
+
+    draw_command bent;
+    bent.type = DRAW_PEN;
+    bent.color = PEN_COLOR;
+    bent.size = PEN_WIDTH / SIZE;
+    bent.points = { point(40.0f, 200.0f), point(128.0f, 128.0f), point(216.0f, 200.0f) };
+
+    const draw_command commands[] = { dense, bent };
+    raster_image image;
+    raster_clear(image, SIZE, SIZE);
+    raster_commands(image, commands, 2, nullptr);
+
+    const uint32_t expected = PEN_COLOR >> 24;
+    bool ok = true;
+    ok &= check(image, "middle of a segment", 50, 64, expected);
+    ok &= check(image, "joint", 128, 64, expected);
+    ok &= check(image, "joint off the center line", 128, 69, expected);
+    ok &= check(image, "middle of a bent segment", 84, 164, expected);
+    ok &= check(image, "bent joint", 128, 130, expected);
+    // the edge fades by coverage, once
+    ok &= check(image, "edge at a joint", 128, 71, alpha_at(image, 50, 71));
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,207 @@
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the procs of the source are static, so the check is built with them
+#include "../drawing-source.cpp"
+
+// The UI, input and render threads of the host at once, on three sources:
+// two with the same session sharing the pages of a key, and one with its
+// own session showing a key of the same name.  Meant to be built with
+// DRAWING_SOURCE_TSAN, which reports the races and lock order inversions;
+// fails by itself when a page breaks its invariants.
+//
+// Graphics is the null one of null-graphics.cpp: strokes are committed,
+// pages parked, restored and saved as with a GPU, but nothing is drawn, so
+// the pixels of the pages are not checked.
+#define STRESS_ITERATIONS 4000
+#define STRESS_SCRATCH_KEYS 8
+#define STRESS_SHARED_PAGES 4
+
+static std::atomic<bool> failed { false };
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "%s\n", what);
+    failed = true;
+}
+
+static void quiet_log(int level, const char *format, va_list args, void *param)
+{
+    UNUSED_PARAMETER(param);
+    if (level <= LOG_ERROR)
+        vfprintf(stderr, format, args);
+}
+
+/* The applied commands of each page of the key, as a session saves them;
+ * graphics context entered. */
+static std::vector<std::vector<draw_command>> page_commands(SourceManager *context, const char *key)
+{
+    std::vector<std::vector<draw_command>> pages(STRESS_SHARED_PAGES);
+    for (int32_t page = 0; page < STRESS_SHARED_PAGES; page++) {
+        context->AddPage(key, page);
+        gs_drawing_texture *texture = context->GetPageTexture(key, page);
+        if (!texture)
+            continue;
+        const auto &commands = texture->history.Commands();
+        pages[page].assign(commands.begin()
+            , commands.begin() + static_cast<ptrdiff_t>(texture->history.Applied()));
+    }
+    return pages;
+}
+
+static bool same_command(const draw_command &a, const draw_command &b)
+{
+    if (a.type != b.type || a.color != b.color || a.size != b.size
+        || a.points.size() != b.points.size() || a.targets != b.targets)
+        return false;
+
+    for (size_t i = 0; i < a.points.size(); i++) {
+        if (a.points[i].x != b.points[i].x || a.points[i].y != b.points[i].y)
+            return false;
+    }
+    return true;
+}
+
+static bool same_pages(const std::vector<std::vector<draw_command>> &a
+    , const std::vector<std::vector<draw_command>> &b)
+{
+    for (int32_t page = 0; page < STRESS_SHARED_PAGES; page++) {
+        if (a[page].size() != b[page].size())
+            return false;
+        for (size_t i = 0; i < a[page].size(); i++) {
+            if (!same_command(a[page][i], b[page][i]))
+                return false;
+        }
+    }
+    return true;
+}
+
+static SourceManager *create_source(const std::string &session_path)
+{
+    auto *context = new SourceManager(nullptr);
+    context->UpdateCanvasSize(256, 256);
+    context->OpenSession(session_path);
+    return context;
+}
+
+/* Turns pages and adds and removes keys, as the host does on its UI thread. */
+static void ui_thread(SourceManager *const sources[3], std::atomic<bool> &stop)
+{
+    for (int32_t i = 0; i < STRESS_ITERATIONS; i++) {
+        draw_page_change(sources[0], "shared", i % STRESS_SHARED_PAGES);
+        draw_page_change(sources[1], "shared", (i + 1) % STRESS_SHARED_PAGES);
+        draw_page_change(sources[2], "shared", i % 3);
+
+        const std::string scratch = "scratch-" + std::to_string(i % STRESS_SCRATCH_KEYS);
+        if (i % 2)
+            sources[0]->RemoveKey(scratch);
+        else
+            sources[0]->AddKey(scratch);
+        if (i % 16 == 0)
+            draw_page_change(sources[1], scratch.c_str(), i % 2);
+
+        if (i % 256 == 0)
+            sources[i / 256 % 3]->SaveSession();
+    }
+    stop = true;
+}
+
+/* Queues pen strokes, as the host delivers input. */
+static void input_thread(SourceManager *const sources[3], std::atomic<bool> &stop)
+{
+    for (int32_t i = 0; !stop; i++) {
+        const int32_t step = i % 32;
+        const int32_t x = 16 + step * 6;
+        const int32_t y = 16 + i / 32 % 200;
+        for (int s = 0; s < 3; s++)
+            draw_canvas_data(sources[s], x, y, step == 0, step > 0 && step < 31, step == 31
+                , 0x800000FFu, DRAW_PEN, 4);
+    }
+}
+
+/* Ticks the sources and reads their current pages, as video rendering does. */
+static void render_thread(SourceManager *const sources[3], std::atomic<bool> &stop)
+{
+    while (!stop) {
+        for (int s = 0; s < 3; s++) {
+            draw_source_tick(sources[s], 0.0f);
+
+            obs_enter_graphics();
+            gs_drawing_texture *texture = sources[s]->GetCurrentPageTexture();
+            if (texture && texture->history.Applied() > texture->history.Commands().size())
+                fail("page history applies more commands than it has");
+            obs_leave_graphics();
+        }
+    }
+}
+
+int main()
+{
+    base_set_log_handler(quiet_log, nullptr);
+
+    const auto dir = std::filesystem::temp_directory_path()
+        / ("drawing-source-threads-" + std::to_string(os_gettime_ns()));
+    std::filesystem::create_directories(dir);
+    const std::string shared_session = (dir / "shared.drws").string();
+    const std::string own_session = (dir / "own.drws").string();
+
+    SourceManager *const sources[3] = {
+        create_source(shared_session),
+        create_source(shared_session),
+        create_source(own_session),
+    };
+    for (auto *context : sources) {
+        context->AddKey("shared");
+        context->SetCurrentKey("shared");
+    }
+
+    std::atomic<bool> stop { false };
+    std::thread input(input_thread, sources, std::ref(stop));
+    std::thread render(render_thread, sources, std::ref(stop));
+    ui_thread(sources, stop);
+    input.join();
+    render.join();
+
+    // the strokes must have reached the pages for the run to mean anything
+    size_t committed = 0;
+    obs_enter_graphics();
+    for (int32_t page = 0; page < 3; page++) {
+        gs_drawing_texture *texture = sources[2]->GetPageTexture("shared", page);
+        if (texture)
+            committed += texture->history.Commands().size();
+    }
+    obs_leave_graphics();
+    if (!committed)
+        fail("no stroke was committed");
+
+    obs_enter_graphics();
+    for (int32_t page = 0; page < STRESS_SHARED_PAGES; page++) {
+        if (sources[0]->GetPageTexture("shared", page) != sources[1]->GetPageTexture("shared", page))
+            fail("sources of a session do not share the pages of a key");
+    }
+    if (sources[0]->GetPageTexture("shared", 0) == sources[2]->GetPageTexture("shared", 0))
+        fail("sources of different sessions share pages");
+    const auto drawn = page_commands(sources[0], "shared");
+    obs_leave_graphics();
+
+    for (auto *context : sources) {
+        context->SaveSession();
+        delete context;
+    }
+
+    // the last source closed the shared session; it reloads as they left it
+    SourceManager *reloaded = create_source(shared_session);
+    reloaded->AddKey("shared");
+    obs_enter_graphics();
+    if (!same_pages(drawn, page_commands(reloaded, "shared")))
+        fail("the shared session reloads other pages than were drawn");
+    obs_leave_graphics();
+    delete reloaded;
+    std::filesystem::remove_all(dir);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+#include "thumbnail-cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+static void thumbnail_size(uint32_t width, uint32_t height, uint32_t &out_width, uint32_t &out_height)
+{
+    if (width >= height) {
+        out_width = std::min<uint32_t>(width, THUMBNAIL_SIZE);
+        out_height = static_cast<uint32_t>(static_cast<uint64_t>(height) * out_width / width);
+    }
+    else {
+        out_height = std::min<uint32_t>(height, THUMBNAIL_SIZE);
+        out_width = static_cast<uint32_t>(static_cast<uint64_t>(width) * out_height / height);
+    }
+    out_width = std::max<uint32_t>(out_width, 1);
+    out_height = std::max<uint32_t>(out_height, 1);
+}
+
+/* Averages the source pixels under each thumbnail pixel. */
+static void box_filter(const uint32_t *pixels, uint32_t width, uint32_t height, page_thumbnail &thumbnail)
+{
+    thumbnail.pixels.resize(static_cast<size_t>(thumbnail.width) * thumbnail.height);
+
+    for (uint32_t ty = 0; ty < thumbnail.height; ty++) {
+        const uint32_t y0 = static_cast<uint32_t>(static_cast<uint64_t>(ty) * height / thumbnail.height);
+        const uint32_t y1 = std::max(y0 + 1
+            , static_cast<uint32_t>(static_cast<uint64_t>(ty + 1) * height / thumbnail.height));
+
+        for (uint32_t tx = 0; tx < thumbnail.width; tx++) {
+            const uint32_t x0 = static_cast<uint32_t>(static_cast<uint64_t>(tx) * width / thumbnail.width);
+            const uint32_t x1 = std::max(x0 + 1
+                , static_cast<uint32_t>(static_cast<uint64_t>(tx + 1) * width / thumbnail.width));
+
+            uint32_t sum[4] = { 0, 0, 0, 0 };
+            for (uint32_t y = y0; y < y1; y++) {
+                const uint32_t *row = pixels + static_cast<size_t>(y) * width;
+                for (uint32_t x = x0; x < x1; x++) {
+                    sum[0] += row[x] & 0xFF;
+                    sum[1] += (row[x] >> 8) & 0xFF;
+                    sum[2] += (row[x] >> 16) & 0xFF;
+                    sum[3] += row[x] >> 24;
+                }
+            }
+
+            const uint32_t count = (y1 - y0) * (x1 - x0);
+            thumbnail.pixels[static_cast<size_t>(ty) * thumbnail.width + tx] = (sum[0] / count)
+                | (sum[1] / count) << 8 | (sum[2] / count) << 16 | (sum[3] / count) << 24;
+        }
+    }
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+    obs_enter_graphics();
+    gs_texrender_destroy(m_steps_[0]);
+    gs_texrender_destroy(m_steps_[1]);
+    gs_stagesurface_destroy(m_stage_);
+    obs_leave_graphics();
+}
+
+bool ThumbnailCache::Current(const std::string &key, int32_t page_index, uint32_t revision)
+{
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    const auto find_item = m_thumbnails_.find({ key, page_index });
+    return find_item != m_thumbnails_.end() && find_item->second.revision == revision;
+}
+
+void ThumbnailCache::Render(const std::string &key, int32_t page_index, uint32_t revision, gs_texture_t *source)
+{
+    uint32_t width = gs_texture_get_width(source);
+    uint32_t height = gs_texture_get_height(source);
+    uint32_t target_width, target_height;
+    thumbnail_size(width, height, target_width, target_height);
+
+    for (auto &step : m_steps_) {
+        if (!step)
+            step = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+    }
+
+    gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+    gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
+
+    gs_blend_state_push();
+    gs_enable_blending(false);
+
+    // each step at most halves, so bilinear sampling covers every texel
+    gs_texture_t *current = source;
+    size_t step = 0;
+    do {
+        width = std::max(width / 2, target_width);
+        height = std::max(height / 2, target_height);
+
+        gs_texrender_t *target = m_steps_[step];
+        step ^= 1;
+
+        gs_texrender_reset(target);
+        if (!gs_texrender_begin(target, width, height)) {
+            gs_blend_state_pop();
+            return;
+        }
+
+        gs_ortho(0.0f, static_cast<float>(width), 0.0f, static_cast<float>(height), -100.0f, 100.0f);
+        gs_effect_set_texture(image, current);
+        while (gs_effect_loop(effect, "Draw"))
+            gs_draw_sprite(current, 0, width, height);
+        gs_texrender_end(target);
+
+        current = gs_texrender_get_texture(target);
+    } while (width != target_width || height != target_height);
+
+    gs_blend_state_pop();
+
+    if (!m_stage_ || gs_stagesurface_get_width(m_stage_) != width
+        || gs_stagesurface_get_height(m_stage_) != height) {
+        gs_stagesurface_destroy(m_stage_);
+        m_stage_ = gs_stagesurface_create(width, height, GS_RGBA);
+        if (!m_stage_)
+            return;
+    }
+
+    gs_stage_texture(m_stage_, current);
+    m_pending_ = true;
+    m_pending_page_ = { key, page_index };
+    m_pending_thumbnail_.revision = revision;
+    m_pending_thumbnail_.width = width;
+    m_pending_thumbnail_.height = height;
+}
+
+void ThumbnailCache::Store(const std::string &key, int32_t page_index, uint32_t revision,
+    const uint32_t *pixels, uint32_t width, uint32_t height, const thumbnail_func &ready)
+{
+    if (!width || !height)
+        return;
+
+    page_thumbnail thumbnail;
+    thumbnail.revision = revision;
+    thumbnail_size(width, height, thumbnail.width, thumbnail.height);
+    if (pixels)
+        box_filter(pixels, width, height, thumbnail);
+    else
+        thumbnail.pixels.assign(static_cast<size_t>(thumbnail.width) * thumbnail.height, 0x00FFFFFF);
+
+    page_thumbnail *stored;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        stored = &(m_thumbnails_[{ key, page_index }] = std::move(thumbnail));
+    }
+    ready(key, page_index, *stored);
+}
+
+void ThumbnailCache::Poll(const thumbnail_func &ready)
+{
+    if (!m_pending_)
+        return;
+    m_pending_ = false;
+
+    uint8_t *data;
+    uint32_t linesize;
+    if (!gs_stagesurface_map(m_stage_, &data, &linesize))
+        return;
+
+    page_thumbnail &thumbnail = m_pending_thumbnail_;
+    thumbnail.pixels.resize(static_cast<size_t>(thumbnail.width) * thumbnail.height);
+    for (uint32_t y = 0; y < thumbnail.height; y++)
+        memcpy(&thumbnail.pixels[static_cast<size_t>(y) * thumbnail.width]
+            , data + static_cast<size_t>(y) * linesize, static_cast<size_t>(thumbnail.width) * 4);
+    gs_stagesurface_unmap(m_stage_);
+
+    page_thumbnail *stored;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        stored = &(m_thumbnails_[m_pending_page_] = std::move(thumbnail));
+    }
+    thumbnail = page_thumbnail();
+    ready(m_pending_page_.first, m_pending_page_.second, *stored);
+}
+
+void ThumbnailCache::ForEach(const thumbnail_func &func)
+{
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    for (const auto &item : m_thumbnails_)
+        func(item.first.first, item.first.second, item.second);
+}
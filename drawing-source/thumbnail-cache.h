@@ -0,0 +1,61 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "obs-module.h"
+
+// Small previews of pages for page navigation.  Pages with a render target
+// are downsampled on the GPU in halving steps and read back on the next
+// frame; pages only in the session file are drawn on the CPU from their
+// saved raster and commands, then box filtered.  A thumbnail is kept until
+// its page's revision changes.
+#define THUMBNAIL_SIZE 256
+
+struct page_thumbnail {
+    uint32_t revision = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // RGBA
+    std::vector<uint32_t> pixels;
+};
+
+class ThumbnailCache {
+public:
+    typedef std::function<void(const std::string &key, int32_t page_index, const page_thumbnail &thumbnail)>
+        thumbnail_func;
+
+    ThumbnailCache() = default;
+    ThumbnailCache(const ThumbnailCache &) = delete;
+    ThumbnailCache &operator=(const ThumbnailCache &) = delete;
+    virtual ~ThumbnailCache();
+
+    bool Current(const std::string &key, int32_t page_index, uint32_t revision);
+
+    // A GPU thumbnail is waiting to be read back.
+    bool Busy() const { return m_pending_; }
+
+    // Graphics context entered; the thumbnail is ready after a later Poll.
+    void Render(const std::string &key, int32_t page_index, uint32_t revision, gs_texture_t *source);
+    // Pixels may be null for a blank page of that size.
+    void Store(const std::string &key, int32_t page_index, uint32_t revision,
+        const uint32_t *pixels, uint32_t width, uint32_t height, const thumbnail_func &ready);
+    // Graphics context entered.
+    void Poll(const thumbnail_func &ready);
+
+    void ForEach(const thumbnail_func &func);
+
+private:
+    std::mutex m_mutex_;
+    std::map<std::pair<std::string, int32_t>, page_thumbnail> m_thumbnails_;
+
+    // graphics thread only
+    gs_texrender_t *m_steps_[2] { nullptr, nullptr };
+    gs_stagesurf_t *m_stage_ { nullptr };
+    bool m_pending_ = false;
+    std::pair<std::string, int32_t> m_pending_page_;
+    page_thumbnail m_pending_thumbnail_;
+};
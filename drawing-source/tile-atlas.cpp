@@ -0,0 +1,93 @@
+#include "tile-atlas.h"
+
+#include <algorithm>
+#include <mutex>
+
+// a tile and its border
+#define SLOT_PITCH (PAGE_TILE_SIZE + 2)
+#define SLOTS_PER_ROW (TILE_ATLAS_SIZE / SLOT_PITCH)
+
+std::shared_ptr<TileAtlas> TileAtlas::Get()
+{
+    static std::mutex registry_mutex;
+    static std::weak_ptr<TileAtlas> registry;
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto tiles = registry.lock();
+    if (!tiles) {
+        tiles = std::make_shared<TileAtlas>();
+        registry = tiles;
+    }
+    return tiles;
+}
+
+TileAtlas::~TileAtlas()
+{
+    obs_enter_graphics();
+    for (const auto &atlas : m_atlases_)
+        gs_texrender_destroy(atlas.target);
+    obs_leave_graphics();
+}
+
+bool TileAtlas::Allocate(tile_slot &slot)
+{
+    if (m_free_.empty()) {
+        auto find_item = std::find_if(m_atlases_.begin(), m_atlases_.end()
+            , [](const atlas_target &atlas) { return !atlas.target; });
+        if (find_item == m_atlases_.end())
+            find_item = m_atlases_.insert(m_atlases_.end(), { nullptr, 0 });
+
+        find_item->target = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+        if (!find_item->target)
+            return false;
+
+        // handed out from the top left
+        const auto atlas = static_cast<uint32_t>(find_item - m_atlases_.begin());
+        for (uint32_t i = SLOTS_PER_ROW * SLOTS_PER_ROW; i-- > 0;)
+            m_free_.push_back({ atlas, i % SLOTS_PER_ROW * SLOT_PITCH + 1, i / SLOTS_PER_ROW * SLOT_PITCH + 1 });
+    }
+
+    slot = m_free_.back();
+    m_free_.pop_back();
+    m_atlases_[slot.atlas].used++;
+    m_used_++;
+    return true;
+}
+
+void TileAtlas::Free(const tile_slot &slot)
+{
+    atlas_target &atlas = m_atlases_[slot.atlas];
+    m_used_--;
+    if (--atlas.used) {
+        m_free_.push_back(slot);
+        return;
+    }
+
+    gs_texrender_destroy(atlas.target);
+    atlas.target = nullptr;
+    m_free_.erase(std::remove_if(m_free_.begin(), m_free_.end()
+        , [&slot](const tile_slot &item) { return item.atlas == slot.atlas; }), m_free_.end());
+}
+
+bool TileAtlas::Begin(uint32_t atlas)
+{
+    gs_texrender_t *target = m_atlases_[atlas].target;
+    gs_texrender_reset(target);
+    if (!gs_texrender_begin(target, TILE_ATLAS_SIZE, TILE_ATLAS_SIZE))
+        return false;
+
+    gs_ortho(0.0f, static_cast<float>(TILE_ATLAS_SIZE), 0.0f, static_cast<float>(TILE_ATLAS_SIZE),
+        -100.0f, 100.0f);
+    return true;
+}
+
+void TileAtlas::End(uint32_t atlas)
+{
+    gs_texrender_end(m_atlases_[atlas].target);
+}
+
+gs_texture_t *TileAtlas::GetTexture(uint32_t atlas)
+{
+    return atlas < m_atlases_.size() && m_atlases_[atlas].target
+        ? gs_texrender_get_texture(m_atlases_[atlas].target) : nullptr;
+}
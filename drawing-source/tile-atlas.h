@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "obs-module.h"
+
+// Render targets shared by the parked pages of every source.  A page that
+// is not being drawn on gives up its full size render target and keeps
+// only the PAGE_TILE_SIZE tiles it has drawn on, each in a slot of one of
+// these atlases, so memory follows the inked area rather than the canvas.
+// Pages are shared between sources, so there is one set of atlases for
+// the module, kept while any source holds it.
+//
+// Slots keep a one pixel border copied from the neighbouring tiles, so
+// scaled drawing does not sample other pages.  An atlas is created when
+// the others are full and freed when its last tile is.
+//
+// Graphics thread only.
+#define PAGE_TILE_SIZE 128
+#define TILE_ATLAS_SIZE 2048
+
+struct tile_slot {
+    uint32_t atlas;
+    // top left of the tile, inside its border
+    uint32_t x;
+    uint32_t y;
+};
+
+class TileAtlas {
+public:
+    static std::shared_ptr<TileAtlas> Get();
+
+    TileAtlas() = default;
+    TileAtlas(const TileAtlas &) = delete;
+    TileAtlas &operator=(const TileAtlas &) = delete;
+    virtual ~TileAtlas();
+
+    bool Allocate(tile_slot &slot);
+    void Free(const tile_slot &slot);
+
+    // Binds the atlas as the render target, keeping the tiles in it, with
+    // a projection in atlas pixels.
+    bool Begin(uint32_t atlas);
+    void End(uint32_t atlas);
+
+    gs_texture_t *GetTexture(uint32_t atlas);
+
+    size_t Used() const { return m_used_; }
+
+private:
+    struct atlas_target {
+        gs_texrender_t *target;
+        uint32_t used;
+    };
+
+    std::vector<atlas_target> m_atlases_;
+    std::vector<tile_slot> m_free_;
+    size_t m_used_ = 0;
+};